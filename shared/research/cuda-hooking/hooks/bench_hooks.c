@@ -0,0 +1,461 @@
+/*
+ * bench_hooks.c - Per-call overhead of the hooks against a no-op driver
+ *
+ * Built by `make bench` with libcuda_stub.so (bench_stub.c), whose entry
+ * points return at once. Every API in hook_apis.h is timed in a tight loop
+ * on its own, then again with libcuda_hook.so preloaded in each requested
+ * CUDA_HOOK_MODE, at 1, 2, 4 ... N threads calling at once, so contention
+ * in the hooks shows up as ns/call growing with the thread count. Results,
+ * including each mode's overhead over the plain call, are printed as JSON.
+ *
+ * Each configuration runs in a child (this program run again with --run),
+ * since the hook can only be preloaded at exec. Hooked children trace to
+ * /dev/null in binary format unless CUDA_HOOK_TRACE or CUDA_HOOK_FORMAT say
+ * otherwise; every other CUDA_HOOK_* setting is passed through, e.g.
+ * CUDA_HOOK_CLOCK=tsc make bench.
+ *
+ * Every API is called with a pointer to a zeroed per-thread block in every
+ * argument, through a pointer type taking twelve integers: the stub ignores
+ * its arguments and the hooks only record them, and under the x86-64 and
+ * AArch64 calling conventions a callee ignores trailing arguments it does
+ * not take. Allocations and registrations, whose hooks keep state per
+ * address, are timed in batches against their release instead, each with a
+ * distinct address, so that state stays the size of a real program's.
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cuda_hook.h"
+
+// Called by the symbols cuda.h maps them to, as an application calls them
+#define HOOK_API(name, category, versioned, ret, params, args) \
+    ret name params __asm__(HOOK_SYMBOL_##versioned(name));
+#include "hook_apis.h"
+#undef HOOK_API
+
+#define DEFAULT_CALLS  20000
+#define DEFAULT_REPEAT 3
+#define DEFAULT_HOOK   "./libcuda_hook.so"
+#define MAX_THREADS    256
+#define MAX_COUNTS     10     // 1, 2, 4 ... 256
+#define MAX_CONFIGS    4      // no hook, then up to three modes
+#define BATCH          256    // addresses live at once per thread in a pair
+
+typedef CUresult (*bench_fn)(uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t,
+                             uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t);
+#define ARGS11(a) a, a, a, a, a, a, a, a, a, a, a
+
+struct bench_api {
+    const char* name;
+    const char* category;
+    bench_fn fn;
+};
+
+static const struct bench_api apis[API_COUNT] = {
+#define HOOK_API(name, category, versioned, ret, params, args) \
+    { #name, category, (bench_fn)(void (*)(void))name },
+#include "hook_apis.h"
+#undef HOOK_API
+};
+
+// An acquire returns its address through its first argument (the stub
+// leaves whatever the slot held) or takes it there (cuMemHostRegister).
+// cuMemFreeHost releases two kinds of allocation and is timed with the first.
+struct bench_pair {
+    enum hook_api acquire;
+    enum hook_api release;
+    int out;
+    int time_release;
+};
+
+static const struct bench_pair pairs[] = {
+    { API_cuMemAlloc, API_cuMemFree, 1, 1 },
+    { API_cuMemAllocAsync, API_cuMemFreeAsync, 1, 1 },
+    { API_cuMemAllocHost, API_cuMemFreeHost, 1, 1 },
+    { API_cuMemHostAlloc, API_cuMemFreeHost, 1, 0 },
+    { API_cuMemHostRegister, API_cuMemHostUnregister, 0, 1 },
+};
+#define PAIR_COUNT (sizeof(pairs) / sizeof(pairs[0]))
+
+struct bench_run {
+    long calls;
+    pthread_barrier_t barrier;
+    double* ns;     // [thread][api]
+};
+
+static struct bench_run run;
+static int paired[API_COUNT];
+static __thread uint64_t scratch[64] __attribute__((aligned(64)));
+
+static int64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static double time_call(bench_fn fn, uintptr_t a, long calls) {
+    for (long i = 0; i < calls / 16; i++) {
+        fn(a, ARGS11(a));
+    }
+    int64_t start = now_ns();
+    for (long i = 0; i < calls; i++) {
+        fn(a, ARGS11(a));
+    }
+    return (double)(now_ns() - start) / (double)calls;
+}
+
+static void time_pair(const struct bench_pair* p, int thread, uintptr_t a, double* ns) {
+    bench_fn acquire = apis[p->acquire].fn, release = apis[p->release].fn;
+    uint64_t base = (uint64_t)(thread + 1) << 40;
+    uint64_t slots[BATCH];
+    long batches = (run.calls + BATCH - 1) / BATCH;
+    int64_t acquire_ns = 0, release_ns = 0;
+
+    // Batch -1 warms up
+    for (long b = -1; b < batches; b++) {
+        for (int i = 0; i < BATCH; i++) {
+            slots[i] = base + (uint64_t)i * 4096;
+        }
+        int64_t t0 = now_ns();
+        for (int i = 0; i < BATCH; i++) {
+            if (p->out) {
+                acquire((uintptr_t)&slots[i], 4096, a, a, a, a, a, a, a, a, a, a);
+            } else {
+                acquire(slots[i], 4096, 0, a, a, a, a, a, a, a, a, a);
+            }
+        }
+        int64_t t1 = now_ns();
+        for (int i = 0; i < BATCH; i++) {
+            release(slots[i], ARGS11(a));
+        }
+        int64_t t2 = now_ns();
+        if (b >= 0) {
+            acquire_ns += t1 - t0;
+            release_ns += t2 - t1;
+        }
+    }
+    ns[p->acquire] = (double)acquire_ns / (double)(batches * BATCH);
+    if (p->time_release) {
+        ns[p->release] = (double)release_ns / (double)(batches * BATCH);
+    }
+}
+
+static void* bench_thread(void* arg) {
+    int thread = (int)(intptr_t)arg;
+    double* ns = run.ns + (size_t)thread * API_COUNT;
+    uintptr_t a = (uintptr_t)scratch;
+
+    for (int api = 0; api < API_COUNT; api++) {
+        if (!paired[api]) {
+            pthread_barrier_wait(&run.barrier);
+            ns[api] = time_call(apis[api].fn, a, run.calls);
+        }
+    }
+    for (size_t i = 0; i < PAIR_COUNT; i++) {
+        pthread_barrier_wait(&run.barrier);
+        time_pair(&pairs[i], thread, a, ns);
+    }
+    return NULL;
+}
+
+static int compare_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+static int thread_counts(int max_threads, int* counts) {
+    int n = 0;
+    for (int t = 1; t < max_threads; t *= 2) {
+        counts[n++] = t;
+    }
+    counts[n++] = max_threads;
+    return n;
+}
+
+// Child: one line per API and thread count, the median over the repeats
+// of the mean across threads
+static int run_child(int max_threads, long calls, long repeat) {
+    int counts[MAX_COUNTS];
+    int ncounts = thread_counts(max_threads, counts);
+    run.calls = calls;
+    double* samples = malloc(sizeof(double) * (size_t)repeat * API_COUNT);
+    run.ns = malloc(sizeof(double) * (size_t)max_threads * API_COUNT);
+    if (!samples || !run.ns) {
+        fprintf(stderr, "Error: out of memory\n");
+        return 1;
+    }
+    for (size_t i = 0; i < PAIR_COUNT; i++) {
+        paired[pairs[i].acquire] = paired[pairs[i].release] = 1;
+    }
+
+    for (int c = 0; c < ncounts; c++) {
+        int threads = counts[c];
+        for (long r = 0; r < repeat; r++) {
+            pthread_t tids[MAX_THREADS];
+            pthread_barrier_init(&run.barrier, NULL, (unsigned)threads);
+            for (int t = 0; t < threads; t++) {
+                if (pthread_create(&tids[t], NULL, bench_thread, (void*)(intptr_t)t) != 0) {
+                    fprintf(stderr, "Error: cannot start %d threads\n", threads);
+                    return 1;
+                }
+            }
+            for (int t = 0; t < threads; t++) {
+                pthread_join(tids[t], NULL);
+            }
+            pthread_barrier_destroy(&run.barrier);
+
+            for (int api = 0; api < API_COUNT; api++) {
+                double sum = 0;
+                for (int t = 0; t < threads; t++) {
+                    sum += run.ns[(size_t)t * API_COUNT + api];
+                }
+                samples[(size_t)api * repeat + r] = sum / threads;
+            }
+        }
+        for (int api = 0; api < API_COUNT; api++) {
+            double* s = samples + (size_t)api * repeat;
+            qsort(s, (size_t)repeat, sizeof(double), compare_double);
+            printf("%d\t%d\t%.2f\n", threads, api, s[repeat / 2]);
+        }
+    }
+
+    // Recording the hook gave up on because a ring was full makes the
+    // hooked numbers look better than they are
+    uint64_t (*dropped)(void) = (uint64_t (*)(void))dlsym(RTLD_DEFAULT, "trace_dropped_events");
+    printf("dropped\t%llu\n", dropped ? (unsigned long long)dropped() : 0ULL);
+    return fflush(stdout) == 0 ? 0 : 1;
+}
+
+struct config {
+    const char* name;       // "none" or a CUDA_HOOK_MODE
+    double ns[MAX_COUNTS][API_COUNT];
+    unsigned long long dropped;
+};
+
+static int run_config(struct config* config, const char* hook, char** child_argv) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        if (strcmp(config->name, "none") == 0) {
+            unsetenv("LD_PRELOAD");
+        } else {
+            setenv("LD_PRELOAD", hook, 1);
+            setenv("CUDA_HOOK_MODE", config->name, 1);
+            setenv("CUDA_HOOK_TRACE", "/dev/null", 0);
+            setenv("CUDA_HOOK_FORMAT", "binary", 0);
+        }
+        execv("/proc/self/exe", child_argv);
+        perror("execv");
+        _exit(127);
+    }
+
+    close(fds[1]);
+    FILE* in = fdopen(fds[0], "r");
+    int counts[MAX_COUNTS], threads, api;
+    int ncounts = 0;
+    double ns;
+    char line[256];
+    while (in && fgets(line, sizeof(line), in)) {
+        if (sscanf(line, "dropped\t%llu", &config->dropped) == 1) {
+            continue;
+        }
+        if (sscanf(line, "%d\t%d\t%lf", &threads, &api, &ns) != 3 || api < 0 || api >= API_COUNT) {
+            continue;
+        }
+        if (ncounts == 0 || counts[ncounts - 1] != threads) {
+            if (ncounts == MAX_COUNTS) {
+                continue;
+            }
+            counts[ncounts++] = threads;
+        }
+        config->ns[ncounts - 1][api] = ns;
+    }
+    if (in) {
+        fclose(in);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "Error: %s run failed\n", config->name);
+        return -1;
+    }
+    return 0;
+}
+
+static void print_array(const double* values, int n, size_t stride) {
+    putchar('[');
+    for (int i = 0; i < n; i++) {
+        printf("%s%.1f", i ? ", " : "", values[(size_t)i * stride]);
+    }
+    putchar(']');
+}
+
+static void print_json(const struct config* configs, int nconfigs, const int* counts, int ncounts,
+                       const char* hook, long calls, long repeat) {
+    static double overhead[MAX_CONFIGS][MAX_COUNTS][API_COUNT];
+    for (int c = 1; c < nconfigs; c++) {
+        for (int t = 0; t < ncounts; t++) {
+            for (int api = 0; api < API_COUNT; api++) {
+                overhead[c][t][api] = configs[c].ns[t][api] - configs[0].ns[t][api];
+            }
+        }
+    }
+
+    printf("{\n  \"hook\": \"%s\",\n  \"calls\": %ld,\n  \"repeat\": %ld,\n  \"threads\": ",
+           hook, calls, repeat);
+    putchar('[');
+    for (int t = 0; t < ncounts; t++) {
+        printf("%s%d", t ? ", " : "", counts[t]);
+    }
+    printf("],\n  \"modes\": {");
+    for (int c = 1; c < nconfigs; c++) {
+        double median[MAX_COUNTS], max[MAX_COUNTS];
+        for (int t = 0; t < ncounts; t++) {
+            double sorted[API_COUNT];
+            memcpy(sorted, overhead[c][t], sizeof(sorted));
+            qsort(sorted, API_COUNT, sizeof(double), compare_double);
+            median[t] = sorted[API_COUNT / 2];
+            max[t] = sorted[API_COUNT - 1];
+        }
+        printf("%s\n    \"%s\": {\"dropped\": %llu, \"median_overhead_ns\": ", c > 1 ? "," : "",
+               configs[c].name, configs[c].dropped);
+        print_array(median, ncounts, 1);
+        printf(", \"max_overhead_ns\": ");
+        print_array(max, ncounts, 1);
+        putchar('}');
+    }
+    printf("\n  },\n  \"apis\": [");
+    for (int api = 0; api < API_COUNT; api++) {
+        printf("%s\n    {\"name\": \"%s\", \"category\": \"%s\", \"ns\": {", api ? "," : "",
+               apis[api].name, apis[api].category);
+        for (int c = 0; c < nconfigs; c++) {
+            printf("%s\"%s\": ", c ? ", " : "", configs[c].name);
+            print_array(&configs[c].ns[0][api], ncounts, API_COUNT);
+        }
+        printf("}, \"overhead_ns\": {");
+        for (int c = 1; c < nconfigs; c++) {
+            printf("%s\"%s\": ", c > 1 ? ", " : "", configs[c].name);
+            print_array(&overhead[c][0][api], ncounts, API_COUNT);
+        }
+        printf("}}");
+    }
+    printf("\n  ]\n}\n");
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [--threads=N] [--calls=N] [--repeat=N] [--modes=trace,aggregate,off]\n"
+            "       [--hook=PATH]\n"
+            "Default: up to one thread per CPU, %d calls per thread, median of %d runs,\n"
+            "trace mode, hook %s\n",
+            prog, DEFAULT_CALLS, DEFAULT_REPEAT, DEFAULT_HOOK);
+}
+
+static int option_long(const char* arg, const char* name, long* value) {
+    size_t len = strlen(name);
+    if (strncmp(arg, name, len) != 0 || arg[len] != '=') {
+        return 0;
+    }
+    char* endp;
+    *value = strtol(arg + len + 1, &endp, 10);
+    return *endp == '\0' && *value > 0 ? 1 : -1;
+}
+
+int main(int argc, char** argv) {
+    long threads = sysconf(_SC_NPROCESSORS_ONLN), calls = DEFAULT_CALLS, repeat = DEFAULT_REPEAT;
+    const char* modes = "trace";
+    const char* hook = DEFAULT_HOOK;
+    int child = 0;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        int ok = 0;
+        if (strcmp(arg, "--run") == 0) {
+            child = ok = 1;
+        } else if (strncmp(arg, "--modes=", 8) == 0) {
+            modes = arg + 8;
+            ok = 1;
+        } else if (strncmp(arg, "--hook=", 7) == 0) {
+            hook = arg + 7;
+            ok = 1;
+        } else {
+            ok = option_long(arg, "--threads", &threads) + option_long(arg, "--calls", &calls) +
+                 option_long(arg, "--repeat", &repeat);
+        }
+        if (ok != 1) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (threads > MAX_THREADS) {
+        threads = MAX_THREADS;
+    }
+    if (child) {
+        return run_child((int)threads, calls, repeat);
+    }
+
+    char hook_path[PATH_MAX];
+    if (!realpath(hook, hook_path)) {
+        perror(hook);
+        return 1;
+    }
+
+    static struct config configs[MAX_CONFIGS];
+    int nconfigs = 0;
+    configs[nconfigs++].name = "none";
+    char* mode_list = strdup(modes);
+    for (char* save = NULL, *mode = strtok_r(mode_list, ",", &save); mode;
+         mode = strtok_r(NULL, ",", &save)) {
+        if (strcmp(mode, "trace") != 0 && strcmp(mode, "aggregate") != 0 && strcmp(mode, "off") != 0) {
+            fprintf(stderr, "Error: unknown mode %s\n", mode);
+            return 1;
+        }
+        if (nconfigs == MAX_CONFIGS) {
+            usage(argv[0]);
+            return 1;
+        }
+        configs[nconfigs++].name = mode;
+    }
+
+    char threads_arg[32], calls_arg[32], repeat_arg[32];
+    snprintf(threads_arg, sizeof(threads_arg), "--threads=%ld", threads);
+    snprintf(calls_arg, sizeof(calls_arg), "--calls=%ld", calls);
+    snprintf(repeat_arg, sizeof(repeat_arg), "--repeat=%ld", repeat);
+    char* child_argv[] = { argv[0], "--run", threads_arg, calls_arg, repeat_arg, NULL };
+
+    for (int c = 0; c < nconfigs; c++) {
+        fprintf(stderr, "Timing %d APIs, %s\n", API_COUNT,
+                c == 0 ? "without the hook" : configs[c].name);
+        if (run_config(&configs[c], hook_path, child_argv) != 0) {
+            return 1;
+        }
+    }
+
+    int counts[MAX_COUNTS];
+    int ncounts = thread_counts((int)threads, counts);
+    print_json(configs, nconfigs, counts, ncounts, hook_path, calls, repeat);
+    return 0;
+}
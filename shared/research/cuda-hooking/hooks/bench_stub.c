@@ -0,0 +1,18 @@
+/*
+ * bench_stub.c - No-op driver library for cuda_hook_bench
+ *
+ * Exports every API in hook_apis.h under the symbol cuda.h maps it to
+ * (HOOK_SYMBOL), each returning CUDA_SUCCESS without touching its
+ * arguments, so a benchmark linked against it times the call path alone:
+ * the PLT call here, and with the hook preloaded, the hook and its indirect
+ * call through hook_real. The hook resolves these through RTLD_NEXT as it
+ * would the real libcuda.
+ */
+
+#include "cuda_hook.h"
+
+#define HOOK_API(name, category, versioned, ret, params, args) \
+    ret name params __asm__(HOOK_SYMBOL_##versioned(name)); \
+    ret name params { return (ret)CUDA_SUCCESS; }
+#include "hook_apis.h"
+#undef HOOK_API
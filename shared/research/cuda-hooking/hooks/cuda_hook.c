@@ -4,12 +4,96 @@
  * Intercepts all major CUDA Driver API calls to trace the complete
  * pipeline from model loading through inference to result retrieval.
  *
- * Compile: gcc -shared -fPIC cuda_hook.c -o libcuda_hook.so -ldl
+ * Each hooked call writes one record into a per-thread ring buffer; a
+ * background drainer thread formats the records and writes the trace file,
+ * so the calling thread never takes a lock or makes a syscall to log.
+ *
+ * Compile: make
  * Usage: LD_PRELOAD=./libcuda_hook.so python your_inference.py
+ *
+ * Environment:
+ *   CUDA_HOOK_TRACE        Trace output path (default: cuda_trace.jsonl, or
+ *                          cuda_trace.bin / cuda_trace.json in binary /
+ *                          chrome format)
+ *   CUDA_HOOK_FORMAT       "json" (default), "binary" or "chrome"; binary
+ *                          traces are turned back into JSONL by
+ *                          cuda_trace_convert; chrome writes a Chrome trace
+ *                          (cuda_trace.json) with a track per stream that
+ *                          chrome://tracing and Perfetto open directly, and
+ *                          holds calls only, no summaries or other records
+ *   CUDA_HOOK_COLLECTOR    1 (or a socket path) to stream the trace to
+ *                          cuda_trace_collectd through shared memory instead
+ *                          of writing a file (binary format implied; falls
+ *                          back to the file when no collector answers)
+ *   CUDA_HOOK_COLLECTOR_MB Shared memory ring for the collector (default: 16)
+ *   CUDA_HOOK_ROTATE_MB    Start a new trace segment (cuda_trace.00001.jsonl,
+ *                          ...) once this many MB are written (default: off)
+ *   CUDA_HOOK_ROTATE_S     Start a new trace segment every this many seconds
+ *                          (default: off); either limit also writes an index
+ *                          of the segments and their time ranges to
+ *                          cuda_trace.index.jsonl
+ *   CUDA_HOOK_COMPRESS     gzip level (1-9) for finished segments, applied on
+ *                          a background thread (default: 0, uncompressed)
+ *   CUDA_HOOK_RING_EVENTS  Events per thread ring, rounded up to a power of
+ *                          two (default: 65536); events are dropped and
+ *                          counted when a ring is full
+ *   CUDA_HOOK_DRAIN_US     Drainer poll interval when idle (default: 1000)
+ *   CUDA_HOOK_CLOCK        "monotonic" (default) or "tsc"; tsc reads the
+ *                          invariant TSC on the hot path and converts to
+ *                          CLOCK_MONOTONIC ns when draining
+ *   CUDA_HOOK_TSC_CALIBRATE_MS  TSC recalibration period (default: 1000)
+ *   CUDA_HOOK_MODE         "trace" (default) writes one record per call;
+ *                          "aggregate" keeps per-API counts and latency
+ *                          histograms and writes one summary per window;
+ *                          "off" only forwards calls until switched on
+ *                          through CUDA_HOOK_CONTROL
+ *   CUDA_HOOK_CONTROL      1 to switch the mode at runtime by writing "off",
+ *                          "aggregate" or "trace" (optionally followed by
+ *                          seconds), or "filter <spec>", to
+ *                          /dev/shm/cuda_hook.<pid>, or the path of the
+ *                          control file to use instead
+ *   CUDA_HOOK_FILTER       APIs to record, e.g. "kernel,transfer,-sync" (API
+ *                          names, categories or "*", '-' removes); the rest
+ *                          are forwarded untouched (default: all)
+ *   CUDA_HOOK_WINDOW_MS    Aggregate mode summary window (default: 10000)
+ *   CUDA_HOOK_SAMPLE       Trace mode: record 1 in N calls per API, e.g.
+ *                          "cuLaunchKernel=100,transfer=10" (API names,
+ *                          categories or "*")
+ *   CUDA_HOOK_RATE_LIMIT   Trace mode: max records per second per API, same
+ *                          syntax
+ *   CUDA_HOOK_ADAPTIVE_OVERHEAD  Trace mode: fraction of wall time (e.g. 0.02)
+ *                          hook recording may take before the busiest APIs
+ *                          are sampled more sparsely
+ *                          With any sampling set, summaries with exact
+ *                          per-API counts are written every window as in
+ *                          aggregate mode
+ *   CUDA_HOOK_ALLOCS       1 to track live device allocations: per-context
+ *                          live/peak bytes and a size-class histogram every
+ *                          CUDA_HOOK_WINDOW_MS, unfreed blocks listed at exit
+ *   CUDA_HOOK_STACKS       Trace mode: capture the host stack of 1 in N calls
+ *                          per thread, same syntax as CUDA_HOOK_SAMPLE, e.g.
+ *                          "cuMemAlloc=1,cuStreamSynchronize=1"
+ *   CUDA_HOOK_STACK_DEPTH  Frames per stack (default: 16, at most 64)
+ *   CUDA_HOOK_STACK_MIN_US Only capture calls at least this long (default: 0)
+ *   CUDA_HOOK_STACK_UNWIND "fp" (default) walks frame pointers; "dwarf" uses
+ *                          backtrace() for code built without them
+ *   CUDA_HOOK_GPU_TIMING   Trace mode: time 1 in N kernel launches on the
+ *                          device with CUDA event pairs (default: off)
+ *   CUDA_HOOK_GPU_EVENTS   Event pairs per stream for GPU timing (default: 256)
+ *   CUDA_HOOK_GPU_POLL_US  GPU timing harvester poll interval (default: 1000)
+ *   CUDA_HOOK_TRACE_OWNER  Set by the hook to the pid of the traced process;
+ *                          a traced process's exec'd descendants and forked
+ *                          children that make CUDA calls write their own
+ *                          trace at the path with their pid added
+ *                          (cuda_trace.<pid>.jsonl). GPU timing is off in
+ *                          forked children.
+ *   CUDA_HOOK_LIBCUDA      Driver library to forward to when it is not found
+ *                          through RTLD_NEXT (default: libcuda.so.1)
  */
 
 #define _GNU_SOURCE
-#include <dlfcn.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
@@ -17,168 +101,534 @@
 #include <stdint.h>
 #include <string.h>
 #include <pthread.h>
+#include <unistd.h>
+
+#include "cuda_hook.h"
+
+// Defaults for the per-thread rings (override with CUDA_HOOK_RING_EVENTS and
+// CUDA_HOOK_DRAIN_US)
+#define DEFAULT_RING_EVENTS 65536
+#define DEFAULT_DRAIN_US    1000
+
+// TSC recalibration period (override with CUDA_HOOK_TSC_CALIBRATE_MS)
+#define DEFAULT_CALIBRATE_MS 1000
+
+// Aggregate mode summary and allocation report window (override with
+// CUDA_HOOK_WINDOW_MS)
+#define DEFAULT_WINDOW_MS 10000
+
+// Host stack depth (override with CUDA_HOOK_STACK_DEPTH)
+#define DEFAULT_STACK_DEPTH 16
 
-// CUDA types (minimal definitions needed for hooking)
-typedef void* CUdevice;
-typedef void* CUcontext;
-typedef void* CUstream;
-typedef void* CUfunction;
-typedef void* CUmodule;
-typedef unsigned long long CUdeviceptr;
-typedef int CUresult;
+// GPU timing pools and harvester (override with CUDA_HOOK_GPU_EVENTS and
+// CUDA_HOOK_GPU_POLL_US)
+#define DEFAULT_GPU_EVENTS  256
+#define DEFAULT_GPU_POLL_US 1000
 
-// Thread-safe counter for operation IDs
-static uint64_t operation_counter = 0;
-static pthread_mutex_t counter_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Collector ring size (override with CUDA_HOOK_COLLECTOR_MB)
+#define DEFAULT_COLLECTOR_MB 16
 
-// Trace output file
+// Trace output buffer; the drainer flushes once per pass, not per event
+#define TRACE_BUFFER_SIZE (1 << 20)
+
+// Operation IDs are unique in the process but only increase per thread:
+// each thread takes a block of OP_ID_BLOCK from the shared counter at a
+// time, so calls do not all contend on its cache line. 0 is never handed
+// out; tracked hooks pass it for calls they do not record.
+#define OP_ID_BLOCK 1024
+static uint64_t operation_counter = 1;
+static __thread uint64_t tls_op_next __attribute__((tls_model("initial-exec"))) = 0;
+static __thread uint64_t tls_op_end __attribute__((tls_model("initial-exec"))) = 0;
+
+// Trace output file (written only by the drainer thread)
 static FILE* trace_file = NULL;
-static pthread_mutex_t file_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+struct string_table hook_strings;
+struct func_table hook_functions;
+
+static long env_long(const char* name, long fallback) {
+    const char* value = getenv(name);
+    if (!value || !*value) {
+        return fallback;
+    }
+    char* endp;
+    long parsed = strtol(value, &endp, 10);
+    return (*endp == '\0' && parsed > 0) ? parsed : fallback;
+}
 
 // Initialize tracing on library load
 __attribute__((constructor))
 static void init_tracing(void) {
+    enum trace_format format = TRACE_FORMAT_JSON;
+    const char* format_name = getenv("CUDA_HOOK_FORMAT");
+    if (format_name && strcmp(format_name, "binary") == 0) {
+        format = TRACE_FORMAT_BINARY;
+    } else if (format_name && strcmp(format_name, "chrome") == 0) {
+        format = TRACE_FORMAT_CHROME;
+    } else if (format_name && strcmp(format_name, "json") != 0) {
+        fprintf(stderr, "[CUDA_HOOK] Unknown CUDA_HOOK_FORMAT '%s', using json\n", format_name);
+    }
+
+    int mode = HOOK_MODE_TRACE;
+    const char* mode_name = getenv("CUDA_HOOK_MODE");
+    if (mode_name && (mode = hook_mode_parse(mode_name)) < 0) {
+        fprintf(stderr, "[CUDA_HOOK] Unknown CUDA_HOOK_MODE '%s', using trace\n", mode_name);
+        mode = HOOK_MODE_TRACE;
+    }
+    if (mode == HOOK_MODE_AGGREGATE && format == TRACE_FORMAT_CHROME) {
+        fprintf(stderr, "[CUDA_HOOK] Aggregate mode writes only summaries, which a chrome trace "
+                        "leaves out\n");
+    }
+
+    // A controlled process sets up everything any mode needs, since it can
+    // be switched to any of them later
+    const char* control = getenv("CUDA_HOOK_CONTROL");
+    if (control && (!*control || strcmp(control, "0") == 0)) {
+        control = NULL;
+    }
+    int may_trace = mode == HOOK_MODE_TRACE || control;
+
     const char* trace_path = getenv("CUDA_HOOK_TRACE");
     if (!trace_path) {
-        trace_path = "cuda_trace.jsonl";
+        trace_path = format == TRACE_FORMAT_BINARY ? "cuda_trace.bin" :
+                     format == TRACE_FORMAT_CHROME ? "cuda_trace.json" : "cuda_trace.jsonl";
+    }
+
+    // A descendant of a traced process writes next to its ancestor's trace
+    static char own_path[PATH_MAX];
+    static char own_control[PATH_MAX];
+    const char* base_path = trace_path;
+    enum process_origin origin = process_identify();
+    if (origin != PROCESS_START) {
+        char pid[16];
+        snprintf(pid, sizeof(pid), "%d", (int)getpid());
+        if (trace_path_insert(own_path, sizeof(own_path), trace_path, pid) == 0) {
+            trace_path = own_path;
+        }
+        if (control) {
+            control = process_control_path(own_control, sizeof(own_control), control);
+        }
+    }
+
+    const char* clock_name = getenv("CUDA_HOOK_CLOCK");
+    if (clock_name && strcmp(clock_name, "tsc") == 0) {
+        if (!hook_clock_tsc_supported()) {
+            fprintf(stderr, "[CUDA_HOOK] No invariant TSC, using CLOCK_MONOTONIC\n");
+        } else if (hook_clock_init() != 0) {
+            fprintf(stderr, "[CUDA_HOOK] TSC calibration failed, using CLOCK_MONOTONIC\n");
+        } else {
+            hook_clock_tsc = 1;
+        }
     }
 
-    trace_file = fopen(trace_path, "w");
+    string_table_init(&hook_strings);
+    func_table_init(&hook_functions);
+
+    const char* collector = getenv("CUDA_HOOK_COLLECTOR");
+    long rotate_mb = env_long("CUDA_HOOK_ROTATE_MB", 0);
+    long rotate_s = env_long("CUDA_HOOK_ROTATE_S", 0);
+    if (collector && *collector && strcmp(collector, "0") != 0 &&
+        (trace_file = collector_open(collector,
+                                     env_long("CUDA_HOOK_COLLECTOR_MB", DEFAULT_COLLECTOR_MB)))) {
+        // The collector decodes the binary stream
+        format = TRACE_FORMAT_BINARY;
+        trace_path = strcmp(collector, "1") == 0 ? COLLECTOR_SOCKET : collector;
+    } else if (rotate_mb > 0 || rotate_s > 0) {
+        trace_file = segment_open(trace_path, rotate_mb, rotate_s,
+                                  (int)env_long("CUDA_HOOK_COMPRESS", 0));
+    } else {
+        trace_file = fopen(trace_path, "we");
+    }
     if (!trace_file) {
         fprintf(stderr, "[CUDA_HOOK] Failed to open trace file: %s\n", trace_path);
+        if (format == TRACE_FORMAT_BINARY) {
+            return;
+        }
         trace_file = stderr;
+    } else {
+        setvbuf(trace_file, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+    }
+
+    if (format == TRACE_FORMAT_BINARY) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        uint32_t clock = hook_clock_tsc ? TRACE_CLOCK_TSC : TRACE_CLOCK_MONOTONIC;
+        if (trace_write_binary_header(trace_file, (uint32_t)getpid(), clock,
+                                      (int64_t)now.tv_sec * 1000000000 + now.tv_nsec) != 0) {
+            fprintf(stderr, "[CUDA_HOOK] Failed to write trace header: %s\n", trace_path);
+            return;
+        }
+        if (hook_clock_tsc) {
+            trace_write_binary_clock(trace_file, &hook_clock_map.points[0]);
+        }
+    } else if (format == TRACE_FORMAT_CHROME) {
+        chrome_writer_init(&hook_chrome, trace_file, &hook_strings, &hook_functions,
+                           (uint32_t)getpid());
+        chrome_begin(&hook_chrome, program_invocation_short_name);
+    }
+    if (fork_tracking_start(trace_file, format, base_path, origin, control) != 0) {
+        fprintf(stderr, "[CUDA_HOOK] Failed to set up fork handling, children write no trace\n");
     }
 
-    fprintf(stderr, "[CUDA_HOOK] Tracing initialized. Output: %s\n", trace_path);
+    if (may_trace) {
+        const char* target = getenv("CUDA_HOOK_ADAPTIVE_OVERHEAD");
+        if (sample_configure(getenv("CUDA_HOOK_SAMPLE"), getenv("CUDA_HOOK_RATE_LIMIT"),
+                             target ? atof(target) : 0) != 0) {
+            fprintf(stderr, "[CUDA_HOOK] Ignoring invalid sampling entries\n");
+        }
+    }
+
+    // Sampled traces keep exact counts in the aggregate summaries
+    long window_ms = env_long("CUDA_HOOK_WINDOW_MS", DEFAULT_WINDOW_MS);
+    if (mode == HOOK_MODE_AGGREGATE || hook_sampling || control) {
+        if (aggregate_start(trace_file, format, window_ms) != 0) {
+            fprintf(stderr, "[CUDA_HOOK] Failed to start aggregation, using trace mode\n");
+            hook_sampling = 0;
+            sample_adaptive = 0;
+            mode = HOOK_MODE_TRACE;
+            control = NULL;
+        }
+    }
+
+    if (env_long("CUDA_HOOK_ALLOCS", 0) > 0 &&
+        alloc_tracking_start(trace_file, format, window_ms) != 0) {
+        fprintf(stderr, "[CUDA_HOOK] Failed to start allocation tracking\n");
+    }
+
+    const char* stacks = getenv("CUDA_HOOK_STACKS");
+    if (stacks && *stacks && may_trace &&
+        stack_tracking_start(trace_file, format, stacks,
+                             env_long("CUDA_HOOK_STACK_DEPTH", DEFAULT_STACK_DEPTH),
+                             env_long("CUDA_HOOK_STACK_MIN_US", 0),
+                             getenv("CUDA_HOOK_STACK_UNWIND")) != 0) {
+        fprintf(stderr, "[CUDA_HOOK] Ignoring invalid CUDA_HOOK_STACKS entries\n");
+    }
+
+    // Set before the drainer starts, which owns the trace file from then on
+    hook_mode = mode;
+    if (filter_start(trace_file, format, getenv("CUDA_HOOK_FILTER")) != 0) {
+        fprintf(stderr, "[CUDA_HOOK] Ignoring invalid CUDA_HOOK_FILTER, recording all APIs\n");
+    }
+    if (control && control_start(trace_file, format, control) != 0) {
+        fprintf(stderr, "[CUDA_HOOK] Failed to create control file, mode is fixed\n");
+    }
+
+    long ring_events = env_long("CUDA_HOOK_RING_EVENTS", DEFAULT_RING_EVENTS);
+    long drain_us = env_long("CUDA_HOOK_DRAIN_US", DEFAULT_DRAIN_US);
+    long calibrate_ms = env_long("CUDA_HOOK_TSC_CALIBRATE_MS", DEFAULT_CALIBRATE_MS);
+    if (trace_rings_start(trace_file, format, (size_t)ring_events, drain_us, calibrate_ms) != 0) {
+        fprintf(stderr, "[CUDA_HOOK] Failed to start trace drainer, tracing disabled\n");
+        control_stop();
+        return;
+    }
+
+    long gpu_every = env_long("CUDA_HOOK_GPU_TIMING", 0);
+    if (gpu_every > 0 && may_trace &&
+        gpu_timing_start(gpu_every, env_long("CUDA_HOOK_GPU_EVENTS", DEFAULT_GPU_EVENTS),
+                         env_long("CUDA_HOOK_GPU_POLL_US", DEFAULT_GPU_POLL_US)) != 0) {
+        fprintf(stderr, "[CUDA_HOOK] Failed to start GPU timing harvester\n");
+    }
+
+    // Resolve the driver entry points now if libcuda is already mapped;
+    // otherwise the first hooked call does it
+    if (hook_libcuda_loaded()) {
+        hook_resolve_symbols();
+    }
+
+    if (!hook_dlsym_interposed) {
+        fprintf(stderr, "[CUDA_HOOK] dlsym is not interposed on this architecture, so calls "
+                        "libcudart 11.3+ makes through cuGetProcAddress bypass the hooks\n");
+    }
+    fprintf(stderr, "[CUDA_HOOK] Tracing initialized (%s). Output: %s\n",
+            hook_mode == HOOK_MODE_TRACE && hook_sampling ? "sampled trace" :
+            hook_mode_names[hook_mode], trace_path);
     fflush(stderr);
 }
 
 __attribute__((destructor))
 static void cleanup_tracing(void) {
+    gpu_timing_stop();
+    trace_rings_stop();
+    control_stop();
+    alloc_leak_report(stderr);
+
+    uint64_t dropped = trace_dropped_events();
+    if (dropped) {
+        fprintf(stderr, "[CUDA_HOOK] Dropped %llu events (ring full)\n",
+                (unsigned long long)dropped);
+    }
+
     if (trace_file && trace_file != stderr) {
         fclose(trace_file);
     }
 }
 
-// Get high-resolution timestamp
-static double get_timestamp(void) {
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return ts.tv_sec + ts.tv_nsec / 1e9;
-}
-
 // Get next operation ID
-static uint64_t next_op_id(void) {
-    pthread_mutex_lock(&counter_mutex);
-    uint64_t id = operation_counter++;
-    pthread_mutex_unlock(&counter_mutex);
-    return id;
-}
-
-// Generic trace logging (JSON Lines format)
-static void log_trace(const char* phase, const char* category, const char* name,
-                      uint64_t op_id, double timestamp, const char* details) {
-    pthread_mutex_lock(&file_mutex);
-    fprintf(trace_file,
-            "{\"ts\":%.9f,\"op_id\":%llu,\"phase\"%s\",\"category\":\"%s\",\"name\":\"%s\"",
-            timestamp, op_id, phase, category, name);
-    if (details) {
-        fprintf(trace_file, ",\"details\":%s", details);
-    }
-    fprintf(trace_file, "}\n");
-    fflush(trace_file);
-    pthread_mutex_unlock(&file_mutex);
+static inline uint64_t next_op_id(void) {
+    if (__builtin_expect(tls_op_next == tls_op_end, 0)) {
+        tls_op_next = __atomic_fetch_add(&operation_counter, OP_ID_BLOCK, __ATOMIC_RELAXED);
+        tls_op_end = tls_op_next + OP_ID_BLOCK;
+    }
+    return tls_op_next++;
 }
 
-// Macro to define hooks with timing
+// Macro to define hooks with timing. The hook body calls the real function
+// (hook_real.<name>) into `result`, then RECORD_HOOK opens this call's
+// record as `ev` (a ring slot, or a stack scratch record in aggregate mode)
+// so the body can fill in its arguments before END_HOOK publishes it.
+// Calls the filter leaves out, or all calls while the hooks are switched
+// off, go straight through.
 #define HOOK_FUNCTION(ret_type, func_name, params, args) \
-    static ret_type (*real_##func_name) params = NULL; \
     ret_type func_name params { \
-        if (!real_##func_name) { \
-            real_##func_name = dlsym(RTLD_NEXT, #func_name); \
-            if (!real_##func_name) { \
-                fprintf(stderr, "[CUDA_HOOK] Failed to load " #func_name "\n"); \
-                return 1; \
-            } \
+        if (hook_skip(API_##func_name)) { \
+            return hook_real.func_name args; \
         } \
+        const int skipped = 0; \
         uint64_t op_id = next_op_id(); \
-        double start = get_timestamp();
-
-#define END_HOOK(category, name, details) \
-        double end = get_timestamp(); \
-        log_trace("\"E\"", category, name, op_id, end, details); \
+        int64_t start = hook_timestamp();
+
+// For hooks whose body keeps state (live allocations, pinned ranges, kernel
+// names) that must stay right while the hooks are off or the API is
+// filtered out. A skipped call still runs the body, with op_id and start 0
+// (state that needs a time takes it itself), and returns at RECORD_HOOK:
+// the same single bit test as HOOK_FUNCTION before the real call.
+#define HOOK_FUNCTION_TRACKED(ret_type, func_name, params, args) \
+    ret_type func_name params { \
+        const int skipped = hook_skip(API_##func_name); \
+        uint64_t op_id = 0; \
+        int64_t start = 0; \
+        if (!skipped) { \
+            op_id = next_op_id(); \
+            start = hook_timestamp(); \
+        }
+
+#define RECORD_HOOK(func_name) \
+        if (skipped) { \
+            return result; \
+        } \
+        int64_t end = hook_timestamp(); \
+        struct hook_event scratch; \
+        struct hook_event* ev = hook_begin_event(&scratch, API_##func_name); \
+        if (ev) { \
+            ev->ts = start; \
+            ev->end = end; \
+            ev->op_id = op_id; \
+            ev->api = API_##func_name; \
+            ev->status = (int16_t)result;
+
+#define END_HOOK \
+            hook_end_event(ev, &scratch); \
+        } \
         return result; \
     }
 
+// cuda.h renames most entry points to their versioned symbol (cuMemAlloc to
+// cuMemAlloc_v2 and so on), which is what applications built against it
+// call, so each hook is exported under HOOK_SYMBOL (hook_apis.h).
+#define HOOK_API(name, category, versioned, ret, params, args) \
+    ret name params __asm__(HOOK_SYMBOL_##versioned(name));
+#include "hook_apis.h"
+#undef HOOK_API
+
+// The plain symbols of v2 APIs keep the ABI from before CUDA 3.2 (32-bit
+// sizes and device pointers) and are only called by binaries that old or
+// code that looks them up by name. They go to the driver's plain symbol
+// with the registers as the caller left them, and are not recorded, since
+// their arguments do not have the types the records are built from.
+#define HOOK_LEGACY_none(name, ret, params, args)
+#define HOOK_LEGACY_v2(name, ret, params, args) \
+    ret legacy_##name params __asm__(#name); \
+    ret legacy_##name params { \
+        return hook_legacy.name args; \
+    }
+#define HOOK_API(name, category, versioned, ret, params, args) \
+    HOOK_LEGACY_##versioned(name, ret, params, args)
+#include "hook_apis.h"
+#undef HOOK_API
+
 //
 // Memory Management Hooks
 //
 
-HOOK_FUNCTION(CUresult, cuMemAlloc, (CUdeviceptr *dptr, size_t bytesize), (dptr, bytesize))
-    char details[256];
-    snprintf(details, sizeof(details), "{\"size\":%zu}", bytesize);
-    log_trace("\"B\"", "memory", "cuMemAlloc", op_id, start, details);
-
-    CUresult result = real_cuMemAlloc(dptr, bytesize);
-
-    snprintf(details, sizeof(details), "{\"size\":%zu,\"ptr\":\"%p\",\"status\":%d}",
-             bytesize, (void*)*dptr, result);
-END_HOOK("memory", "cuMemAlloc", details)
-
-HOOK_FUNCTION(CUresult, cuMemFree, (CUdeviceptr dptr), (dptr))
-    char details[256];
-    snprintf(details, sizeof(details), "{\"ptr\":\"%p\"}", (void*)dptr);
-    log_trace("\"B\"", "memory", "cuMemFree", op_id, start, details);
-
-    CUresult result = real_cuMemFree(dptr);
-
-    snprintf(details, sizeof(details), "{\"ptr\":\"%p\",\"status\":%d}", (void*)dptr, result);
-END_HOOK("memory", "cuMemFree", details)
+HOOK_FUNCTION_TRACKED(CUresult, cuMemAlloc, (CUdeviceptr *dptr, size_t bytesize), (dptr, bytesize))
+    CUresult result = hook_real.cuMemAlloc(dptr, bytesize);
+    if (result == CUDA_SUCCESS && dptr) {
+        alloc_record(*dptr, bytesize, op_id, start);
+    }
+RECORD_HOOK(cuMemAlloc)
+    ev->args.mem.ptr = dptr ? *dptr : 0;
+    ev->args.mem.size = bytesize;
+END_HOOK
+
+HOOK_FUNCTION_TRACKED(CUresult, cuMemFree, (CUdeviceptr dptr), (dptr))
+    CUresult result = hook_real.cuMemFree(dptr);
+    if (result == CUDA_SUCCESS) {
+        alloc_release(dptr);
+    }
+RECORD_HOOK(cuMemFree)
+    ev->args.mem.ptr = dptr;
+END_HOOK
 
 HOOK_FUNCTION(CUresult, cuMemcpyHtoD, (CUdeviceptr dstDevice, const void *srcHost, size_t ByteCount),
               (dstDevice, srcHost, ByteCount))
-    char details[512];
-    snprintf(details, sizeof(details),
-             "{\"direction\":\"host_to_device\",\"dst\":\"%p\",\"src\":\"%p\",\"size\":%zu}",
-             (void*)dstDevice, srcHost, ByteCount);
-    log_trace("\"B\"", "transfer", "cuMemcpyHtoD", op_id, start, details);
-
-    CUresult result = real_cuMemcpyHtoD(dstDevice, srcHost, ByteCount);
-
-    snprintf(details, sizeof(details),
-             "{\"direction\":\"host_to_device\",\"size\":%zu,\"bandwidth_gbps\":%.2f,\"status\":%d}",
-             ByteCount, ByteCount / ((end - start) * 1e9), result);
-END_HOOK("transfer", "cuMemcpyHtoD", details)
+    CUresult result = hook_real.cuMemcpyHtoD(dstDevice, srcHost, ByteCount);
+RECORD_HOOK(cuMemcpyHtoD)
+    ev->args.copy.dst = dstDevice;
+    ev->args.copy.src = (uintptr_t)srcHost;
+    ev->args.copy.size = ByteCount;
+    ev->args.copy.host = pinned_classify((uintptr_t)srcHost, ByteCount);
+END_HOOK
 
 HOOK_FUNCTION(CUresult, cuMemcpyDtoH, (void *dstHost, CUdeviceptr srcDevice, size_t ByteCount),
               (dstHost, srcDevice, ByteCount))
-    char details[512];
-    snprintf(details, sizeof(details),
-             "{\"direction\":\"device_to_host\",\"dst\":\"%p\",\"src\":\"%p\",\"size\":%zu}",
-             dstHost, (void*)srcDevice, ByteCount);
-    log_trace("\"B\"", "transfer", "cuMemcpyDtoH", op_id, start, details);
-
-    CUresult result = real_cuMemcpyDtoH(dstHost, srcDevice, ByteCount);
-
-    snprintf(details, sizeof(details),
-             "{\"direction\":\"device_to_host\",\"size\":%zu,\"bandwidth_gbps\":%.2f,\"status\":%d}",
-             ByteCount, ByteCount / ((end - start) * 1e9), result);
-END_HOOK("transfer", "cuMemcpyDtoH", details)
+    CUresult result = hook_real.cuMemcpyDtoH(dstHost, srcDevice, ByteCount);
+RECORD_HOOK(cuMemcpyDtoH)
+    ev->args.copy.dst = (uintptr_t)dstHost;
+    ev->args.copy.src = srcDevice;
+    ev->args.copy.size = ByteCount;
+    ev->args.copy.host = pinned_classify((uintptr_t)dstHost, ByteCount);
+END_HOOK
 
 HOOK_FUNCTION(CUresult, cuMemcpyDtoD, (CUdeviceptr dstDevice, CUdeviceptr srcDevice, size_t ByteCount),
               (dstDevice, srcDevice, ByteCount))
-    char details[512];
-    snprintf(details, sizeof(details),
-             "{\"direction\":\"device_to_device\",\"dst\":\"%p\",\"src\":\"%p\",\"size\":%zu}",
-             (void*)dstDevice, (void*)srcDevice, ByteCount);
-    log_trace("\"B\"", "transfer", "cuMemcpyDtoD", op_id, start, details);
-
-    CUresult result = real_cuMemcpyDtoD(dstDevice, srcDevice, ByteCount);
-
-    snprintf(details, sizeof(details),
-             "{\"direction\":\"device_to_device\",\"size\":%zu,\"bandwidth_gbps\":%.2f,\"status\":%d}",
-             ByteCount, ByteCount / ((end - start) * 1e9), result);
-END_HOOK("transfer", "cuMemcpyDtoD", details)
+    CUresult result = hook_real.cuMemcpyDtoD(dstDevice, srcDevice, ByteCount);
+RECORD_HOOK(cuMemcpyDtoD)
+    ev->args.copy.dst = dstDevice;
+    ev->args.copy.src = srcDevice;
+    ev->args.copy.size = ByteCount;
+    ev->args.copy.host = HOOK_HOST_UNKNOWN;
+END_HOOK
+
+HOOK_FUNCTION(CUresult, cuMemcpy, (CUdeviceptr dst, CUdeviceptr src, size_t ByteCount),
+              (dst, src, ByteCount))
+    CUresult result = hook_real.cuMemcpy(dst, src, ByteCount);
+RECORD_HOOK(cuMemcpy)
+    ev->args.copy.dst = dst;
+    ev->args.copy.src = src;
+    ev->args.copy.size = ByteCount;
+    ev->args.copy.host = HOOK_HOST_UNKNOWN;
+END_HOOK
+
+HOOK_FUNCTION(CUresult, cuMemcpyAsync, (CUdeviceptr dst, CUdeviceptr src, size_t ByteCount, CUstream hStream),
+              (dst, src, ByteCount, hStream))
+    CUresult result = hook_real.cuMemcpyAsync(dst, src, ByteCount, hStream);
+RECORD_HOOK(cuMemcpyAsync)
+    ev->args.copy.dst = dst;
+    ev->args.copy.src = src;
+    ev->args.copy.size = ByteCount;
+    ev->args.copy.host = HOOK_HOST_UNKNOWN;
+    ev->args.copy.stream = (uintptr_t)hStream;
+END_HOOK
+
+HOOK_FUNCTION(CUresult, cuMemcpyHtoDAsync,
+              (CUdeviceptr dstDevice, const void *srcHost, size_t ByteCount, CUstream hStream),
+              (dstDevice, srcHost, ByteCount, hStream))
+    CUresult result = hook_real.cuMemcpyHtoDAsync(dstDevice, srcHost, ByteCount, hStream);
+RECORD_HOOK(cuMemcpyHtoDAsync)
+    ev->args.copy.dst = dstDevice;
+    ev->args.copy.src = (uintptr_t)srcHost;
+    ev->args.copy.size = ByteCount;
+    ev->args.copy.host = pinned_classify((uintptr_t)srcHost, ByteCount);
+    ev->args.copy.stream = (uintptr_t)hStream;
+END_HOOK
+
+HOOK_FUNCTION(CUresult, cuMemcpyDtoHAsync,
+              (void *dstHost, CUdeviceptr srcDevice, size_t ByteCount, CUstream hStream),
+              (dstHost, srcDevice, ByteCount, hStream))
+    CUresult result = hook_real.cuMemcpyDtoHAsync(dstHost, srcDevice, ByteCount, hStream);
+RECORD_HOOK(cuMemcpyDtoHAsync)
+    ev->args.copy.dst = (uintptr_t)dstHost;
+    ev->args.copy.src = srcDevice;
+    ev->args.copy.size = ByteCount;
+    ev->args.copy.host = pinned_classify((uintptr_t)dstHost, ByteCount);
+    ev->args.copy.stream = (uintptr_t)hStream;
+END_HOOK
+
+HOOK_FUNCTION(CUresult, cuMemcpyDtoDAsync,
+              (CUdeviceptr dstDevice, CUdeviceptr srcDevice, size_t ByteCount, CUstream hStream),
+              (dstDevice, srcDevice, ByteCount, hStream))
+    CUresult result = hook_real.cuMemcpyDtoDAsync(dstDevice, srcDevice, ByteCount, hStream);
+RECORD_HOOK(cuMemcpyDtoDAsync)
+    ev->args.copy.dst = dstDevice;
+    ev->args.copy.src = srcDevice;
+    ev->args.copy.size = ByteCount;
+    ev->args.copy.host = HOOK_HOST_UNKNOWN;
+    ev->args.copy.stream = (uintptr_t)hStream;
+END_HOOK
+
+HOOK_FUNCTION_TRACKED(CUresult, cuMemAllocAsync, (CUdeviceptr *dptr, size_t bytesize, CUstream hStream),
+                      (dptr, bytesize, hStream))
+    CUresult result = hook_real.cuMemAllocAsync(dptr, bytesize, hStream);
+    if (result == CUDA_SUCCESS && dptr) {
+        alloc_record(*dptr, bytesize, op_id, start);
+    }
+RECORD_HOOK(cuMemAllocAsync)
+    ev->args.mem.ptr = dptr ? *dptr : 0;
+    ev->args.mem.size = bytesize;
+    ev->args.mem.stream = (uintptr_t)hStream;
+END_HOOK
+
+HOOK_FUNCTION_TRACKED(CUresult, cuMemFreeAsync, (CUdeviceptr dptr, CUstream hStream), (dptr, hStream))
+    CUresult result = hook_real.cuMemFreeAsync(dptr, hStream);
+    if (result == CUDA_SUCCESS) {
+        alloc_release(dptr);
+    }
+RECORD_HOOK(cuMemFreeAsync)
+    ev->args.mem.ptr = dptr;
+    ev->args.mem.stream = (uintptr_t)hStream;
+END_HOOK
+
+HOOK_FUNCTION_TRACKED(CUresult, cuMemAllocHost, (void **pp, size_t bytesize), (pp, bytesize))
+    CUresult result = hook_real.cuMemAllocHost(pp, bytesize);
+    if (result == CUDA_SUCCESS && pp) {
+        pinned_add((uintptr_t)*pp, bytesize);
+    }
+RECORD_HOOK(cuMemAllocHost)
+    ev->args.mem.ptr = pp ? (uintptr_t)*pp : 0;
+    ev->args.mem.size = bytesize;
+END_HOOK
+
+HOOK_FUNCTION_TRACKED(CUresult, cuMemHostAlloc, (void **pp, size_t bytesize, unsigned int Flags),
+                      (pp, bytesize, Flags))
+    CUresult result = hook_real.cuMemHostAlloc(pp, bytesize, Flags);
+    if (result == CUDA_SUCCESS && pp) {
+        pinned_add((uintptr_t)*pp, bytesize);
+    }
+RECORD_HOOK(cuMemHostAlloc)
+    ev->args.mem.ptr = pp ? (uintptr_t)*pp : 0;
+    ev->args.mem.size = bytesize;
+    ev->args.mem.flags = Flags;
+END_HOOK
+
+HOOK_FUNCTION_TRACKED(CUresult, cuMemFreeHost, (void *p), (p))
+    CUresult result = hook_real.cuMemFreeHost(p);
+    if (result == CUDA_SUCCESS) {
+        pinned_remove((uintptr_t)p);
+    }
+RECORD_HOOK(cuMemFreeHost)
+    ev->args.mem.ptr = (uintptr_t)p;
+END_HOOK
+
+HOOK_FUNCTION_TRACKED(CUresult, cuMemHostRegister, (void *p, size_t bytesize, unsigned int Flags),
+                      (p, bytesize, Flags))
+    CUresult result = hook_real.cuMemHostRegister(p, bytesize, Flags);
+    if (result == CUDA_SUCCESS) {
+        pinned_add((uintptr_t)p, bytesize);
+    }
+RECORD_HOOK(cuMemHostRegister)
+    ev->args.mem.ptr = (uintptr_t)p;
+    ev->args.mem.size = bytesize;
+    ev->args.mem.flags = Flags;
+END_HOOK
+
+HOOK_FUNCTION_TRACKED(CUresult, cuMemHostUnregister, (void *p), (p))
+    CUresult result = hook_real.cuMemHostUnregister(p);
+    if (result == CUDA_SUCCESS) {
+        pinned_remove((uintptr_t)p);
+    }
+RECORD_HOOK(cuMemHostUnregister)
+    ev->args.mem.ptr = (uintptr_t)p;
+END_HOOK
 
 //
 // Context Management Hooks
@@ -186,44 +636,53 @@ END_HOOK("transfer", "cuMemcpyDtoD", details)
 
 HOOK_FUNCTION(CUresult, cuCtxCreate, (CUcontext *pctx, unsigned int flags, CUdevice dev),
               (pctx, flags, dev))
-    char details[256];
-    snprintf(details, sizeof(details), "{\"flags\":%u,\"device\":\"%p\"}", flags, dev);
-    log_trace("\"B\"", "context", "cuCtxCreate", op_id, start, details);
-
-    CUresult result = real_cuCtxCreate(pctx, flags, dev);
-
-    snprintf(details, sizeof(details), "{\"ctx\":\"%p\",\"status\":%d}", *pctx, result);
-END_HOOK("context", "cuCtxCreate", details)
+    CUresult result = hook_real.cuCtxCreate(pctx, flags, dev);
+RECORD_HOOK(cuCtxCreate)
+    ev->args.ctx.ctx = pctx ? (uintptr_t)*pctx : 0;
+    ev->args.ctx.device = (uintptr_t)dev;
+    ev->args.ctx.flags = flags;
+END_HOOK
 
 HOOK_FUNCTION(CUresult, cuCtxDestroy, (CUcontext ctx), (ctx))
-    char details[256];
-    snprintf(details, sizeof(details), "{\"ctx\":\"%p\"}", ctx);
-    log_trace("\"B\"", "context", "cuCtxDestroy", op_id, start, details);
-
-    CUresult result = real_cuCtxDestroy(ctx);
-
-    snprintf(details, sizeof(details), "{\"ctx\":\"%p\",\"status\":%d}", ctx, result);
-END_HOOK("context", "cuCtxDestroy", details)
+    gpu_timing_context_destroyed(ctx);
+    CUresult result = hook_real.cuCtxDestroy(ctx);
+RECORD_HOOK(cuCtxDestroy)
+    ev->args.ctx.ctx = (uintptr_t)ctx;
+END_HOOK
+
+#if HOOK_ENABLE_CONTEXT
+// Listed in hook_apis_gen.h, recorded the same way
+HOOK_FUNCTION(CUresult, cuDevicePrimaryCtxRelease, (CUdevice dev), (dev))
+    gpu_timing_primary_released(dev);
+    CUresult result = hook_real.cuDevicePrimaryCtxRelease(dev);
+RECORD_HOOK(cuDevicePrimaryCtxRelease)
+    ev->args.generic[0] = (uint64_t)(int64_t)dev;
+    ev->args.generic[1] = 0;
+    ev->args.generic[2] = 0;
+    ev->args.generic[3] = 0;
+END_HOOK
+
+HOOK_FUNCTION(CUresult, cuDevicePrimaryCtxReset, (CUdevice dev), (dev))
+    gpu_timing_primary_released(dev);
+    CUresult result = hook_real.cuDevicePrimaryCtxReset(dev);
+RECORD_HOOK(cuDevicePrimaryCtxReset)
+    ev->args.generic[0] = (uint64_t)(int64_t)dev;
+    ev->args.generic[1] = 0;
+    ev->args.generic[2] = 0;
+    ev->args.generic[3] = 0;
+END_HOOK
+#endif
 
 HOOK_FUNCTION(CUresult, cuCtxSetCurrent, (CUcontext ctx), (ctx))
-    char details[256];
-    snprintf(details, sizeof(details), "{\"ctx\":\"%p\"}", ctx);
-    log_trace("\"B\"", "context", "cuCtxSetCurrent", op_id, start, details);
-
-    CUresult result = real_cuCtxSetCurrent(ctx);
-
-    snprintf(details, sizeof(details), "{\"ctx\":\"%p\",\"status\":%d}", ctx, result);
-END_HOOK("context", "cuCtxSetCurrent", details)
+    CUresult result = hook_real.cuCtxSetCurrent(ctx);
+RECORD_HOOK(cuCtxSetCurrent)
+    ev->args.ctx.ctx = (uintptr_t)ctx;
+END_HOOK
 
 HOOK_FUNCTION(CUresult, cuCtxSynchronize, (void), ())
-    log_trace("\"B\"", "sync", "cuCtxSynchronize", op_id, start, NULL);
-
-    CUresult result = real_cuCtxSynchronize();
-
-    char details[256];
-    snprintf(details, sizeof(details), "{\"duration_ms\":%.3f,\"status\":%d}",
-             (end - start) * 1000, result);
-END_HOOK("sync", "cuCtxSynchronize", details)
+    CUresult result = hook_real.cuCtxSynchronize();
+RECORD_HOOK(cuCtxSynchronize)
+END_HOOK
 
 //
 // Stream Management Hooks
@@ -231,36 +690,52 @@ END_HOOK("sync", "cuCtxSynchronize", details)
 
 HOOK_FUNCTION(CUresult, cuStreamCreate, (CUstream *phStream, unsigned int Flags),
               (phStream, Flags))
-    char details[256];
-    snprintf(details, sizeof(details), "{\"flags\":%u}", Flags);
-    log_trace("\"B\"", "stream", "cuStreamCreate", op_id, start, details);
-
-    CUresult result = real_cuStreamCreate(phStream, Flags);
-
-    snprintf(details, sizeof(details), "{\"stream\":\"%p\",\"status\":%d}", *phStream, result);
-END_HOOK("stream", "cuStreamCreate", details)
+    CUresult result = hook_real.cuStreamCreate(phStream, Flags);
+RECORD_HOOK(cuStreamCreate)
+    ev->args.stream.stream = phStream ? (uintptr_t)*phStream : 0;
+    ev->args.stream.flags = Flags;
+END_HOOK
 
 HOOK_FUNCTION(CUresult, cuStreamDestroy, (CUstream hStream), (hStream))
-    char details[256];
-    snprintf(details, sizeof(details), "{\"stream\":\"%p\"}", hStream);
-    log_trace("\"B\"", "stream", "cuStreamDestroy", op_id, start, details);
-
-    CUresult result = real_cuStreamDestroy(hStream);
-
-    snprintf(details, sizeof(details), "{\"stream\":\"%p\",\"status\":%d}", hStream, result);
-END_HOOK("stream", "cuStreamDestroy", details)
+    CUresult result = hook_real.cuStreamDestroy(hStream);
+RECORD_HOOK(cuStreamDestroy)
+    ev->args.stream.stream = (uintptr_t)hStream;
+END_HOOK
 
 HOOK_FUNCTION(CUresult, cuStreamSynchronize, (CUstream hStream), (hStream))
-    char details[256];
-    snprintf(details, sizeof(details), "{\"stream\":\"%p\"}", hStream);
-    log_trace("\"B\"", "sync", "cuStreamSynchronize", op_id, start, details);
+    CUresult result = hook_real.cuStreamSynchronize(hStream);
+RECORD_HOOK(cuStreamSynchronize)
+    ev->args.stream.stream = (uintptr_t)hStream;
+END_HOOK
+
+HOOK_FUNCTION(CUresult, cuStreamWaitEvent, (CUstream hStream, CUevent hEvent, unsigned int Flags),
+              (hStream, hEvent, Flags))
+    CUresult result = hook_real.cuStreamWaitEvent(hStream, hEvent, Flags);
+RECORD_HOOK(cuStreamWaitEvent)
+    ev->args.event.event = (uintptr_t)hEvent;
+    ev->args.event.stream = (uintptr_t)hStream;
+    ev->args.event.flags = Flags;
+END_HOOK
 
-    CUresult result = real_cuStreamSynchronize(hStream);
+//
+// Event Hooks
+//
 
-    snprintf(details, sizeof(details),
-             "{\"stream\":\"%p\",\"duration_ms\":%.3f,\"status\":%d}",
-             hStream, (end - start) * 1000, result);
-END_HOOK("sync", "cuStreamSynchronize", details)
+HOOK_FUNCTION(CUresult, cuEventRecord, (CUevent hEvent, CUstream hStream), (hEvent, hStream))
+    CUresult result = hook_real.cuEventRecord(hEvent, hStream);
+RECORD_HOOK(cuEventRecord)
+    ev->args.event.event = (uintptr_t)hEvent;
+    ev->args.event.stream = (uintptr_t)hStream;
+END_HOOK
+
+HOOK_FUNCTION(CUresult, cuEventRecordWithFlags,
+              (CUevent hEvent, CUstream hStream, unsigned int flags), (hEvent, hStream, flags))
+    CUresult result = hook_real.cuEventRecordWithFlags(hEvent, hStream, flags);
+RECORD_HOOK(cuEventRecordWithFlags)
+    ev->args.event.event = (uintptr_t)hEvent;
+    ev->args.event.stream = (uintptr_t)hStream;
+    ev->args.event.flags = flags;
+END_HOOK
 
 //
 // Kernel Execution Hooks
@@ -272,79 +747,119 @@ HOOK_FUNCTION(CUresult, cuLaunchKernel,
                unsigned int sharedMemBytes, CUstream hStream, void **kernelParams, void **extra),
               (f, gridDimX, gridDimY, gridDimZ, blockDimX, blockDimY, blockDimZ,
                sharedMemBytes, hStream, kernelParams, extra))
-    char details[512];
-    snprintf(details, sizeof(details),
-             "{\"function\":\"%p\",\"grid\":[%u,%u,%u],\"block\":[%u,%u,%u],\"shared_mem\":%u,\"stream\":\"%p\"}",
-             f, gridDimX, gridDimY, gridDimZ, blockDimX, blockDimY, blockDimZ,
-             sharedMemBytes, hStream);
-    log_trace("\"B\"", "kernel", "cuLaunchKernel", op_id, start, details);
-
-    CUresult result = real_cuLaunchKernel(f, gridDimX, gridDimY, gridDimZ,
+    struct gpu_slot* gpu = gpu_timing_begin(hStream);
+    CUresult result = hook_real.cuLaunchKernel(f, gridDimX, gridDimY, gridDimZ,
                                           blockDimX, blockDimY, blockDimZ,
                                           sharedMemBytes, hStream, kernelParams, extra);
-
-    unsigned int total_threads = gridDimX * gridDimY * gridDimZ *
-                                blockDimX * blockDimY * blockDimZ;
-    snprintf(details, sizeof(details),
-             "{\"grid\":[%u,%u,%u],\"block\":[%u,%u,%u],\"total_threads\":%u,\"duration_us\":%.3f,\"status\":%d}",
-             gridDimX, gridDimY, gridDimZ, blockDimX, blockDimY, blockDimZ,
-             total_threads, (end - start) * 1e6, result);
-END_HOOK("kernel", "cuLaunchKernel", details)
+    if (gpu) {
+        gpu_timing_record_end(gpu, hStream, f, op_id, start, result);
+    }
+RECORD_HOOK(cuLaunchKernel)
+    // Handles seen only here (e.g. looked up before the hook was loaded)
+    // get a nameless entry so launches of the same kernel still group
+    ev->args.launch.func = func_table_lookup(&hook_functions, (uintptr_t)f);
+    if (__builtin_expect(!ev->args.launch.func, 0)) {
+        ev->args.launch.func = func_table_register(&hook_functions, (uintptr_t)f, 0);
+    }
+    ev->args.launch.reserved = 0;
+    ev->args.launch.stream = (uintptr_t)hStream;
+    ev->args.launch.grid_x = gridDimX;
+    ev->args.launch.grid_y = (uint16_t)gridDimY;
+    ev->args.launch.grid_z = (uint16_t)gridDimZ;
+    ev->args.launch.block = HOOK_PACK_BLOCK(blockDimX, blockDimY, blockDimZ);
+    ev->args.launch.shared_mem = sharedMemBytes;
+END_HOOK
 
 HOOK_FUNCTION(CUresult, cuModuleLoad, (CUmodule *module, const char *fname), (module, fname))
-    char details[512];
-    snprintf(details, sizeof(details), "{\"file\":\"%s\"}", fname ? fname : "null");
-    log_trace("\"B\"", "module", "cuModuleLoad", op_id, start, details);
-
-    CUresult result = real_cuModuleLoad(module, fname);
-
-    snprintf(details, sizeof(details), "{\"module\":\"%p\",\"file\":\"%s\",\"status\":%d}",
-             *module, fname ? fname : "null", result);
-END_HOOK("module", "cuModuleLoad", details)
+    CUresult result = hook_real.cuModuleLoad(module, fname);
+RECORD_HOOK(cuModuleLoad)
+    ev->args.module.module = module ? (uintptr_t)*module : 0;
+    ev->args.module.name = string_table_intern(&hook_strings, fname);
+END_HOOK
 
 HOOK_FUNCTION(CUresult, cuModuleUnload, (CUmodule hmod), (hmod))
-    char details[256];
-    snprintf(details, sizeof(details), "{\"module\":\"%p\"}", hmod);
-    log_trace("\"B\"", "module", "cuModuleUnload", op_id, start, details);
-
-    CUresult result = real_cuModuleUnload(hmod);
-
-    snprintf(details, sizeof(details), "{\"module\":\"%p\",\"status\":%d}", hmod, result);
-END_HOOK("module", "cuModuleUnload", details)
-
-HOOK_FUNCTION(CUresult, cuModuleGetFunction, (CUfunction *hfunc, CUmodule hmod, const char *name),
-              (hfunc, hmod, name))
-    char details[512];
-    snprintf(details, sizeof(details), "{\"module\":\"%p\",\"name\":\"%s\"}", hmod, name ? name : "null");
-    log_trace("\"B\"", "module", "cuModuleGetFunction", op_id, start, details);
+    CUresult result = hook_real.cuModuleUnload(hmod);
+RECORD_HOOK(cuModuleUnload)
+    ev->args.module.module = (uintptr_t)hmod;
+END_HOOK
+
+HOOK_FUNCTION_TRACKED(CUresult, cuModuleGetFunction, (CUfunction *hfunc, CUmodule hmod, const char *name),
+                      (hfunc, hmod, name))
+    CUresult result = hook_real.cuModuleGetFunction(hfunc, hmod, name);
+    // Register even when the call itself is not recorded
+    uint32_t name_id = string_table_intern(&hook_strings, name);
+    if (result == CUDA_SUCCESS && hfunc) {
+        func_table_register(&hook_functions, (uintptr_t)*hfunc, name_id);
+    }
+RECORD_HOOK(cuModuleGetFunction)
+    ev->args.module.module = (uintptr_t)hmod;
+    ev->args.module.func = hfunc ? (uintptr_t)*hfunc : 0;
+    ev->args.module.name = name_id;
+END_HOOK
 
-    CUresult result = real_cuModuleGetFunction(hfunc, hmod, name);
+//
+// Library Management Hooks
+//
 
-    snprintf(details, sizeof(details), "{\"function\":\"%p\",\"name\":\"%s\",\"status\":%d}",
-             *hfunc, name ? name : "null", result);
-END_HOOK("module", "cuModuleGetFunction", details)
+// CUkernel handles can be passed to cuLaunchKernel directly
+HOOK_FUNCTION_TRACKED(CUresult, cuLibraryGetKernel, (CUkernel *pKernel, CUlibrary library, const char *name),
+                      (pKernel, library, name))
+    CUresult result = hook_real.cuLibraryGetKernel(pKernel, library, name);
+    uint32_t name_id = string_table_intern(&hook_strings, name);
+    if (result == CUDA_SUCCESS && pKernel) {
+        func_table_register(&hook_functions, (uintptr_t)*pKernel, name_id);
+    }
+RECORD_HOOK(cuLibraryGetKernel)
+    ev->args.module.module = (uintptr_t)library;
+    ev->args.module.func = pKernel ? (uintptr_t)*pKernel : 0;
+    ev->args.module.name = name_id;
+END_HOOK
 
 //
 // Device Management Hooks
 //
 
 HOOK_FUNCTION(CUresult, cuInit, (unsigned int Flags), (Flags))
-    char details[256];
-    snprintf(details, sizeof(details), "{\"flags\":%u}", Flags);
-    log_trace("\"B\"", "init", "cuInit", op_id, start, details);
-
-    CUresult result = real_cuInit(Flags);
-
-    snprintf(details, sizeof(details), "{\"status\":%d}", result);
-END_HOOK("init", "cuInit", details)
+    CUresult result = hook_real.cuInit(Flags);
+RECORD_HOOK(cuInit)
+    ev->args.device.flags = Flags;
+END_HOOK
 
 HOOK_FUNCTION(CUresult, cuDeviceGet, (CUdevice *device, int ordinal), (device, ordinal))
-    char details[256];
-    snprintf(details, sizeof(details), "{\"ordinal\":%d}", ordinal);
-    log_trace("\"B\"", "device", "cuDeviceGet", op_id, start, details);
+    CUresult result = hook_real.cuDeviceGet(device, ordinal);
+RECORD_HOOK(cuDeviceGet)
+    ev->args.device.device = device ? (uintptr_t)*device : 0;
+    ev->args.device.ordinal = ordinal;
+END_HOOK
 
-    CUresult result = real_cuDeviceGet(device, ordinal);
+//
+// Generated Hooks (hook_apis_gen.h)
+//
 
-    snprintf(details, sizeof(details), "{\"device\":\"%p\",\"ordinal\":%d,\"status\":%d}",
-             *device, ordinal, result);
-END_HOOK("device", "cuDeviceGet", details)
+// Capture expressions per argument kind; outputs are read only on success
+#define CAP_NONE          0
+#define CAP_SIZE(x)       (uint64_t)(x)
+#define CAP_INT(x)        (uint64_t)(int64_t)(x)
+#define CAP_FLAGS(x)      (uint64_t)(x)
+#define CAP_HANDLE(x)     (uint64_t)(uintptr_t)(x)
+#define CAP_PTR(x)        (uint64_t)(uintptr_t)(x)
+#define CAP_STRING(x)     string_table_intern(&hook_strings, (x))
+#define CAP_OUT_HANDLE(p) (result == CUDA_SUCCESS && (p) ? (uint64_t)(uintptr_t)*(p) : 0)
+#define CAP_OUT_INT(p)    (result == CUDA_SUCCESS && (p) ? (uint64_t)(int64_t)*(p) : 0)
+#define CAP_OUT_SIZE(p)   (result == CUDA_SUCCESS && (p) ? (uint64_t)*(p) : 0)
+
+#define HOOK_API(name, category, versioned, ret, params, args)
+#define HOOK_GEN_CUSTOM(name, category, version, params, call_args, c0, c1, c2, c3)
+#define HOOK_GEN(name, category, version, params, call_args, c0, c1, c2, c3) \
+    HOOK_FUNCTION(CUresult, name, params, call_args) \
+        CUresult result = hook_real.name call_args; \
+    RECORD_HOOK(name) \
+        ev->args.generic[0] = c0; \
+        ev->args.generic[1] = c1; \
+        ev->args.generic[2] = c2; \
+        ev->args.generic[3] = c3; \
+    END_HOOK
+#include "hook_apis.h"
+#undef HOOK_GEN
+#undef HOOK_GEN_CUSTOM
+#undef HOOK_API
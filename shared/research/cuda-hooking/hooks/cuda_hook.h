@@ -0,0 +1,1252 @@
+/*
+ * cuda_hook.h - Shared definitions for the CUDA hooking library
+ *
+ * Hooks record one fixed-size event per intercepted call into a per-thread
+ * ring buffer (trace_ring.c). A background drainer formats the events
+ * (trace_format.c) and writes them to the trace file.
+ */
+
+#ifndef CUDA_HOOK_H
+#define CUDA_HOOK_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// CUDA types (minimal definitions needed for hooking)
+typedef int CUdevice;
+typedef void* CUcontext;
+typedef void* CUstream;
+typedef void* CUfunction;
+typedef void* CUmodule;
+typedef void* CUlibrary;
+typedef void* CUkernel;
+typedef void* CUevent;
+typedef void* CUmemoryPool;
+typedef void* CUlinkState;
+typedef void* CUgraph;
+typedef void* CUgraphExec;
+typedef void* CUgraphNode;
+typedef unsigned long long CUdeviceptr;
+typedef unsigned long long CUmemGenericAllocationHandle;
+typedef int CUresult;
+typedef void (*CUhostFn)(void* userData);
+typedef void (*CUstreamCallback)(CUstream hStream, CUresult status, void* userData);
+typedef size_t (*CUoccupancyB2DSize)(int blockSize);
+
+#define CUDA_SUCCESS          0
+#define CUDA_ERROR_NOT_FOUND  500
+#define CUDA_ERROR_NOT_READY  600
+
+//
+// API identifiers
+//
+
+enum hook_api {
+#define HOOK_API(name, category, versioned, ret, params, args) API_##name,
+#include "hook_apis.h"
+#undef HOOK_API
+    API_COUNT
+};
+
+// Records that do not come from a hooked call. They are numbered after the
+// APIs and share their name table, so binary traces map them the same way.
+enum hook_record {
+    REC_GPU_KERNEL = API_COUNT, // Device-side timing of a launch (hook_gputime.c)
+    REC_HOST_STACK,             // Host stack id of a call (hook_stack.c)
+    REC_COUNT
+};
+
+extern const char* const hook_api_names[REC_COUNT];
+extern const char* const hook_api_categories[REC_COUNT];
+
+//
+// Real driver entry points (hook_dispatch.c)
+//
+// One pointer per hooked API, resolved together so a hook is a plain
+// indirect call. Until resolution every entry points at a trampoline that
+// resolves the whole table once; entries the driver does not export point
+// at a stub returning CUDA_ERROR_NOT_FOUND. hook_real holds the symbol of
+// the current ABI (HOOK_SYMBOL in hook_apis.h), hook_legacy the plain one,
+// which differs only for v2 APIs and is used only by their plain exports.
+//
+
+struct hook_dispatch {
+#define HOOK_API(name, category, versioned, ret, params, args) ret (*name) params;
+#include "hook_apis.h"
+#undef HOOK_API
+} __attribute__((aligned(64)));
+
+extern struct hook_dispatch hook_real;
+extern struct hook_dispatch hook_legacy;
+
+void hook_resolve_symbols(void);
+int hook_libcuda_loaded(void);
+void* hook_driver_handle(void);
+void* hook_driver_symbol(const char* name);
+
+// Whether dlsym() is interposed on this architecture (hook_procaddr.c);
+// without it libcudart's cuGetProcAddress lookups bypass the hooks
+extern const int hook_dlsym_interposed;
+
+//
+// Event records
+//
+
+// Kernel block dimensions are packed into 32 bits (x and y are at most
+// 1024, z at most 64) so a launch fits in the 32-byte argument union.
+#define HOOK_PACK_BLOCK(x, y, z) \
+    ((uint32_t)(x) | ((uint32_t)(y) << 11) | ((uint32_t)(z) << 22))
+#define HOOK_BLOCK_X(b) ((b) & 0x7ff)
+#define HOOK_BLOCK_Y(b) (((b) >> 11) & 0x7ff)
+#define HOOK_BLOCK_Z(b) ((b) >> 22)
+
+// Arguments recorded by a generated hook, described per API in
+// hook_api_args (trace_format.c)
+#define HOOK_GEN_ARGS 4
+
+enum hook_arg_kind {
+    HOOK_ARG_NONE = 0,
+    HOOK_ARG_SIZE,
+    HOOK_ARG_INT,
+    HOOK_ARG_FLAGS,
+    HOOK_ARG_HANDLE,
+    HOOK_ARG_PTR,
+    HOOK_ARG_STRING,            // String table id
+};
+
+struct hook_arg_desc {
+    uint8_t kind;               // enum hook_arg_kind
+    uint8_t out;                // Read through an output pointer after the call
+    const char* name;
+};
+
+extern const struct hook_arg_desc hook_api_args[API_COUNT][HOOK_GEN_ARGS];
+
+// Parameters of each generated hook (0 for handwritten ones); those beyond
+// its captures are not in the record, which the JSON output says
+extern const uint8_t hook_api_arg_count[API_COUNT];
+
+#define HOOK_NARGS(...) HOOK_NARGS_(__VA_ARGS__, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define HOOK_NARGS_(a1, a2, a3, a4, a5, a6, a7, a8, a9, a10, a11, a12, n, ...) n
+
+// Host side of a copy, from the page-locked ranges in hook_pinned.c
+enum hook_host_memory {
+    HOOK_HOST_UNKNOWN = 0,      // Device-to-device, unified, or older traces
+    HOOK_HOST_PINNED,
+    HOOK_HOST_PAGEABLE,         // Staged through the driver's pinned buffers
+};
+
+// One intercepted call. Begin and end are kept in a single record so the
+// hot path publishes exactly one 64-byte slot per call.
+struct hook_event {
+    int64_t  ts;                // Call entry timestamp (ns, or TSC ticks until drained)
+    int64_t  end;               // Call exit timestamp
+    uint64_t op_id;             // Unique per process, increasing per thread
+    uint32_t tid;
+    uint16_t api;               // enum hook_api
+    int16_t  status;            // CUresult returned by the real call
+    union {
+        struct { uint64_t ptr; uint64_t size; uint64_t stream; uint32_t flags; } mem;
+        struct {
+            uint64_t dst;
+            uint64_t src;
+            uint64_t size : 56;
+            uint64_t host : 8;  // enum hook_host_memory of the host side
+            uint64_t stream;
+        } copy;
+        struct { uint64_t ctx; uint64_t device; uint32_t flags; } ctx;
+        struct { uint64_t stream; uint32_t flags; } stream;
+        struct { uint64_t event; uint64_t stream; uint32_t flags; } event;
+        struct {
+            uint32_t func;      // Function table id
+            uint32_t reserved;
+            uint64_t stream;
+            uint32_t grid_x;
+            uint32_t shared_mem;
+            uint16_t grid_y;
+            uint16_t grid_z;
+            uint32_t block;     // HOOK_PACK_BLOCK
+        } launch;
+        struct { uint64_t module; uint64_t func; uint32_t name; } module;
+        struct { uint64_t device; int32_t ordinal; uint32_t flags; } device;
+        struct {
+            uint64_t stream;
+            uint32_t func;      // Function table id
+            uint32_t reserved;
+            int64_t  device_ns; // Kernel run time from the event pair
+            int64_t  queue_ns;  // Launch call entry to kernel start
+        } gpu;
+        struct {
+            uint32_t id;        // Stack table id, 0 if the table is full
+            uint16_t depth;
+        } stack;
+        uint64_t generic[HOOK_GEN_ARGS];  // Captures of a hook_apis_gen.h entry
+        uint8_t raw[32];
+    } args;
+};
+
+_Static_assert(sizeof(struct hook_event) == 64, "hook_event must stay one cache line");
+
+//
+// Timestamp sources (hook_clock.c)
+//
+
+// A calibration point: from tsc onwards, ns = ns + ((ticks - tsc) * mult) >> 32.
+// Also the payload of a TRACE_BLOCK_CLOCK block.
+struct trace_clock_point {
+    int64_t  tsc;
+    int64_t  ns;                // CLOCK_MONOTONIC at tsc, continuing the previous segment
+    uint64_t mult;              // ns per tick, 32.32 fixed point
+};
+
+// Calibration points in TSC order, used to convert ticks to ns
+struct clock_map {
+    struct trace_clock_point* points;
+    size_t count;
+    size_t capacity;
+};
+
+extern int hook_clock_tsc;      // Hooks record TSC ticks instead of ns
+extern struct clock_map hook_clock_map;
+
+int hook_clock_tsc_supported(void);
+int hook_clock_init(void);
+int hook_clock_recalibrate(struct trace_clock_point* pt);
+int clock_map_add(struct clock_map* map, const struct trace_clock_point* pt);
+void clock_map_free(struct clock_map* map);
+int64_t clock_map_to_ns(const struct clock_map* map, int64_t ticks);
+int64_t clock_map_duration_ns(const struct clock_map* map, int64_t ticks);
+int64_t hook_clock_from_ns(int64_t ns);
+int64_t hook_clock_to_ns(int64_t units);
+
+static inline int64_t hook_rdtsc(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return (int64_t)__rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Hook timestamp: CLOCK_MONOTONIC ns, or raw TSC ticks when hook_clock_tsc
+// is set (converted by the drainer)
+static inline int64_t hook_timestamp(void) {
+    if (hook_clock_tsc) {
+        return hook_rdtsc();
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+//
+// String table (string_table.c)
+//
+// Interns strings such as module paths and kernel names so events can refer
+// to them by a 32-bit id. Inserts take a lock; lookups by id are lock-free.
+// Id 0 is reserved for NULL.
+//
+
+#define STRTAB_CHUNK_SHIFT 10
+#define STRTAB_CHUNK_SIZE  (1u << STRTAB_CHUNK_SHIFT)
+#define STRTAB_MAX_CHUNKS  1024
+
+struct string_table {
+    pthread_mutex_t lock;
+    char** chunks[STRTAB_MAX_CHUNKS];
+    uint32_t count;             // Published with release semantics
+    uint32_t* index;            // Open-addressed hash of ids, guarded by lock
+    uint32_t index_cap;
+};
+
+void string_table_init(struct string_table* tab);
+void string_table_free(struct string_table* tab);
+uint32_t string_table_intern(struct string_table* tab, const char* s);
+const char* string_table_get(const struct string_table* tab, uint32_t id);
+uint32_t string_table_count(const struct string_table* tab);
+
+extern struct string_table hook_strings;
+
+//
+// Kernel function table (func_table.c)
+//
+// Maps CUfunction (and CUkernel) handles to the kernel name they were
+// obtained with. Launch records carry the small function id instead of the
+// handle; the id's entry holds the handle and the interned name. Entries
+// live in chunks that never move and the handle index is replaced, never
+// edited in place, when it grows, so lookups take no lock. Id 0 means an
+// unknown handle.
+//
+
+struct func_entry {
+    uint64_t handle;
+    uint32_t name;              // String id, 0 if unknown
+};
+
+struct func_slot {
+    uint64_t handle;            // Published last, 0 = empty
+    uint32_t id;
+};
+
+struct func_index {
+    uint32_t mask;
+    struct func_index* retired; // Older indexes, freed with the table
+    struct func_slot slots[];
+};
+
+struct func_table {
+    pthread_mutex_t lock;
+    struct func_entry* chunks[STRTAB_MAX_CHUNKS];
+    uint32_t count;             // Published with release semantics
+    struct func_index* index;   // Published with release semantics
+};
+
+void func_table_init(struct func_table* tab);
+void func_table_free(struct func_table* tab);
+uint32_t func_table_register(struct func_table* tab, uint64_t handle, uint32_t name);
+const struct func_entry* func_table_get(const struct func_table* tab, uint32_t id);
+uint32_t func_table_count(const struct func_table* tab);
+
+extern struct func_table hook_functions;
+
+static inline uint32_t func_hash(uint64_t handle) {
+    return (uint32_t)((handle * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+static inline uint32_t func_table_lookup(const struct func_table* tab, uint64_t handle) {
+    const struct func_index* index = __atomic_load_n(&tab->index, __ATOMIC_ACQUIRE);
+    if (!index || !handle) {
+        return 0;
+    }
+    for (uint32_t slot = func_hash(handle) & index->mask;; slot = (slot + 1) & index->mask) {
+        uint64_t h = __atomic_load_n(&index->slots[slot].handle, __ATOMIC_ACQUIRE);
+        if (h == handle) {
+            return __atomic_load_n(&index->slots[slot].id, __ATOMIC_RELAXED);
+        }
+        if (h == 0) {
+            return 0;
+        }
+    }
+}
+
+//
+// Per-thread event rings (trace_ring.c)
+//
+// Each thread appends to its own single-producer/single-consumer ring; the
+// drainer thread is the only consumer. The producer and consumer indices
+// live on separate cache lines so the hot path never shares a written line.
+//
+
+struct trace_ring {
+    // Immutable after attach
+    struct hook_event* events;
+    uint64_t mask;
+    uint32_t tid;
+    int dead;                   // Set when the owning thread exits
+    struct trace_ring* next;
+
+    // Producer side
+    uint64_t head __attribute__((aligned(64)));
+    uint64_t cached_tail;
+    uint64_t dropped;
+
+    // Consumer side
+    uint64_t tail __attribute__((aligned(64)));
+};
+
+// initial-exec: the library is LD_PRELOADed, so its TLS is in the static
+// block and the hot path avoids a __tls_get_addr call.
+enum trace_format {
+    TRACE_FORMAT_JSON,
+    TRACE_FORMAT_BINARY,
+    TRACE_FORMAT_CHROME,        // Calls only (trace_chrome.c); other records are left out
+};
+
+extern __thread struct trace_ring* tls_ring __attribute__((tls_model("initial-exec")));
+extern int tracing_active;
+
+int trace_rings_start(FILE* out, enum trace_format format, size_t ring_events,
+                      long drain_interval_us, long calibrate_interval_ms);
+void trace_rings_stop(void);
+int trace_rings_restart(void);
+struct trace_ring* trace_ring_attach(void);
+uint64_t trace_dropped_events(void);
+
+// Hot-path helpers: reserve a slot in the calling thread's ring (attaching
+// one on first use) and publish it once filled. A NULL slot means tracing is
+// stopped or the ring is full; a full ring counts the drop. No locks and no
+// syscalls after the first call on a thread.
+static inline struct hook_event* trace_reserve(void) {
+    if (__builtin_expect(!__atomic_load_n(&tracing_active, __ATOMIC_RELAXED), 0)) {
+        return NULL;
+    }
+
+    struct trace_ring* ring = tls_ring;
+    if (__builtin_expect(!ring, 0)) {
+        ring = trace_ring_attach();
+        if (!ring) {
+            return NULL;
+        }
+    }
+
+    uint64_t head = ring->head;
+    if (head - ring->cached_tail > ring->mask) {
+        ring->cached_tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (head - ring->cached_tail > ring->mask) {
+            __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+    }
+
+    struct hook_event* ev = &ring->events[head & ring->mask];
+    ev->tid = ring->tid;
+    return ev;
+}
+
+static inline void trace_commit(void) {
+    struct trace_ring* ring = tls_ring;
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+//
+// Trace segments (trace_segment.c)
+//
+// CUDA_HOOK_ROTATE_MB / CUDA_HOOK_ROTATE_S split the output into numbered
+// segments; the drainer moves to the next one between passes, and finished
+// segments are gzipped on a background thread and listed in an index.
+//
+
+extern int segment_active;
+
+FILE* segment_open(const char* path, long rotate_mb, long rotate_s, int compress_level);
+int segment_due(FILE* out, int64_t now_ns);
+int segment_rotate(FILE* out, int64_t first_ns, int64_t last_ns, int64_t now_ns);
+void segment_finish(FILE* out, int64_t first_ns, int64_t last_ns);
+int segment_reopen(FILE* out, const char* path);
+int trace_path_insert(char* out, size_t size, const char* path, const char* tag);
+
+//
+// Fork and exec (hook_fork.c)
+//
+// A forked child keeps none of its parent's unwritten records, counters or
+// tracked memory, and writes nothing until it records a call of its own;
+// then it opens a trace of its own, cuda_trace.<pid>.jsonl, which starts
+// with a process record naming its parent. An exec'd descendant (told apart
+// by CUDA_HOOK_TRACE_OWNER) does the same from its constructor.
+//
+
+enum fork_phase {
+    FORK_PREPARE,               // Parent, before fork: take every lock
+    FORK_PARENT,                // Parent, after fork: release them
+    FORK_CHILD,                 // Child: release them and reset the state
+};
+
+enum process_origin {
+    PROCESS_START = 0,          // The process CUDA_HOOK_TRACE was set for
+    PROCESS_FORK  = 1,
+    PROCESS_EXEC  = 2,
+};
+
+extern int fork_restart_pending;    // Forked child that has not traced yet
+
+enum process_origin process_identify(void);
+int fork_tracking_start(FILE* out, enum trace_format format, const char* trace_path,
+                        enum process_origin origin, const char* control);
+void fork_restart(void);
+void process_segment_start(int64_t now_ns);
+const char* process_control_path(char* out, size_t size, const char* control);
+void trace_rings_atfork(enum fork_phase phase);
+void segment_atfork(enum fork_phase phase);
+
+//
+// Node collector (hook_collector.c, trace_collectd.c)
+//
+// With CUDA_HOOK_COLLECTOR set the trace goes to cuda_trace_collectd rather
+// than a file. The process maps a ring of shared memory, hands it to the
+// collector over a Unix socket, and the drainer writes the binary trace
+// stream into it; the collector merges the streams of every process on the
+// node into one trace. The socket stays open for the life of the process,
+// so each side sees the other go away.
+//
+
+#define COLLECTOR_MAGIC   0x4b484355u   // "UCHK"
+#define COLLECTOR_VERSION 1
+#define COLLECTOR_SOCKET  "/dev/shm/cuda_hook_collector.sock"
+
+// Sent once by the process, with the ring's memfd attached (SCM_RIGHTS);
+// the collector answers with a uint32_t, 0 = accepted
+struct collector_hello {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t pid;
+    uint32_t reserved;
+    uint64_t map_bytes;         // Whole mapping, this header included
+};
+
+// Start of the shared mapping; `size` bytes of trace stream follow. The
+// process only moves `head`, the collector only `tail`.
+struct collector_ring {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;              // Power of two
+    uint64_t head __attribute__((aligned(64)));
+    uint64_t tail __attribute__((aligned(64)));
+    unsigned char data[] __attribute__((aligned(64)));
+};
+
+extern int collector_active;
+
+FILE* collector_open(const char* spec, long ring_mb);
+int collector_reopen(void);
+void collector_atfork(enum fork_phase phase);
+
+//
+// Aggregation mode (hook_aggregate.c)
+//
+// With CUDA_HOOK_MODE=aggregate the hooks skip the rings and bump per-thread
+// counters and latency histograms instead. The drainer merges the shards
+// into rolling windows and writes one summary per window.
+//
+
+enum hook_mode {
+    HOOK_MODE_TRACE,            // One record per call through the rings
+    HOOK_MODE_AGGREGATE,        // Per-API counters and histograms only
+    HOOK_MODE_OFF,              // Hooks forward to the driver, nothing recorded
+    HOOK_MODE_COUNT,
+};
+
+extern int hook_mode;           // Changed at runtime by hook_control.c
+extern const char* const hook_mode_names[HOOK_MODE_COUNT];
+
+// Log-linear histogram: exact below 2^STATS_SUB_BITS, then 2^STATS_SUB_BITS
+// sub-buckets per power of two (about 6% relative error). Durations at or
+// above 2^STATS_MAX_BITS clock units land in the last bucket.
+#define STATS_SUB_BITS 4
+#define STATS_MAX_BITS 40
+#define STATS_BUCKETS  ((STATS_MAX_BITS - STATS_SUB_BITS + 1) << STATS_SUB_BITS)
+
+// Transfer size classes: under 1 KiB, then one per factor of 4 up to
+// 64 MiB and over
+#define STATS_SIZE_CLASSES 10
+
+// Cumulative per-API totals of one thread. Only the owning thread writes;
+// the drainer reads with relaxed loads and diffs successive merges.
+struct agg_api_stats {
+    uint64_t count;
+    uint64_t errors;
+    uint64_t bytes;             // Bytes moved, for the memcpy hooks
+    uint64_t total;             // Sum of durations, clock units
+    uint64_t overhead;          // Time spent recording sampled calls
+    uint64_t hist[STATS_BUCKETS];
+    struct {
+        uint64_t count;
+        uint64_t bytes;
+        uint64_t total;         // Clock units
+    } sizes[STATS_SIZE_CLASSES];
+};
+
+struct agg_shard {
+    struct agg_api_stats* api[API_COUNT];   // Allocated on first use
+    int dead;                   // Set when the owning thread exits
+    struct agg_shard* next;
+};
+
+extern __thread struct agg_shard* tls_shard __attribute__((tls_model("initial-exec")));
+
+struct agg_shard* agg_shard_attach(void);
+struct agg_api_stats* agg_api_attach(struct agg_shard* shard, uint16_t api);
+int aggregate_start(FILE* out, enum trace_format format, long window_ms);
+void aggregate_poll(int64_t now_ns);
+void aggregate_flush(int64_t now_ns);
+void aggregate_finish(int64_t now_ns);
+void aggregate_atfork(enum fork_phase phase);
+void aggregate_overhead_ns(uint64_t* per_api);
+
+static inline unsigned stats_bucket(uint64_t v) {
+    if (v < (1u << STATS_SUB_BITS)) {
+        return (unsigned)v;
+    }
+    unsigned shift = 63 - __builtin_clzll(v) - STATS_SUB_BITS;
+    unsigned idx = ((shift + 1) << STATS_SUB_BITS) + (unsigned)((v >> shift) - (1u << STATS_SUB_BITS));
+    return idx < STATS_BUCKETS ? idx : STATS_BUCKETS - 1;
+}
+
+// Midpoint (or upper bound) of a histogram bucket, in clock units
+static inline uint64_t stats_bucket_value(unsigned idx, int upper) {
+    if (idx < (1u << STATS_SUB_BITS)) {
+        return idx;
+    }
+    unsigned shift = (idx >> STATS_SUB_BITS) - 1;
+    uint64_t mantissa = (idx & ((1u << STATS_SUB_BITS) - 1)) + (1u << STATS_SUB_BITS);
+    uint64_t low = mantissa << shift;
+    uint64_t high = ((mantissa + 1) << shift) - 1;
+    return upper ? high : low + (high - low) / 2;
+}
+
+static inline uint64_t stats_percentile(const uint64_t* hist, uint64_t count, double q) {
+    uint64_t target = (uint64_t)(q * count);
+    if (target >= count) {
+        target = count - 1;
+    }
+    uint64_t seen = 0;
+    for (unsigned b = 0; b < STATS_BUCKETS; b++) {
+        seen += hist[b];
+        if (seen > target) {
+            return stats_bucket_value(b, 0);
+        }
+    }
+    return stats_bucket_value(STATS_BUCKETS - 1, 0);
+}
+
+static inline unsigned stats_size_class(uint64_t bytes) {
+    if (bytes < 1024) {
+        return 0;
+    }
+    unsigned cls = (63 - __builtin_clzll(bytes) - 10) / 2 + 1;
+    return cls < STATS_SIZE_CLASSES ? cls : STATS_SIZE_CLASSES - 1;
+}
+
+static inline int hook_api_is_copy(uint16_t api) {
+    switch (api) {
+    case API_cuMemcpyHtoD:
+    case API_cuMemcpyDtoH:
+    case API_cuMemcpyDtoD:
+    case API_cuMemcpy:
+    case API_cuMemcpyAsync:
+    case API_cuMemcpyHtoDAsync:
+    case API_cuMemcpyDtoHAsync:
+    case API_cuMemcpyDtoDAsync:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// Async copies return once queued, so their call time is not transfer time
+static inline int hook_api_is_async_copy(uint16_t api) {
+    switch (api) {
+    case API_cuMemcpyAsync:
+    case API_cuMemcpyHtoDAsync:
+    case API_cuMemcpyDtoHAsync:
+    case API_cuMemcpyDtoDAsync:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static inline uint64_t hook_event_bytes(const struct hook_event* ev) {
+    return hook_api_is_copy(ev->api) ? ev->args.copy.size : 0;
+}
+
+// Single-writer increments: plain read, relaxed store
+#define AGG_ADD(field, n) __atomic_store_n(&(field), (field) + (n), __ATOMIC_RELAXED)
+
+static inline void aggregate_event(const struct hook_event* ev) {
+    struct agg_shard* shard = tls_shard;
+    if (__builtin_expect(!shard, 0)) {
+        shard = agg_shard_attach();
+        if (!shard) {
+            return;
+        }
+    }
+    struct agg_api_stats* stats = shard->api[ev->api];
+    if (__builtin_expect(!stats, 0)) {
+        stats = agg_api_attach(shard, ev->api);
+        if (!stats) {
+            return;
+        }
+    }
+
+    uint64_t duration = ev->end > ev->ts ? (uint64_t)(ev->end - ev->ts) : 0;
+    uint64_t bytes = hook_event_bytes(ev);
+    AGG_ADD(stats->count, 1);
+    AGG_ADD(stats->errors, ev->status != CUDA_SUCCESS);
+    AGG_ADD(stats->bytes, bytes);
+    AGG_ADD(stats->total, duration);
+    AGG_ADD(stats->hist[stats_bucket(duration)], 1);
+    if (bytes) {
+        unsigned cls = stats_size_class(bytes);
+        AGG_ADD(stats->sizes[cls].count, 1);
+        AGG_ADD(stats->sizes[cls].bytes, bytes);
+        AGG_ADD(stats->sizes[cls].total, duration);
+    }
+}
+
+static inline void aggregate_add_overhead(uint16_t api, int64_t cost) {
+    struct agg_shard* shard = tls_shard;
+    if (shard && shard->api[api] && cost > 0) {
+        AGG_ADD(shard->api[api]->overhead, (uint64_t)cost);
+    }
+}
+
+//
+// Host call stacks (hook_stack.c)
+//
+// With CUDA_HOOK_STACKS the hooks of chosen APIs walk the calling host stack
+// after recording the call, 1 in N per thread and optionally only for calls
+// slower than CUDA_HOOK_STACK_MIN_US. Identical stacks share an id in a
+// deduplicated table, so a capture costs one REC_HOST_STACK record carrying
+// the call's op_id and the stack id. A /proc/self/maps snapshot follows the
+// trace header for symbolizing the return addresses offline.
+//
+
+#define STACK_MAX_DEPTH 64
+
+// One stack table entry; binary traces store only depth frames
+struct trace_stack {
+    uint32_t id;
+    uint16_t depth;
+    uint16_t reserved;
+    uint64_t frames[STACK_MAX_DEPTH];   // Return addresses, innermost first
+};
+
+extern int hook_stacks;                     // Any API captures stacks
+extern uint32_t stack_every[API_COUNT];     // Capture 1 in N, 0 = off
+extern int64_t stack_min_duration;          // Clock units
+extern __thread uint32_t tls_stack_skip[API_COUNT] __attribute__((tls_model("initial-exec")));
+
+int stack_tracking_start(FILE* out, enum trace_format format, const char* spec, long depth,
+                         long min_us, const char* unwind);
+void stack_record(const struct hook_event* call);
+void stack_drain(void);
+void stack_segment_start(int64_t now_ns);
+void stack_finish(int64_t now_ns);
+void stack_atfork(enum fork_phase phase);
+
+// Called with a call's committed ring record
+static inline void stack_maybe_record(const struct hook_event* ev) {
+    uint32_t every = stack_every[ev->api];
+    if (!every || ev->end - ev->ts < stack_min_duration) {
+        return;
+    }
+    if (every > 1) {
+        uint32_t skipped = tls_stack_skip[ev->api] + 1;
+        if (skipped < every) {
+            tls_stack_skip[ev->api] = skipped;
+            return;
+        }
+        tls_stack_skip[ev->api] = 0;
+    }
+    stack_record(ev);
+}
+
+//
+// API filter (hook_filter.c)
+//
+// CUDA_HOOK_FILTER, e.g. "kernel,transfer,-cuMemcpyAsync", is compiled into
+// one bit per API. hook_active holds that mask, or nothing while the mode is
+// off, so the first thing a hook does is one bit test; a filtered-out call
+// goes straight to the driver.
+//
+
+#define API_MASK_WORDS ((API_COUNT + 63) / 64)
+#define FILTER_SPEC_MAX 256
+
+extern uint64_t hook_active[API_MASK_WORDS];
+
+int filter_start(FILE* out, enum trace_format format, const char* spec);
+int filter_set(const char* spec, int64_t now_ns);
+void filter_refresh(void);
+
+static inline int hook_skip(uint16_t api) {
+    return !((__atomic_load_n(&hook_active[api >> 6], __ATOMIC_RELAXED) >> (api & 63)) & 1);
+}
+
+//
+// Sampling (hook_sample.c)
+//
+// In trace mode, CUDA_HOOK_SAMPLE and CUDA_HOOK_RATE_LIMIT thin out the
+// records of chosen APIs, and CUDA_HOOK_ADAPTIVE_OVERHEAD lets the drainer
+// raise the 1-in-N of the APIs whose recording costs the most. Every call
+// still goes through aggregate_event(), so the summaries keep exact counts.
+//
+
+extern int hook_sampling;               // Any sampling configured
+extern int sample_adaptive;             // Measure recording overhead
+extern uint32_t sample_every[API_COUNT];    // Record 1 in N (fixed x adaptive)
+extern uint32_t sample_rate_cap[API_COUNT]; // Max records per second, 0 = none
+extern __thread uint32_t tls_sample_skip[API_COUNT] __attribute__((tls_model("initial-exec")));
+
+int sample_configure(const char* every_spec, const char* rate_spec, double overhead_target);
+int sample_parse_spec(const char* spec, const char* env, uint32_t* out);
+int sample_rate_admit(uint16_t api);
+void sample_adapt(int64_t now_ns);
+
+// Per-thread 1-in-N countdown, then the process-wide rate cap
+static inline int sample_take(uint16_t api) {
+    uint32_t every = __atomic_load_n(&sample_every[api], __ATOMIC_RELAXED);
+    if (every > 1) {
+        uint32_t skipped = tls_sample_skip[api] + 1;
+        if (skipped < every) {
+            tls_sample_skip[api] = skipped;
+            return 0;
+        }
+        tls_sample_skip[api] = 0;
+    }
+    return !sample_rate_cap[api] || sample_rate_admit(api);
+}
+
+// Where a hook writes its record: the thread's ring in trace mode, or a
+// scratch record on the caller's stack that aggregate_event() folds into
+// counters (aggregate mode, or a call sampling skipped). NULL when the call
+// is not recorded at all.
+static inline struct hook_event* hook_begin_event(struct hook_event* scratch, uint16_t api) {
+    // Filtered out, or switched off, while the call was running
+    if (hook_skip(api)) {
+        return NULL;
+    }
+    int mode = __atomic_load_n(&hook_mode, __ATOMIC_RELAXED);
+    if (mode == HOOK_MODE_TRACE) {
+        if (!hook_sampling) {
+            return trace_reserve();
+        }
+        if (sample_take(api)) {
+            struct hook_event* ev = trace_reserve();
+            if (ev) {
+                return ev;
+            }
+        }
+    }
+    // Hooks fill only the args they use; hook_event_bytes() reads copy
+    memset(&scratch->args, 0, sizeof(scratch->args));
+    return scratch;
+}
+
+static inline void hook_end_event(struct hook_event* ev, struct hook_event* scratch) {
+    if (ev == scratch) {
+        aggregate_event(ev);
+        return;
+    }
+    if (hook_sampling) {
+        aggregate_event(ev);
+    }
+    trace_commit();
+    if (__builtin_expect(hook_stacks, 0)) {
+        stack_maybe_record(ev);
+    }
+    if (sample_adaptive) {
+        // The slot is only ever rewritten by this thread, so reading it
+        // after the commit is safe
+        aggregate_add_overhead(ev->api, hook_timestamp() - ev->end);
+    }
+}
+
+//
+// Device-side kernel timing (hook_gputime.c)
+//
+// With CUDA_HOOK_GPU_TIMING=N, one launch in N per thread is bracketed by
+// a cuEventRecord pair from a per-stream pool. A harvester thread polls the
+// pairs and writes a REC_GPU_KERNEL record with the launch's op_id.
+//
+
+struct gpu_slot;
+
+extern uint32_t gpu_timing_every;       // 0 = off
+extern __thread uint32_t tls_gpu_skip __attribute__((tls_model("initial-exec")));
+
+int gpu_timing_start(long every, long pool_events, long poll_us);
+void gpu_timing_stop(void);
+void gpu_timing_atfork(enum fork_phase phase);
+struct gpu_slot* gpu_timing_record_start(CUstream stream);
+void gpu_timing_record_end(struct gpu_slot* slot, CUstream stream, CUfunction func,
+                           uint64_t op_id, int64_t launch_ts, CUresult result);
+// Before the driver call that may destroy the context
+void gpu_timing_context_destroyed(CUcontext ctx);
+void gpu_timing_primary_released(CUdevice dev);
+
+// Hot-path check; NULL unless this launch is timed
+static inline struct gpu_slot* gpu_timing_begin(CUstream stream) {
+    uint32_t every = gpu_timing_every;
+    if (__builtin_expect(!every, 1)) {
+        return NULL;
+    }
+    if (__atomic_load_n(&hook_mode, __ATOMIC_RELAXED) != HOOK_MODE_TRACE) {
+        return NULL;
+    }
+    if (++tls_gpu_skip < every) {
+        return NULL;
+    }
+    tls_gpu_skip = 0;
+    return gpu_timing_record_start(stream);
+}
+
+//
+// Runtime control (hook_control.c)
+//
+// With CUDA_HOOK_CONTROL the drainer watches a small control file and
+// switches hook_mode between off, aggregate and trace when a new mode is
+// written to it, optionally for a limited time, or replaces the API filter.
+// Every switch is written to the trace.
+//
+
+int control_start(FILE* out, enum trace_format format, const char* spec);
+void control_poll(int64_t now_ns);
+void control_stop(void);
+void control_atfork(enum fork_phase phase);
+int hook_mode_parse(const char* name);
+
+//
+// Page-locked host ranges (hook_pinned.c)
+//
+// Host allocations and registrations from the hooks, so the host-to-device
+// and device-to-host copies can be tagged pinned or pageable.
+//
+
+void pinned_add(uint64_t ptr, uint64_t size);
+void pinned_remove(uint64_t ptr);
+uint8_t pinned_classify(uint64_t ptr, uint64_t size);   // enum hook_host_memory
+void pinned_atfork(enum fork_phase phase);
+
+//
+// Live allocation tracking (hook_alloc.c)
+//
+// With CUDA_HOOK_ALLOCS=1 the device allocation hooks keep a map of live
+// blocks with per-context current/peak bytes; a report is written to the
+// trace every window and unfreed blocks are listed at exit.
+//
+
+extern int hook_alloc_tracking;
+
+int alloc_tracking_start(FILE* out, enum trace_format format, long window_ms);
+void alloc_track(uint64_t ptr, uint64_t size, uint64_t op_id, int64_t ts);
+void alloc_untrack(uint64_t ptr);
+void alloc_poll(int64_t now_ns);
+void alloc_finish(int64_t now_ns);
+void alloc_leak_report(FILE* to);
+void alloc_atfork(enum fork_phase phase);
+
+// ts 0 (a call the hooks did not record) takes the time here
+static inline void alloc_record(uint64_t ptr, uint64_t size, uint64_t op_id, int64_t ts) {
+    if (__builtin_expect(hook_alloc_tracking, 0) && ptr) {
+        alloc_track(ptr, size, op_id, ts ? ts : hook_timestamp());
+    }
+}
+
+static inline void alloc_release(uint64_t ptr) {
+    if (__builtin_expect(hook_alloc_tracking, 0) && ptr) {
+        alloc_untrack(ptr);
+    }
+}
+
+//
+// Output formatting (trace_format.c)
+//
+
+void trace_write_json(FILE* out, const struct hook_event* ev, const struct string_table* strings,
+                      const struct func_table* functions);
+void trace_write_chrome(FILE* out, const struct hook_event* ev, const struct string_table* strings,
+                        const struct func_table* functions, uint32_t pid, int first);
+
+// Per-API line of a window summary. Durations are ns.
+struct trace_summary_api {
+    uint16_t api;
+    uint16_t reserved[3];
+    uint64_t count;
+    uint64_t errors;
+    uint64_t bytes;
+    int64_t  total_ns;
+    int64_t  p50_ns;
+    int64_t  p99_ns;
+    int64_t  p999_ns;
+    int64_t  max_ns;            // Upper bound of the highest occupied bucket
+    struct trace_summary_size {
+        uint64_t count;
+        uint64_t bytes;
+        int64_t  total_ns;
+    } sizes[STATS_SIZE_CLASSES];  // Copy APIs only (version 4 and later)
+};
+
+extern const char* const stats_size_class_names[STATS_SIZE_CLASSES];
+
+#define TRACE_SUMMARY_TOTAL 0x1 // Whole run rather than one window
+
+// Payload header of a TRACE_BLOCK_SUMMARY; api_count entries follow
+struct trace_summary {
+    int64_t  start_ns;
+    int64_t  end_ns;
+    uint32_t api_count;
+    uint32_t flags;
+};
+
+void trace_write_summary_json(FILE* out, const struct trace_summary* summary,
+                              const struct trace_summary_api* apis);
+
+#define TRACE_ALLOC_FINAL 0x1   // Written at exit
+
+// Payload header of a TRACE_BLOCK_ALLOCS; context_count entries follow
+struct trace_alloc_report {
+    int64_t  ts_ns;
+    uint32_t context_count;
+    uint32_t flags;
+};
+
+// Live device memory of one context at report time
+struct trace_alloc_context {
+    uint64_t ctx;
+    uint64_t live_count;
+    uint64_t live_bytes;
+    uint64_t peak_bytes;
+    uint64_t allocs;
+    uint64_t frees;
+    struct {
+        uint64_t count;
+        uint64_t bytes;
+    } sizes[STATS_SIZE_CLASSES];  // Live blocks by size class
+};
+
+void trace_write_allocs_json(FILE* out, const struct trace_alloc_report* report,
+                             const struct trace_alloc_context* contexts);
+
+#define TRACE_MAPS_FINAL 0x1    // Taken at exit, after the one at startup
+
+// Payload header of a TRACE_BLOCK_MAPS; the maps text follows
+struct trace_maps {
+    int64_t  ts_ns;
+    uint32_t flags;
+    uint32_t reserved;
+};
+
+void trace_write_stack_json(FILE* out, const struct trace_stack* stack);
+void trace_write_maps_json(FILE* out, const struct trace_maps* maps, const char* text,
+                           size_t len);
+
+// Payload of a TRACE_BLOCK_MODE: hook_mode changed at runtime
+struct trace_mode_change {
+    int64_t  ts_ns;
+    uint32_t mode;              // enum hook_mode
+    uint32_t previous;
+    int64_t  until_ns;          // When `previous` comes back, 0 = not timed
+};
+
+void trace_write_mode_json(FILE* out, const struct trace_mode_change* change);
+
+// Payload header of a TRACE_BLOCK_FILTER; the filter spec follows
+struct trace_filter_change {
+    int64_t  ts_ns;
+    uint32_t length;
+    uint32_t reserved;
+};
+
+void trace_write_filter_json(FILE* out, const struct trace_filter_change* change,
+                             const char* spec);
+
+// Payload of a TRACE_BLOCK_PROCESS: which process wrote the trace, and how
+// it came to be traced
+struct trace_process {
+    int64_t  ts_ns;
+    uint32_t pid;
+    uint32_t parent;            // 0 = not a traced process's child
+    uint32_t origin;            // enum process_origin
+    uint32_t reserved;
+};
+
+void trace_write_process_json(FILE* out, const struct trace_process* process);
+void trace_write_string(FILE* out, const char* s);
+
+//
+// Chrome trace output (trace_chrome.c)
+//
+// CUDA_HOOK_FORMAT=chrome has the drainer write a Chrome Trace Event file
+// that chrome://tracing and Perfetto open as it is: one slice per call on
+// its host thread, a track per stream with the work issued to it (and the
+// kernels' device time with CUDA_HOOK_GPU_TIMING), and flow arrows from
+// each launch or copy to the synchronization that waited for it.
+// cuda_trace_convert --format=chrome writes the same from a binary trace.
+//
+
+#define CHROME_STREAMS 1024     // Streams with a track; power of two
+#define CHROME_EVENTS  4096     // CUevents followed for cuEventSynchronize
+
+// The last work issued to a stream, or captured by an event record
+struct chrome_op {
+    int64_t  ts;                // Middle of the issuing call, ns
+    uint32_t tid;
+    uint32_t valid;
+};
+
+struct chrome_stream {
+    uint64_t key;               // Stream handle, see chrome_stream_key()
+    uint32_t track;             // Track's tid; 0 = free slot
+    uint32_t reserved;
+    struct chrome_op pending;   // Not yet waited for
+};
+
+struct chrome_event {
+    uint64_t handle;            // 0 = free slot
+    struct chrome_op op;
+};
+
+// Fixed-size state, so a forked child can drop its parent's by
+// starting over
+struct chrome_writer {
+    FILE* out;
+    const struct string_table* strings;
+    const struct func_table* functions;
+    uint32_t pid;
+    int first;                  // Nothing written since the opening bracket
+    uint32_t tracks;
+    uint64_t flows;
+    struct chrome_stream streams[CHROME_STREAMS];
+    struct chrome_event events[CHROME_EVENTS];
+};
+
+extern struct chrome_writer hook_chrome;    // The drainer's
+
+void chrome_writer_init(struct chrome_writer* w, FILE* out, const struct string_table* strings,
+                        const struct func_table* functions, uint32_t pid);
+void chrome_begin(struct chrome_writer* w, const char* process_name);
+void chrome_event(struct chrome_writer* w, const struct hook_event* ev);
+void chrome_process(struct chrome_writer* w, const struct trace_process* process);
+void chrome_end(struct chrome_writer* w);
+void chrome_resume(struct chrome_writer* w);
+
+//
+// Binary trace format
+//
+// A file is a trace_file_header, the API table it describes, then a stream
+// of blocks. Event blocks hold raw struct hook_event records exactly as they
+// sat in the ring, so writing them costs one fwrite and no formatting.
+// Strings and function table entries are written in a block before the first
+// event that refers to them.
+// All fields are little-endian.
+//
+
+#define TRACE_MAGIC   "CUHKTRCE"
+#define TRACE_VERSION 11      // 2: clock field and TRACE_BLOCK_CLOCK
+                              // 3: launch func is a function table id
+                              // 4: copy/mem stream, summary size classes
+                              // 5: TRACE_BLOCK_ALLOCS
+                              // 6: REC_HOST_STACK, TRACE_BLOCK_STACKS/MAPS
+                              // 7: copy host memory kind
+                              // 8: event/stream-wait records
+                              // 9: TRACE_BLOCK_MODE
+                              // 10: TRACE_BLOCK_FILTER
+                              // 11: TRACE_BLOCK_PROCESS
+
+enum trace_clock {
+    TRACE_CLOCK_MONOTONIC = 0,  // Event timestamps are CLOCK_MONOTONIC ns
+    TRACE_CLOCK_TSC       = 1,  // Event timestamps are TSC ticks, see TRACE_BLOCK_CLOCK
+};
+
+struct trace_file_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t header_size;       // Bytes up to the first block, API table included
+    uint32_t record_size;       // sizeof(struct hook_event)
+    uint32_t api_count;         // Entries in the API table
+    uint32_t pid;
+    uint32_t clock;             // enum trace_clock (0 in version 1 files)
+    int64_t  start_ns;          // CLOCK_MONOTONIC when tracing (or this segment) started
+    // Followed by api_count entries of:
+    //   uint16_t id; uint8_t name_len; char name[name_len];
+    //   uint8_t category_len; char category[category_len];
+};
+
+enum trace_block_type {
+    TRACE_BLOCK_EVENTS  = 1,    // Array of struct hook_event
+    TRACE_BLOCK_STRINGS = 2,    // Repeated { uint32_t id; uint32_t len; char s[len]; }
+    TRACE_BLOCK_CLOCK   = 3,    // struct trace_clock_point; the first follows the header
+    TRACE_BLOCK_SUMMARY = 4,    // struct trace_summary + api_count trace_summary_api
+    TRACE_BLOCK_FUNCTIONS = 5,  // Array of struct trace_function
+    TRACE_BLOCK_ALLOCS  = 6,    // struct trace_alloc_report + context_count trace_alloc_context
+    TRACE_BLOCK_STACKS  = 7,    // Stack table entries, each trace_stack cut to depth frames
+    TRACE_BLOCK_MAPS    = 8,    // struct trace_maps + /proc/self/maps text
+    TRACE_BLOCK_MODE    = 9,    // struct trace_mode_change
+    TRACE_BLOCK_FILTER  = 10,   // struct trace_filter_change + spec text
+    TRACE_BLOCK_PROCESS = 11,   // struct trace_process
+};
+
+// Function table entry; ids are written in order starting at 1
+struct trace_function {
+    uint32_t id;
+    uint32_t name;              // String id
+    uint64_t handle;
+};
+
+struct trace_block {
+    uint32_t type;
+    uint32_t size;              // Payload bytes following this header
+};
+
+int trace_write_binary_header(FILE* out, uint32_t pid, uint32_t clock, int64_t start_ns);
+void trace_write_binary_clock(FILE* out, const struct trace_clock_point* pt);
+void trace_write_binary_strings(FILE* out, const struct string_table* strings,
+                                uint32_t first, uint32_t end);
+void trace_write_binary_functions(FILE* out, const struct func_table* functions,
+                                  uint32_t first, uint32_t end);
+void trace_write_binary_events(FILE* out, const struct hook_event* ev, size_t count);
+void trace_write_binary_summary(FILE* out, const struct trace_summary* summary,
+                                const struct trace_summary_api* apis);
+void trace_write_binary_allocs(FILE* out, const struct trace_alloc_report* report,
+                               const struct trace_alloc_context* contexts);
+void trace_write_binary_stacks(FILE* out, const struct trace_stack* stacks, uint32_t count);
+void trace_write_binary_maps(FILE* out, const struct trace_maps* maps, const char* text,
+                             size_t len);
+void trace_write_binary_mode(FILE* out, const struct trace_mode_change* change);
+void trace_write_binary_filter(FILE* out, const struct trace_filter_change* change,
+                               const char* spec);
+void trace_write_binary_process(FILE* out, const struct trace_process* process);
+
+//
+// Reading binary traces (trace_reader.c)
+//
+// Used by cuda_trace_convert, cuda_trace_collectd and cuda_trace_replay.
+// Callbacks left NULL skip their records; events arrive with ids mapped
+// onto this build's APIs and timestamps in CLOCK_MONOTONIC ns.
+//
+
+struct trace_reader_ops {
+    void (*event)(void* ctx, const struct hook_event* ev);
+    void (*summary)(void* ctx, const struct trace_summary* summary,
+                    const struct trace_summary_api* apis);
+    void (*allocs)(void* ctx, const struct trace_alloc_report* report,
+                   const struct trace_alloc_context* contexts);
+    void (*stack)(void* ctx, const struct trace_stack* stack);
+    void (*maps)(void* ctx, const struct trace_maps* maps, const char* text, size_t len);
+    void (*mode)(void* ctx, const struct trace_mode_change* change);
+    void (*filter)(void* ctx, const struct trace_filter_change* change, const char* spec);
+    void (*process)(void* ctx, const struct trace_process* process);
+};
+
+struct trace_reader {
+    FILE* in;
+    struct trace_file_header hdr;
+    uint16_t* api_map;          // File API id -> this build's, REC_COUNT = unknown
+    struct string_table strings;
+    struct func_table functions;
+    struct clock_map clock;
+    int launch_handles;         // Version 1-2: launch records hold raw handles
+    int wait_stream_first;      // Version 1-7: stream-wait fields swapped
+    int tsc;
+    int truncated;
+    uint32_t summary_entry_size;
+    uint64_t events;            // Delivered so far
+    uint64_t summaries;         // Summaries and allocation reports
+};
+
+// Open a trace file, gzipped (a CUDA_HOOK_COMPRESS segment) or not
+FILE* trace_reader_fopen(const char* path);
+int trace_reader_open(struct trace_reader* r, FILE* in, const char* name);
+int trace_reader_next(struct trace_reader* r, const struct trace_reader_ops* ops, void* ctx);
+void trace_reader_close(struct trace_reader* r);
+
+//
+// Mock driver (mock_cuda.c, mock_apis.c)
+//
+// libcuda_mock.so, a CPU-only stand-in for libcuda. The defaults in
+// mock_apis.c only need these two from mock_cuda.c.
+//
+
+// Spend the host latency CUDA_MOCK_LATENCY gives one call of this API
+void mock_call(enum hook_api api);
+// Distinct non-zero value for a handle the mock does not keep state for
+uint64_t mock_handle(void);
+
+#endif // CUDA_HOOK_H
@@ -0,0 +1,120 @@
+/*
+ * func_table.c - Kernel handle to name map referenced by launch events
+ *
+ * Registration (cuModuleGetFunction, cuLibraryGetKernel, or the first launch
+ * of a handle nobody registered) takes the lock; func_table_lookup() in
+ * cuda_hook.h only reads. A handle registered again with another name, as
+ * happens when a module is unloaded and its memory reused, gets a new id so
+ * earlier launches keep their name.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+
+#include "cuda_hook.h"
+
+#define FUNC_INDEX_INITIAL 1024
+
+void func_table_init(struct func_table* tab) {
+    memset(tab, 0, sizeof(*tab));
+    pthread_mutex_init(&tab->lock, NULL);
+    tab->count = 1;             // Id 0 is an unknown handle
+}
+
+void func_table_free(struct func_table* tab) {
+    for (uint32_t c = 0; c < STRTAB_MAX_CHUNKS && tab->chunks[c]; c++) {
+        free(tab->chunks[c]);
+    }
+    struct func_index* index = tab->index;
+    while (index) {
+        struct func_index* retired = index->retired;
+        free(index);
+        index = retired;
+    }
+    pthread_mutex_destroy(&tab->lock);
+    memset(tab, 0, sizeof(*tab));
+}
+
+static void index_put(struct func_index* index, uint64_t handle, uint32_t id) {
+    uint32_t slot = func_hash(handle) & index->mask;
+    while (index->slots[slot].handle && index->slots[slot].handle != handle) {
+        slot = (slot + 1) & index->mask;
+    }
+    __atomic_store_n(&index->slots[slot].id, id, __ATOMIC_RELAXED);
+    __atomic_store_n(&index->slots[slot].handle, handle, __ATOMIC_RELEASE);
+}
+
+// Caller holds the lock. Readers may still be walking the old index, so it
+// is kept until the table is freed.
+static int index_grow(struct func_table* tab) {
+    struct func_index* old = tab->index;
+    uint32_t cap = old ? (old->mask + 1) * 2 : FUNC_INDEX_INITIAL;
+    struct func_index* index = calloc(1, sizeof(*index) + cap * sizeof(struct func_slot));
+    if (!index) {
+        return -1;
+    }
+    index->mask = cap - 1;
+    index->retired = old;
+    if (old) {
+        for (uint32_t i = 0; i <= old->mask; i++) {
+            if (old->slots[i].handle) {
+                index_put(index, old->slots[i].handle, old->slots[i].id);
+            }
+        }
+    }
+    __atomic_store_n(&tab->index, index, __ATOMIC_RELEASE);
+    return 0;
+}
+
+uint32_t func_table_register(struct func_table* tab, uint64_t handle, uint32_t name) {
+    if (!handle) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&tab->lock);
+
+    uint32_t id = func_table_lookup(tab, handle);
+    if (id && (name == 0 || func_table_get(tab, id)->name == name)) {
+        goto out;               // Already known; a nameless launch never renames
+    }
+
+    id = 0;
+    uint32_t count = tab->count;
+    if ((!tab->index || count * 2 > tab->index->mask + 1) && index_grow(tab) != 0) {
+        goto out;
+    }
+
+    uint32_t chunk = count >> STRTAB_CHUNK_SHIFT;
+    if (chunk >= STRTAB_MAX_CHUNKS) {
+        goto out;
+    }
+    if (!tab->chunks[chunk]) {
+        tab->chunks[chunk] = calloc(STRTAB_CHUNK_SIZE, sizeof(struct func_entry));
+        if (!tab->chunks[chunk]) {
+            goto out;
+        }
+    }
+
+    struct func_entry* entry = &tab->chunks[chunk][count & (STRTAB_CHUNK_SIZE - 1)];
+    entry->handle = handle;
+    entry->name = name;
+    __atomic_store_n(&tab->count, count + 1, __ATOMIC_RELEASE);
+    index_put(tab->index, handle, count);
+    id = count;
+
+out:
+    pthread_mutex_unlock(&tab->lock);
+    return id;
+}
+
+const struct func_entry* func_table_get(const struct func_table* tab, uint32_t id) {
+    if (id == 0 || id >= func_table_count(tab)) {
+        return NULL;
+    }
+    return &tab->chunks[id >> STRTAB_CHUNK_SHIFT][id & (STRTAB_CHUNK_SIZE - 1)];
+}
+
+uint32_t func_table_count(const struct func_table* tab) {
+    return __atomic_load_n(&tab->count, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,306 @@
+/*
+ * hook_aggregate.c - Per-API counters and latency histograms
+ *
+ * In aggregate mode every thread owns a shard of cumulative per-API stats
+ * (see aggregate_event() in cuda_hook.h). The drainer sums all shards once
+ * per window, subtracts the previous sum and writes the difference as one
+ * summary record, so nothing on the hot path is ever reset or locked.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cuda_hook.h"
+
+int hook_mode = HOOK_MODE_TRACE;
+__thread struct agg_shard* tls_shard __attribute__((tls_model("initial-exec"))) = NULL;
+
+// Shard registry, same scheme as the ring registry in trace_ring.c
+static struct agg_shard* shards = NULL;
+static pthread_mutex_t shard_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t shard_key;
+
+static FILE* summary_out = NULL;
+static enum trace_format summary_format = TRACE_FORMAT_JSON;
+static int64_t window_ns = 0;
+static int64_t window_start_ns = 0;
+static int64_t run_start_ns = 0;
+
+// Drainer-side sums, one entry per API: stats folded in from exited
+// threads, the sum at the last window boundary, and a scratch sum
+static struct agg_api_stats* retired = NULL;
+static struct agg_api_stats* previous = NULL;
+static struct agg_api_stats* current = NULL;
+static struct trace_summary_api* summary_apis = NULL;
+
+static void shard_thread_exit(void* arg) {
+    struct agg_shard* shard = arg;
+    tls_shard = NULL;
+    __atomic_store_n(&shard->dead, 1, __ATOMIC_RELEASE);
+}
+
+struct agg_shard* agg_shard_attach(void) {
+    if (!summary_out) {
+        return NULL;            // Aggregation not started
+    }
+    if (__builtin_expect(fork_restart_pending, 0)) {
+        fork_restart();
+    }
+
+    struct agg_shard* shard = calloc(1, sizeof(*shard));
+    if (!shard) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&shard_lock);
+    shard->next = shards;
+    __atomic_store_n(&shards, shard, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&shard_lock);
+
+    pthread_setspecific(shard_key, shard);
+    tls_shard = shard;
+    return shard;
+}
+
+struct agg_api_stats* agg_api_attach(struct agg_shard* shard, uint16_t api) {
+    struct agg_api_stats* stats = calloc(1, sizeof(*stats));
+    if (stats) {
+        __atomic_store_n(&shard->api[api], stats, __ATOMIC_RELEASE);
+    }
+    return stats;
+}
+
+static void stats_add(struct agg_api_stats* dst, const struct agg_api_stats* src) {
+    dst->count += __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+    dst->errors += __atomic_load_n(&src->errors, __ATOMIC_RELAXED);
+    dst->bytes += __atomic_load_n(&src->bytes, __ATOMIC_RELAXED);
+    dst->total += __atomic_load_n(&src->total, __ATOMIC_RELAXED);
+    dst->overhead += __atomic_load_n(&src->overhead, __ATOMIC_RELAXED);
+    for (unsigned b = 0; b < STATS_BUCKETS; b++) {
+        dst->hist[b] += __atomic_load_n(&src->hist[b], __ATOMIC_RELAXED);
+    }
+    for (unsigned c = 0; c < STATS_SIZE_CLASSES; c++) {
+        dst->sizes[c].count += __atomic_load_n(&src->sizes[c].count, __ATOMIC_RELAXED);
+        dst->sizes[c].bytes += __atomic_load_n(&src->sizes[c].bytes, __ATOMIC_RELAXED);
+        dst->sizes[c].total += __atomic_load_n(&src->sizes[c].total, __ATOMIC_RELAXED);
+    }
+}
+
+// Sum retired stats and every live shard into `current`; fold and free
+// shards whose thread has exited
+static void merge_shards(void) {
+    memcpy(current, retired, API_COUNT * sizeof(*current));
+
+    struct agg_shard* prev = NULL;
+    struct agg_shard* shard = __atomic_load_n(&shards, __ATOMIC_ACQUIRE);
+    while (shard) {
+        int dead = __atomic_load_n(&shard->dead, __ATOMIC_ACQUIRE);
+        struct agg_shard* next = shard->next;
+
+        for (uint16_t api = 0; api < API_COUNT; api++) {
+            struct agg_api_stats* stats = __atomic_load_n(&shard->api[api], __ATOMIC_ACQUIRE);
+            if (stats) {
+                stats_add(&current[api], stats);
+                if (dead) {
+                    stats_add(&retired[api], stats);
+                }
+            }
+        }
+
+        if (dead) {
+            pthread_mutex_lock(&shard_lock);
+            if (prev) {
+                prev->next = next;
+            } else if (shards == shard) {
+                shards = next;
+            } else {
+                struct agg_shard* p = shards;
+                while (p->next != shard) {
+                    p = p->next;
+                }
+                p->next = next;
+            }
+            pthread_mutex_unlock(&shard_lock);
+            for (uint16_t api = 0; api < API_COUNT; api++) {
+                free(shard->api[api]);
+            }
+            free(shard);
+        } else {
+            prev = shard;
+        }
+        shard = next;
+    }
+}
+
+static int64_t to_ns(uint64_t clock_units) {
+    return hook_clock_tsc ? clock_map_duration_ns(&hook_clock_map, (int64_t)clock_units)
+                          : (int64_t)clock_units;
+}
+
+// Write `to - from` as one summary; returns the number of APIs included
+static uint32_t write_summary(const struct agg_api_stats* to, const struct agg_api_stats* from,
+                              int64_t start_ns, int64_t end_ns, uint32_t flags) {
+    static uint64_t hist[STATS_BUCKETS];
+    uint32_t n = 0;
+
+    for (uint16_t api = 0; api < API_COUNT; api++) {
+        uint64_t count = to[api].count - (from ? from[api].count : 0);
+        if (count == 0) {
+            continue;
+        }
+
+        unsigned highest = 0;
+        for (unsigned b = 0; b < STATS_BUCKETS; b++) {
+            hist[b] = to[api].hist[b] - (from ? from[api].hist[b] : 0);
+            if (hist[b]) {
+                highest = b;
+            }
+        }
+
+        struct trace_summary_api* a = &summary_apis[n++];
+        memset(a, 0, sizeof(*a));
+        a->api = api;
+        a->count = count;
+        a->errors = to[api].errors - (from ? from[api].errors : 0);
+        a->bytes = to[api].bytes - (from ? from[api].bytes : 0);
+        a->total_ns = to_ns(to[api].total - (from ? from[api].total : 0));
+        a->p50_ns = to_ns(stats_percentile(hist, count, 0.50));
+        a->p99_ns = to_ns(stats_percentile(hist, count, 0.99));
+        a->p999_ns = to_ns(stats_percentile(hist, count, 0.999));
+        a->max_ns = to_ns(stats_bucket_value(highest, 1));
+        for (unsigned c = 0; c < STATS_SIZE_CLASSES; c++) {
+            a->sizes[c].count = to[api].sizes[c].count - (from ? from[api].sizes[c].count : 0);
+            a->sizes[c].bytes = to[api].sizes[c].bytes - (from ? from[api].sizes[c].bytes : 0);
+            a->sizes[c].total_ns = to_ns(to[api].sizes[c].total - (from ? from[api].sizes[c].total : 0));
+        }
+    }
+
+    if (n == 0) {
+        return 0;
+    }
+
+    struct trace_summary summary = { start_ns, end_ns, n, flags };
+    if (summary_format == TRACE_FORMAT_BINARY) {
+        trace_write_binary_summary(summary_out, &summary, summary_apis);
+    } else if (summary_format == TRACE_FORMAT_JSON) {
+        trace_write_summary_json(summary_out, &summary, summary_apis);
+    }
+    fflush(summary_out);
+    return n;
+}
+
+int aggregate_start(FILE* out, enum trace_format format, long window_ms) {
+    retired = calloc(API_COUNT, sizeof(*retired));
+    previous = calloc(API_COUNT, sizeof(*previous));
+    current = calloc(API_COUNT, sizeof(*current));
+    summary_apis = calloc(API_COUNT, sizeof(*summary_apis));
+    if (!retired || !previous || !current || !summary_apis) {
+        return -1;
+    }
+    if (pthread_key_create(&shard_key, shard_thread_exit) != 0) {
+        return -1;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    run_start_ns = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    window_start_ns = run_start_ns;
+    window_ns = (int64_t)window_ms * 1000000;
+    summary_format = format;
+    __atomic_store_n(&summary_out, out, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// A forked child counts its own calls from zero; the shards of the parent's
+// threads, the forking one included, are dropped
+void aggregate_atfork(enum fork_phase phase) {
+    if (!summary_out) {
+        return;
+    }
+    if (phase == FORK_PREPARE) {
+        pthread_mutex_lock(&shard_lock);
+        return;
+    }
+    pthread_mutex_unlock(&shard_lock);
+    if (phase == FORK_PARENT) {
+        return;
+    }
+
+    struct agg_shard* shard = shards;
+    while (shard) {
+        struct agg_shard* next = shard->next;
+        for (uint16_t api = 0; api < API_COUNT; api++) {
+            free(shard->api[api]);
+        }
+        free(shard);
+        shard = next;
+    }
+    shards = NULL;
+    tls_shard = NULL;
+    pthread_setspecific(shard_key, NULL);
+
+    memset(retired, 0, API_COUNT * sizeof(*retired));
+    memset(previous, 0, API_COUNT * sizeof(*previous));
+    memset(current, 0, API_COUNT * sizeof(*current));
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    run_start_ns = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    window_start_ns = run_start_ns;
+}
+
+// Drainer thread: cumulative recording overhead per API, in ns
+void aggregate_overhead_ns(uint64_t* per_api) {
+    for (uint16_t api = 0; api < API_COUNT; api++) {
+        per_api[api] = retired ? retired[api].overhead : 0;
+    }
+    for (struct agg_shard* shard = __atomic_load_n(&shards, __ATOMIC_ACQUIRE); shard;
+         shard = shard->next) {
+        for (uint16_t api = 0; api < API_COUNT; api++) {
+            struct agg_api_stats* stats = __atomic_load_n(&shard->api[api], __ATOMIC_ACQUIRE);
+            if (stats) {
+                per_api[api] += __atomic_load_n(&stats->overhead, __ATOMIC_RELAXED);
+            }
+        }
+    }
+    for (uint16_t api = 0; api < API_COUNT; api++) {
+        per_api[api] = (uint64_t)to_ns(per_api[api]);
+    }
+}
+
+static void close_window(int64_t now_ns) {
+    merge_shards();
+    write_summary(current, previous, window_start_ns, now_ns, 0);
+
+    struct agg_api_stats* swap = previous;
+    previous = current;
+    current = swap;
+    window_start_ns = now_ns;
+}
+
+// Drainer thread: close the window once it has run its length
+void aggregate_poll(int64_t now_ns) {
+    if (summary_out && now_ns - window_start_ns >= window_ns) {
+        close_window(now_ns);
+    }
+}
+
+// Drainer thread: close the window early, so that windows line up with
+// runtime mode switches
+void aggregate_flush(int64_t now_ns) {
+    if (summary_out) {
+        close_window(now_ns);
+    }
+}
+
+// Final partial window plus whole-run totals; the drainer has stopped
+void aggregate_finish(int64_t now_ns) {
+    if (!summary_out) {
+        return;
+    }
+
+    merge_shards();
+    write_summary(current, previous, window_start_ns, now_ns, 0);
+    write_summary(current, NULL, run_start_ns, now_ns, TRACE_SUMMARY_TOTAL);
+}
@@ -0,0 +1,394 @@
+/*
+ * hook_alloc.c - Live device allocation tracking
+ *
+ * With CUDA_HOOK_ALLOCS=1 the allocation hooks keep every live device
+ * allocation in a map sharded by address, along with current and peak bytes
+ * and a size-class histogram of live blocks per context. The drainer writes
+ * one allocation report per window; cleanup_tracing() prints what was never
+ * freed.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cuda_hook.h"
+
+#define ALLOC_SHARD_BITS   6
+#define ALLOC_SHARDS       (1u << ALLOC_SHARD_BITS)
+#define ALLOC_SHARD_INITIAL 256
+// Contexts past this many share the last slot
+#define ALLOC_MAX_CONTEXTS 64
+// Unfreed allocations listed individually in the leak report
+#define ALLOC_LEAK_LINES   20
+
+struct alloc_entry {
+    uint64_t ptr;               // 0 = empty slot
+    uint64_t size;
+    uint64_t op_id;
+    int64_t  ts;                // Clock units
+    uint32_t context;           // Index into contexts[]
+};
+
+struct alloc_shard {
+    pthread_mutex_t lock;
+    struct alloc_entry* slots;
+    uint32_t mask;
+    uint32_t count;
+} __attribute__((aligned(64)));
+
+struct alloc_context {
+    uint64_t ctx;
+    uint64_t live_count;
+    uint64_t live_bytes;
+    uint64_t peak_bytes;
+    uint64_t allocs;
+    uint64_t frees;
+    struct {
+        uint64_t count;
+        uint64_t bytes;
+    } sizes[STATS_SIZE_CLASSES];
+} __attribute__((aligned(64)));
+
+typedef CUresult (*ctx_get_current_fn)(CUcontext*);
+
+int hook_alloc_tracking = 0;
+
+static struct alloc_shard shards[ALLOC_SHARDS];
+static struct alloc_context contexts[ALLOC_MAX_CONTEXTS];
+static uint32_t context_count = 0;
+static pthread_mutex_t context_lock = PTHREAD_MUTEX_INITIALIZER;
+static ctx_get_current_fn ctx_get_current = NULL;
+static pthread_once_t resolve_once = PTHREAD_ONCE_INIT;
+
+static FILE* report_out = NULL;
+static enum trace_format report_format = TRACE_FORMAT_JSON;
+static int64_t window_ns = 0;
+static int64_t last_report_ns = 0;
+static int64_t start_ns = 0;
+
+static void resolve_ctx_get_current(void) {
+    ctx_get_current = (ctx_get_current_fn)hook_driver_symbol("cuCtxGetCurrent");
+}
+
+// Slot of the calling thread's current context
+static uint32_t current_context(void) {
+    pthread_once(&resolve_once, resolve_ctx_get_current);
+    CUcontext ctx = NULL;
+    if (ctx_get_current && ctx_get_current(&ctx) != CUDA_SUCCESS) {
+        ctx = NULL;
+    }
+
+    uint64_t key = (uintptr_t)ctx;
+    uint32_t n = __atomic_load_n(&context_count, __ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < n; i++) {
+        if (contexts[i].ctx == key) {
+            return i;
+        }
+    }
+
+    // Claim a slot; another thread may have added this context meanwhile
+    pthread_mutex_lock(&context_lock);
+    n = context_count;
+    uint32_t i = 0;
+    while (i < n && contexts[i].ctx != key) {
+        i++;
+    }
+    if (i == n) {
+        if (n < ALLOC_MAX_CONTEXTS) {
+            contexts[n].ctx = key;
+            __atomic_store_n(&context_count, n + 1, __ATOMIC_RELEASE);
+        } else {
+            i = ALLOC_MAX_CONTEXTS - 1;
+        }
+    }
+    pthread_mutex_unlock(&context_lock);
+    return i;
+}
+
+static void context_add(uint32_t c, uint64_t size) {
+    struct alloc_context* ctx = &contexts[c];
+    unsigned cls = stats_size_class(size);
+
+    __atomic_fetch_add(&ctx->allocs, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&ctx->live_count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&ctx->sizes[cls].count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&ctx->sizes[cls].bytes, size, __ATOMIC_RELAXED);
+
+    uint64_t live = __atomic_add_fetch(&ctx->live_bytes, size, __ATOMIC_RELAXED);
+    uint64_t peak = __atomic_load_n(&ctx->peak_bytes, __ATOMIC_RELAXED);
+    while (live > peak && !__atomic_compare_exchange_n(&ctx->peak_bytes, &peak, live, 1,
+                                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static void context_remove(uint32_t c, uint64_t size) {
+    struct alloc_context* ctx = &contexts[c];
+    unsigned cls = stats_size_class(size);
+
+    __atomic_fetch_add(&ctx->frees, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&ctx->live_count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&ctx->live_bytes, size, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&ctx->sizes[cls].count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&ctx->sizes[cls].bytes, size, __ATOMIC_RELAXED);
+}
+
+static struct alloc_shard* shard_of(uint64_t ptr, uint32_t* hash) {
+    *hash = func_hash(ptr);
+    return &shards[*hash & (ALLOC_SHARDS - 1)];
+}
+
+static uint32_t home_slot(const struct alloc_shard* shard, uint32_t hash) {
+    return (hash >> ALLOC_SHARD_BITS) & shard->mask;
+}
+
+// Caller holds the shard lock
+static int shard_grow(struct alloc_shard* shard) {
+    uint32_t cap = shard->slots ? (shard->mask + 1) * 2 : ALLOC_SHARD_INITIAL;
+    struct alloc_entry* slots = calloc(cap, sizeof(*slots));
+    if (!slots) {
+        return -1;
+    }
+
+    struct alloc_entry* old = shard->slots;
+    uint32_t old_cap = old ? shard->mask + 1 : 0;
+    shard->slots = slots;
+    shard->mask = cap - 1;
+    for (uint32_t i = 0; i < old_cap; i++) {
+        if (old[i].ptr) {
+            uint32_t slot = home_slot(shard, func_hash(old[i].ptr));
+            while (slots[slot].ptr) {
+                slot = (slot + 1) & shard->mask;
+            }
+            slots[slot] = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+void alloc_track(uint64_t ptr, uint64_t size, uint64_t op_id, int64_t ts) {
+    uint32_t c = current_context();
+    uint32_t hash;
+    struct alloc_shard* shard = shard_of(ptr, &hash);
+
+    pthread_mutex_lock(&shard->lock);
+    if ((!shard->slots || (shard->count + 1) * 2 > shard->mask + 1) && shard_grow(shard) != 0) {
+        pthread_mutex_unlock(&shard->lock);
+        return;
+    }
+
+    uint32_t slot = home_slot(shard, hash);
+    while (shard->slots[slot].ptr && shard->slots[slot].ptr != ptr) {
+        slot = (slot + 1) & shard->mask;
+    }
+    struct alloc_entry* entry = &shard->slots[slot];
+    if (entry->ptr) {
+        // Address reused without a free we saw (e.g. freed by an API we do
+        // not hook); the old block is gone
+        context_remove(entry->context, entry->size);
+    } else {
+        shard->count++;
+    }
+    entry->ptr = ptr;
+    entry->size = size;
+    entry->op_id = op_id;
+    entry->ts = ts;
+    entry->context = c;
+    context_add(c, size);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void alloc_untrack(uint64_t ptr) {
+    uint32_t hash;
+    struct alloc_shard* shard = shard_of(ptr, &hash);
+
+    pthread_mutex_lock(&shard->lock);
+    if (!shard->slots) {
+        pthread_mutex_unlock(&shard->lock);
+        return;
+    }
+
+    uint32_t slot = home_slot(shard, hash);
+    while (shard->slots[slot].ptr && shard->slots[slot].ptr != ptr) {
+        slot = (slot + 1) & shard->mask;
+    }
+    if (!shard->slots[slot].ptr) {
+        pthread_mutex_unlock(&shard->lock);
+        return;                 // Allocated before tracking started
+    }
+    context_remove(shard->slots[slot].context, shard->slots[slot].size);
+    shard->count--;
+
+    // Backward-shift deletion keeps probe chains intact without tombstones
+    uint32_t hole = slot;
+    for (uint32_t next = (hole + 1) & shard->mask; shard->slots[next].ptr;
+         next = (next + 1) & shard->mask) {
+        uint32_t home = home_slot(shard, func_hash(shard->slots[next].ptr));
+        if (((next - home) & shard->mask) >= ((next - hole) & shard->mask)) {
+            shard->slots[hole] = shard->slots[next];
+            hole = next;
+        }
+    }
+    shard->slots[hole].ptr = 0;
+    pthread_mutex_unlock(&shard->lock);
+}
+
+int alloc_tracking_start(FILE* out, enum trace_format format, long window_ms) {
+    for (uint32_t i = 0; i < ALLOC_SHARDS; i++) {
+        pthread_mutex_init(&shards[i].lock, NULL);
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    start_ns = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    last_report_ns = start_ns;
+    window_ns = (int64_t)window_ms * 1000000;
+    report_format = format;
+    report_out = out;
+    __atomic_store_n(&hook_alloc_tracking, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Device memory does not carry over into a forked child, so the child
+// starts with no live blocks and no contexts
+void alloc_atfork(enum fork_phase phase) {
+    if (!__atomic_load_n(&hook_alloc_tracking, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    if (phase == FORK_PREPARE) {
+        pthread_mutex_lock(&context_lock);
+        for (uint32_t i = 0; i < ALLOC_SHARDS; i++) {
+            pthread_mutex_lock(&shards[i].lock);
+        }
+        return;
+    }
+    for (uint32_t i = ALLOC_SHARDS; i-- > 0;) {
+        struct alloc_shard* shard = &shards[i];
+        if (phase == FORK_CHILD && shard->slots) {
+            memset(shard->slots, 0, (shard->mask + 1) * sizeof(*shard->slots));
+            shard->count = 0;
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+    if (phase == FORK_CHILD) {
+        memset(contexts, 0, sizeof(contexts));
+        context_count = 0;
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        start_ns = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+        last_report_ns = start_ns;
+    }
+    pthread_mutex_unlock(&context_lock);
+}
+
+static void write_report(int64_t now_ns, uint32_t flags) {
+    static struct trace_alloc_context entries[ALLOC_MAX_CONTEXTS];
+    uint32_t n = __atomic_load_n(&context_count, __ATOMIC_ACQUIRE);
+    if (n == 0) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        const struct alloc_context* ctx = &contexts[i];
+        struct trace_alloc_context* e = &entries[i];
+        e->ctx = ctx->ctx;
+        e->live_count = __atomic_load_n(&ctx->live_count, __ATOMIC_RELAXED);
+        e->live_bytes = __atomic_load_n(&ctx->live_bytes, __ATOMIC_RELAXED);
+        e->peak_bytes = __atomic_load_n(&ctx->peak_bytes, __ATOMIC_RELAXED);
+        e->allocs = __atomic_load_n(&ctx->allocs, __ATOMIC_RELAXED);
+        e->frees = __atomic_load_n(&ctx->frees, __ATOMIC_RELAXED);
+        for (unsigned c = 0; c < STATS_SIZE_CLASSES; c++) {
+            e->sizes[c].count = __atomic_load_n(&ctx->sizes[c].count, __ATOMIC_RELAXED);
+            e->sizes[c].bytes = __atomic_load_n(&ctx->sizes[c].bytes, __ATOMIC_RELAXED);
+        }
+    }
+
+    struct trace_alloc_report report = { now_ns, n, flags };
+    if (report_format == TRACE_FORMAT_BINARY) {
+        trace_write_binary_allocs(report_out, &report, entries);
+    } else if (report_format == TRACE_FORMAT_JSON) {
+        trace_write_allocs_json(report_out, &report, entries);
+    }
+    fflush(report_out);
+}
+
+// Drainer thread: one report per window
+void alloc_poll(int64_t now_ns) {
+    if (!report_out || now_ns - last_report_ns < window_ns) {
+        return;
+    }
+    write_report(now_ns, 0);
+    last_report_ns = now_ns;
+}
+
+// Last report, after the drainer has stopped
+void alloc_finish(int64_t now_ns) {
+    if (!report_out) {
+        return;
+    }
+    write_report(now_ns, TRACE_ALLOC_FINAL);
+}
+
+// Unfreed allocations, largest first, and each context's peak
+void alloc_leak_report(FILE* to) {
+    if (!__atomic_load_n(&hook_alloc_tracking, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    // Keep the ALLOC_LEAK_LINES largest; count the rest
+    struct alloc_entry top[ALLOC_LEAK_LINES];
+    uint32_t kept = 0;
+    uint64_t leaked = 0;
+    uint64_t leaked_bytes = 0;
+
+    for (uint32_t s = 0; s < ALLOC_SHARDS; s++) {
+        struct alloc_shard* shard = &shards[s];
+        pthread_mutex_lock(&shard->lock);
+        for (uint32_t i = 0; shard->slots && i <= shard->mask; i++) {
+            if (!shard->slots[i].ptr) {
+                continue;
+            }
+            leaked++;
+            leaked_bytes += shard->slots[i].size;
+            // Insertion into the sorted top list
+            uint32_t pos = kept < ALLOC_LEAK_LINES ? kept++ : ALLOC_LEAK_LINES;
+            while (pos > 0 && top[pos - 1].size < shard->slots[i].size) {
+                if (pos < ALLOC_LEAK_LINES) {
+                    top[pos] = top[pos - 1];
+                }
+                pos--;
+            }
+            if (pos < ALLOC_LEAK_LINES) {
+                top[pos] = shard->slots[i];
+            }
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    uint32_t n = __atomic_load_n(&context_count, __ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < n; i++) {
+        fprintf(to, "[CUDA_HOOK] Context 0x%llx: %llu allocations, peak %.1f MiB, "
+                "%llu live (%.1f MiB)\n",
+                (unsigned long long)contexts[i].ctx, (unsigned long long)contexts[i].allocs,
+                contexts[i].peak_bytes / 1048576.0, (unsigned long long)contexts[i].live_count,
+                contexts[i].live_bytes / 1048576.0);
+    }
+
+    if (leaked == 0) {
+        return;
+    }
+    fprintf(to, "[CUDA_HOOK] %llu allocations never freed (%.1f MiB):\n",
+            (unsigned long long)leaked, leaked_bytes / 1048576.0);
+    for (uint32_t i = 0; i < kept; i++) {
+        fprintf(to, "[CUDA_HOOK]   0x%llx %llu bytes, ctx 0x%llx, op_id %llu, +%.3f s\n",
+                (unsigned long long)top[i].ptr, (unsigned long long)top[i].size,
+                (unsigned long long)contexts[top[i].context].ctx,
+                (unsigned long long)top[i].op_id,
+                (hook_clock_to_ns(top[i].ts) - start_ns) / 1e9);
+    }
+    if (leaked > kept) {
+        fprintf(to, "[CUDA_HOOK]   ... and %llu smaller\n", (unsigned long long)(leaked - kept));
+    }
+}
@@ -0,0 +1,129 @@
+/*
+ * hook_apis.h - List of CUDA Driver API calls intercepted by cuda_hook.c
+ *
+ * X-macro list: define HOOK_API(name, category, versioned, ret, params, args)
+ * before including this file. `versioned` is v2 when the driver exports the
+ * current ABI under name_v2 (e.g. cuMemAlloc_v2, which takes 64-bit sizes)
+ * and none when the plain name is current; HOOK_SYMBOL_##versioned(name) is
+ * the symbol cuda.h maps the name to. The plain symbol of a v2 API keeps the
+ * older ABI, so the two are resolved, exported and called separately. The
+ * position in the list is the API id stored in every trace record, so new
+ * entries must be appended to keep older traces decodable.
+ *
+ * Entries here have handwritten hooks in cuda_hook.c; APIs that only need
+ * their arguments recorded go in hook_apis_gen.h instead.
+ */
+
+#ifndef HOOK_SYMBOL_none
+// The symbol of the current ABI, which callers built against cuda.h link to
+#define HOOK_SYMBOL_none(name) #name
+#define HOOK_SYMBOL_v2(name)   #name "_v2"
+#endif
+
+// Memory Management
+HOOK_API(cuMemAlloc, "memory", v2, CUresult,
+         (CUdeviceptr *dptr, size_t bytesize), (dptr, bytesize))
+HOOK_API(cuMemFree, "memory", v2, CUresult,
+         (CUdeviceptr dptr), (dptr))
+HOOK_API(cuMemcpyHtoD, "transfer", v2, CUresult,
+         (CUdeviceptr dstDevice, const void *srcHost, size_t ByteCount),
+         (dstDevice, srcHost, ByteCount))
+HOOK_API(cuMemcpyDtoH, "transfer", v2, CUresult,
+         (void *dstHost, CUdeviceptr srcDevice, size_t ByteCount),
+         (dstHost, srcDevice, ByteCount))
+HOOK_API(cuMemcpyDtoD, "transfer", v2, CUresult,
+         (CUdeviceptr dstDevice, CUdeviceptr srcDevice, size_t ByteCount),
+         (dstDevice, srcDevice, ByteCount))
+
+// Context Management
+HOOK_API(cuCtxCreate, "context", v2, CUresult,
+         (CUcontext *pctx, unsigned int flags, CUdevice dev), (pctx, flags, dev))
+HOOK_API(cuCtxDestroy, "context", v2, CUresult,
+         (CUcontext ctx), (ctx))
+HOOK_API(cuCtxSetCurrent, "context", none, CUresult,
+         (CUcontext ctx), (ctx))
+HOOK_API(cuCtxSynchronize, "sync", none, CUresult,
+         (void), ())
+
+// Stream Management
+HOOK_API(cuStreamCreate, "stream", none, CUresult,
+         (CUstream *phStream, unsigned int Flags), (phStream, Flags))
+HOOK_API(cuStreamDestroy, "stream", v2, CUresult,
+         (CUstream hStream), (hStream))
+HOOK_API(cuStreamSynchronize, "sync", none, CUresult,
+         (CUstream hStream), (hStream))
+
+// Kernel Execution
+HOOK_API(cuLaunchKernel, "kernel", none, CUresult,
+         (CUfunction f, unsigned int gridDimX, unsigned int gridDimY, unsigned int gridDimZ,
+          unsigned int blockDimX, unsigned int blockDimY, unsigned int blockDimZ,
+          unsigned int sharedMemBytes, CUstream hStream, void **kernelParams, void **extra),
+         (f, gridDimX, gridDimY, gridDimZ, blockDimX, blockDimY, blockDimZ,
+          sharedMemBytes, hStream, kernelParams, extra))
+HOOK_API(cuModuleLoad, "module", none, CUresult,
+         (CUmodule *module, const char *fname), (module, fname))
+HOOK_API(cuModuleUnload, "module", none, CUresult,
+         (CUmodule hmod), (hmod))
+HOOK_API(cuModuleGetFunction, "module", none, CUresult,
+         (CUfunction *hfunc, CUmodule hmod, const char *name), (hfunc, hmod, name))
+
+// Device Management
+HOOK_API(cuInit, "init", none, CUresult,
+         (unsigned int Flags), (Flags))
+HOOK_API(cuDeviceGet, "device", none, CUresult,
+         (CUdevice *device, int ordinal), (device, ordinal))
+
+// Library Management (CUDA 12 context-independent loading)
+HOOK_API(cuLibraryGetKernel, "module", none, CUresult,
+         (CUkernel *pKernel, CUlibrary library, const char *name), (pKernel, library, name))
+
+// Unified-address and asynchronous copies
+HOOK_API(cuMemcpy, "transfer", none, CUresult,
+         (CUdeviceptr dst, CUdeviceptr src, size_t ByteCount), (dst, src, ByteCount))
+HOOK_API(cuMemcpyAsync, "transfer", none, CUresult,
+         (CUdeviceptr dst, CUdeviceptr src, size_t ByteCount, CUstream hStream),
+         (dst, src, ByteCount, hStream))
+HOOK_API(cuMemcpyHtoDAsync, "transfer", v2, CUresult,
+         (CUdeviceptr dstDevice, const void *srcHost, size_t ByteCount, CUstream hStream),
+         (dstDevice, srcHost, ByteCount, hStream))
+HOOK_API(cuMemcpyDtoHAsync, "transfer", v2, CUresult,
+         (void *dstHost, CUdeviceptr srcDevice, size_t ByteCount, CUstream hStream),
+         (dstHost, srcDevice, ByteCount, hStream))
+HOOK_API(cuMemcpyDtoDAsync, "transfer", v2, CUresult,
+         (CUdeviceptr dstDevice, CUdeviceptr srcDevice, size_t ByteCount, CUstream hStream),
+         (dstDevice, srcDevice, ByteCount, hStream))
+
+// Stream-ordered and page-locked host allocations
+HOOK_API(cuMemAllocAsync, "memory", none, CUresult,
+         (CUdeviceptr *dptr, size_t bytesize, CUstream hStream), (dptr, bytesize, hStream))
+HOOK_API(cuMemFreeAsync, "memory", none, CUresult,
+         (CUdeviceptr dptr, CUstream hStream), (dptr, hStream))
+HOOK_API(cuMemAllocHost, "memory", v2, CUresult,
+         (void **pp, size_t bytesize), (pp, bytesize))
+HOOK_API(cuMemHostAlloc, "memory", none, CUresult,
+         (void **pp, size_t bytesize, unsigned int Flags), (pp, bytesize, Flags))
+HOOK_API(cuMemFreeHost, "memory", none, CUresult,
+         (void *p), (p))
+HOOK_API(cuMemHostRegister, "memory", v2, CUresult,
+         (void *p, size_t bytesize, unsigned int Flags), (p, bytesize, Flags))
+HOOK_API(cuMemHostUnregister, "memory", none, CUresult,
+         (void *p), (p))
+
+// Cross-stream ordering: the edges of the stream dependency graph
+HOOK_API(cuEventRecord, "event", none, CUresult,
+         (CUevent hEvent, CUstream hStream), (hEvent, hStream))
+HOOK_API(cuEventRecordWithFlags, "event", none, CUresult,
+         (CUevent hEvent, CUstream hStream, unsigned int flags), (hEvent, hStream, flags))
+HOOK_API(cuStreamWaitEvent, "stream", none, CUresult,
+         (CUstream hStream, CUevent hEvent, unsigned int Flags), (hStream, hEvent, Flags))
+
+// Hooks generated from a signature list; here they read as plain entries
+// unless the includer defines HOOK_GEN itself
+#ifdef HOOK_GEN
+#include "hook_apis_gen.h"
+#else
+#define HOOK_GEN(name, category, version, params, args, c0, c1, c2, c3) \
+    HOOK_API(name, category, version, CUresult, params, args)
+#include "hook_apis_gen.h"
+#undef HOOK_GEN
+#endif
@@ -0,0 +1,513 @@
+/*
+ * hook_apis_gen.h - Driver APIs whose hooks are generated from this list
+ *
+ * X-macro list, included at the end of hook_apis.h:
+ *
+ *   HOOK_GEN(name, category, version, params, args, c0, c1, c2, c3)
+ *
+ * Every entry gets an API id, a hook_real slot and an exported hook, exactly
+ * like a HOOK_API entry; the hook itself is generated in cuda_hook.c. All
+ * entries return CUresult. `version` is v2 when cuda.h maps the name to
+ * name_v2, none otherwise, as in hook_apis.h.
+ *
+ * c0..c3 name up to four arguments to record, by kind, or CAP_NONE:
+ *   CAP_SIZE(x)     byte count or length
+ *   CAP_INT(x)      enum, ordinal or plain integer
+ *   CAP_FLAGS(x)    flag word
+ *   CAP_HANDLE(x)   driver handle or device address
+ *   CAP_PTR(x)      host pointer
+ *   CAP_STRING(x)   C string, interned in the trace string table
+ *   CAP_OUT_HANDLE(p), CAP_OUT_INT(p), CAP_OUT_SIZE(p)
+ *                   value stored through an output pointer by the call
+ * Each kind expands to its own capture expression, so a generated hook does
+ * the same work as a handwritten one.
+ * At most four arguments fit a record (HOOK_GEN_ARGS); the JSON output of
+ * a call whose API has more parameters than captures carries
+ * "args_not_recorded" with the number left out.
+ *
+ * HOOK_GEN_CUSTOM entries are described the same way, but their hooks are
+ * written by hand in cuda_hook.c, for work around the driver call; they
+ * read as HOOK_GEN unless the includer defines HOOK_GEN_CUSTOM itself.
+ *
+ * Whole categories are compiled out with -DHOOK_ENABLE_<CATEGORY>=0 (see
+ * HOOK_DISABLE in the Makefile); their calls then go straight to the driver.
+ * Disabling a category changes the ids of the entries after it, which binary
+ * traces tolerate since they carry their own API table.
+ *
+ * Coverage: the list is written by hand, not generated from cuda.h, and
+ * holds the 110 entry points that runtime-based frameworks commonly reach
+ * (144 hooked APIs with hook_apis.h), not the whole driver API of roughly
+ * 500. Each category covers:
+ *   device     version, count, name, memory, attributes, PCI ids, peer
+ *              access, default and current memory pools
+ *   context    primary context lifetime, flags and state; push/pop and
+ *              queries; limits, cache config, peer access
+ *   module     module data and fatbin loads, globals; library loads and
+ *              unload, cuKernelGetFunction; the JIT linker
+ *   kernel     function attributes and cache config; cooperative, Ex and
+ *              host function launches; occupancy
+ *   memory     info, pitch and managed allocations, address range, host
+ *              flags and mappings, prefetch and advice, pointer
+ *              attributes, 1D memsets; VMM reserve/create/map/access;
+ *              pool create/trim/attributes and cuMemAllocFromPoolAsync
+ *   transfer   2D, 3D and peer copies
+ *   stream     priority streams, query, callbacks, a stream's priority,
+ *              flags and context, capture begin/end/status,
+ *              cuStreamAttachMemAsync
+ *   event      create, query, synchronize, destroy, elapsed time
+ *   graph      create, destroy, nodes, instantiate, upload, launch
+ * Left out, so called straight to the driver and not traced: graph node
+ * construction and exec updates; arrays, mipmapped arrays, texture and
+ * surface objects and references; copies to or from arrays, 2D memsets;
+ * stream memory operations (wait/write value, batch ops) and stream
+ * attributes; IPC, external memory and semaphores, shareable handles and
+ * multicast; graphics interop (GL, EGL, VDPAU, cuGraphics*); the
+ * pre-cuLaunchKernel launch API (cuLaunch, cuParamSet*); tensor maps,
+ * green contexts, user objects, library and kernel getters other than
+ * cuLibraryGetKernel and cuKernelGetFunction, profiler control and error
+ * strings. Any of them is one appended entry away.
+ */
+
+#ifndef HOOK_GEN_CUSTOM
+#define HOOK_GEN_CUSTOM HOOK_GEN
+#define HOOK_GEN_CUSTOM_DEFAULT
+#endif
+
+#ifndef HOOK_ENABLE_DEVICE
+#define HOOK_ENABLE_DEVICE 1
+#endif
+#ifndef HOOK_ENABLE_CONTEXT
+#define HOOK_ENABLE_CONTEXT 1
+#endif
+#ifndef HOOK_ENABLE_MODULE
+#define HOOK_ENABLE_MODULE 1
+#endif
+#ifndef HOOK_ENABLE_KERNEL
+#define HOOK_ENABLE_KERNEL 1
+#endif
+#ifndef HOOK_ENABLE_MEMORY
+#define HOOK_ENABLE_MEMORY 1
+#endif
+#ifndef HOOK_ENABLE_TRANSFER
+#define HOOK_ENABLE_TRANSFER 1
+#endif
+#ifndef HOOK_ENABLE_STREAM
+#define HOOK_ENABLE_STREAM 1
+#endif
+#ifndef HOOK_ENABLE_EVENT
+#define HOOK_ENABLE_EVENT 1
+#endif
+#ifndef HOOK_ENABLE_GRAPH
+#define HOOK_ENABLE_GRAPH 1
+#endif
+
+#if HOOK_ENABLE_DEVICE
+HOOK_GEN(cuDriverGetVersion, "device", none,
+         (int *driverVersion), (driverVersion),
+         CAP_OUT_INT(driverVersion), CAP_NONE, CAP_NONE, CAP_NONE)
+HOOK_GEN(cuDeviceGetCount, "device", none,
+         (int *count), (count),
+         CAP_OUT_INT(count), CAP_NONE, CAP_NONE, CAP_NONE)
+HOOK_GEN(cuDeviceGetName, "device", none,
+         (char *name, int len, CUdevice dev), (name, len, dev),
+         CAP_INT(dev), CAP_INT(len), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuDeviceTotalMem, "device", v2,
+         (size_t *bytes, CUdevice dev), (bytes, dev),
+         CAP_INT(dev), CAP_OUT_SIZE(bytes), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuDeviceGetAttribute, "device", none,
+         (int *pi, int attrib, CUdevice dev), (pi, attrib, dev),
+         CAP_INT(dev), CAP_INT(attrib), CAP_OUT_INT(pi), CAP_NONE)
+HOOK_GEN(cuDeviceGetPCIBusId, "device", none,
+         (char *pciBusId, int len, CUdevice dev), (pciBusId, len, dev),
+         CAP_INT(dev), CAP_NONE, CAP_NONE, CAP_NONE)
+HOOK_GEN(cuDeviceGetByPCIBusId, "device", none,
+         (CUdevice *dev, const char *pciBusId), (dev, pciBusId),
+         CAP_STRING(pciBusId), CAP_OUT_INT(dev), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuDeviceCanAccessPeer, "device", none,
+         (int *canAccessPeer, CUdevice dev, CUdevice peerDev), (canAccessPeer, dev, peerDev),
+         CAP_INT(dev), CAP_INT(peerDev), CAP_OUT_INT(canAccessPeer), CAP_NONE)
+HOOK_GEN(cuDeviceGetP2PAttribute, "device", none,
+         (int *value, int attrib, CUdevice srcDevice, CUdevice dstDevice),
+         (value, attrib, srcDevice, dstDevice),
+         CAP_INT(attrib), CAP_INT(srcDevice), CAP_INT(dstDevice), CAP_OUT_INT(value))
+HOOK_GEN(cuDeviceGetDefaultMemPool, "device", none,
+         (CUmemoryPool *pool_out, CUdevice dev), (pool_out, dev),
+         CAP_INT(dev), CAP_OUT_HANDLE(pool_out), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuDeviceGetMemPool, "device", none,
+         (CUmemoryPool *pool, CUdevice dev), (pool, dev),
+         CAP_INT(dev), CAP_OUT_HANDLE(pool), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuDeviceSetMemPool, "device", none,
+         (CUdevice dev, CUmemoryPool pool), (dev, pool),
+         CAP_INT(dev), CAP_HANDLE(pool), CAP_NONE, CAP_NONE)
+#endif
+
+#if HOOK_ENABLE_CONTEXT
+HOOK_GEN(cuDevicePrimaryCtxRetain, "context", none,
+         (CUcontext *pctx, CUdevice dev), (pctx, dev),
+         CAP_INT(dev), CAP_OUT_HANDLE(pctx), CAP_NONE, CAP_NONE)
+HOOK_GEN_CUSTOM(cuDevicePrimaryCtxRelease, "context", v2,
+                (CUdevice dev), (dev),
+                CAP_INT(dev), CAP_NONE, CAP_NONE, CAP_NONE)
+HOOK_GEN_CUSTOM(cuDevicePrimaryCtxReset, "context", v2,
+                (CUdevice dev), (dev),
+                CAP_INT(dev), CAP_NONE, CAP_NONE, CAP_NONE)
+HOOK_GEN(cuDevicePrimaryCtxSetFlags, "context", v2,
+         (CUdevice dev, unsigned int flags), (dev, flags),
+         CAP_INT(dev), CAP_FLAGS(flags), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuDevicePrimaryCtxGetState, "context", none,
+         (CUdevice dev, unsigned int *flags, int *active), (dev, flags, active),
+         CAP_INT(dev), CAP_OUT_INT(flags), CAP_OUT_INT(active), CAP_NONE)
+HOOK_GEN(cuCtxGetCurrent, "context", none,
+         (CUcontext *pctx), (pctx),
+         CAP_OUT_HANDLE(pctx), CAP_NONE, CAP_NONE, CAP_NONE)
+HOOK_GEN(cuCtxPushCurrent, "context", v2,
+         (CUcontext ctx), (ctx),
+         CAP_HANDLE(ctx), CAP_NONE, CAP_NONE, CAP_NONE)
+HOOK_GEN(cuCtxPopCurrent, "context", v2,
+         (CUcontext *pctx), (pctx),
+         CAP_OUT_HANDLE(pctx), CAP_NONE, CAP_NONE, CAP_NONE)
+HOOK_GEN(cuCtxGetDevice, "context", none,
+         (CUdevice *device), (device),
+         CAP_OUT_INT(device), CAP_NONE, CAP_NONE, CAP_NONE)
+HOOK_GEN(cuCtxGetFlags, "context", none,
+         (unsigned int *flags), (flags),
+         CAP_OUT_INT(flags), CAP_NONE, CAP_NONE, CAP_NONE)
+HOOK_GEN(cuCtxSetLimit, "context", none,
+         (int limit, size_t value), (limit, value),
+         CAP_INT(limit), CAP_SIZE(value), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuCtxGetLimit, "context", none,
+         (size_t *pvalue, int limit), (pvalue, limit),
+         CAP_INT(limit), CAP_OUT_SIZE(pvalue), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuCtxGetCacheConfig, "context", none,
+         (int *pconfig), (pconfig),
+         CAP_OUT_INT(pconfig), CAP_NONE, CAP_NONE, CAP_NONE)
+HOOK_GEN(cuCtxSetCacheConfig, "context", none,
+         (int config), (config),
+         CAP_INT(config), CAP_NONE, CAP_NONE, CAP_NONE)
+HOOK_GEN(cuCtxGetApiVersion, "context", none,
+         (CUcontext ctx, unsigned int *version), (ctx, version),
+         CAP_HANDLE(ctx), CAP_OUT_INT(version), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuCtxGetStreamPriorityRange, "context", none,
+         (int *leastPriority, int *greatestPriority), (leastPriority, greatestPriority),
+         CAP_OUT_INT(leastPriority), CAP_OUT_INT(greatestPriority), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuCtxEnablePeerAccess, "context", none,
+         (CUcontext peerContext, unsigned int Flags), (peerContext, Flags),
+         CAP_HANDLE(peerContext), CAP_FLAGS(Flags), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuCtxDisablePeerAccess, "context", none,
+         (CUcontext peerContext), (peerContext),
+         CAP_HANDLE(peerContext), CAP_NONE, CAP_NONE, CAP_NONE)
+#endif
+
+#if HOOK_ENABLE_MODULE
+HOOK_GEN(cuModuleLoadData, "module", none,
+         (CUmodule *module, const void *image), (module, image),
+         CAP_PTR(image), CAP_OUT_HANDLE(module), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuModuleLoadDataEx, "module", none,
+         (CUmodule *module, const void *image, unsigned int numOptions, int *options,
+          void **optionValues),
+         (module, image, numOptions, options, optionValues),
+         CAP_PTR(image), CAP_INT(numOptions), CAP_OUT_HANDLE(module), CAP_NONE)
+HOOK_GEN(cuModuleLoadFatBinary, "module", none,
+         (CUmodule *module, const void *fatCubin), (module, fatCubin),
+         CAP_PTR(fatCubin), CAP_OUT_HANDLE(module), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuModuleGetGlobal, "module", v2,
+         (CUdeviceptr *dptr, size_t *bytes, CUmodule hmod, const char *name),
+         (dptr, bytes, hmod, name),
+         CAP_HANDLE(hmod), CAP_STRING(name), CAP_OUT_HANDLE(dptr), CAP_OUT_SIZE(bytes))
+HOOK_GEN(cuLibraryLoadData, "module", none,
+         (CUlibrary *library, const void *code, void *jitOptions, void **jitOptionsValues,
+          unsigned int numJitOptions, void *libraryOptions, void **libraryOptionValues,
+          unsigned int numLibraryOptions),
+         (library, code, jitOptions, jitOptionsValues, numJitOptions, libraryOptions,
+          libraryOptionValues, numLibraryOptions),
+         CAP_PTR(code), CAP_OUT_HANDLE(library), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuLibraryLoadFromFile, "module", none,
+         (CUlibrary *library, const char *fileName, void *jitOptions, void **jitOptionsValues,
+          unsigned int numJitOptions, void *libraryOptions, void **libraryOptionValues,
+          unsigned int numLibraryOptions),
+         (library, fileName, jitOptions, jitOptionsValues, numJitOptions, libraryOptions,
+          libraryOptionValues, numLibraryOptions),
+         CAP_STRING(fileName), CAP_OUT_HANDLE(library), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuLibraryUnload, "module", none,
+         (CUlibrary library), (library),
+         CAP_HANDLE(library), CAP_NONE, CAP_NONE, CAP_NONE)
+HOOK_GEN(cuKernelGetFunction, "module", none,
+         (CUfunction *pFunc, CUkernel kernel), (pFunc, kernel),
+         CAP_HANDLE(kernel), CAP_OUT_HANDLE(pFunc), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuLinkCreate, "module", v2,
+         (unsigned int numOptions, int *options, void **optionValues, CUlinkState *stateOut),
+         (numOptions, options, optionValues, stateOut),
+         CAP_INT(numOptions), CAP_OUT_HANDLE(stateOut), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuLinkAddData, "module", v2,
+         (CUlinkState state, int type, void *data, size_t size, const char *name,
+          unsigned int numOptions, int *options, void **optionValues),
+         (state, type, data, size, name, numOptions, options, optionValues),
+         CAP_HANDLE(state), CAP_INT(type), CAP_SIZE(size), CAP_STRING(name))
+HOOK_GEN(cuLinkComplete, "module", none,
+         (CUlinkState state, void **cubinOut, size_t *sizeOut), (state, cubinOut, sizeOut),
+         CAP_HANDLE(state), CAP_OUT_SIZE(sizeOut), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuLinkDestroy, "module", none,
+         (CUlinkState state), (state),
+         CAP_HANDLE(state), CAP_NONE, CAP_NONE, CAP_NONE)
+#endif
+
+#if HOOK_ENABLE_KERNEL
+HOOK_GEN(cuFuncGetAttribute, "kernel", none,
+         (int *pi, int attrib, CUfunction hfunc), (pi, attrib, hfunc),
+         CAP_HANDLE(hfunc), CAP_INT(attrib), CAP_OUT_INT(pi), CAP_NONE)
+HOOK_GEN(cuFuncSetAttribute, "kernel", none,
+         (CUfunction hfunc, int attrib, int value), (hfunc, attrib, value),
+         CAP_HANDLE(hfunc), CAP_INT(attrib), CAP_INT(value), CAP_NONE)
+HOOK_GEN(cuFuncSetCacheConfig, "kernel", none,
+         (CUfunction hfunc, int config), (hfunc, config),
+         CAP_HANDLE(hfunc), CAP_INT(config), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuLaunchCooperativeKernel, "kernel", none,
+         (CUfunction f, unsigned int gridDimX, unsigned int gridDimY, unsigned int gridDimZ,
+          unsigned int blockDimX, unsigned int blockDimY, unsigned int blockDimZ,
+          unsigned int sharedMemBytes, CUstream hStream, void **kernelParams),
+         (f, gridDimX, gridDimY, gridDimZ, blockDimX, blockDimY, blockDimZ,
+          sharedMemBytes, hStream, kernelParams),
+         CAP_HANDLE(f), CAP_HANDLE(hStream), CAP_INT(gridDimX), CAP_INT(blockDimX))
+HOOK_GEN(cuLaunchKernelEx, "kernel", none,
+         (const void *config, CUfunction f, void **kernelParams, void **extra),
+         (config, f, kernelParams, extra),
+         CAP_HANDLE(f), CAP_PTR(config), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuLaunchHostFunc, "kernel", none,
+         (CUstream hStream, CUhostFn fn, void *userData), (hStream, fn, userData),
+         CAP_HANDLE(hStream), CAP_PTR(fn), CAP_PTR(userData), CAP_NONE)
+HOOK_GEN(cuOccupancyMaxActiveBlocksPerMultiprocessor, "kernel", none,
+         (int *numBlocks, CUfunction func, int blockSize, size_t dynamicSMemSize),
+         (numBlocks, func, blockSize, dynamicSMemSize),
+         CAP_HANDLE(func), CAP_INT(blockSize), CAP_SIZE(dynamicSMemSize), CAP_OUT_INT(numBlocks))
+HOOK_GEN(cuOccupancyMaxPotentialBlockSize, "kernel", none,
+         (int *minGridSize, int *blockSize, CUfunction func,
+          CUoccupancyB2DSize blockSizeToDynamicSMemSize, size_t dynamicSMemSize,
+          int blockSizeLimit),
+         (minGridSize, blockSize, func, blockSizeToDynamicSMemSize, dynamicSMemSize,
+          blockSizeLimit),
+         CAP_HANDLE(func), CAP_SIZE(dynamicSMemSize), CAP_OUT_INT(minGridSize),
+         CAP_OUT_INT(blockSize))
+#endif
+
+#if HOOK_ENABLE_MEMORY
+HOOK_GEN(cuMemGetInfo, "memory", v2,
+         (size_t *free, size_t *total), (free, total),
+         CAP_OUT_SIZE(free), CAP_OUT_SIZE(total), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuMemAllocPitch, "memory", v2,
+         (CUdeviceptr *dptr, size_t *pPitch, size_t WidthInBytes, size_t Height,
+          unsigned int ElementSizeBytes),
+         (dptr, pPitch, WidthInBytes, Height, ElementSizeBytes),
+         CAP_SIZE(WidthInBytes), CAP_SIZE(Height), CAP_OUT_HANDLE(dptr), CAP_OUT_SIZE(pPitch))
+HOOK_GEN(cuMemAllocManaged, "memory", none,
+         (CUdeviceptr *dptr, size_t bytesize, unsigned int flags), (dptr, bytesize, flags),
+         CAP_SIZE(bytesize), CAP_FLAGS(flags), CAP_OUT_HANDLE(dptr), CAP_NONE)
+HOOK_GEN(cuMemGetAddressRange, "memory", v2,
+         (CUdeviceptr *pbase, size_t *psize, CUdeviceptr dptr), (pbase, psize, dptr),
+         CAP_HANDLE(dptr), CAP_OUT_HANDLE(pbase), CAP_OUT_SIZE(psize), CAP_NONE)
+HOOK_GEN(cuMemHostGetDevicePointer, "memory", v2,
+         (CUdeviceptr *pdptr, void *p, unsigned int Flags), (pdptr, p, Flags),
+         CAP_PTR(p), CAP_FLAGS(Flags), CAP_OUT_HANDLE(pdptr), CAP_NONE)
+HOOK_GEN(cuMemHostGetFlags, "memory", none,
+         (unsigned int *pFlags, void *p), (pFlags, p),
+         CAP_PTR(p), CAP_OUT_INT(pFlags), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuMemPrefetchAsync, "memory", none,
+         (CUdeviceptr devPtr, size_t count, CUdevice dstDevice, CUstream hStream),
+         (devPtr, count, dstDevice, hStream),
+         CAP_HANDLE(devPtr), CAP_SIZE(count), CAP_INT(dstDevice), CAP_HANDLE(hStream))
+HOOK_GEN(cuMemAdvise, "memory", none,
+         (CUdeviceptr devPtr, size_t count, int advice, CUdevice device),
+         (devPtr, count, advice, device),
+         CAP_HANDLE(devPtr), CAP_SIZE(count), CAP_INT(advice), CAP_INT(device))
+HOOK_GEN(cuPointerGetAttribute, "memory", none,
+         (void *data, int attribute, CUdeviceptr ptr), (data, attribute, ptr),
+         CAP_HANDLE(ptr), CAP_INT(attribute), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuPointerGetAttributes, "memory", none,
+         (unsigned int numAttributes, int *attributes, void **data, CUdeviceptr ptr),
+         (numAttributes, attributes, data, ptr),
+         CAP_HANDLE(ptr), CAP_INT(numAttributes), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuPointerSetAttribute, "memory", none,
+         (const void *value, int attribute, CUdeviceptr ptr), (value, attribute, ptr),
+         CAP_HANDLE(ptr), CAP_INT(attribute), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuMemsetD8, "memory", v2,
+         (CUdeviceptr dstDevice, unsigned char uc, size_t N), (dstDevice, uc, N),
+         CAP_HANDLE(dstDevice), CAP_SIZE(N), CAP_INT(uc), CAP_NONE)
+HOOK_GEN(cuMemsetD16, "memory", v2,
+         (CUdeviceptr dstDevice, unsigned short us, size_t N), (dstDevice, us, N),
+         CAP_HANDLE(dstDevice), CAP_SIZE(N), CAP_INT(us), CAP_NONE)
+HOOK_GEN(cuMemsetD32, "memory", v2,
+         (CUdeviceptr dstDevice, unsigned int ui, size_t N), (dstDevice, ui, N),
+         CAP_HANDLE(dstDevice), CAP_SIZE(N), CAP_INT(ui), CAP_NONE)
+HOOK_GEN(cuMemsetD8Async, "memory", none,
+         (CUdeviceptr dstDevice, unsigned char uc, size_t N, CUstream hStream),
+         (dstDevice, uc, N, hStream),
+         CAP_HANDLE(dstDevice), CAP_SIZE(N), CAP_INT(uc), CAP_HANDLE(hStream))
+HOOK_GEN(cuMemsetD16Async, "memory", none,
+         (CUdeviceptr dstDevice, unsigned short us, size_t N, CUstream hStream),
+         (dstDevice, us, N, hStream),
+         CAP_HANDLE(dstDevice), CAP_SIZE(N), CAP_INT(us), CAP_HANDLE(hStream))
+HOOK_GEN(cuMemsetD32Async, "memory", none,
+         (CUdeviceptr dstDevice, unsigned int ui, size_t N, CUstream hStream),
+         (dstDevice, ui, N, hStream),
+         CAP_HANDLE(dstDevice), CAP_SIZE(N), CAP_INT(ui), CAP_HANDLE(hStream))
+HOOK_GEN(cuMemAddressReserve, "memory", none,
+         (CUdeviceptr *ptr, size_t size, size_t alignment, CUdeviceptr addr,
+          unsigned long long flags),
+         (ptr, size, alignment, addr, flags),
+         CAP_SIZE(size), CAP_SIZE(alignment), CAP_HANDLE(addr), CAP_OUT_HANDLE(ptr))
+HOOK_GEN(cuMemAddressFree, "memory", none,
+         (CUdeviceptr ptr, size_t size), (ptr, size),
+         CAP_HANDLE(ptr), CAP_SIZE(size), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuMemCreate, "memory", none,
+         (CUmemGenericAllocationHandle *handle, size_t size, const void *prop,
+          unsigned long long flags),
+         (handle, size, prop, flags),
+         CAP_SIZE(size), CAP_FLAGS(flags), CAP_OUT_HANDLE(handle), CAP_NONE)
+HOOK_GEN(cuMemRelease, "memory", none,
+         (CUmemGenericAllocationHandle handle), (handle),
+         CAP_HANDLE(handle), CAP_NONE, CAP_NONE, CAP_NONE)
+HOOK_GEN(cuMemMap, "memory", none,
+         (CUdeviceptr ptr, size_t size, size_t offset, CUmemGenericAllocationHandle handle,
+          unsigned long long flags),
+         (ptr, size, offset, handle, flags),
+         CAP_HANDLE(ptr), CAP_SIZE(size), CAP_SIZE(offset), CAP_HANDLE(handle))
+HOOK_GEN(cuMemUnmap, "memory", none,
+         (CUdeviceptr ptr, size_t size), (ptr, size),
+         CAP_HANDLE(ptr), CAP_SIZE(size), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuMemSetAccess, "memory", none,
+         (CUdeviceptr ptr, size_t size, const void *desc, size_t count),
+         (ptr, size, desc, count),
+         CAP_HANDLE(ptr), CAP_SIZE(size), CAP_INT(count), CAP_NONE)
+HOOK_GEN(cuMemGetAllocationGranularity, "memory", none,
+         (size_t *granularity, const void *prop, int option), (granularity, prop, option),
+         CAP_INT(option), CAP_OUT_SIZE(granularity), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuMemPoolCreate, "memory", none,
+         (CUmemoryPool *pool, const void *poolProps), (pool, poolProps),
+         CAP_OUT_HANDLE(pool), CAP_NONE, CAP_NONE, CAP_NONE)
+HOOK_GEN(cuMemPoolDestroy, "memory", none,
+         (CUmemoryPool pool), (pool),
+         CAP_HANDLE(pool), CAP_NONE, CAP_NONE, CAP_NONE)
+HOOK_GEN(cuMemPoolTrimTo, "memory", none,
+         (CUmemoryPool pool, size_t minBytesToKeep), (pool, minBytesToKeep),
+         CAP_HANDLE(pool), CAP_SIZE(minBytesToKeep), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuMemPoolSetAttribute, "memory", none,
+         (CUmemoryPool pool, int attr, void *value), (pool, attr, value),
+         CAP_HANDLE(pool), CAP_INT(attr), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuMemPoolGetAttribute, "memory", none,
+         (CUmemoryPool pool, int attr, void *value), (pool, attr, value),
+         CAP_HANDLE(pool), CAP_INT(attr), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuMemAllocFromPoolAsync, "memory", none,
+         (CUdeviceptr *dptr, size_t bytesize, CUmemoryPool pool, CUstream hStream),
+         (dptr, bytesize, pool, hStream),
+         CAP_SIZE(bytesize), CAP_HANDLE(pool), CAP_HANDLE(hStream), CAP_OUT_HANDLE(dptr))
+#endif
+
+#if HOOK_ENABLE_TRANSFER
+HOOK_GEN(cuMemcpy2D, "transfer", v2,
+         (const void *pCopy), (pCopy),
+         CAP_PTR(pCopy), CAP_NONE, CAP_NONE, CAP_NONE)
+HOOK_GEN(cuMemcpy2DUnaligned, "transfer", v2,
+         (const void *pCopy), (pCopy),
+         CAP_PTR(pCopy), CAP_NONE, CAP_NONE, CAP_NONE)
+HOOK_GEN(cuMemcpy2DAsync, "transfer", v2,
+         (const void *pCopy, CUstream hStream), (pCopy, hStream),
+         CAP_PTR(pCopy), CAP_HANDLE(hStream), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuMemcpy3D, "transfer", v2,
+         (const void *pCopy), (pCopy),
+         CAP_PTR(pCopy), CAP_NONE, CAP_NONE, CAP_NONE)
+HOOK_GEN(cuMemcpy3DAsync, "transfer", v2,
+         (const void *pCopy, CUstream hStream), (pCopy, hStream),
+         CAP_PTR(pCopy), CAP_HANDLE(hStream), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuMemcpyPeer, "transfer", none,
+         (CUdeviceptr dstDevice, CUcontext dstContext, CUdeviceptr srcDevice,
+          CUcontext srcContext, size_t ByteCount),
+         (dstDevice, dstContext, srcDevice, srcContext, ByteCount),
+         CAP_HANDLE(dstDevice), CAP_HANDLE(srcDevice), CAP_SIZE(ByteCount), CAP_NONE)
+HOOK_GEN(cuMemcpyPeerAsync, "transfer", none,
+         (CUdeviceptr dstDevice, CUcontext dstContext, CUdeviceptr srcDevice,
+          CUcontext srcContext, size_t ByteCount, CUstream hStream),
+         (dstDevice, dstContext, srcDevice, srcContext, ByteCount, hStream),
+         CAP_HANDLE(dstDevice), CAP_HANDLE(srcDevice), CAP_SIZE(ByteCount), CAP_HANDLE(hStream))
+#endif
+
+#if HOOK_ENABLE_STREAM
+HOOK_GEN(cuStreamCreateWithPriority, "stream", none,
+         (CUstream *phStream, unsigned int flags, int priority), (phStream, flags, priority),
+         CAP_FLAGS(flags), CAP_INT(priority), CAP_OUT_HANDLE(phStream), CAP_NONE)
+HOOK_GEN(cuStreamQuery, "stream", none,
+         (CUstream hStream), (hStream),
+         CAP_HANDLE(hStream), CAP_NONE, CAP_NONE, CAP_NONE)
+HOOK_GEN(cuStreamAddCallback, "stream", none,
+         (CUstream hStream, CUstreamCallback callback, void *userData, unsigned int flags),
+         (hStream, callback, userData, flags),
+         CAP_HANDLE(hStream), CAP_PTR(callback), CAP_PTR(userData), CAP_FLAGS(flags))
+HOOK_GEN(cuStreamGetPriority, "stream", none,
+         (CUstream hStream, int *priority), (hStream, priority),
+         CAP_HANDLE(hStream), CAP_OUT_INT(priority), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuStreamGetFlags, "stream", none,
+         (CUstream hStream, unsigned int *flags), (hStream, flags),
+         CAP_HANDLE(hStream), CAP_OUT_INT(flags), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuStreamGetCtx, "stream", none,
+         (CUstream hStream, CUcontext *pctx), (hStream, pctx),
+         CAP_HANDLE(hStream), CAP_OUT_HANDLE(pctx), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuStreamBeginCapture, "stream", v2,
+         (CUstream hStream, int mode), (hStream, mode),
+         CAP_HANDLE(hStream), CAP_INT(mode), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuStreamEndCapture, "stream", none,
+         (CUstream hStream, CUgraph *phGraph), (hStream, phGraph),
+         CAP_HANDLE(hStream), CAP_OUT_HANDLE(phGraph), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuStreamIsCapturing, "stream", none,
+         (CUstream hStream, int *captureStatus), (hStream, captureStatus),
+         CAP_HANDLE(hStream), CAP_OUT_INT(captureStatus), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuStreamAttachMemAsync, "stream", none,
+         (CUstream hStream, CUdeviceptr dptr, size_t length, unsigned int flags),
+         (hStream, dptr, length, flags),
+         CAP_HANDLE(hStream), CAP_HANDLE(dptr), CAP_SIZE(length), CAP_FLAGS(flags))
+#endif
+
+#if HOOK_ENABLE_EVENT
+HOOK_GEN(cuEventCreate, "event", none,
+         (CUevent *phEvent, unsigned int Flags), (phEvent, Flags),
+         CAP_FLAGS(Flags), CAP_OUT_HANDLE(phEvent), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuEventQuery, "event", none,
+         (CUevent hEvent), (hEvent),
+         CAP_HANDLE(hEvent), CAP_NONE, CAP_NONE, CAP_NONE)
+HOOK_GEN(cuEventSynchronize, "event", none,
+         (CUevent hEvent), (hEvent),
+         CAP_HANDLE(hEvent), CAP_NONE, CAP_NONE, CAP_NONE)
+HOOK_GEN(cuEventDestroy, "event", v2,
+         (CUevent hEvent), (hEvent),
+         CAP_HANDLE(hEvent), CAP_NONE, CAP_NONE, CAP_NONE)
+HOOK_GEN(cuEventElapsedTime, "event", none,
+         (float *pMilliseconds, CUevent hStart, CUevent hEnd), (pMilliseconds, hStart, hEnd),
+         CAP_HANDLE(hStart), CAP_HANDLE(hEnd), CAP_NONE, CAP_NONE)
+#endif
+
+#if HOOK_ENABLE_GRAPH
+HOOK_GEN(cuGraphCreate, "graph", none,
+         (CUgraph *phGraph, unsigned int flags), (phGraph, flags),
+         CAP_FLAGS(flags), CAP_OUT_HANDLE(phGraph), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuGraphDestroy, "graph", none,
+         (CUgraph hGraph), (hGraph),
+         CAP_HANDLE(hGraph), CAP_NONE, CAP_NONE, CAP_NONE)
+HOOK_GEN(cuGraphGetNodes, "graph", none,
+         (CUgraph hGraph, CUgraphNode *nodes, size_t *numNodes), (hGraph, nodes, numNodes),
+         CAP_HANDLE(hGraph), CAP_OUT_SIZE(numNodes), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuGraphInstantiateWithFlags, "graph", none,
+         (CUgraphExec *phGraphExec, CUgraph hGraph, unsigned long long flags),
+         (phGraphExec, hGraph, flags),
+         CAP_HANDLE(hGraph), CAP_FLAGS(flags), CAP_OUT_HANDLE(phGraphExec), CAP_NONE)
+HOOK_GEN(cuGraphUpload, "graph", none,
+         (CUgraphExec hGraphExec, CUstream hStream), (hGraphExec, hStream),
+         CAP_HANDLE(hGraphExec), CAP_HANDLE(hStream), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuGraphLaunch, "graph", none,
+         (CUgraphExec hGraphExec, CUstream hStream), (hGraphExec, hStream),
+         CAP_HANDLE(hGraphExec), CAP_HANDLE(hStream), CAP_NONE, CAP_NONE)
+HOOK_GEN(cuGraphExecDestroy, "graph", none,
+         (CUgraphExec hGraphExec), (hGraphExec),
+         CAP_HANDLE(hGraphExec), CAP_NONE, CAP_NONE, CAP_NONE)
+#endif
+
+#ifdef HOOK_GEN_CUSTOM_DEFAULT
+#undef HOOK_GEN_CUSTOM
+#undef HOOK_GEN_CUSTOM_DEFAULT
+#endif
@@ -0,0 +1,188 @@
+/*
+ * hook_clock.c - Timestamp sources for the hook hot path
+ *
+ * CLOCK_MONOTONIC is the default. With CUDA_HOOK_CLOCK=tsc the hooks store
+ * raw invariant-TSC ticks and the drainer converts them to CLOCK_MONOTONIC
+ * nanoseconds (the clock behind bpf_ktime_get_ns) using calibration points
+ * taken at init and then periodically. Each point starts a linear segment,
+ * so a trace can be converted offline from the points alone. A new segment
+ * starts where the previous one ends, so converted time never steps; its
+ * slope is the measured TSC rate, slewed to work off the drift against
+ * CLOCK_MONOTONIC by the next calibration.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include "cuda_hook.h"
+
+// Samples per calibration point; the tightest TSC window wins
+#define CALIBRATION_SAMPLES 7
+// Gap between the two samples of the initial calibration
+#define INITIAL_CALIBRATION_NS 10000000
+
+int hook_clock_tsc = 0;
+struct clock_map hook_clock_map;
+
+// Last raw sample, the start of the next slope measurement
+static struct trace_clock_point last_sample;
+
+// Newest slope, for threads other than the drainer (which may grow the map)
+static uint64_t latest_mult = 1ull << 32;
+
+int hook_clock_tsc_supported(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007) {
+        return 0;
+    }
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return (edx >> 8) & 1;      // Invariant TSC
+#else
+    return 0;
+#endif
+}
+
+static int64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Pair a TSC reading with CLOCK_MONOTONIC, centred on the clock_gettime call
+static void sample_clocks(struct trace_clock_point* pt) {
+    int64_t best_window = INT64_MAX;
+
+    for (int i = 0; i < CALIBRATION_SAMPLES; i++) {
+        int64_t before = hook_rdtsc();
+        int64_t ns = monotonic_ns();
+        int64_t after = hook_rdtsc();
+        if (after - before < best_window) {
+            best_window = after - before;
+            pt->tsc = before + (after - before) / 2;
+            pt->ns = ns;
+        }
+    }
+}
+
+// ns per tick as a 32.32 fixed-point multiplier
+static uint64_t slope(const struct trace_clock_point* a, const struct trace_clock_point* b) {
+    if (b->tsc <= a->tsc) {
+        return 1ull << 32;
+    }
+    return (uint64_t)(((unsigned __int128)(b->ns - a->ns) << 32) / (uint64_t)(b->tsc - a->tsc));
+}
+
+int hook_clock_init(void) {
+    memset(&hook_clock_map, 0, sizeof(hook_clock_map));
+
+    struct trace_clock_point first, second;
+    sample_clocks(&first);
+    struct timespec gap = { 0, INITIAL_CALIBRATION_NS };
+    nanosleep(&gap, NULL);
+    sample_clocks(&second);
+
+    first.mult = slope(&first, &second);
+    last_sample = second;
+    __atomic_store_n(&latest_mult, first.mult, __ATOMIC_RELAXED);
+    return clock_map_add(&hook_clock_map, &first);
+}
+
+int hook_clock_recalibrate(struct trace_clock_point* pt) {
+    struct trace_clock_point sample;
+    sample_clocks(&sample);
+    uint64_t rate = slope(&last_sample, &sample);
+    int64_t span = sample.tsc - last_sample.tsc;
+    last_sample = sample;
+
+    // Join the current segment at the switch point, then aim to meet the
+    // clock again one interval like the last one later; a bounded slew keeps
+    // the map increasing whatever the error
+    pt->tsc = sample.tsc;
+    pt->ns = clock_map_to_ns(&hook_clock_map, sample.tsc);
+    pt->mult = rate;
+    if (span > 0) {
+        __int128 mult = (__int128)rate + ((__int128)(sample.ns - pt->ns) << 32) / span;
+        __int128 lo = rate / 2, hi = (__int128)rate * 2;
+        pt->mult = (uint64_t)(mult < lo ? lo : mult > hi ? hi : mult);
+    }
+    __atomic_store_n(&latest_mult, rate, __ATOMIC_RELAXED);
+    return clock_map_add(&hook_clock_map, pt);
+}
+
+int clock_map_add(struct clock_map* map, const struct trace_clock_point* pt) {
+    if (map->count == map->capacity) {
+        size_t capacity = map->capacity ? map->capacity * 2 : 64;
+        struct trace_clock_point* points = realloc(map->points, capacity * sizeof(*points));
+        if (!points) {
+            return -1;
+        }
+        map->points = points;
+        map->capacity = capacity;
+    }
+    map->points[map->count++] = *pt;
+    return 0;
+}
+
+void clock_map_free(struct clock_map* map) {
+    free(map->points);
+    memset(map, 0, sizeof(*map));
+}
+
+int64_t clock_map_to_ns(const struct clock_map* map, int64_t ticks) {
+    if (map->count == 0) {
+        return ticks;
+    }
+
+    // Last point at or before ticks; earlier ticks extrapolate from the first.
+    // Points are appended in TSC order, and most lookups hit the newest one.
+    size_t lo = 0, hi = map->count;
+    if (ticks >= map->points[hi - 1].tsc) {
+        lo = hi - 1;
+    } else {
+        while (hi - lo > 1) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (map->points[mid].tsc <= ticks) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+    }
+
+    const struct trace_clock_point* pt = &map->points[lo];
+    __int128 delta = (__int128)(ticks - pt->tsc) * (__int128)pt->mult;
+    return pt->ns + (int64_t)(delta >> 32);
+}
+
+// Length of an interval in ns, using the newest calibration
+int64_t clock_map_duration_ns(const struct clock_map* map, int64_t ticks) {
+    if (map->count == 0) {
+        return ticks;
+    }
+    __int128 ns = (__int128)ticks * (__int128)map->points[map->count - 1].mult;
+    return (int64_t)(ns >> 32);
+}
+
+// Interval conversions between ns and hook timestamp units (ticks with
+// TSC), safe on any thread
+int64_t hook_clock_from_ns(int64_t ns) {
+    if (!hook_clock_tsc) {
+        return ns;
+    }
+    uint64_t mult = __atomic_load_n(&latest_mult, __ATOMIC_RELAXED);
+    return mult ? (int64_t)(((__int128)ns << 32) / (__int128)mult) : ns;
+}
+
+int64_t hook_clock_to_ns(int64_t units) {
+    if (!hook_clock_tsc) {
+        return units;
+    }
+    uint64_t mult = __atomic_load_n(&latest_mult, __ATOMIC_RELAXED);
+    return (int64_t)(((__int128)units * (__int128)mult) >> 32);
+}
@@ -0,0 +1,240 @@
+/*
+ * hook_collector.c - Stream the trace to cuda_trace_collectd
+ *
+ * CUDA_HOOK_COLLECTOR=1 (or the collector's socket path) makes the trace
+ * FILE a stream into shared memory instead of a file. The process creates a
+ * ring with memfd_create(), passes it to the collector over its Unix socket
+ * and from then on the drainer's fwrite()s land in the ring; the collector
+ * reads them out, so the process itself does no file I/O for tracing.
+ *
+ * The stream is the binary trace format, byte for byte what
+ * CUDA_HOOK_FORMAT=binary would write to a file, so every module keeps
+ * writing to the FILE it was given. When the ring is full the drainer waits
+ * for the collector, as it would for a slow disk, and the per-thread rings
+ * absorb or drop what comes in meanwhile. If the collector goes away the
+ * rest of the trace is discarded and the process carries on.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cuda_hook.h"
+
+// Drainer sleep while the ring is full, and how often it then checks that
+// the collector is still there
+#define COLLECTOR_WAIT_US    200
+#define COLLECTOR_CHECK_WAITS 50
+// Handshake timeout
+#define COLLECTOR_REPLY_MS   2000
+
+int collector_active = 0;
+
+struct collector_stream {
+    struct collector_ring* ring;    // NULL = detached, writes are discarded
+    size_t map_bytes;
+    int sock;
+    uint64_t discarded;
+};
+
+static struct collector_stream stream = { NULL, 0, -1, 0 };
+static char socket_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+static size_t ring_bytes = 0;
+
+static void detach(struct collector_stream* s) {
+    if (s->ring) {
+        munmap(s->ring, s->map_bytes);
+        s->ring = NULL;
+    }
+    if (s->sock >= 0) {
+        close(s->sock);
+        s->sock = -1;
+    }
+}
+
+// The collector never writes after its reply, so a readable socket means it
+// has closed its end
+static int collector_gone(int sock) {
+    struct pollfd pfd = { sock, POLLIN | POLLRDHUP, 0 };
+    return poll(&pfd, 1, 0) != 0;
+}
+
+static ssize_t collector_write(void* cookie, const char* buf, size_t size) {
+    struct collector_stream* s = cookie;
+    size_t done = 0;
+    unsigned waits = 0;
+
+    while (done < size && s->ring) {
+        struct collector_ring* ring = s->ring;
+        uint64_t head = ring->head;
+        uint64_t used = head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        size_t n = ring->size - used < size - done ? ring->size - used : size - done;
+        if (n == 0) {
+            if (++waits % COLLECTOR_CHECK_WAITS == 0 && collector_gone(s->sock)) {
+                fprintf(stderr, "[CUDA_HOOK] Collector went away, discarding the rest of the trace\n");
+                detach(s);
+                break;
+            }
+            struct timespec pause = { 0, COLLECTOR_WAIT_US * 1000 };
+            nanosleep(&pause, NULL);
+            continue;
+        }
+
+        uint64_t at = head & (ring->size - 1);
+        size_t first = ring->size - at < n ? ring->size - at : n;
+        memcpy(ring->data + at, buf + done, first);
+        memcpy(ring->data, buf + done + first, n - first);
+        __atomic_store_n(&ring->head, head + n, __ATOMIC_RELEASE);
+        done += n;
+    }
+
+    s->discarded += size - done;
+    return (ssize_t)size;
+}
+
+// Closing the socket tells the collector to read what is left and finish
+static int collector_close(void* cookie) {
+    struct collector_stream* s = cookie;
+    detach(s);
+    if (s->discarded) {
+        fprintf(stderr, "[CUDA_HOOK] Discarded %llu trace bytes after the collector left\n",
+                (unsigned long long)s->discarded);
+    }
+    return 0;
+}
+
+static int send_hello(int sock, int memfd, size_t map_bytes) {
+    struct collector_hello hello = { COLLECTOR_MAGIC, COLLECTOR_VERSION, (uint32_t)getpid(), 0,
+                                     map_bytes };
+    struct iovec iov = { &hello, sizeof(hello) };
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr msg = { 0 };
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) != (ssize_t)sizeof(hello)) {
+        return -1;
+    }
+    uint32_t reply = 1;
+    struct pollfd pfd = { sock, POLLIN, 0 };
+    if (poll(&pfd, 1, COLLECTOR_REPLY_MS) != 1) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    if (recv(sock, &reply, sizeof(reply), MSG_WAITALL) != sizeof(reply) || reply != 0) {
+        errno = ECONNREFUSED;
+        return -1;
+    }
+    return 0;
+}
+
+// Map a new ring and hand it to the collector
+static int attach(struct collector_stream* s) {
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strcpy(addr.sun_path, socket_path);
+    if (sock < 0 || connect(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        if (sock >= 0) {
+            close(sock);
+        }
+        return -1;
+    }
+
+    size_t map_bytes = sizeof(struct collector_ring) + ring_bytes;
+    int memfd = memfd_create("cuda_hook_trace", MFD_CLOEXEC);
+    void* map = MAP_FAILED;
+    if (memfd >= 0 && ftruncate(memfd, (off_t)map_bytes) == 0) {
+        map = mmap(NULL, map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    }
+    if (map == MAP_FAILED) {
+        if (memfd >= 0) {
+            close(memfd);
+        }
+        close(sock);
+        return -1;
+    }
+
+    struct collector_ring* ring = map;
+    ring->magic = COLLECTOR_MAGIC;
+    ring->version = COLLECTOR_VERSION;
+    ring->size = ring_bytes;
+    int rc = send_hello(sock, memfd, map_bytes);
+    close(memfd);
+    if (rc != 0) {
+        munmap(map, map_bytes);
+        close(sock);
+        return -1;
+    }
+
+    s->ring = ring;
+    s->map_bytes = map_bytes;
+    s->sock = sock;
+    s->discarded = 0;
+    return 0;
+}
+
+// Returns NULL, having said why, when there is no collector to talk to;
+// the caller then writes a trace file as usual
+FILE* collector_open(const char* spec, long ring_mb) {
+    const char* path = strcmp(spec, "1") == 0 ? COLLECTOR_SOCKET : spec;
+    if (strlen(path) >= sizeof(socket_path)) {
+        fprintf(stderr, "[CUDA_HOOK] Collector socket path too long: %s\n", path);
+        return NULL;
+    }
+    strcpy(socket_path, path);
+
+    // Power of two, so positions wrap with a mask
+    ring_bytes = 1 << 20;
+    while (ring_bytes < (size_t)ring_mb << 20) {
+        ring_bytes <<= 1;
+    }
+
+    if (attach(&stream) != 0) {
+        fprintf(stderr, "[CUDA_HOOK] No collector at %s (%s)\n", socket_path, strerror(errno));
+        return NULL;
+    }
+    cookie_io_functions_t io = { NULL, collector_write, NULL, collector_close };
+    FILE* out = fopencookie(&stream, "w", io);
+    if (!out) {
+        detach(&stream);
+        return NULL;
+    }
+    collector_active = 1;
+    return out;
+}
+
+// The child must not write into its parent's ring; it gets one of its own
+// from collector_reopen() once it traces. The drainer, the only writer, is
+// held out of the FILE across the fork by hook_fork.c.
+void collector_atfork(enum fork_phase phase) {
+    if (phase == FORK_CHILD && collector_active) {
+        detach(&stream);
+    }
+}
+
+int collector_reopen(void) {
+    if (attach(&stream) != 0) {
+        fprintf(stderr, "[CUDA_HOOK] Child could not reach the collector at %s\n", socket_path);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,272 @@
+/*
+ * hook_control.c - Switching the hooks between off, aggregate and trace
+ *
+ * With CUDA_HOOK_CONTROL set the hook creates a small control file, by
+ * default /dev/shm/cuda_hook.<pid>, holding the current mode. Writing "off",
+ * "aggregate" (or "counters") or "trace" to it switches every hook without
+ * restarting the process; a number of seconds after the mode makes it
+ * temporary, after which the mode the process was in before comes back:
+ *
+ *   echo "trace 30" > /dev/shm/cuda_hook.1234
+ *
+ * A "filter <spec>" line replaces the API filter (see hook_filter.c); a
+ * file may hold one command per line, and all of them are applied each time
+ * it changes:
+ *
+ *   printf 'trace\nfilter kernel,transfer\n' > /dev/shm/cuda_hook.1234
+ *
+ * The drainer stats the file every CONTROL_POLL_MS and reads it only when
+ * its modification time or size moved, so an idle process pays one fstat()
+ * per poll and the hooks themselves only ever look at hook_active. Each
+ * switch is written to the trace, which tells a quiet stretch from an
+ * untraced one.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cuda_hook.h"
+
+#define CONTROL_POLL_MS 100
+
+static int control_fd = -1;
+static char control_path[256];
+static FILE* control_out = NULL;
+static enum trace_format control_format = TRACE_FORMAT_JSON;
+
+// Last state of the file that was acted on
+static struct timespec seen_mtime;
+static off_t seen_size = -1;
+static int64_t last_poll_ns = 0;
+
+// A timed mode: `revert_mode` comes back at `revert_ns` (0 = not timed)
+static int64_t revert_ns = 0;
+static int revert_mode = HOOK_MODE_OFF;
+
+// Last filter set through the file, kept when the file is rewritten
+static char control_filter[FILTER_SPEC_MAX];
+
+int hook_mode_parse(const char* name) {
+    if (strcmp(name, "counters") == 0) {
+        return HOOK_MODE_AGGREGATE;
+    }
+    for (int mode = 0; mode < HOOK_MODE_COUNT; mode++) {
+        if (strcmp(name, hook_mode_names[mode]) == 0) {
+            return mode;
+        }
+    }
+    return -1;
+}
+
+static int64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void remember_file(void) {
+    struct stat st;
+    if (fstat(control_fd, &st) == 0) {
+        seen_mtime = st.st_mtim;
+        seen_size = st.st_size;
+    }
+}
+
+// Show the mode and filter in effect, for anyone reading the file back
+static void write_file(int mode) {
+    char text[FILTER_SPEC_MAX + 32];
+    int len = snprintf(text, sizeof(text), "%s\n", hook_mode_names[mode]);
+    if (control_filter[0]) {
+        len += snprintf(text + len, sizeof(text) - len, "filter %s\n", control_filter);
+    }
+    if (pwrite(control_fd, text, len, 0) == len && ftruncate(control_fd, len) == 0) {
+        remember_file();
+    }
+}
+
+static void write_change(int mode, int previous, int64_t now_ns, int64_t until_ns) {
+    struct trace_mode_change change = { now_ns, (uint32_t)mode, (uint32_t)previous, until_ns };
+    if (control_format == TRACE_FORMAT_BINARY) {
+        trace_write_binary_mode(control_out, &change);
+    } else if (control_format == TRACE_FORMAT_JSON) {
+        trace_write_mode_json(control_out, &change);
+    }
+    fflush(control_out);
+}
+
+static void set_mode(int mode, int64_t now_ns, int64_t until_ns) {
+    int previous = hook_mode;
+
+    // Summary windows end at the switch, so no window mixes two modes
+    aggregate_flush(now_ns);
+    __atomic_store_n(&hook_mode, mode, __ATOMIC_RELAXED);
+    filter_refresh();
+    write_change(mode, previous, now_ns, until_ns);
+
+    if (until_ns) {
+        fprintf(stderr, "[CUDA_HOOK] Mode %s for %.1f s\n", hook_mode_names[mode],
+                (until_ns - now_ns) / 1e9);
+    } else {
+        fprintf(stderr, "[CUDA_HOOK] Mode %s\n", hook_mode_names[mode]);
+    }
+}
+
+// "<mode> [seconds]" or "filter <spec>"
+static void apply_command(const char* line, int64_t now_ns) {
+    if (strncmp(line, "filter", 6) == 0 && (line[6] == ' ' || line[6] == '\t')) {
+        const char* spec = line + 7 + strspn(line + 7, " \t");
+        if (filter_set(spec, now_ns) != 0) {
+            fprintf(stderr, "[CUDA_HOOK] Ignoring control filter '%s'\n", spec);
+        } else {
+            snprintf(control_filter, sizeof(control_filter), "%s", spec);
+            fprintf(stderr, "[CUDA_HOOK] Filter %s\n", spec);
+        }
+        return;
+    }
+
+    char words[64];
+    snprintf(words, sizeof(words), "%s", line);
+    char* save = NULL;
+    char* name = strtok_r(words, " \t", &save);
+    char* seconds = strtok_r(NULL, " \t", &save);
+
+    int mode = name ? hook_mode_parse(name) : -1;
+    double duration = 0;
+    if (seconds) {
+        char* endp;
+        duration = strtod(seconds, &endp);
+        if (*endp != '\0' || duration <= 0) {
+            mode = -1;
+        }
+    }
+    if (mode < 0) {
+        fprintf(stderr, "[CUDA_HOOK] Ignoring control command '%s' (want off, aggregate or "
+                "trace, then optionally seconds, or filter)\n", line);
+        return;
+    }
+
+    if (duration > 0) {
+        // A timed mode on top of another timed mode still ends in the
+        // untimed one
+        if (!revert_ns) {
+            revert_mode = hook_mode;
+        }
+        revert_ns = now_ns + (int64_t)(duration * 1e9);
+    } else {
+        revert_ns = 0;
+    }
+    if (mode != hook_mode || revert_ns) {
+        set_mode(mode, now_ns, revert_ns);
+    }
+}
+
+// The default directories are world-writable, so the file is always
+// created afresh and never followed through a link someone else planted. A
+// file left behind by an earlier process of this user (pids are reused) is
+// replaced; anything else is an error.
+static int create_control_file(const char* path) {
+    int flags = O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC;
+    int fd = open(path, flags, 0600);
+    if (fd < 0 && errno == EEXIST) {
+        struct stat st;
+        if (lstat(path, &st) == 0 && S_ISREG(st.st_mode) && st.st_uid == geteuid() &&
+            unlink(path) == 0) {
+            fd = open(path, flags, 0600);
+        } else {
+            fprintf(stderr, "[CUDA_HOOK] %s exists and is not a control file of this user\n",
+                    path);
+            return -1;
+        }
+    }
+    if (fd < 0) {
+        perror(path);
+    }
+    return fd;
+}
+
+int control_start(FILE* out, enum trace_format format, const char* spec) {
+    if (strcmp(spec, "1") == 0) {
+        const char* dir = access("/dev/shm", W_OK) == 0 ? "/dev/shm" : "/tmp";
+        snprintf(control_path, sizeof(control_path), "%s/cuda_hook.%d", dir, (int)getpid());
+    } else {
+        snprintf(control_path, sizeof(control_path), "%s", spec);
+    }
+
+    control_fd = create_control_file(control_path);
+    if (control_fd < 0) {
+        return -1;
+    }
+    control_out = out;
+    control_format = format;
+
+    write_file(hook_mode);
+    write_change(hook_mode, hook_mode, monotonic_ns(), 0);
+    fprintf(stderr, "[CUDA_HOOK] Control file: %s (write off, aggregate or trace)\n", control_path);
+    return 0;
+}
+
+// Drainer thread
+void control_poll(int64_t now_ns) {
+    if (control_fd < 0 || now_ns - last_poll_ns < CONTROL_POLL_MS * 1000000LL) {
+        return;
+    }
+    last_poll_ns = now_ns;
+
+    if (revert_ns && now_ns >= revert_ns) {
+        revert_ns = 0;
+        set_mode(revert_mode, now_ns, 0);
+        write_file(revert_mode);
+    }
+
+    struct stat st;
+    if (fstat(control_fd, &st) != 0 ||
+        (st.st_mtim.tv_sec == seen_mtime.tv_sec && st.st_mtim.tv_nsec == seen_mtime.tv_nsec &&
+         st.st_size == seen_size)) {
+        return;
+    }
+
+    char text[FILTER_SPEC_MAX + 128];
+    ssize_t len = pread(control_fd, text, sizeof(text) - 1, 0);
+    if (len <= 0) {
+        // Truncated by a writer that has not written yet; look again next poll
+        return;
+    }
+    text[len] = '\0';
+    seen_mtime = st.st_mtim;
+    seen_size = st.st_size;
+
+    char* save = NULL;
+    for (char* line = strtok_r(text, "\r\n", &save); line; line = strtok_r(NULL, "\r\n", &save)) {
+        line += strspn(line, " \t");
+        if (*line && *line != '#') {
+            apply_command(line, now_ns);
+        }
+    }
+}
+
+// The parent's control file stays the parent's: the child closes its copy
+// and makes its own when it starts tracing
+void control_atfork(enum fork_phase phase) {
+    if (phase != FORK_CHILD || control_fd < 0) {
+        return;
+    }
+    close(control_fd);
+    control_fd = -1;
+    revert_ns = 0;
+    last_poll_ns = 0;
+    seen_size = -1;
+}
+
+void control_stop(void) {
+    if (control_fd >= 0) {
+        close(control_fd);
+        unlink(control_path);
+        control_fd = -1;
+    }
+}
@@ -0,0 +1,146 @@
+/*
+ * hook_dispatch.c - Resolution of the real driver entry points
+ *
+ * Every hooked API has one slot in hook_real, resolved from the symbol of
+ * the current ABI, and one in hook_legacy, resolved from the plain name for
+ * the plain exports of v2 APIs (see hook_apis.h). A missing versioned
+ * symbol is never stood in for by the plain one, whose arguments differ.
+ * Slots start out pointing at a trampoline, so the first call through any
+ * of them resolves both tables (under pthread_once) and later calls go
+ * straight to the driver. When libcuda is already loaded, init_tracing()
+ * resolves the tables eagerly and the trampolines are never used.
+ *
+ * CUDA_HOOK_LIBCUDA names the driver library to load when it is not found
+ * through RTLD_NEXT (default: libcuda.so.1); point it at a stub library to
+ * run without a GPU.
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cuda_hook.h"
+
+// Stand-ins for entry points the driver does not export
+#define HOOK_API(name, category, versioned, ret, params, args) \
+    static ret missing_##name params { return (ret)CUDA_ERROR_NOT_FOUND; }
+#include "hook_apis.h"
+#undef HOOK_API
+
+// Initial slot values: resolve everything, then forward the call
+#define HOOK_API(name, category, versioned, ret, params, args) \
+    static ret resolve_##name params { \
+        hook_resolve_symbols(); \
+        return hook_real.name args; \
+    } \
+    static ret resolve_legacy_##name params { \
+        hook_resolve_symbols(); \
+        return hook_legacy.name args; \
+    }
+#include "hook_apis.h"
+#undef HOOK_API
+
+struct hook_dispatch hook_real = {
+#define HOOK_API(name, category, versioned, ret, params, args) .name = resolve_##name,
+#include "hook_apis.h"
+#undef HOOK_API
+};
+
+struct hook_dispatch hook_legacy = {
+#define HOOK_API(name, category, versioned, ret, params, args) .name = resolve_legacy_##name,
+#include "hook_apis.h"
+#undef HOOK_API
+};
+
+static pthread_once_t resolve_once = PTHREAD_ONCE_INIT;
+static void* driver_handle = NULL;
+
+static const char* libcuda_path(void) {
+    const char* path = getenv("CUDA_HOOK_LIBCUDA");
+    return path ? path : "libcuda.so.1";
+}
+
+int hook_libcuda_loaded(void) {
+    if (getenv("CUDA_HOOK_LIBCUDA")) {
+        return 1;
+    }
+    if (dlsym(RTLD_NEXT, "cuInit")) {
+        return 1;
+    }
+    // Loaded RTLD_LOCAL by someone else (e.g. as a dependency of a dlopen'ed
+    // library), so not visible through RTLD_NEXT
+    void* handle = dlopen(libcuda_path(), RTLD_LAZY | RTLD_NOLOAD);
+    if (handle) {
+        dlclose(handle);
+        return 1;
+    }
+    return 0;
+}
+
+static void resolve_all(void) {
+    void* handle = RTLD_NEXT;
+    const char* source = "RTLD_NEXT";
+
+    if (getenv("CUDA_HOOK_LIBCUDA") || !dlsym(RTLD_NEXT, "cuInit")) {
+        source = libcuda_path();
+        handle = dlopen(source, RTLD_LAZY | RTLD_NOLOAD);
+        if (!handle) {
+            handle = dlopen(source, RTLD_LAZY);
+        }
+        if (!handle) {
+            fprintf(stderr, "[CUDA_HOOK] Failed to load %s: %s\n", source, dlerror());
+        }
+    }
+
+    driver_handle = handle;
+
+    int resolved = 0;
+#define HOOK_API(name, category, versioned, ret, params, args) \
+    { \
+        const char* symbol = HOOK_SYMBOL_##versioned(name); \
+        void* sym = handle ? dlsym(handle, symbol) : NULL; \
+        void* plain = strcmp(symbol, #name) == 0 ? sym : handle ? dlsym(handle, #name) : NULL; \
+        if (sym) { \
+            resolved++; \
+            __atomic_store_n(&hook_real.name, (ret (*) params)sym, __ATOMIC_RELEASE); \
+        } else { \
+            __atomic_store_n(&hook_real.name, missing_##name, __ATOMIC_RELEASE); \
+        } \
+        __atomic_store_n(&hook_legacy.name, plain ? (ret (*) params)plain : missing_##name, \
+                         __ATOMIC_RELEASE); \
+    }
+#include "hook_apis.h"
+#undef HOOK_API
+
+    fprintf(stderr, "[CUDA_HOOK] Resolved %d/%d driver entry points from %s\n",
+            resolved, API_COUNT, source);
+    if (resolved < API_COUNT) {
+        fprintf(stderr, "[CUDA_HOOK] Missing (calls return CUDA_ERROR_NOT_FOUND):");
+#define HOOK_API(name, category, versioned, ret, params, args) \
+        if (hook_real.name == missing_##name) { \
+            fprintf(stderr, " %s", HOOK_SYMBOL_##versioned(name)); \
+        }
+#include "hook_apis.h"
+#undef HOOK_API
+        fprintf(stderr, "\n");
+    }
+}
+
+void hook_resolve_symbols(void) {
+    pthread_once(&resolve_once, resolve_all);
+}
+
+// Library the tables were resolved from (may be RTLD_NEXT)
+void* hook_driver_handle(void) {
+    hook_resolve_symbols();
+    return driver_handle;
+}
+
+// Entry points the hooks call but do not intercept (e.g. the event API
+// used for GPU timing), from the same library as hook_real
+void* hook_driver_symbol(const char* name) {
+    void* handle = hook_driver_handle();
+    return handle ? dlsym(handle, name) : NULL;
+}
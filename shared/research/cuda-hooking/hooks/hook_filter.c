@@ -0,0 +1,118 @@
+/*
+ * hook_filter.c - Which APIs the hooks record at all
+ *
+ * A filter is a comma-separated list of APIs, categories from hook_apis.h
+ * or "*", each optionally prefixed with '-' to take it out again, applied
+ * left to right. It starts from nothing, or from every API when the first
+ * entry is a removal, so "kernel,transfer" keeps two categories and
+ * "-sync,-cuStreamQuery" drops an API and a category from everything.
+ *
+ * The result is a bitmask over API ids. Filtered-out hooks test their bit
+ * before taking an op id or a timestamp and forward to the driver, so they
+ * cost about as much as an unhooked call. Hooks that keep state (the
+ * allocation, pinned memory and kernel name hooks) test it first too, and
+ * then do only that bookkeeping. The control file can swap in a new filter
+ * at runtime; every filter in effect is written to the trace.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cuda_hook.h"
+
+uint64_t hook_active[API_MASK_WORDS];
+
+static uint64_t filter_mask[API_MASK_WORDS];
+static FILE* filter_out = NULL;
+static enum trace_format filter_format = TRACE_FORMAT_JSON;
+
+// Returns -1, leaving `mask` alone, when an entry names nothing
+static int filter_parse(const char* spec, uint64_t* mask) {
+    char copy[FILTER_SPEC_MAX];
+    if (strlen(spec) >= sizeof(copy)) {
+        fprintf(stderr, "[CUDA_HOOK] Filter longer than %d characters\n", FILTER_SPEC_MAX - 1);
+        return -1;
+    }
+    strcpy(copy, spec);
+
+    uint64_t bits[API_MASK_WORDS];
+    int fill = copy[strspn(copy, " ")] == '-';
+    memset(bits, fill ? 0xff : 0, sizeof(bits));
+
+    char* save = NULL;
+    for (char* item = strtok_r(copy, ", \t\r\n", &save); item;
+         item = strtok_r(NULL, ", \t\r\n", &save)) {
+        int remove = *item == '-';
+        const char* key = item + remove;
+
+        int matched = 0;
+        for (uint16_t api = 0; api < API_COUNT; api++) {
+            if (strcmp(key, "*") == 0 || strcmp(key, hook_api_names[api]) == 0 ||
+                strcmp(key, hook_api_categories[api]) == 0) {
+                uint64_t bit = 1ull << (api & 63);
+                bits[api >> 6] = remove ? bits[api >> 6] & ~bit : bits[api >> 6] | bit;
+                matched = 1;
+            }
+        }
+        if (!matched) {
+            fprintf(stderr, "[CUDA_HOOK] Filter: no API or category named '%s'\n", key);
+            return -1;
+        }
+    }
+
+    memcpy(mask, bits, sizeof(bits));
+    return 0;
+}
+
+static void write_change(const char* spec, int64_t now_ns) {
+    if (!filter_out) {
+        return;
+    }
+    struct trace_filter_change change = { now_ns, (uint32_t)strlen(spec), 0 };
+    if (filter_format == TRACE_FORMAT_BINARY) {
+        trace_write_binary_filter(filter_out, &change, spec);
+    } else if (filter_format == TRACE_FORMAT_JSON) {
+        trace_write_filter_json(filter_out, &change, spec);
+    }
+    fflush(filter_out);
+}
+
+// Recompute hook_active after a new filter or a mode switch
+void filter_refresh(void) {
+    int off = __atomic_load_n(&hook_mode, __ATOMIC_RELAXED) == HOOK_MODE_OFF;
+    for (int w = 0; w < API_MASK_WORDS; w++) {
+        __atomic_store_n(&hook_active[w], off ? 0 : filter_mask[w], __ATOMIC_RELAXED);
+    }
+}
+
+// Before the drainer starts. With no spec every API is recorded and nothing
+// is written to the trace.
+int filter_start(FILE* out, enum trace_format format, const char* spec) {
+    filter_out = out;
+    filter_format = format;
+
+    int rc = 0;
+    if (spec && *spec && filter_parse(spec, filter_mask) == 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        write_change(spec, (int64_t)now.tv_sec * 1000000000 + now.tv_nsec);
+    } else {
+        rc = spec && *spec ? -1 : 0;
+        memset(filter_mask, 0xff, sizeof(filter_mask));
+    }
+    filter_refresh();
+    return rc;
+}
+
+// Drainer thread (control file)
+int filter_set(const char* spec, int64_t now_ns) {
+    if (filter_parse(spec, filter_mask) != 0) {
+        return -1;
+    }
+    filter_refresh();
+    write_change(spec, now_ns);
+    return 0;
+}
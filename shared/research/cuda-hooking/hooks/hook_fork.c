@@ -0,0 +1,242 @@
+/*
+ * hook_fork.c - Tracing across fork() and exec()
+ *
+ * fork() copies the parent's rings, counters, tables and trace FILE into the
+ * child, but only the forking thread: the drainer, the compressor and the GPU
+ * timing harvester are gone, and any lock one of them held stays held. The
+ * pthread_atfork handlers here take every hook lock before the fork, so the
+ * child gets them in a known state, then reset what belongs to the parent:
+ * unwritten records are dropped rather than written twice, counters and
+ * tracked memory start from zero, and the trace FILE's buffer is discarded
+ * and its descriptor pointed at /dev/null so nothing lands in the parent's
+ * file.
+ *
+ * A child that goes on to make CUDA calls (most do not: a fork before exec
+ * or a data loader worker) opens a trace of its own at the first recorded
+ * call, cuda_trace.<pid>.jsonl next to the parent's, rotated and compressed
+ * the same way, and starts its own drainer. Every trace begins with a
+ * process record giving its pid, its parent's pid and how it started, so a
+ * tree of traces can be put back together.
+ *
+ * An exec'd process loads the hook again from scratch; CUDA_HOOK_TRACE_OWNER,
+ * which each traced process sets to its pid, tells it that it descends from
+ * a traced process and must not overwrite that process's trace.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdio_ext.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cuda_hook.h"
+
+int fork_restart_pending = 0;
+
+static FILE* fork_out = NULL;
+static enum trace_format fork_format = TRACE_FORMAT_JSON;
+static char base_path[PATH_MAX];        // CUDA_HOOK_TRACE as given
+static char control_spec[PATH_MAX];     // CUDA_HOOK_CONTROL, "" = none
+static uint32_t parent_pid = 0;
+static enum process_origin origin = PROCESS_START;
+static pthread_mutex_t restart_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// Called from the constructor, before the trace is opened
+enum process_origin process_identify(void) {
+    const char* owner = getenv("CUDA_HOOK_TRACE_OWNER");
+    if (owner && *owner) {
+        origin = PROCESS_EXEC;
+        parent_pid = (uint32_t)strtoul(owner, NULL, 10);
+    }
+    char pid[16];
+    snprintf(pid, sizeof(pid), "%d", (int)getpid());
+    setenv("CUDA_HOOK_TRACE_OWNER", pid, 1);
+    return origin;
+}
+
+// A descendant's custom control file gets the pid added, as its trace does;
+// the default one already has it
+const char* process_control_path(char* out, size_t size, const char* control) {
+    if (origin == PROCESS_START || strcmp(control, "1") == 0) {
+        return control;
+    }
+    char pid[16];
+    snprintf(pid, sizeof(pid), "%d", (int)getpid());
+    return trace_path_insert(out, size, control, pid) == 0 ? out : NULL;
+}
+
+static void write_process(int64_t now_ns) {
+    struct trace_process process = { now_ns, (uint32_t)getpid(), parent_pid, origin, 0 };
+    if (fork_format == TRACE_FORMAT_BINARY) {
+        trace_write_binary_process(fork_out, &process);
+    } else if (fork_format == TRACE_FORMAT_CHROME) {
+        chrome_process(&hook_chrome, &process);
+    } else {
+        trace_write_process_json(fork_out, &process);
+    }
+}
+
+// Drainer thread: every segment names its process
+void process_segment_start(int64_t now_ns) {
+    if (fork_out) {
+        write_process(now_ns);
+    }
+}
+
+static void prepare(void) {
+    pthread_mutex_lock(&restart_lock);
+    pthread_mutex_lock(&hook_strings.lock);
+    pthread_mutex_lock(&hook_functions.lock);
+    trace_rings_atfork(FORK_PREPARE);
+    aggregate_atfork(FORK_PREPARE);
+    alloc_atfork(FORK_PREPARE);
+    pinned_atfork(FORK_PREPARE);
+    stack_atfork(FORK_PREPARE);
+    gpu_timing_atfork(FORK_PREPARE);
+    segment_atfork(FORK_PREPARE);
+    control_atfork(FORK_PREPARE);
+    // Last: the drainer may be inside an fwrite, but never takes one of the
+    // locks above while it is
+    flockfile(fork_out);
+}
+
+static void release(enum fork_phase phase) {
+    collector_atfork(phase);
+    control_atfork(phase);
+    segment_atfork(phase);
+    gpu_timing_atfork(phase);
+    stack_atfork(phase);
+    pinned_atfork(phase);
+    alloc_atfork(phase);
+    aggregate_atfork(phase);
+    trace_rings_atfork(phase);
+    pthread_mutex_unlock(&hook_functions.lock);
+    pthread_mutex_unlock(&hook_strings.lock);
+    pthread_mutex_unlock(&restart_lock);
+}
+
+// glibc resets every stdio lock in the child before the handlers run, so
+// only the parent gives the trace FILE back
+static void parent(void) {
+    funlockfile(fork_out);
+    release(FORK_PARENT);
+}
+
+static void child(void) {
+    uint32_t forked_from = (uint32_t)getppid();
+    release(FORK_CHILD);
+
+    // The parent flushes its own buffer; this copy of it, and anything the
+    // child writes before it has a trace of its own, goes nowhere
+    __fpurge(fork_out);
+    int null_fd = collector_active ? -1 : open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (null_fd >= 0) {
+        dup3(null_fd, fileno(fork_out), O_CLOEXEC);
+        close(null_fd);
+    }
+
+    parent_pid = forked_from;
+    origin = PROCESS_FORK;
+    __atomic_store_n(&fork_restart_pending, 1, __ATOMIC_RELEASE);
+}
+
+// After the binary header, before the drainer starts
+int fork_tracking_start(FILE* out, enum trace_format format, const char* trace_path,
+                        enum process_origin how, const char* control) {
+    if (snprintf(base_path, sizeof(base_path), "%s", trace_path) >= (int)sizeof(base_path) ||
+        snprintf(control_spec, sizeof(control_spec), "%s", control ? control : "") >=
+            (int)sizeof(control_spec)) {
+        return -1;
+    }
+    fork_out = out;
+    fork_format = format;
+    origin = how;
+    write_process(monotonic_ns());
+
+    // stderr stands in for an unopenable JSON trace; a child must not
+    // point that at /dev/null, so it keeps writing there unchanged
+    if (out == stderr) {
+        return 0;
+    }
+    return pthread_atfork(prepare, parent, child) == 0 ? 0 : -1;
+}
+
+// The forked child's first recorded call: open its own trace and start a
+// drainer. Calls on other threads wait here until that is done.
+void fork_restart(void) {
+    pthread_mutex_lock(&restart_lock);
+    if (!__atomic_load_n(&fork_restart_pending, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_unlock(&restart_lock);
+        return;
+    }
+
+    // Not in the atfork handler, where another thread may have held the
+    // environment lock; until here an exec'd descendant names the parent
+    char pid[16], path[PATH_MAX];
+    snprintf(pid, sizeof(pid), "%d", (int)getpid());
+    setenv("CUDA_HOOK_TRACE_OWNER", pid, 1);
+    int rc;
+    if (collector_active) {
+        // Records keep going nowhere if this fails, as for a file below
+        rc = collector_reopen();
+        snprintf(path, sizeof(path), "the collector");
+    } else {
+        rc = trace_path_insert(path, sizeof(path), base_path, pid);
+        if (rc == 0) {
+            rc = segment_reopen(fork_out, path);
+        }
+        if (rc == 1) {
+            int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            rc = fd >= 0 && dup3(fd, fileno(fork_out), O_CLOEXEC) >= 0 ? 0 : -1;
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+        if (rc != 0) {
+            // Records keep going to /dev/null; the process still runs normally
+            fprintf(stderr, "[CUDA_HOOK] Failed to open child trace file: %s\n", path);
+        }
+    }
+
+    int64_t now_ns = monotonic_ns();
+    if (fork_format == TRACE_FORMAT_BINARY) {
+        uint32_t clock = hook_clock_tsc ? TRACE_CLOCK_TSC : TRACE_CLOCK_MONOTONIC;
+        trace_write_binary_header(fork_out, (uint32_t)getpid(), clock, now_ns);
+        if (hook_clock_tsc) {
+            trace_write_binary_clock(fork_out, &hook_clock_map.points[hook_clock_map.count - 1]);
+        }
+    } else if (fork_format == TRACE_FORMAT_CHROME) {
+        chrome_begin(&hook_chrome, program_invocation_short_name);
+    }
+    write_process(now_ns);
+    stack_segment_start(now_ns);
+    fflush(fork_out);
+
+    char control_path[PATH_MAX];
+    const char* control = control_spec[0]
+                              ? process_control_path(control_path, sizeof(control_path),
+                                                     control_spec) : NULL;
+    if (control && control_start(fork_out, fork_format, control) != 0) {
+        fprintf(stderr, "[CUDA_HOOK] Failed to create child control file, mode is fixed\n");
+    }
+
+    if (trace_rings_restart() != 0) {
+        fprintf(stderr, "[CUDA_HOOK] Failed to start child trace drainer\n");
+    } else if (rc == 0) {
+        fprintf(stderr, "[CUDA_HOOK] Child %s of %u tracing to %s\n", pid, parent_pid, path);
+    }
+    __atomic_store_n(&fork_restart_pending, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&restart_lock);
+}
@@ -0,0 +1,557 @@
+/*
+ * hook_gputime.c - Device-side kernel durations from pooled CUDA events
+ *
+ * A timed launch takes a slot from its stream's pool and records the slot's
+ * start event before the launch and its end event after it. The harvester
+ * thread walks each pool in slot order, stops at the first pair that has
+ * not completed, and turns finished pairs into REC_GPU_KERNEL records
+ * written through its own ring.
+ *
+ * Device timestamps are placed on the host clock through an anchor event
+ * per context: recorded on an idle private stream and synchronized, so its
+ * device time is taken as the midpoint of the host clock reads around it.
+ * Queue delay is measured from the launch call's entry to the kernel start.
+ *
+ * Launches into a stream that is being captured are not timed, since the
+ * event records would become nodes of the graph. A context's pools and
+ * anchor are retired before the context is destroyed (cuCtxDestroy, or the
+ * release or reset of a primary context), harvesting what has completed.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "cuda_hook.h"
+
+#define CU_STREAM_NON_BLOCKING 0x1
+#define CU_STREAM_CAPTURE_STATUS_NONE 0
+#define CU_STREAM_CAPTURE_MODE_RELAXED 2
+
+// Re-take a context's anchor this often to follow clock drift
+#define ANCHOR_INTERVAL_NS 10000000000LL
+
+enum slot_state {
+    SLOT_FREE,
+    SLOT_RECORDING,             // Handed to a launch, end event not recorded yet
+    SLOT_PENDING,               // Both events recorded
+    SLOT_FAILED,                // Launch failed; released by the harvester
+};
+
+struct gpu_slot {
+    CUevent start;
+    CUevent end;
+    uint64_t op_id;
+    int64_t launch_ts;          // Hook timestamp units
+    uint32_t tid;
+    uint32_t func;
+    int state;
+};
+
+struct gpu_context {
+    CUcontext ctx;
+    CUstream anchor_stream;
+    CUevent anchor;
+    int64_t anchor_ts;          // Hook timestamp units at the anchor
+    int64_t anchored_ns;        // CLOCK_MONOTONIC when taken
+    int ready;                  // Anchor taken; -1 if it cannot be
+    struct gpu_context* next;
+};
+
+struct gpu_stream {
+    struct gpu_context* ctx;
+    CUstream stream;
+    struct gpu_slot* slots;
+    uint32_t mask;
+    uint32_t head;              // Next slot to hand out, advanced under pool_lock
+    uint32_t tail;              // Next slot to harvest, harvester only
+    struct gpu_stream* next;
+};
+
+typedef CUresult (*event_create_fn)(CUevent*, unsigned int);
+typedef CUresult (*event_record_fn)(CUevent, CUstream);
+typedef CUresult (*event_query_fn)(CUevent);
+typedef CUresult (*event_sync_fn)(CUevent);
+typedef CUresult (*event_elapsed_fn)(float*, CUevent, CUevent);
+typedef CUresult (*event_destroy_fn)(CUevent);
+typedef CUresult (*ctx_get_current_fn)(CUcontext*);
+typedef CUresult (*ctx_push_fn)(CUcontext);
+typedef CUresult (*ctx_pop_fn)(CUcontext*);
+typedef CUresult (*stream_is_capturing_fn)(CUstream, int*);
+typedef CUresult (*exchange_capture_mode_fn)(int*);
+typedef CUresult (*primary_get_state_fn)(CUdevice, unsigned int*, int*);
+typedef CUresult (*primary_retain_fn)(CUcontext*, CUdevice);
+typedef CUresult (*primary_release_fn)(CUdevice);
+
+// Event entry points are not hooked; they are resolved from the same driver
+static struct {
+    event_create_fn create;
+    event_record_fn record;
+    event_query_fn query;
+    event_sync_fn synchronize;
+    event_elapsed_fn elapsed;
+    event_destroy_fn destroy;
+    ctx_get_current_fn ctx_get_current;
+    ctx_push_fn ctx_push;
+    ctx_pop_fn ctx_pop;
+    stream_is_capturing_fn is_capturing;
+    // Optional: before CUDA 10.1 there are no capture modes
+    exchange_capture_mode_fn exchange_capture_mode;
+    // Optional: primary contexts are then not retired
+    primary_get_state_fn primary_get_state;
+    primary_retain_fn primary_retain;
+    primary_release_fn primary_release;
+} drv;
+static pthread_once_t drv_once = PTHREAD_ONCE_INIT;
+static int drv_ok = 0;
+
+uint32_t gpu_timing_every = 0;
+__thread uint32_t tls_gpu_skip __attribute__((tls_model("initial-exec"))) = 0;
+
+// Pools and contexts are added under pool_lock, at the head, and removed
+// under both locks by retire_context. The harvester holds harvest_lock for
+// each pass, so it walks both lists without pool_lock.
+static struct gpu_stream* pools = NULL;
+static struct gpu_context* contexts = NULL;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t harvest_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t pool_slots = 0;
+static long harvest_interval_us = 0;
+static pthread_t harvester_thread;
+static int harvester_stop = 0;
+static int harvester_running = 0;
+static uint64_t skipped = 0;    // Pool full or event record failed
+static uint64_t lost = 0;       // Pairs that never completed
+
+static void resolve_events(void) {
+    drv.create = (event_create_fn)hook_driver_symbol("cuEventCreate");
+    drv.record = (event_record_fn)hook_driver_symbol("cuEventRecord");
+    drv.query = (event_query_fn)hook_driver_symbol("cuEventQuery");
+    drv.synchronize = (event_sync_fn)hook_driver_symbol("cuEventSynchronize");
+    drv.elapsed = (event_elapsed_fn)hook_driver_symbol("cuEventElapsedTime");
+    drv.destroy = (event_destroy_fn)hook_driver_symbol("cuEventDestroy_v2");
+    drv.ctx_get_current = (ctx_get_current_fn)hook_driver_symbol("cuCtxGetCurrent");
+    drv.ctx_push = (ctx_push_fn)hook_driver_symbol("cuCtxPushCurrent_v2");
+    drv.ctx_pop = (ctx_pop_fn)hook_driver_symbol("cuCtxPopCurrent_v2");
+    drv.is_capturing = (stream_is_capturing_fn)hook_driver_symbol("cuStreamIsCapturing");
+    drv.exchange_capture_mode =
+        (exchange_capture_mode_fn)hook_driver_symbol("cuThreadExchangeStreamCaptureMode");
+    drv.primary_get_state = (primary_get_state_fn)hook_driver_symbol("cuDevicePrimaryCtxGetState");
+    drv.primary_retain = (primary_retain_fn)hook_driver_symbol("cuDevicePrimaryCtxRetain");
+    drv.primary_release = (primary_release_fn)hook_driver_symbol("cuDevicePrimaryCtxRelease_v2");
+    drv_ok = drv.create && drv.record && drv.query && drv.synchronize && drv.elapsed &&
+             drv.destroy && drv.ctx_get_current && drv.ctx_push && drv.ctx_pop &&
+             drv.is_capturing;
+    if (!drv_ok) {
+        fprintf(stderr, "[CUDA_HOOK] Driver lacks the event API, GPU timing disabled\n");
+        __atomic_store_n(&gpu_timing_every, 0, __ATOMIC_RELAXED);
+    }
+}
+
+static int64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Events of slots that were created; the rest are NULL
+static void destroy_slots(struct gpu_slot* slots, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (slots[i].start) {
+            drv.destroy(slots[i].start);
+        }
+        if (slots[i].end) {
+            drv.destroy(slots[i].end);
+        }
+    }
+}
+
+// Caller holds pool_lock and has ctx current
+static struct gpu_stream* pool_create(CUcontext ctx, CUstream stream) {
+    struct gpu_context* gctx = contexts;
+    while (gctx && gctx->ctx != ctx) {
+        gctx = gctx->next;
+    }
+    if (!gctx) {
+        gctx = calloc(1, sizeof(*gctx));
+        if (!gctx) {
+            return NULL;
+        }
+        gctx->ctx = ctx;
+        gctx->next = contexts;
+        __atomic_store_n(&contexts, gctx, __ATOMIC_RELEASE);
+    }
+
+    struct gpu_stream* pool = calloc(1, sizeof(*pool));
+    struct gpu_slot* slots = calloc(pool_slots, sizeof(*slots));
+    if (!pool || !slots) {
+        free(pool);
+        free(slots);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < pool_slots; i++) {
+        if (drv.create(&slots[i].start, 0) != CUDA_SUCCESS ||
+            drv.create(&slots[i].end, 0) != CUDA_SUCCESS) {
+            destroy_slots(slots, pool_slots);
+            free(slots);
+            free(pool);
+            return NULL;
+        }
+    }
+
+    pool->ctx = gctx;
+    pool->stream = stream;
+    pool->slots = slots;
+    pool->mask = pool_slots - 1;
+    pool->next = pools;
+    __atomic_store_n(&pools, pool, __ATOMIC_RELEASE);
+    return pool;
+}
+
+// Launching thread, before the real launch: take a slot and record its
+// start event on the launch stream
+struct gpu_slot* gpu_timing_record_start(CUstream stream) {
+    pthread_once(&drv_once, resolve_events);
+    if (!drv_ok) {
+        return NULL;
+    }
+
+    CUcontext ctx = NULL;
+    if (drv.ctx_get_current(&ctx) != CUDA_SUCCESS || !ctx) {
+        return NULL;
+    }
+    // Fails too when the legacy stream cannot be used during another
+    // thread's capture
+    int capture = CU_STREAM_CAPTURE_STATUS_NONE;
+    if (drv.is_capturing(stream, &capture) != CUDA_SUCCESS ||
+        capture != CU_STREAM_CAPTURE_STATUS_NONE) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    struct gpu_stream* pool = pools;
+    while (pool && (pool->ctx->ctx != ctx || pool->stream != stream)) {
+        pool = pool->next;
+    }
+    if (!pool) {
+        pool = pool_create(ctx, stream);
+    }
+
+    struct gpu_slot* slot = NULL;
+    if (pool && pool->head - __atomic_load_n(&pool->tail, __ATOMIC_ACQUIRE) <= pool->mask) {
+        slot = &pool->slots[pool->head & pool->mask];
+        slot->state = SLOT_RECORDING;
+        __atomic_store_n(&pool->head, pool->head + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    if (!slot) {
+        __atomic_fetch_add(&skipped, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    if (drv.record(slot->start, stream) != CUDA_SUCCESS) {
+        __atomic_fetch_add(&skipped, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->state, SLOT_FAILED, __ATOMIC_RELEASE);
+        return NULL;
+    }
+    return slot;
+}
+
+// Launching thread, after the real launch
+void gpu_timing_record_end(struct gpu_slot* slot, CUstream stream, CUfunction func,
+                           uint64_t op_id, int64_t launch_ts, CUresult result) {
+    if (result != CUDA_SUCCESS || drv.record(slot->end, stream) != CUDA_SUCCESS) {
+        __atomic_store_n(&slot->state, SLOT_FAILED, __ATOMIC_RELEASE);
+        return;
+    }
+    slot->op_id = op_id;
+    slot->launch_ts = launch_ts;
+    slot->tid = (uint32_t)syscall(SYS_gettid);
+    slot->func = func_table_lookup(&hook_functions, (uintptr_t)func);
+    if (!slot->func) {
+        slot->func = func_table_register(&hook_functions, (uintptr_t)func, 0);
+    }
+    __atomic_store_n(&slot->state, SLOT_PENDING, __ATOMIC_RELEASE);
+}
+
+// Harvester: pin the context's device clock to the host clock
+static int take_anchor(struct gpu_context* gctx, int64_t now_ns) {
+    if (gctx->ready < 0) {
+        return -1;
+    }
+    if (gctx->ready && now_ns - gctx->anchored_ns < ANCHOR_INTERVAL_NS) {
+        return 0;
+    }
+    if (!gctx->ready &&
+        (hook_real.cuStreamCreate(&gctx->anchor_stream, CU_STREAM_NON_BLOCKING) != CUDA_SUCCESS ||
+         drv.create(&gctx->anchor, 0) != CUDA_SUCCESS)) {
+        fprintf(stderr, "[CUDA_HOOK] Cannot create GPU timing anchor, context %p skipped\n",
+                gctx->ctx);
+        gctx->ready = -1;
+        return -1;
+    }
+
+    int64_t before = hook_timestamp();
+    if (drv.record(gctx->anchor, gctx->anchor_stream) != CUDA_SUCCESS ||
+        drv.synchronize(gctx->anchor) != CUDA_SUCCESS) {
+        return gctx->ready ? 0 : -1;    // Keep the previous anchor if there is one
+    }
+    int64_t after = hook_timestamp();
+
+    gctx->anchor_ts = before + (after - before) / 2;
+    gctx->anchored_ns = now_ns;
+    gctx->ready = 1;
+    return 0;
+}
+
+static void emit(const struct gpu_stream* pool, const struct gpu_slot* slot,
+                 float start_ms, float run_ms) {
+    struct hook_event* ev = trace_reserve();
+    if (!ev) {
+        return;
+    }
+    int64_t start = pool->ctx->anchor_ts + hook_clock_from_ns((int64_t)(start_ms * 1e6));
+    ev->ts = start;
+    ev->end = start + hook_clock_from_ns((int64_t)(run_ms * 1e6));
+    ev->op_id = slot->op_id;
+    ev->tid = slot->tid;
+    ev->api = REC_GPU_KERNEL;
+    ev->status = CUDA_SUCCESS;
+    ev->args.gpu.stream = (uintptr_t)pool->stream;
+    ev->args.gpu.func = slot->func;
+    ev->args.gpu.reserved = 0;
+    ev->args.gpu.device_ns = (int64_t)(run_ms * 1e6);
+    ev->args.gpu.queue_ns = hook_clock_to_ns(start - slot->launch_ts);
+    trace_commit();
+}
+
+// Harvest one pool in slot order; returns the number of slots released
+static size_t harvest_pool(struct gpu_stream* pool, int final) {
+    size_t released = 0;
+    uint32_t tail = pool->tail;
+
+    for (;;) {
+        if (tail == __atomic_load_n(&pool->head, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+
+        struct gpu_slot* slot = &pool->slots[tail & pool->mask];
+        int state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+        if (state == SLOT_RECORDING) {
+            break;              // Launch still in progress
+        }
+        if (state == SLOT_PENDING) {
+            CUresult rc = drv.query(slot->end);
+            if (rc == CUDA_ERROR_NOT_READY && !final) {
+                break;
+            }
+            float start_ms, run_ms;
+            if (rc == CUDA_SUCCESS &&
+                drv.elapsed(&start_ms, pool->ctx->anchor, slot->start) == CUDA_SUCCESS &&
+                drv.elapsed(&run_ms, slot->start, slot->end) == CUDA_SUCCESS) {
+                emit(pool, slot, start_ms, run_ms);
+            } else {
+                lost++;
+            }
+        }
+
+        slot->state = SLOT_FREE;
+        tail++;
+        released++;
+        __atomic_store_n(&pool->tail, tail, __ATOMIC_RELEASE);
+    }
+    return released;
+}
+
+// Harvester, under harvest_lock
+static size_t harvest_all(int final) {
+    size_t released = 0;
+    int64_t now_ns = monotonic_ns();
+
+    for (struct gpu_stream* pool = __atomic_load_n(&pools, __ATOMIC_ACQUIRE); pool;
+         pool = pool->next) {
+        if (pool->tail == __atomic_load_n(&pool->head, __ATOMIC_RELAXED)) {
+            continue;
+        }
+        if (hook_real.cuCtxSetCurrent(pool->ctx->ctx) != CUDA_SUCCESS ||
+            take_anchor(pool->ctx, now_ns) != 0) {
+            continue;
+        }
+        released += harvest_pool(pool, final);
+    }
+    return released;
+}
+
+static void* harvester_main(void* arg) {
+    (void)arg;
+    struct timespec interval = {
+        .tv_sec = harvest_interval_us / 1000000,
+        .tv_nsec = (harvest_interval_us % 1000000) * 1000,
+    };
+
+    // Nothing the harvester calls may invalidate another thread's capture
+    pthread_once(&drv_once, resolve_events);
+    if (drv.exchange_capture_mode) {
+        int mode = CU_STREAM_CAPTURE_MODE_RELAXED;
+        drv.exchange_capture_mode(&mode);
+    }
+
+    while (!__atomic_load_n(&harvester_stop, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&harvest_lock);
+        size_t released = harvest_all(0);
+        pthread_mutex_unlock(&harvest_lock);
+        if (released == 0) {
+            nanosleep(&interval, NULL);
+        }
+    }
+    pthread_mutex_lock(&harvest_lock);
+    harvest_all(1);
+    pthread_mutex_unlock(&harvest_lock);
+    return NULL;
+}
+
+// Application thread, before ctx is destroyed: unlink its pools, harvest
+// what has completed and free their events. A launch into ctx racing with
+// its destruction is the application's error.
+static void retire_context(CUcontext ctx) {
+    pthread_mutex_lock(&harvest_lock);
+    pthread_mutex_lock(&pool_lock);
+    struct gpu_context** gp = &contexts;
+    while (*gp && (*gp)->ctx != ctx) {
+        gp = &(*gp)->next;
+    }
+    struct gpu_context* gctx = *gp;
+    struct gpu_stream* retired = NULL;
+    if (gctx) {
+        *gp = gctx->next;
+        for (struct gpu_stream** pp = &pools; *pp;) {
+            struct gpu_stream* pool = *pp;
+            if (pool->ctx == gctx) {
+                *pp = pool->next;
+                pool->next = retired;
+                retired = pool;
+            } else {
+                pp = &pool->next;
+            }
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    if (gctx) {
+        // Without the context current nothing can be released; the driver
+        // frees the events along with it
+        CUcontext popped;
+        int pushed = drv.ctx_push(ctx) == CUDA_SUCCESS;
+        int64_t now_ns = monotonic_ns();
+        while (retired) {
+            struct gpu_stream* pool = retired;
+            retired = pool->next;
+            if (pushed && pool->tail != pool->head && take_anchor(gctx, now_ns) == 0) {
+                harvest_pool(pool, 1);
+            }
+            if (pushed) {
+                destroy_slots(pool->slots, pool->mask + 1);
+            }
+            free(pool->slots);
+            free(pool);
+        }
+        if (pushed) {
+            if (gctx->anchor) {
+                drv.destroy(gctx->anchor);
+            }
+            if (gctx->anchor_stream) {
+                hook_real.cuStreamDestroy(gctx->anchor_stream);
+            }
+            drv.ctx_pop(&popped);
+        }
+        free(gctx);
+    }
+    pthread_mutex_unlock(&harvest_lock);
+}
+
+void gpu_timing_context_destroyed(CUcontext ctx) {
+    if (!__atomic_load_n(&contexts, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    retire_context(ctx);
+}
+
+// The primary context is destroyed when its last reference goes, which the
+// driver does not report, so it is retired on every release. Its handle is
+// found by taking and dropping a reference while it is still active.
+void gpu_timing_primary_released(CUdevice dev) {
+    if (!__atomic_load_n(&contexts, __ATOMIC_ACQUIRE) || !drv.primary_get_state ||
+        !drv.primary_retain || !drv.primary_release) {
+        return;
+    }
+    unsigned int flags;
+    int active = 0;
+    CUcontext primary = NULL;
+    if (drv.primary_get_state(dev, &flags, &active) != CUDA_SUCCESS || !active ||
+        drv.primary_retain(&primary, dev) != CUDA_SUCCESS) {
+        return;
+    }
+    drv.primary_release(dev);
+    retire_context(primary);
+}
+
+int gpu_timing_start(long every, long pool_events, long poll_us) {
+    uint32_t slots = 1;
+    while (slots < (uint32_t)pool_events) {
+        slots <<= 1;
+    }
+    pool_slots = slots;
+    harvest_interval_us = poll_us;
+
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int rc = pthread_create(&harvester_thread, NULL, harvester_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rc != 0) {
+        return -1;
+    }
+
+    harvester_running = 1;
+    __atomic_store_n(&gpu_timing_every, (uint32_t)every, __ATOMIC_RELAXED);
+    return 0;
+}
+
+// A forked child cannot use its parent's contexts or events, and has no
+// harvester: device timing stays off there
+void gpu_timing_atfork(enum fork_phase phase) {
+    if (phase == FORK_PREPARE) {
+        pthread_mutex_lock(&pool_lock);
+        return;
+    }
+    if (phase == FORK_CHILD) {
+        __atomic_store_n(&gpu_timing_every, 0, __ATOMIC_RELAXED);
+        harvester_running = 0;
+        pools = NULL;
+        contexts = NULL;
+        harvest_lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+// Before the rings stop, so the last completions are still drained
+void gpu_timing_stop(void) {
+    if (!harvester_running) {
+        return;
+    }
+    __atomic_store_n(&gpu_timing_every, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&harvester_stop, 1, __ATOMIC_RELEASE);
+    pthread_join(harvester_thread, NULL);
+    harvester_running = 0;
+
+    if (skipped || lost) {
+        fprintf(stderr, "[CUDA_HOOK] GPU timing: %llu launches not timed (pool full), "
+                "%llu timings lost\n", (unsigned long long)skipped, (unsigned long long)lost);
+    }
+}
@@ -0,0 +1,208 @@
+/*
+ * hook_pinned.c - Page-locked host ranges, for tagging host copies
+ *
+ * cuMemHostAlloc, cuMemAllocHost and cuMemHostRegister add a range;
+ * cuMemFreeHost and cuMemHostUnregister remove it again by its start
+ * address. The ranges are kept in an interval tree - an AVL tree keyed by
+ * start whose nodes also hold the largest end in their subtree - under a
+ * reader-writer lock, since copies only read it and pinning is rare next to
+ * copying. A copy whose host buffer lies entirely inside one range is
+ * pinned; anything else goes through the driver's staging buffers.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+
+#include "cuda_hook.h"
+
+struct pinned_node {
+    uint64_t start;
+    uint64_t end;
+    uint64_t max_end;           // Largest end in this subtree
+    int height;
+    struct pinned_node* left;
+    struct pinned_node* right;
+};
+
+static pthread_rwlock_t pinned_lock = PTHREAD_RWLOCK_INITIALIZER;
+static struct pinned_node* pinned_root = NULL;
+static uint32_t pinned_count = 0;   // Ranges in the tree, under the lock
+static int pinned_any = 0;          // Lets copies skip the lock while nothing is pinned
+
+static int height(const struct pinned_node* n) {
+    return n ? n->height : 0;
+}
+
+static void update(struct pinned_node* n) {
+    int hl = height(n->left);
+    int hr = height(n->right);
+    n->height = (hl > hr ? hl : hr) + 1;
+    n->max_end = n->end;
+    if (n->left && n->left->max_end > n->max_end) {
+        n->max_end = n->left->max_end;
+    }
+    if (n->right && n->right->max_end > n->max_end) {
+        n->max_end = n->right->max_end;
+    }
+}
+
+static struct pinned_node* rotate_right(struct pinned_node* n) {
+    struct pinned_node* l = n->left;
+    n->left = l->right;
+    l->right = n;
+    update(n);
+    update(l);
+    return l;
+}
+
+static struct pinned_node* rotate_left(struct pinned_node* n) {
+    struct pinned_node* r = n->right;
+    n->right = r->left;
+    r->left = n;
+    update(n);
+    update(r);
+    return r;
+}
+
+static struct pinned_node* rebalance(struct pinned_node* n) {
+    update(n);
+    int balance = height(n->left) - height(n->right);
+    if (balance > 1) {
+        if (height(n->left->left) < height(n->left->right)) {
+            n->left = rotate_left(n->left);
+        }
+        return rotate_right(n);
+    }
+    if (balance < -1) {
+        if (height(n->right->right) < height(n->right->left)) {
+            n->right = rotate_right(n->right);
+        }
+        return rotate_left(n);
+    }
+    return n;
+}
+
+// A range registered again at the same start replaces the old one
+static struct pinned_node* insert(struct pinned_node* n, struct pinned_node* node) {
+    if (!n) {
+        pinned_count++;
+        return node;
+    }
+    if (node->start < n->start) {
+        n->left = insert(n->left, node);
+    } else if (node->start > n->start) {
+        n->right = insert(n->right, node);
+    } else {
+        n->end = node->end;
+        free(node);
+    }
+    return rebalance(n);
+}
+
+static struct pinned_node* remove_min(struct pinned_node* n, struct pinned_node** min) {
+    if (!n->left) {
+        *min = n;
+        return n->right;
+    }
+    n->left = remove_min(n->left, min);
+    return rebalance(n);
+}
+
+static struct pinned_node* erase(struct pinned_node* n, uint64_t start) {
+    if (!n) {
+        return NULL;
+    }
+    if (start < n->start) {
+        n->left = erase(n->left, start);
+    } else if (start > n->start) {
+        n->right = erase(n->right, start);
+    } else {
+        struct pinned_node* left = n->left;
+        struct pinned_node* right = n->right;
+        free(n);
+        pinned_count--;
+        if (!right) {
+            return left;
+        }
+        struct pinned_node* min;
+        right = remove_min(right, &min);
+        min->left = left;
+        min->right = right;
+        n = min;
+    }
+    return rebalance(n);
+}
+
+void pinned_add(uint64_t ptr, uint64_t size) {
+    struct pinned_node* node = calloc(1, sizeof(*node));
+    if (!node) {
+        return;
+    }
+    node->start = ptr;
+    node->end = ptr + size;
+    node->max_end = node->end;
+    node->height = 1;
+
+    pthread_rwlock_wrlock(&pinned_lock);
+    pinned_root = insert(pinned_root, node);
+    __atomic_store_n(&pinned_any, pinned_count != 0, __ATOMIC_RELAXED);
+    pthread_rwlock_unlock(&pinned_lock);
+}
+
+void pinned_remove(uint64_t ptr) {
+    pthread_rwlock_wrlock(&pinned_lock);
+    pinned_root = erase(pinned_root, ptr);
+    __atomic_store_n(&pinned_any, pinned_count != 0, __ATOMIC_RELAXED);
+    pthread_rwlock_unlock(&pinned_lock);
+}
+
+static void free_tree(struct pinned_node* n) {
+    if (n) {
+        free_tree(n->left);
+        free_tree(n->right);
+        free(n);
+    }
+}
+
+// Pinning does not carry over into a forked child: the pages are plain
+// copy-on-write memory there. glibc records an rwlock's writer by thread id,
+// which the child's only thread does not share, so the child starts over
+// with a fresh lock instead of unlocking the inherited one.
+void pinned_atfork(enum fork_phase phase) {
+    if (phase == FORK_PREPARE) {
+        pthread_rwlock_wrlock(&pinned_lock);
+        return;
+    }
+    if (phase == FORK_CHILD) {
+        free_tree(pinned_root);
+        pinned_root = NULL;
+        pinned_count = 0;
+        __atomic_store_n(&pinned_any, 0, __ATOMIC_RELAXED);
+        pinned_lock = (pthread_rwlock_t)PTHREAD_RWLOCK_INITIALIZER;
+        return;
+    }
+    pthread_rwlock_unlock(&pinned_lock);
+}
+
+uint8_t pinned_classify(uint64_t ptr, uint64_t size) {
+    if (!__atomic_load_n(&pinned_any, __ATOMIC_RELAXED)) {
+        return HOOK_HOST_PAGEABLE;
+    }
+
+    // Interval search: a left subtree that reaches past ptr either holds
+    // the range or proves no range to the right can
+    uint8_t kind = HOOK_HOST_PAGEABLE;
+    pthread_rwlock_rdlock(&pinned_lock);
+    const struct pinned_node* n = pinned_root;
+    while (n && n->max_end > ptr) {
+        if (n->start <= ptr && ptr < n->end) {
+            if (ptr + size <= n->end) {
+                kind = HOOK_HOST_PINNED;
+            }
+            break;
+        }
+        n = (n->left && n->left->max_end > ptr) ? n->left : n->right;
+    }
+    pthread_rwlock_unlock(&pinned_lock);
+    return kind;
+}
@@ -0,0 +1,243 @@
+/*
+ * hook_procaddr.c - Hooks handed out through cuGetProcAddress
+ *
+ * Since CUDA 11.3 libcudart loads libcuda itself, fetches cuGetProcAddress
+ * with dlsym() on that handle and asks it for every other entry point, so
+ * neither call ever reaches the exported hooks. The dlsym() below swaps in
+ * the wrappers for the two cuGetProcAddress symbols only; the wrappers ask
+ * the driver and replace its answer with the hook when the pointer is the
+ * very entry point hook_real forwards to. Anything else - APIs without a
+ * hook, other ABI versions (cuCtxCreate_v3, 32-bit pre-3.2 variants), the
+ * _ptsz/_ptds per-thread default stream variants - is returned as the
+ * driver gave it and costs nothing.
+ *
+ * glibc resolves RTLD_NEXT, and the caller's own scope for RTLD_DEFAULT,
+ * from dlsym's return address, so every other lookup must reach the real
+ * dlsym with the caller's: the exported dlsym is a stub that asks
+ * dlsym_target() where the call goes and jumps there with the arguments and
+ * return address untouched. The stub exists for x86-64 and AArch64; on
+ * other architectures dlsym is left alone and only callers of the exported
+ * cuGetProcAddress get the hooks through it.
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "cuda_hook.h"
+
+typedef CUresult (*get_proc_address_fn)(const char* symbol, void** pfn, int cuda_version,
+                                        uint64_t flags);
+typedef CUresult (*get_proc_address_v2_fn)(const char* symbol, void** pfn, int cuda_version,
+                                           uint64_t flags, int* symbol_status);
+typedef void* (*dlsym_fn)(void* handle, const char* symbol);
+
+CUresult cuGetProcAddress(const char* symbol, void** pfn, int cuda_version, uint64_t flags);
+CUresult cuGetProcAddress_v2(const char* symbol, void** pfn, int cuda_version, uint64_t flags,
+                             int* symbol_status);
+
+// The hooks in cuda_hook.c, under the symbols they are exported as
+#define HOOK_API(name, category, versioned, ret, params, args) \
+    ret name params __asm__(HOOK_SYMBOL_##versioned(name));
+#include "hook_apis.h"
+#undef HOOK_API
+
+// One entry per hooked API: the name cuGetProcAddress is asked for, where
+// hook_real keeps the driver's pointer, and the hook to return instead
+struct proc_hook {
+    const char* name;
+    size_t real_offset;
+    void* hook;
+};
+
+static const struct proc_hook proc_hooks[] = {
+#define HOOK_API(name, category, versioned, ret, params, args) \
+    { #name, offsetof(struct hook_dispatch, name), (void*)name },
+#include "hook_apis.h"
+#undef HOOK_API
+};
+
+static get_proc_address_fn real_get_proc_address = NULL;
+static get_proc_address_v2_fn real_get_proc_address_v2 = NULL;
+static pthread_once_t resolve_once = PTHREAD_ONCE_INIT;
+
+#if defined(__x86_64__) || defined(__aarch64__)
+#define HOOK_DLSYM 1
+#endif
+
+#ifdef HOOK_DLSYM
+const int hook_dlsym_interposed = 1;
+#else
+const int hook_dlsym_interposed = 0;
+#endif
+
+#ifdef HOOK_DLSYM
+// dlsym's version before glibc 2.34 moved it into libc, per architecture
+#if defined(__x86_64__)
+#define DLSYM_BASE_VERSION "GLIBC_2.2.5"
+#else
+#define DLSYM_BASE_VERSION "GLIBC_2.17"
+#endif
+
+static dlsym_fn real_dlsym = NULL;
+
+static dlsym_fn get_real_dlsym(void) {
+    dlsym_fn fn = __atomic_load_n(&real_dlsym, __ATOMIC_ACQUIRE);
+    if (!fn) {
+        fn = (dlsym_fn)dlvsym(RTLD_NEXT, "dlsym", "GLIBC_2.34");
+        if (!fn) {
+            fn = (dlsym_fn)dlvsym(RTLD_NEXT, "dlsym", DLSYM_BASE_VERSION);
+        }
+        __atomic_store_n(&real_dlsym, fn, __ATOMIC_RELEASE);
+    }
+    return fn;
+}
+#else
+static dlsym_fn get_real_dlsym(void) {
+    return dlsym;
+}
+#endif
+
+static void resolve_get_proc_address(void) {
+    void* handle = hook_driver_handle();
+    dlsym_fn lookup = get_real_dlsym();
+    if (!handle || !lookup) {
+        return;
+    }
+    real_get_proc_address = (get_proc_address_fn)lookup(handle, "cuGetProcAddress");
+    real_get_proc_address_v2 = (get_proc_address_v2_fn)lookup(handle, "cuGetProcAddress_v2");
+}
+
+// The hook for `symbol` if the driver resolved it to the entry point the
+// hook forwards to, otherwise the driver's pointer
+static void* redirect(const char* symbol, void* fn) {
+    if (!symbol || !fn) {
+        return fn;
+    }
+    if (strcmp(symbol, "cuGetProcAddress") == 0) {
+        if (fn == (void*)real_get_proc_address) {
+            return (void*)cuGetProcAddress;
+        }
+        if (fn == (void*)real_get_proc_address_v2) {
+            return (void*)cuGetProcAddress_v2;
+        }
+        return fn;
+    }
+
+    for (size_t i = 0; i < sizeof(proc_hooks) / sizeof(proc_hooks[0]); i++) {
+        if (strcmp(symbol, proc_hooks[i].name) == 0) {
+            void* real;
+            memcpy(&real, (const char*)&hook_real + proc_hooks[i].real_offset, sizeof(real));
+            return real == fn ? proc_hooks[i].hook : fn;
+        }
+    }
+    return fn;
+}
+
+CUresult cuGetProcAddress(const char* symbol, void** pfn, int cuda_version, uint64_t flags) {
+    pthread_once(&resolve_once, resolve_get_proc_address);
+    if (!real_get_proc_address) {
+        return CUDA_ERROR_NOT_FOUND;
+    }
+    CUresult result = real_get_proc_address(symbol, pfn, cuda_version, flags);
+    if (result == CUDA_SUCCESS && pfn) {
+        *pfn = redirect(symbol, *pfn);
+    }
+    return result;
+}
+
+CUresult cuGetProcAddress_v2(const char* symbol, void** pfn, int cuda_version, uint64_t flags,
+                             int* symbol_status) {
+    pthread_once(&resolve_once, resolve_get_proc_address);
+    if (!real_get_proc_address_v2) {
+        return CUDA_ERROR_NOT_FOUND;
+    }
+    CUresult result = real_get_proc_address_v2(symbol, pfn, cuda_version, flags, symbol_status);
+    if (result == CUDA_SUCCESS && pfn) {
+        *pfn = redirect(symbol, *pfn);
+    }
+    return result;
+}
+
+#ifdef HOOK_DLSYM
+// Targets of the dlsym stub, called as dlsym would have been
+static void* get_proc_address_hook(void* handle, const char* symbol) {
+    return (void*)cuGetProcAddress;
+}
+
+static void* get_proc_address_v2_hook(void* handle, const char* symbol) {
+    return (void*)cuGetProcAddress_v2;
+}
+
+static void* no_dlsym(void* handle, const char* symbol) {
+    return NULL;
+}
+
+// Where the stub sends dlsym(handle, symbol): the real dlsym, or for a
+// cuGetProcAddress symbol the handle has, a target returning its wrapper
+__attribute__((visibility("hidden"), used))
+dlsym_fn dlsym_target(void* handle, const char* symbol) {
+    dlsym_fn lookup = get_real_dlsym();
+    if (!lookup) {
+        return no_dlsym;
+    }
+    if (symbol && strncmp(symbol, "cuGetProcAddress", 16) == 0 && lookup(handle, symbol)) {
+        if (symbol[16] == '\0') {
+            return get_proc_address_hook;
+        }
+        if (strcmp(symbol + 16, "_v2") == 0) {
+            return get_proc_address_v2_hook;
+        }
+    }
+    return lookup;
+}
+
+// void* dlsym(void* handle, const char* symbol): keep the arguments across
+// the call to dlsym_target, then tail-jump to what it returned
+#if defined(__x86_64__)
+__asm__(".text\n"
+        ".globl dlsym\n"
+        ".type dlsym, @function\n"
+        "dlsym:\n"
+        "    .cfi_startproc\n"
+        "    pushq %rdi\n"
+        "    .cfi_adjust_cfa_offset 8\n"
+        "    pushq %rsi\n"
+        "    .cfi_adjust_cfa_offset 8\n"
+        "    subq $8, %rsp\n"
+        "    .cfi_adjust_cfa_offset 8\n"
+        "    call dlsym_target\n"
+        "    addq $8, %rsp\n"
+        "    .cfi_adjust_cfa_offset -8\n"
+        "    popq %rsi\n"
+        "    .cfi_adjust_cfa_offset -8\n"
+        "    popq %rdi\n"
+        "    .cfi_adjust_cfa_offset -8\n"
+        "    jmp *%rax\n"
+        "    .cfi_endproc\n"
+        ".size dlsym, .-dlsym\n");
+#else
+__asm__(".text\n"
+        ".globl dlsym\n"
+        ".type dlsym, %function\n"
+        "dlsym:\n"
+        "    .cfi_startproc\n"
+        "    stp x29, x30, [sp, #-32]!\n"
+        "    .cfi_def_cfa_offset 32\n"
+        "    .cfi_offset 29, -32\n"
+        "    .cfi_offset 30, -24\n"
+        "    mov x29, sp\n"
+        "    stp x0, x1, [sp, #16]\n"
+        "    bl dlsym_target\n"
+        "    mov x16, x0\n"
+        "    ldp x0, x1, [sp, #16]\n"
+        "    ldp x29, x30, [sp], #32\n"
+        "    .cfi_restore 29\n"
+        "    .cfi_restore 30\n"
+        "    .cfi_def_cfa_offset 0\n"
+        "    br x16\n"
+        "    .cfi_endproc\n"
+        ".size dlsym, .-dlsym\n");
+#endif
+#endif
@@ -0,0 +1,203 @@
+/*
+ * hook_sample.c - Per-API sampling of trace records
+ *
+ * Three knobs, all off by default:
+ *   - a fixed 1-in-N per API, counted per thread (sample_take() in cuda_hook.h)
+ *   - a cap on records per second per API, shared by all threads
+ *   - an adaptive controller in the drainer that doubles an API's N while
+ *     the time spent recording exceeds a fraction of wall time, and halves
+ *     it again once there is room
+ *
+ * Specs name APIs, categories from hook_apis.h or "*", e.g.
+ * "cuLaunchKernel=100,transfer=10".
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cuda_hook.h"
+
+// How often the adaptive controller looks at the overhead
+#define ADAPT_INTERVAL_NS 100000000
+// Largest adaptive multiplier on top of the fixed 1-in-N
+#define ADAPT_MAX_FACTOR  (1u << 16)
+
+int hook_sampling = 0;
+int sample_adaptive = 0;
+uint32_t sample_every[API_COUNT];
+uint32_t sample_rate_cap[API_COUNT];
+__thread uint32_t tls_sample_skip[API_COUNT] __attribute__((tls_model("initial-exec")));
+
+// Rate cap accounting: one-second windows of coarse monotonic time
+struct rate_window {
+    int64_t start_ns;
+    uint64_t count;
+} __attribute__((aligned(64)));
+
+static struct rate_window rate_windows[API_COUNT];
+
+static uint32_t fixed_every[API_COUNT];
+static uint32_t adaptive_factor[API_COUNT];
+static double overhead_target = 0;
+static uint64_t last_overhead[API_COUNT];
+static int64_t last_adapt_ns = 0;
+
+// Parse "key=value,..." and apply value to every API the key names.
+// Returns -1 on a malformed entry or a key that matches nothing.
+int sample_parse_spec(const char* spec, const char* env, uint32_t* out) {
+    char* copy = strdup(spec);
+    if (!copy) {
+        return -1;
+    }
+
+    int rc = 0;
+    char* save = NULL;
+    for (char* item = strtok_r(copy, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+        char* eq = strchr(item, '=');
+        char* endp = NULL;
+        unsigned long value = eq ? strtoul(eq + 1, &endp, 10) : 0;
+        if (!eq || endp == eq + 1 || *endp != '\0' || value == 0 || value > UINT32_MAX) {
+            fprintf(stderr, "[CUDA_HOOK] Bad %s entry '%s'\n", env, item);
+            rc = -1;
+            continue;
+        }
+        *eq = '\0';
+
+        int matched = 0;
+        for (uint16_t api = 0; api < API_COUNT; api++) {
+            if (strcmp(item, "*") == 0 || strcmp(item, hook_api_names[api]) == 0 ||
+                strcmp(item, hook_api_categories[api]) == 0) {
+                out[api] = (uint32_t)value;
+                matched = 1;
+            }
+        }
+        if (!matched) {
+            fprintf(stderr, "[CUDA_HOOK] %s: no API or category named '%s'\n", env, item);
+            rc = -1;
+        }
+    }
+
+    free(copy);
+    return rc;
+}
+
+int sample_configure(const char* every_spec, const char* rate_spec, double target) {
+    for (uint16_t api = 0; api < API_COUNT; api++) {
+        fixed_every[api] = 1;
+        adaptive_factor[api] = 1;
+        sample_rate_cap[api] = 0;
+    }
+
+    int rc = 0;
+    if (every_spec && *every_spec &&
+        sample_parse_spec(every_spec, "CUDA_HOOK_SAMPLE", fixed_every) != 0) {
+        rc = -1;
+    }
+    if (rate_spec && *rate_spec &&
+        sample_parse_spec(rate_spec, "CUDA_HOOK_RATE_LIMIT", sample_rate_cap) != 0) {
+        rc = -1;
+    }
+
+    int any = 0;
+    for (uint16_t api = 0; api < API_COUNT; api++) {
+        sample_every[api] = fixed_every[api];
+        any |= fixed_every[api] > 1 || sample_rate_cap[api] != 0;
+    }
+
+    if (target > 0 && target < 1) {
+        overhead_target = target;
+        sample_adaptive = 1;
+        any = 1;
+    }
+    hook_sampling = any;
+    return rc;
+}
+
+static int64_t coarse_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Admit a record under the API's per-second cap. Once the cap is hit, calls
+// only read the window until it rolls over.
+int sample_rate_admit(uint16_t api) {
+    struct rate_window* w = &rate_windows[api];
+    int64_t now = coarse_ns();
+    int64_t start = __atomic_load_n(&w->start_ns, __ATOMIC_RELAXED);
+
+    if (now - start >= 1000000000) {
+        if (__atomic_compare_exchange_n(&w->start_ns, &start, now, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&w->count, 0, __ATOMIC_RELAXED);
+        }
+    } else if (__atomic_load_n(&w->count, __ATOMIC_RELAXED) >= sample_rate_cap[api]) {
+        return 0;
+    }
+    return __atomic_fetch_add(&w->count, 1, __ATOMIC_RELAXED) < sample_rate_cap[api];
+}
+
+static void set_factor(uint16_t api, uint32_t factor, double fraction) {
+    adaptive_factor[api] = factor;
+    uint64_t every = (uint64_t)fixed_every[api] * factor;
+    __atomic_store_n(&sample_every[api], every > UINT32_MAX ? UINT32_MAX : (uint32_t)every,
+                     __ATOMIC_RELAXED);
+    fprintf(stderr, "[CUDA_HOOK] Sampling %s 1 in %llu (hook overhead %.2f%% of wall time)\n",
+            hook_api_names[api], (unsigned long long)every, fraction * 100);
+}
+
+// Drainer thread: one adaptive step per interval. Raise the N of the API
+// with the largest share while over the target; lower one N while the
+// projected overhead stays under half of it.
+void sample_adapt(int64_t now_ns) {
+    if (!sample_adaptive) {
+        return;
+    }
+    if (last_adapt_ns == 0) {
+        last_adapt_ns = now_ns;
+        return;
+    }
+    if (now_ns - last_adapt_ns < ADAPT_INTERVAL_NS) {
+        return;
+    }
+
+    uint64_t overhead[API_COUNT];
+    double fraction[API_COUNT];
+    double total = 0;
+    double wall = (double)(now_ns - last_adapt_ns);
+
+    aggregate_overhead_ns(overhead);
+    for (uint16_t api = 0; api < API_COUNT; api++) {
+        fraction[api] = (double)(overhead[api] - last_overhead[api]) / wall;
+        total += fraction[api];
+        last_overhead[api] = overhead[api];
+    }
+    last_adapt_ns = now_ns;
+
+    if (total > overhead_target) {
+        int worst = -1;
+        for (uint16_t api = 0; api < API_COUNT; api++) {
+            if (adaptive_factor[api] < ADAPT_MAX_FACTOR &&
+                (worst < 0 || fraction[api] > fraction[worst])) {
+                worst = api;
+            }
+        }
+        if (worst >= 0 && fraction[worst] > 0) {
+            set_factor((uint16_t)worst, adaptive_factor[worst] * 2, total);
+        }
+    } else {
+        // Halving N roughly doubles that API's share
+        int best = -1;
+        for (uint16_t api = 0; api < API_COUNT; api++) {
+            if (adaptive_factor[api] > 1 && total + fraction[api] < overhead_target / 2 &&
+                (best < 0 || adaptive_factor[api] > adaptive_factor[best])) {
+                best = api;
+            }
+        }
+        if (best >= 0) {
+            set_factor((uint16_t)best, adaptive_factor[best] / 2, total);
+        }
+    }
+}
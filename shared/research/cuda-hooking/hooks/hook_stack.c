@@ -0,0 +1,410 @@
+/*
+ * hook_stack.c - Host call stacks of chosen API calls
+ *
+ * CUDA_HOOK_STACKS uses the sampling spec syntax, e.g.
+ * "cuMemAlloc=1,cuStreamSynchronize=1,kernel=100": capture the stack of
+ * 1 in N calls per thread for the named APIs and categories. Stacks are
+ * walked through frame pointers (bounded by the thread's stack, so code
+ * built without them just ends the walk early) or, with
+ * CUDA_HOOK_STACK_UNWIND=dwarf, with glibc's backtrace(). Frames inside this
+ * library are dropped, so the innermost frame is the caller of the CUDA API.
+ *
+ * Captured stacks are interned in a table like the function table: lookups
+ * are lock-free, inserts take the lock, and the drainer writes entries added
+ * since its last pass ahead of the records that refer to them.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <execinfo.h>
+
+#include "cuda_hook.h"
+
+#define STACK_CHUNK_SHIFT   8
+#define STACK_CHUNK_SIZE    (1u << STACK_CHUNK_SHIFT)
+#define STACK_MAX_CHUNKS    256     // Distinct stacks past 65535 get id 0
+#define STACK_INDEX_INITIAL 1024
+// backtrace() frames inside this library before the caller's
+#define STACK_SELF_FRAMES   8
+
+struct stack_slot {
+    uint32_t hash;
+    uint32_t id;                // 0 = empty; published with release semantics
+};
+
+struct stack_index {
+    uint32_t mask;
+    struct stack_index* retired;    // Previous index, kept for readers
+    struct stack_slot slots[];
+};
+
+int hook_stacks = 0;
+uint32_t stack_every[API_COUNT];
+int64_t stack_min_duration = 0;
+__thread uint32_t tls_stack_skip[API_COUNT] __attribute__((tls_model("initial-exec")));
+
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct trace_stack* chunks[STACK_MAX_CHUNKS];
+static uint32_t stack_count = 1;    // Id 0 is "no stack"; published with release
+static struct stack_index* stack_index = NULL;
+static uint32_t stacks_written = 1;
+
+static unsigned max_depth = 16;
+static int use_backtrace = 0;
+static uintptr_t self_start = 0;    // This library's text, skipped when walking
+static uintptr_t self_end = 0;
+
+static FILE* stack_out = NULL;
+static enum trace_format stack_format = TRACE_FORMAT_JSON;
+static char* startup_maps = NULL;
+static size_t startup_maps_len = 0;
+
+// Thread stack bounds for the frame pointer walk
+static __thread uintptr_t tls_stack_lo __attribute__((tls_model("initial-exec")));
+static __thread uintptr_t tls_stack_hi __attribute__((tls_model("initial-exec")));
+
+static char* read_maps(size_t* len) {
+    FILE* f = fopen("/proc/self/maps", "r");
+    if (!f) {
+        return NULL;
+    }
+    size_t cap = 16384;
+    size_t used = 0;
+    char* text = malloc(cap);
+    while (text) {
+        used += fread(text + used, 1, cap - used, f);
+        if (used < cap) {
+            break;
+        }
+        char* grown = realloc(text, cap * 2);
+        if (!grown) {
+            free(text);
+            text = NULL;
+            break;
+        }
+        text = grown;
+        cap *= 2;
+    }
+    fclose(f);
+    *len = used;
+    return text;
+}
+
+static int64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void write_maps(const char* text, size_t len, int64_t ts_ns, uint32_t flags) {
+    struct trace_maps maps = { ts_ns, flags, 0 };
+    if (stack_format == TRACE_FORMAT_BINARY) {
+        trace_write_binary_maps(stack_out, &maps, text, len);
+    } else if (stack_format == TRACE_FORMAT_JSON) {
+        trace_write_maps_json(stack_out, &maps, text, len);
+    }
+}
+
+// The executable mapping holding this code
+static void find_self(const char* text, size_t len) {
+    uintptr_t here = (uintptr_t)&stack_record;
+    const char* end = text + len;
+    for (const char* line = text; line < end;) {
+        const char* eol = memchr(line, '\n', end - line);
+        eol = eol ? eol : end;
+        unsigned long lo, hi;
+        if (sscanf(line, "%lx-%lx", &lo, &hi) == 2 && here >= lo && here < hi) {
+            self_start = lo;
+            self_end = hi;
+            return;
+        }
+        line = eol + 1;
+    }
+}
+
+int stack_tracking_start(FILE* out, enum trace_format format, const char* spec, long depth,
+                         long min_us, const char* unwind) {
+    uint32_t every[API_COUNT] = { 0 };
+    int rc = sample_parse_spec(spec, "CUDA_HOOK_STACKS", every);
+
+    max_depth = depth > STACK_MAX_DEPTH ? STACK_MAX_DEPTH : (unsigned)depth;
+    stack_min_duration = hook_clock_from_ns((int64_t)min_us * 1000);
+    if (unwind && strcmp(unwind, "dwarf") == 0) {
+        // The first call loads libgcc_s; do it here rather than in a hook
+        void* warm[4];
+        backtrace(warm, 4);
+        use_backtrace = 1;
+    } else if (unwind && strcmp(unwind, "fp") != 0) {
+        fprintf(stderr, "[CUDA_HOOK] Unknown CUDA_HOOK_STACK_UNWIND '%s', using fp\n", unwind);
+    }
+
+    stack_out = out;
+    stack_format = format;
+    startup_maps = read_maps(&startup_maps_len);
+    if (startup_maps) {
+        find_self(startup_maps, startup_maps_len);
+        write_maps(startup_maps, startup_maps_len, monotonic_ns(), 0);
+    }
+
+    int any = 0;
+    for (uint16_t api = 0; api < API_COUNT; api++) {
+        stack_every[api] = every[api];
+        any |= every[api] != 0;
+    }
+    __atomic_store_n(&hook_stacks, any, __ATOMIC_RELEASE);
+    return rc;
+}
+
+static int in_self(uintptr_t pc) {
+    return pc >= self_start && pc < self_end;
+}
+
+// Walk saved frame pointers: [fp] is the caller's fp, [fp + 8] the return
+// address. Stops at the first frame outside the thread's stack.
+static unsigned walk_frames(uint64_t* frames) {
+    if (!tls_stack_hi) {
+        pthread_attr_t attr;
+        void* addr;
+        size_t size;
+        tls_stack_hi = 1;       // Do not retry on failure
+        if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+            if (pthread_attr_getstack(&attr, &addr, &size) == 0) {
+                tls_stack_lo = (uintptr_t)addr;
+                tls_stack_hi = (uintptr_t)addr + size;
+            }
+            pthread_attr_destroy(&attr);
+        }
+    }
+
+    unsigned n = 0;
+    uintptr_t fp = (uintptr_t)__builtin_frame_address(0);
+    while (n < max_depth) {
+        if (fp < tls_stack_lo || fp + 2 * sizeof(uintptr_t) > tls_stack_hi ||
+            (fp & (sizeof(uintptr_t) - 1))) {
+            break;
+        }
+        const uintptr_t* frame = (const uintptr_t*)fp;
+        uintptr_t pc = frame[1];
+        if (!pc) {
+            break;
+        }
+        if (n > 0 || !in_self(pc)) {
+            frames[n++] = pc;
+        }
+        if (frame[0] <= fp) {
+            break;
+        }
+        fp = frame[0];
+    }
+    return n;
+}
+
+static unsigned unwind_frames(uint64_t* frames) {
+    void* pcs[STACK_MAX_DEPTH + STACK_SELF_FRAMES];
+    int got = backtrace(pcs, (int)max_depth + STACK_SELF_FRAMES);
+    int first = 0;
+    while (first < got && in_self((uintptr_t)pcs[first])) {
+        first++;
+    }
+    unsigned n = 0;
+    for (int i = first; i < got && n < max_depth; i++) {
+        frames[n++] = (uintptr_t)pcs[i];
+    }
+    return n;
+}
+
+static uint32_t stack_hash(const uint64_t* frames, unsigned depth) {
+    uint64_t h = depth;
+    for (unsigned i = 0; i < depth; i++) {
+        h = (h ^ frames[i]) * 0x9E3779B97F4A7C15ull;
+        h ^= h >> 29;
+    }
+    return (uint32_t)(h >> 32);
+}
+
+static const struct trace_stack* stack_get(uint32_t id) {
+    return &chunks[id >> STACK_CHUNK_SHIFT][id & (STACK_CHUNK_SIZE - 1)];
+}
+
+static uint32_t stack_lookup(uint32_t hash, const uint64_t* frames, unsigned depth) {
+    const struct stack_index* index = __atomic_load_n(&stack_index, __ATOMIC_ACQUIRE);
+    if (!index) {
+        return 0;
+    }
+    uint32_t slot = hash & index->mask;
+    for (;;) {
+        uint32_t id = __atomic_load_n(&index->slots[slot].id, __ATOMIC_ACQUIRE);
+        if (id == 0) {
+            return 0;
+        }
+        if (index->slots[slot].hash == hash) {
+            const struct trace_stack* s = stack_get(id);
+            if (s->depth == depth && memcmp(s->frames, frames, depth * sizeof(*frames)) == 0) {
+                return id;
+            }
+        }
+        slot = (slot + 1) & index->mask;
+    }
+}
+
+static void index_put(struct stack_index* index, uint32_t hash, uint32_t id) {
+    uint32_t slot = hash & index->mask;
+    while (index->slots[slot].id) {
+        slot = (slot + 1) & index->mask;
+    }
+    index->slots[slot].hash = hash;
+    __atomic_store_n(&index->slots[slot].id, id, __ATOMIC_RELEASE);
+}
+
+// Caller holds the lock. Readers may still be walking the old index, so it
+// is kept for the life of the process.
+static int index_grow(void) {
+    struct stack_index* old = stack_index;
+    uint32_t cap = old ? (old->mask + 1) * 2 : STACK_INDEX_INITIAL;
+    struct stack_index* index = calloc(1, sizeof(*index) + cap * sizeof(struct stack_slot));
+    if (!index) {
+        return -1;
+    }
+    index->mask = cap - 1;
+    index->retired = old;
+    if (old) {
+        for (uint32_t i = 0; i <= old->mask; i++) {
+            if (old->slots[i].id) {
+                index_put(index, old->slots[i].hash, old->slots[i].id);
+            }
+        }
+    }
+    __atomic_store_n(&stack_index, index, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static uint32_t stack_intern(const uint64_t* frames, unsigned depth) {
+    uint32_t hash = stack_hash(frames, depth);
+    uint32_t id = stack_lookup(hash, frames, depth);
+    if (id) {
+        return id;
+    }
+
+    pthread_mutex_lock(&table_lock);
+    id = stack_lookup(hash, frames, depth);
+    if (id) {
+        goto out;
+    }
+
+    uint32_t count = stack_count;
+    uint32_t chunk = count >> STACK_CHUNK_SHIFT;
+    if (chunk >= STACK_MAX_CHUNKS ||
+        ((!stack_index || count * 2 > stack_index->mask + 1) && index_grow() != 0)) {
+        goto out;
+    }
+    if (!chunks[chunk]) {
+        chunks[chunk] = calloc(STACK_CHUNK_SIZE, sizeof(struct trace_stack));
+        if (!chunks[chunk]) {
+            goto out;
+        }
+    }
+
+    struct trace_stack* entry = &chunks[chunk][count & (STACK_CHUNK_SIZE - 1)];
+    entry->id = count;
+    entry->depth = (uint16_t)depth;
+    memcpy(entry->frames, frames, depth * sizeof(*frames));
+    __atomic_store_n(&stack_count, count + 1, __ATOMIC_RELEASE);
+    index_put(stack_index, hash, count);
+    id = count;
+
+out:
+    pthread_mutex_unlock(&table_lock);
+    return id;
+}
+
+// Not inlined, so the walk starts from a frame of its own inside the hook
+__attribute__((noinline))
+void stack_record(const struct hook_event* call) {
+    uint64_t frames[STACK_MAX_DEPTH];
+    unsigned depth = use_backtrace ? unwind_frames(frames) : walk_frames(frames);
+    uint32_t id = depth ? stack_intern(frames, depth) : 0;
+
+    // Interned before the record is committed, so the drainer always sees
+    // the table entry first
+    struct hook_event* ev = trace_reserve();
+    if (!ev) {
+        return;
+    }
+    memset(&ev->args, 0, sizeof(ev->args));
+    ev->ts = call->ts;
+    ev->end = call->ts;
+    ev->op_id = call->op_id;
+    ev->api = REC_HOST_STACK;
+    ev->status = CUDA_SUCCESS;
+    ev->args.stack.id = id;
+    ev->args.stack.depth = (uint16_t)depth;
+    trace_commit();
+}
+
+// Drainer thread: write the stacks interned since the last pass
+void stack_drain(void) {
+    if (!stack_out) {
+        return;
+    }
+    uint32_t count = __atomic_load_n(&stack_count, __ATOMIC_ACQUIRE);
+    while (stacks_written < count) {
+        // Entries are contiguous within a chunk
+        uint32_t first = stacks_written;
+        uint32_t run = STACK_CHUNK_SIZE - (first & (STACK_CHUNK_SIZE - 1));
+        if (run > count - first) {
+            run = count - first;
+        }
+        const struct trace_stack* stacks = stack_get(first);
+        if (stack_format == TRACE_FORMAT_BINARY) {
+            trace_write_binary_stacks(stack_out, stacks, run);
+        } else if (stack_format == TRACE_FORMAT_JSON) {
+            for (uint32_t i = 0; i < run; i++) {
+                trace_write_stack_json(stack_out, &stacks[i]);
+            }
+        }
+        stacks_written = first + run;
+    }
+}
+
+// Drainer thread, at the top of a new trace segment: the maps snapshot and
+// every stack go out again so the segment can be symbolized on its own
+void stack_segment_start(int64_t now_ns) {
+    if (!stack_out || !hook_stacks) {
+        return;
+    }
+    if (startup_maps) {
+        write_maps(startup_maps, startup_maps_len, now_ns, 0);
+    }
+    stacks_written = 1;
+}
+
+// The table stays valid in a forked child (same image, same addresses); it
+// is written again at the top of the child's own trace
+void stack_atfork(enum fork_phase phase) {
+    if (phase == FORK_PREPARE) {
+        pthread_mutex_lock(&table_lock);
+        return;
+    }
+    pthread_mutex_unlock(&table_lock);
+    if (phase == FORK_CHILD) {
+        stacks_written = 1;
+    }
+}
+
+// After the drainer has stopped: libraries loaded since startup (libcuda
+// itself, often) need a second snapshot to be symbolized
+void stack_finish(int64_t now_ns) {
+    if (!stack_out || !hook_stacks) {
+        return;
+    }
+    stack_drain();
+
+    size_t len;
+    char* text = read_maps(&len);
+    if (text && (len != startup_maps_len || memcmp(text, startup_maps, len) != 0)) {
+        write_maps(text, len, now_ns, TRACE_MAPS_FINAL);
+    }
+    free(text);
+}
@@ -0,0 +1,59 @@
+/*
+ * mock_apis.c - Default entry points of the mock driver
+ *
+ * Every API in hook_apis.h gets a weak definition here, under the symbol
+ * cuda.h maps it to, that spends the call's configured host latency and
+ * returns CUDA_SUCCESS; mock_cuda.c replaces the ones with state behind
+ * them. The outputs of a generated API, known from its captures in
+ * hook_apis_gen.h, are filled in so a caller never reads garbage: handles
+ * with distinct values, integers and sizes with 0.
+ */
+
+#include "cuda_hook.h"
+
+#define MOCK_DEFAULT __attribute__((weak))
+
+#define CAP_NONE          (void)0
+#define CAP_SIZE(x)       (void)0
+#define CAP_INT(x)        (void)0
+#define CAP_FLAGS(x)      (void)0
+#define CAP_HANDLE(x)     (void)0
+#define CAP_PTR(x)        (void)0
+#define CAP_STRING(x)     (void)0
+#define CAP_OUT_HANDLE(p) do { if (p) *(p) = (__typeof__(*(p)))mock_handle(); } while (0)
+#define CAP_OUT_INT(p)    do { if (p) *(p) = 0; } while (0)
+#define CAP_OUT_SIZE(p)   do { if (p) *(p) = 0; } while (0)
+
+#define CUDA_ERROR_NOT_SUPPORTED 801
+
+// The plain symbols of v2 APIs keep the ABI from before CUDA 3.2, which
+// the mock does not implement; they touch nothing
+#define MOCK_LEGACY_none(name, ret, params)
+#define MOCK_LEGACY_v2(name, ret, params) \
+    ret legacy_##name params __asm__(#name); \
+    ret legacy_##name params { \
+        mock_call(API_##name); \
+        return (ret)CUDA_ERROR_NOT_SUPPORTED; \
+    }
+
+#define HOOK_API(name, category, versioned, ret, params, args) \
+    MOCK_DEFAULT ret name params __asm__(HOOK_SYMBOL_##versioned(name)); \
+    MOCK_DEFAULT ret name params { \
+        mock_call(API_##name); \
+        return (ret)CUDA_SUCCESS; \
+    } \
+    MOCK_LEGACY_##versioned(name, ret, params)
+#define HOOK_GEN(name, category, version, params, args, c0, c1, c2, c3) \
+    MOCK_DEFAULT CUresult name params __asm__(HOOK_SYMBOL_##version(name)); \
+    MOCK_DEFAULT CUresult name params { \
+        mock_call(API_##name); \
+        c0; \
+        c1; \
+        c2; \
+        c3; \
+        return CUDA_SUCCESS; \
+    } \
+    MOCK_LEGACY_##version(name, CUresult, params)
+#include "hook_apis.h"
+#undef HOOK_GEN
+#undef HOOK_API
@@ -0,0 +1,1596 @@
+/*
+ * mock_cuda.c - CPU-only stand-in for libcuda
+ *
+ * libcuda_mock.so implements the driver APIs the hook intercepts well
+ * enough to run driver API programs, the hook, its samplers and the trace
+ * tools on a machine without a GPU:
+ *
+ *   CUDA_HOOK_LIBCUDA=./libcuda_mock.so LD_PRELOAD=./libcuda_hook.so ./app
+ *
+ * or with the program linked against it. Programs built on the CUDA runtime
+ * need more of the driver than this and will not start. Only the current
+ * ABI is implemented: the plain symbols of v2 APIs (see hook_apis.h), which
+ * only binaries from before CUDA 3.2 call, return CUDA_ERROR_NOT_SUPPORTED.
+ *
+ * Device memory is accounted, not backed: allocations get distinct
+ * addresses from an address space of their own and fail with
+ * CUDA_ERROR_OUT_OF_MEMORY past the device size, and nothing may be read or
+ * written through them. Host allocations are real memory.
+ *
+ * Work issued to a stream (launches, copies, memsets, graph launches) is
+ * queued on a simulated timeline: it starts once the host has issued it and
+ * the stream's earlier work is done, and completes in real time, so
+ * cuStreamQuery and cuEventQuery return CUDA_ERROR_NOT_READY until then and
+ * synchronization waits for it. The legacy default stream is ordered with
+ * every blocking stream, as on a real device; other streams overlap freely.
+ * Host functions and stream callbacks run on a worker thread once the work
+ * ahead of them is done, without holding up later work.
+ *
+ * Environment:
+ *   CUDA_MOCK_SEED          Seed for every random draw (default: 1). Each
+ *                           thread draws from its own sequence, numbered in
+ *                           the order threads first draw, so a
+ *                           single-threaded program gets the same
+ *                           latencies, durations and addresses every run
+ *   CUDA_MOCK_LATENCY       Host time a call takes, per API name, category
+ *                           or "*", later entries winning, e.g.
+ *                           "*=fixed:1,cuLaunchKernel=normal:4:1"
+ *                           (default: none)
+ *   CUDA_MOCK_KERNEL        Device time of a launch, per kernel name
+ *                           substring or "*", first match winning, e.g.
+ *                           "gemm=lognormal:200:0.3,*=exp:20" (default:
+ *                           "*=fixed:10"); graph launches take the "*" time
+ *   CUDA_MOCK_BANDWIDTH_GBPS  Copy and memset bandwidth (default: 12)
+ *   CUDA_MOCK_DEVICES       Devices reported, at most 8 (default: 1)
+ *   CUDA_MOCK_MEMORY_MB     Memory per device (default: 16384)
+ *   CUDA_MOCK_VERBOSE       1 to print the configuration at load and the
+ *                           peak and still allocated memory at exit
+ *
+ * Distributions are in microseconds: fixed:T, uniform:LO:HI,
+ * normal:MEAN:SD, exp:MEAN and lognormal:MEDIAN:SIGMA; draws below zero
+ * count as zero.
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cuda_hook.h"
+
+#define CUDA_ERROR_INVALID_VALUE   1
+#define CUDA_ERROR_OUT_OF_MEMORY   2
+#define CUDA_ERROR_INVALID_DEVICE  101
+#define CUDA_ERROR_INVALID_CONTEXT 201
+#define CUDA_ERROR_INVALID_HANDLE  400
+
+#define MOCK_MAX_DEVICES  8
+#define MOCK_STREAMS      4096      // Including the legacy default stream
+#define MOCK_EVENTS       65536
+#define MOCK_FUNCTIONS    16384
+#define MOCK_CTX_STACK    16
+#define MOCK_KERNEL_RULES 64
+#define MOCK_SPIN_NS      50000     // Shorter waits spin instead of sleeping
+#define MOCK_ADDRESS_BASE 0x700000000000ULL
+#define MOCK_ALIGN        512
+
+// CU_STREAM_LEGACY, CU_STREAM_PER_THREAD, CU_STREAM_NON_BLOCKING and
+// CU_EVENT_DISABLE_TIMING
+#define STREAM_LEGACY        ((CUstream)0x1)
+#define STREAM_PER_THREAD    ((CUstream)0x2)
+#define STREAM_NON_BLOCKING  0x1
+#define EVENT_DISABLE_TIMING 0x2
+
+enum mock_dist_kind {
+    DIST_NONE = 0,
+    DIST_FIXED,
+    DIST_UNIFORM,
+    DIST_NORMAL,
+    DIST_EXP,
+    DIST_LOGNORMAL,
+};
+
+struct mock_dist {
+    enum mock_dist_kind kind;
+    double a, b;                // Microseconds, or sigma for lognormal
+};
+
+struct mock_kernel_rule {
+    char* pattern;              // "*" matches every kernel
+    struct mock_dist time;
+};
+
+struct mock_context {
+    int device;
+};
+
+struct mock_stream {
+    int used;
+    unsigned flags;
+    int priority;
+    int64_t tail;               // When its last queued work completes
+    uint32_t callbacks;         // Host functions queued and not yet run
+};
+
+struct mock_event {
+    int used;
+    int recorded;
+    unsigned flags;
+    int64_t time;               // When the work it captured completes
+};
+
+struct mock_function {
+    uint64_t module;
+    uint64_t hash;
+    char* name;
+    const struct mock_dist* time;
+};
+
+struct mock_alloc {
+    uint64_t ptr;               // 0 = empty, 1 = deleted
+    uint64_t size;
+    int device;
+};
+
+struct mock_callback {
+    int64_t due;
+    struct mock_stream* stream;
+    CUstream handle;
+    CUhostFn fn;                // Or cb
+    CUstreamCallback cb;
+    void* data;
+    struct mock_callback* next;
+};
+
+static const char* const api_names[API_COUNT] = {
+#define HOOK_API(name, category, versioned, ret, params, args) #name,
+#include "hook_apis.h"
+#undef HOOK_API
+};
+
+static const char* const api_categories[API_COUNT] = {
+#define HOOK_API(name, category, versioned, ret, params, args) category,
+#include "hook_apis.h"
+#undef HOOK_API
+};
+
+// Configuration, fixed after load
+static uint64_t seed = 1;
+static struct mock_dist latency[API_COUNT];
+static int any_latency = 0;
+static struct mock_kernel_rule kernel_rules[MOCK_KERNEL_RULES];
+static int kernel_rule_count = 0;
+static struct mock_dist default_kernel_time = { DIST_FIXED, 10, 0 };
+static double bandwidth_gbps = 12;
+static int device_count = 1;
+static uint64_t memory_bytes = 16384ULL << 20;
+static int verbose = 0;
+
+// Everything below is under mock_lock
+static pthread_mutex_t mock_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct mock_context contexts[MOCK_MAX_DEVICES];
+static struct mock_stream streams[MOCK_STREAMS];
+static uint32_t stream_high = 1;          // Streams in use are below this
+static struct mock_event events[MOCK_EVENTS];
+static uint32_t event_next = 0;
+static struct mock_function functions[MOCK_FUNCTIONS];
+static uint32_t function_count = 0;
+static struct mock_alloc* allocs = NULL;
+static size_t alloc_cap = 0, alloc_filled = 0;
+static uint64_t next_address = MOCK_ADDRESS_BASE;
+static uint64_t used_bytes[MOCK_MAX_DEVICES], peak_bytes[MOCK_MAX_DEVICES];
+static uint64_t live_allocs = 0;
+
+// Callbacks are under callback_lock
+static pthread_mutex_t callback_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t callback_cond;
+static pthread_once_t callback_once = PTHREAD_ONCE_INIT;
+static struct mock_callback* callbacks = NULL;  // Sorted by due
+static uint32_t callbacks_pending = 0;
+
+static uint64_t handle_counter = 0;
+static uint32_t thread_counter = 0;
+
+static __thread uint64_t rng_state;
+static __thread int rng_ready = 0;
+static __thread CUcontext ctx_stack[MOCK_CTX_STACK];
+static __thread int ctx_depth = 0;
+static __thread struct mock_stream* per_thread_stream = NULL;
+
+static int64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void wait_until(int64_t deadline) {
+    int64_t now = now_ns();
+    if (deadline - now > MOCK_SPIN_NS) {
+        int64_t wake = deadline - MOCK_SPIN_NS / 2;
+        struct timespec ts = { wake / 1000000000, wake % 1000000000 };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+        }
+    }
+    while (now_ns() < deadline) {
+    }
+}
+
+//
+// Random draws
+//
+
+// splitmix64
+static uint64_t next_random(void) {
+    if (!rng_ready) {
+        uint32_t thread = __atomic_fetch_add(&thread_counter, 1, __ATOMIC_RELAXED);
+        rng_state = seed ^ ((uint64_t)thread * 0xd1b54a32d192ed03ULL);
+        rng_ready = 1;
+    }
+    uint64_t z = (rng_state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// In (0, 1]
+static double uniform01(void) {
+    return (double)((next_random() >> 11) + 1) * 0x1.0p-53;
+}
+
+static double standard_normal(void) {
+    return sqrt(-2 * log(uniform01())) * cos(2 * M_PI * uniform01());
+}
+
+static int64_t draw_ns(const struct mock_dist* d) {
+    double us = 0;
+    switch (d->kind) {
+    case DIST_NONE:
+        return 0;
+    case DIST_FIXED:
+        us = d->a;
+        break;
+    case DIST_UNIFORM:
+        us = d->a + (d->b - d->a) * uniform01();
+        break;
+    case DIST_NORMAL:
+        us = d->a + d->b * standard_normal();
+        break;
+    case DIST_EXP:
+        us = -d->a * log(uniform01());
+        break;
+    case DIST_LOGNORMAL:
+        us = d->a * exp(d->b * standard_normal());
+        break;
+    }
+    return us > 0 ? (int64_t)(us * 1000) : 0;
+}
+
+//
+// Configuration
+//
+
+static int parse_dist(const char* text, struct mock_dist* d) {
+    static const struct {
+        const char* name;
+        enum mock_dist_kind kind;
+        int params;
+    } kinds[] = {
+        { "fixed", DIST_FIXED, 1 },   { "uniform", DIST_UNIFORM, 2 },
+        { "normal", DIST_NORMAL, 2 }, { "exp", DIST_EXP, 1 },
+        { "lognormal", DIST_LOGNORMAL, 2 },
+    };
+    const char* colon = strchr(text, ':');
+    if (!colon) {
+        return -1;
+    }
+    for (size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++) {
+        if (strncmp(text, kinds[i].name, (size_t)(colon - text)) != 0 ||
+            kinds[i].name[colon - text] != '\0') {
+            continue;
+        }
+        char* endp;
+        d->kind = kinds[i].kind;
+        d->a = strtod(colon + 1, &endp);
+        d->b = 0;
+        if (endp == colon + 1 || d->a < 0) {
+            return -1;
+        }
+        if (kinds[i].params == 2) {
+            if (*endp != ':') {
+                return -1;
+            }
+            const char* second = endp + 1;
+            d->b = strtod(second, &endp);
+            if (endp == second || d->b < 0) {
+                return -1;
+            }
+        }
+        return *endp == '\0' ? 0 : -1;
+    }
+    return -1;
+}
+
+// "key=dist,..."; apply() is called per entry and says whether the key
+// named anything
+static void parse_spec(const char* spec, const char* env,
+                       int (*apply)(const char* key, const struct mock_dist* d)) {
+    char* copy = strdup(spec);
+    char* save = NULL;
+    for (char* item = copy ? strtok_r(copy, ",", &save) : NULL; item;
+         item = strtok_r(NULL, ",", &save)) {
+        char* eq = strchr(item, '=');
+        struct mock_dist d;
+        if (!eq || parse_dist(eq + 1, &d) != 0) {
+            fprintf(stderr, "[CUDA_MOCK] Bad %s entry '%s'\n", env, item);
+            continue;
+        }
+        *eq = '\0';
+        if (!apply(item, &d)) {
+            fprintf(stderr, "[CUDA_MOCK] %s: nothing named '%s'\n", env, item);
+        }
+    }
+    free(copy);
+}
+
+static int apply_latency(const char* key, const struct mock_dist* d) {
+    int matched = 0;
+    for (int api = 0; api < API_COUNT; api++) {
+        if (strcmp(key, "*") == 0 || strcmp(key, api_names[api]) == 0 ||
+            strcmp(key, api_categories[api]) == 0) {
+            latency[api] = *d;
+            matched = 1;
+        }
+    }
+    any_latency |= matched;
+    return matched;
+}
+
+static int apply_kernel(const char* key, const struct mock_dist* d) {
+    if (kernel_rule_count == MOCK_KERNEL_RULES) {
+        return 0;
+    }
+    if (strcmp(key, "*") == 0 && kernel_rule_count == 0) {
+        default_kernel_time = *d;
+    }
+    kernel_rules[kernel_rule_count].pattern = strdup(key);
+    kernel_rules[kernel_rule_count].time = *d;
+    kernel_rule_count++;
+    return 1;
+}
+
+static const struct mock_dist* kernel_time(const char* name) {
+    for (int i = 0; i < kernel_rule_count; i++) {
+        if (strcmp(kernel_rules[i].pattern, "*") == 0 ||
+            (name && strstr(name, kernel_rules[i].pattern))) {
+            return &kernel_rules[i].time;
+        }
+    }
+    return &default_kernel_time;
+}
+
+static long env_long(const char* name, long fallback) {
+    const char* value = getenv(name);
+    return value && *value ? strtol(value, NULL, 10) : fallback;
+}
+
+static void callback_cond_init(void) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&callback_cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+// A program may fork while other threads are inside the mock. The child
+// gets the state as of the fork with fresh locks, and no callback thread:
+// host functions queued in the parent are dropped, and the first new one
+// starts a worker of the child's own.
+static void fork_prepare(void) {
+    pthread_mutex_lock(&mock_lock);
+    pthread_mutex_lock(&callback_lock);
+}
+
+static void fork_parent(void) {
+    pthread_mutex_unlock(&callback_lock);
+    pthread_mutex_unlock(&mock_lock);
+}
+
+static void fork_child(void) {
+    while (callbacks) {
+        struct mock_callback* c = callbacks;
+        callbacks = c->next;
+        free(c);
+    }
+    callbacks_pending = 0;
+    for (uint32_t i = 0; i < MOCK_STREAMS; i++) {
+        streams[i].callbacks = 0;
+    }
+    callback_once = (pthread_once_t)PTHREAD_ONCE_INIT;
+    callback_cond_init();
+    callback_lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+    mock_lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+}
+
+__attribute__((constructor))
+static void mock_init(void) {
+    seed = (uint64_t)env_long("CUDA_MOCK_SEED", 1);
+    verbose = env_long("CUDA_MOCK_VERBOSE", 0) > 0;
+    long devices = env_long("CUDA_MOCK_DEVICES", 1);
+    device_count = devices < 1 ? 1 : devices > MOCK_MAX_DEVICES ? MOCK_MAX_DEVICES : (int)devices;
+    long memory_mb = env_long("CUDA_MOCK_MEMORY_MB", 16384);
+    memory_bytes = (uint64_t)(memory_mb > 0 ? memory_mb : 16384) << 20;
+    const char* bandwidth = getenv("CUDA_MOCK_BANDWIDTH_GBPS");
+    if (bandwidth && strtod(bandwidth, NULL) > 0) {
+        bandwidth_gbps = strtod(bandwidth, NULL);
+    }
+
+    const char* spec = getenv("CUDA_MOCK_LATENCY");
+    if (spec && *spec) {
+        parse_spec(spec, "CUDA_MOCK_LATENCY", apply_latency);
+    }
+    spec = getenv("CUDA_MOCK_KERNEL");
+    if (spec && *spec) {
+        parse_spec(spec, "CUDA_MOCK_KERNEL", apply_kernel);
+    }
+
+    for (int d = 0; d < MOCK_MAX_DEVICES; d++) {
+        contexts[d].device = d;
+    }
+    streams[0].used = 1;
+
+    callback_cond_init();
+    pthread_atfork(fork_prepare, fork_parent, fork_child);
+
+    if (verbose) {
+        fprintf(stderr, "[CUDA_MOCK] Seed %llu, %d device(s) of %llu MB, %.1f GB/s%s\n",
+                (unsigned long long)seed, device_count, (unsigned long long)(memory_bytes >> 20),
+                bandwidth_gbps, any_latency ? ", host latency set" : "");
+    }
+}
+
+__attribute__((destructor))
+static void mock_fini(void) {
+    if (!verbose) {
+        return;
+    }
+    for (int d = 0; d < device_count; d++) {
+        fprintf(stderr, "[CUDA_MOCK] Device %d: peak %llu bytes, %llu still allocated\n", d,
+                (unsigned long long)peak_bytes[d], (unsigned long long)used_bytes[d]);
+    }
+    if (live_allocs) {
+        fprintf(stderr, "[CUDA_MOCK] %llu allocations never freed\n",
+                (unsigned long long)live_allocs);
+    }
+}
+
+void mock_call(enum hook_api api) {
+    if (any_latency && latency[api].kind != DIST_NONE) {
+        wait_until(now_ns() + draw_ns(&latency[api]));
+    }
+}
+
+uint64_t mock_handle(void) {
+    return (__atomic_add_fetch(&handle_counter, 1, __ATOMIC_RELAXED) << 4) | 0x100000;
+}
+
+// Exported under the symbols cuda.h maps the names to (HOOK_SYMBOL); the
+// plain symbols of v2 APIs are in mock_apis.c
+#define HOOK_API(name, category, versioned, ret, params, args) \
+    ret name params __asm__(HOOK_SYMBOL_##versioned(name));
+#include "hook_apis.h"
+#undef HOOK_API
+
+//
+// Contexts and devices
+//
+
+static CUcontext current_context(void) {
+    return ctx_depth ? ctx_stack[ctx_depth - 1] : NULL;
+}
+
+static int current_device(void) {
+    CUcontext ctx = current_context();
+    return ctx ? ((struct mock_context*)ctx)->device : 0;
+}
+
+static int valid_context(CUcontext ctx) {
+    uintptr_t p = (uintptr_t)ctx;
+    return p >= (uintptr_t)contexts && p < (uintptr_t)(contexts + device_count) &&
+           (p - (uintptr_t)contexts) % sizeof(contexts[0]) == 0;
+}
+
+CUresult cuInit(unsigned int Flags) {
+    mock_call(API_cuInit);
+    return CUDA_SUCCESS;
+}
+
+CUresult cuDriverGetVersion(int* driverVersion) {
+    mock_call(API_cuDriverGetVersion);
+    if (!driverVersion) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    *driverVersion = 12040;
+    return CUDA_SUCCESS;
+}
+
+CUresult cuDeviceGetCount(int* count) {
+    mock_call(API_cuDeviceGetCount);
+    if (!count) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    *count = device_count;
+    return CUDA_SUCCESS;
+}
+
+CUresult cuDeviceGet(CUdevice* device, int ordinal) {
+    mock_call(API_cuDeviceGet);
+    if (!device) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    if (ordinal < 0 || ordinal >= device_count) {
+        return CUDA_ERROR_INVALID_DEVICE;
+    }
+    *device = ordinal;
+    return CUDA_SUCCESS;
+}
+
+CUresult cuDeviceGetName(char* name, int len, CUdevice dev) {
+    mock_call(API_cuDeviceGetName);
+    if (!name || len <= 0) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    if (dev < 0 || dev >= device_count) {
+        return CUDA_ERROR_INVALID_DEVICE;
+    }
+    snprintf(name, (size_t)len, "Mock GPU %d", dev);
+    return CUDA_SUCCESS;
+}
+
+CUresult cuDeviceGetPCIBusId(char* pciBusId, int len, CUdevice dev) {
+    mock_call(API_cuDeviceGetPCIBusId);
+    if (!pciBusId || len <= 0) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    if (dev < 0 || dev >= device_count) {
+        return CUDA_ERROR_INVALID_DEVICE;
+    }
+    snprintf(pciBusId, (size_t)len, "0000:%02x:00.0", dev + 1);
+    return CUDA_SUCCESS;
+}
+
+CUresult cuDeviceTotalMem(size_t* bytes, CUdevice dev) {
+    mock_call(API_cuDeviceTotalMem);
+    if (!bytes) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    if (dev < 0 || dev >= device_count) {
+        return CUDA_ERROR_INVALID_DEVICE;
+    }
+    *bytes = memory_bytes;
+    return CUDA_SUCCESS;
+}
+
+// An A100's, by CUdevice_attribute number; the rest read 0
+CUresult cuDeviceGetAttribute(int* pi, int attrib, CUdevice dev) {
+    static const struct {
+        int attrib, value;
+    } attributes[] = {
+        { 1, 1024 },  { 2, 1024 },  { 3, 1024 },     { 4, 64 },   { 5, 2147483647 },
+        { 6, 65535 }, { 7, 65535 }, { 8, 49152 },    { 10, 32 },  { 12, 65536 },
+        { 13, 1410000 }, { 16, 108 }, { 36, 1215000 }, { 37, 5120 }, { 38, 41943040 },
+        { 39, 2048 }, { 41, 1 },    { 75, 8 },       { 76, 0 },   { 81, 167936 },
+        { 97, 163 }, { 106, 32 },
+    };
+    mock_call(API_cuDeviceGetAttribute);
+    if (!pi) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    if (dev < 0 || dev >= device_count) {
+        return CUDA_ERROR_INVALID_DEVICE;
+    }
+    *pi = 0;
+    for (size_t i = 0; i < sizeof(attributes) / sizeof(attributes[0]); i++) {
+        if (attributes[i].attrib == attrib) {
+            *pi = attributes[i].value;
+        }
+    }
+    return CUDA_SUCCESS;
+}
+
+CUresult cuCtxCreate(CUcontext* pctx, unsigned int flags, CUdevice dev) {
+    mock_call(API_cuCtxCreate);
+    if (!pctx) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    if (dev < 0 || dev >= device_count) {
+        return CUDA_ERROR_INVALID_DEVICE;
+    }
+    if (ctx_depth == MOCK_CTX_STACK) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    *pctx = &contexts[dev];
+    ctx_stack[ctx_depth++] = *pctx;
+    return CUDA_SUCCESS;
+}
+
+CUresult cuCtxDestroy(CUcontext ctx) {
+    mock_call(API_cuCtxDestroy);
+    if (!valid_context(ctx)) {
+        return CUDA_ERROR_INVALID_CONTEXT;
+    }
+    if (current_context() == ctx) {
+        ctx_depth--;
+    }
+    return CUDA_SUCCESS;
+}
+
+CUresult cuDevicePrimaryCtxRetain(CUcontext* pctx, CUdevice dev) {
+    mock_call(API_cuDevicePrimaryCtxRetain);
+    if (!pctx) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    if (dev < 0 || dev >= device_count) {
+        return CUDA_ERROR_INVALID_DEVICE;
+    }
+    *pctx = &contexts[dev];
+    return CUDA_SUCCESS;
+}
+
+CUresult cuCtxSetCurrent(CUcontext ctx) {
+    mock_call(API_cuCtxSetCurrent);
+    if (ctx && !valid_context(ctx)) {
+        return CUDA_ERROR_INVALID_CONTEXT;
+    }
+    if (ctx_depth == 0) {
+        ctx_depth = 1;
+    }
+    ctx_stack[ctx_depth - 1] = ctx;
+    return CUDA_SUCCESS;
+}
+
+CUresult cuCtxGetCurrent(CUcontext* pctx) {
+    mock_call(API_cuCtxGetCurrent);
+    if (!pctx) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    *pctx = current_context();
+    return CUDA_SUCCESS;
+}
+
+CUresult cuCtxPushCurrent(CUcontext ctx) {
+    mock_call(API_cuCtxPushCurrent);
+    if (!valid_context(ctx)) {
+        return CUDA_ERROR_INVALID_CONTEXT;
+    }
+    if (ctx_depth == MOCK_CTX_STACK) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    ctx_stack[ctx_depth++] = ctx;
+    return CUDA_SUCCESS;
+}
+
+CUresult cuCtxPopCurrent(CUcontext* pctx) {
+    mock_call(API_cuCtxPopCurrent);
+    if (ctx_depth == 0) {
+        return CUDA_ERROR_INVALID_CONTEXT;
+    }
+    CUcontext ctx = ctx_stack[--ctx_depth];
+    if (pctx) {
+        *pctx = ctx;
+    }
+    return CUDA_SUCCESS;
+}
+
+CUresult cuCtxGetDevice(CUdevice* device) {
+    mock_call(API_cuCtxGetDevice);
+    if (!device) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    if (!current_context()) {
+        return CUDA_ERROR_INVALID_CONTEXT;
+    }
+    *device = current_device();
+    return CUDA_SUCCESS;
+}
+
+CUresult cuCtxGetStreamPriorityRange(int* leastPriority, int* greatestPriority) {
+    mock_call(API_cuCtxGetStreamPriorityRange);
+    if (leastPriority) {
+        *leastPriority = 0;
+    }
+    if (greatestPriority) {
+        *greatestPriority = -5;
+    }
+    return CUDA_SUCCESS;
+}
+
+//
+// Streams
+//
+
+static struct mock_stream* stream_alloc(unsigned flags, int priority) {
+    for (uint32_t i = 1; i < MOCK_STREAMS; i++) {
+        struct mock_stream* s = &streams[i];
+        if (!s->used) {
+            memset(s, 0, sizeof(*s));
+            s->used = 1;
+            s->flags = flags;
+            s->priority = priority;
+            if (i >= stream_high) {
+                stream_high = i + 1;
+            }
+            return s;
+        }
+    }
+    return NULL;
+}
+
+// Caller holds mock_lock
+static struct mock_stream* find_stream(CUstream h) {
+    if (h == NULL || h == STREAM_LEGACY) {
+        return &streams[0];
+    }
+    if (h == STREAM_PER_THREAD) {
+        if (!per_thread_stream) {
+            per_thread_stream = stream_alloc(0, 0);
+        }
+        return per_thread_stream;
+    }
+    uintptr_t p = (uintptr_t)h;
+    if (p < (uintptr_t)(streams + 1) || p >= (uintptr_t)(streams + MOCK_STREAMS) ||
+        (p - (uintptr_t)streams) % sizeof(streams[0]) != 0 || !((struct mock_stream*)h)->used) {
+        return NULL;
+    }
+    return (struct mock_stream*)h;
+}
+
+// Queue work taking duration_ns; returns when it completes. Caller holds
+// mock_lock.
+static int64_t enqueue(struct mock_stream* s, int64_t duration_ns) {
+    int64_t start = now_ns();
+    if (start < s->tail) {
+        start = s->tail;
+    }
+    if (s == &streams[0]) {
+        for (uint32_t i = 1; i < stream_high; i++) {
+            if (streams[i].used && !(streams[i].flags & STREAM_NON_BLOCKING) &&
+                streams[i].tail > start) {
+                start = streams[i].tail;
+            }
+        }
+    } else if (!(s->flags & STREAM_NON_BLOCKING) && streams[0].tail > start) {
+        start = streams[0].tail;
+    }
+    s->tail = start + duration_ns;
+    return s->tail;
+}
+
+static int64_t copy_ns(size_t bytes) {
+    return (int64_t)((double)bytes / bandwidth_gbps);
+}
+
+// Work on a stream the host does not wait for
+static CUresult issue(CUstream h, int64_t duration_ns) {
+    pthread_mutex_lock(&mock_lock);
+    struct mock_stream* s = find_stream(h);
+    if (s) {
+        enqueue(s, duration_ns);
+    }
+    pthread_mutex_unlock(&mock_lock);
+    return s ? CUDA_SUCCESS : CUDA_ERROR_INVALID_HANDLE;
+}
+
+// Work on the legacy stream the host waits for, as synchronous copies are
+static CUresult issue_sync(int64_t duration_ns) {
+    pthread_mutex_lock(&mock_lock);
+    int64_t done = enqueue(&streams[0], duration_ns);
+    pthread_mutex_unlock(&mock_lock);
+    wait_until(done);
+    return CUDA_SUCCESS;
+}
+
+static void wait_callbacks(const uint32_t* pending) {
+    struct timespec pause = { 0, 20000 };
+    while (__atomic_load_n(pending, __ATOMIC_ACQUIRE)) {
+        nanosleep(&pause, NULL);
+    }
+}
+
+static CUresult stream_create(CUstream* phStream, unsigned int flags, int priority) {
+    if (!phStream) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    pthread_mutex_lock(&mock_lock);
+    struct mock_stream* s = stream_alloc(flags, priority);
+    pthread_mutex_unlock(&mock_lock);
+    if (!s) {
+        return CUDA_ERROR_OUT_OF_MEMORY;
+    }
+    *phStream = s;
+    return CUDA_SUCCESS;
+}
+
+CUresult cuStreamCreate(CUstream* phStream, unsigned int Flags) {
+    mock_call(API_cuStreamCreate);
+    return stream_create(phStream, Flags, 0);
+}
+
+CUresult cuStreamCreateWithPriority(CUstream* phStream, unsigned int flags, int priority) {
+    mock_call(API_cuStreamCreateWithPriority);
+    return stream_create(phStream, flags, priority);
+}
+
+// Work still queued carries on, as on a real device
+CUresult cuStreamDestroy(CUstream hStream) {
+    mock_call(API_cuStreamDestroy);
+    pthread_mutex_lock(&mock_lock);
+    struct mock_stream* s = find_stream(hStream);
+    int ok = s && s != &streams[0] && s != per_thread_stream;
+    if (ok) {
+        s->used = 0;
+    }
+    pthread_mutex_unlock(&mock_lock);
+    return ok ? CUDA_SUCCESS : CUDA_ERROR_INVALID_HANDLE;
+}
+
+CUresult cuStreamSynchronize(CUstream hStream) {
+    mock_call(API_cuStreamSynchronize);
+    pthread_mutex_lock(&mock_lock);
+    struct mock_stream* s = find_stream(hStream);
+    int64_t done = s ? s->tail : 0;
+    pthread_mutex_unlock(&mock_lock);
+    if (!s) {
+        return CUDA_ERROR_INVALID_HANDLE;
+    }
+    wait_until(done);
+    wait_callbacks(&s->callbacks);
+    return CUDA_SUCCESS;
+}
+
+CUresult cuStreamQuery(CUstream hStream) {
+    mock_call(API_cuStreamQuery);
+    pthread_mutex_lock(&mock_lock);
+    struct mock_stream* s = find_stream(hStream);
+    CUresult result = !s ? CUDA_ERROR_INVALID_HANDLE
+                      : s->tail > now_ns() || s->callbacks ? CUDA_ERROR_NOT_READY
+                                                           : CUDA_SUCCESS;
+    pthread_mutex_unlock(&mock_lock);
+    return result;
+}
+
+CUresult cuStreamGetPriority(CUstream hStream, int* priority) {
+    mock_call(API_cuStreamGetPriority);
+    pthread_mutex_lock(&mock_lock);
+    struct mock_stream* s = find_stream(hStream);
+    if (s && priority) {
+        *priority = s->priority;
+    }
+    pthread_mutex_unlock(&mock_lock);
+    return !s ? CUDA_ERROR_INVALID_HANDLE : priority ? CUDA_SUCCESS : CUDA_ERROR_INVALID_VALUE;
+}
+
+CUresult cuStreamGetFlags(CUstream hStream, unsigned int* flags) {
+    mock_call(API_cuStreamGetFlags);
+    pthread_mutex_lock(&mock_lock);
+    struct mock_stream* s = find_stream(hStream);
+    if (s && flags) {
+        *flags = s->flags;
+    }
+    pthread_mutex_unlock(&mock_lock);
+    return !s ? CUDA_ERROR_INVALID_HANDLE : flags ? CUDA_SUCCESS : CUDA_ERROR_INVALID_VALUE;
+}
+
+CUresult cuCtxSynchronize(void) {
+    mock_call(API_cuCtxSynchronize);
+    pthread_mutex_lock(&mock_lock);
+    int64_t done = 0;
+    for (uint32_t i = 0; i < stream_high; i++) {
+        if (streams[i].tail > done) {
+            done = streams[i].tail;
+        }
+    }
+    pthread_mutex_unlock(&mock_lock);
+    wait_until(done);
+    wait_callbacks(&callbacks_pending);
+    return CUDA_SUCCESS;
+}
+
+//
+// Host functions
+//
+
+static void* callback_main(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&callback_lock);
+    for (;;) {
+        struct mock_callback* c = callbacks;
+        if (!c) {
+            pthread_cond_wait(&callback_cond, &callback_lock);
+            continue;
+        }
+        if (c->due > now_ns()) {
+            struct timespec ts = { c->due / 1000000000, c->due % 1000000000 };
+            pthread_cond_timedwait(&callback_cond, &callback_lock, &ts);
+            continue;
+        }
+        callbacks = c->next;
+        pthread_mutex_unlock(&callback_lock);
+
+        if (c->fn) {
+            c->fn(c->data);
+        } else {
+            c->cb(c->handle, CUDA_SUCCESS, c->data);
+        }
+        __atomic_sub_fetch(&c->stream->callbacks, 1, __ATOMIC_RELEASE);
+        __atomic_sub_fetch(&callbacks_pending, 1, __ATOMIC_RELEASE);
+        free(c);
+
+        pthread_mutex_lock(&callback_lock);
+    }
+    return NULL;
+}
+
+static void callback_start(void) {
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, callback_main, NULL) != 0) {
+        fprintf(stderr, "[CUDA_MOCK] Failed to start the callback thread\n");
+    }
+    pthread_attr_destroy(&attr);
+}
+
+static CUresult add_callback(CUstream hStream, CUhostFn fn, CUstreamCallback cb, void* data) {
+    if (!fn && !cb) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    struct mock_callback* c = calloc(1, sizeof(*c));
+    if (!c) {
+        return CUDA_ERROR_OUT_OF_MEMORY;
+    }
+    pthread_once(&callback_once, callback_start);
+
+    pthread_mutex_lock(&mock_lock);
+    struct mock_stream* s = find_stream(hStream);
+    if (s) {
+        c->due = enqueue(s, 0);
+        c->stream = s;
+        __atomic_add_fetch(&s->callbacks, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&callbacks_pending, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&mock_lock);
+    if (!s) {
+        free(c);
+        return CUDA_ERROR_INVALID_HANDLE;
+    }
+    c->handle = hStream;
+    c->fn = fn;
+    c->cb = cb;
+    c->data = data;
+
+    pthread_mutex_lock(&callback_lock);
+    struct mock_callback** at = &callbacks;
+    while (*at && (*at)->due <= c->due) {
+        at = &(*at)->next;
+    }
+    c->next = *at;
+    *at = c;
+    pthread_cond_signal(&callback_cond);
+    pthread_mutex_unlock(&callback_lock);
+    return CUDA_SUCCESS;
+}
+
+CUresult cuLaunchHostFunc(CUstream hStream, CUhostFn fn, void* userData) {
+    mock_call(API_cuLaunchHostFunc);
+    return add_callback(hStream, fn, NULL, userData);
+}
+
+CUresult cuStreamAddCallback(CUstream hStream, CUstreamCallback callback, void* userData,
+                             unsigned int flags) {
+    mock_call(API_cuStreamAddCallback);
+    return add_callback(hStream, NULL, callback, userData);
+}
+
+//
+// Events
+//
+
+// Caller holds mock_lock
+static struct mock_event* find_event(CUevent h) {
+    uintptr_t p = (uintptr_t)h;
+    if (p < (uintptr_t)events || p >= (uintptr_t)(events + MOCK_EVENTS) ||
+        (p - (uintptr_t)events) % sizeof(events[0]) != 0 || !((struct mock_event*)h)->used) {
+        return NULL;
+    }
+    return (struct mock_event*)h;
+}
+
+CUresult cuEventCreate(CUevent* phEvent, unsigned int Flags) {
+    mock_call(API_cuEventCreate);
+    if (!phEvent) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    pthread_mutex_lock(&mock_lock);
+    struct mock_event* e = NULL;
+    for (uint32_t n = 0; n < MOCK_EVENTS && !e; n++) {
+        uint32_t i = (event_next + n) % MOCK_EVENTS;
+        if (!events[i].used) {
+            e = &events[i];
+            event_next = i + 1;
+        }
+    }
+    if (e) {
+        memset(e, 0, sizeof(*e));
+        e->used = 1;
+        e->flags = Flags;
+    }
+    pthread_mutex_unlock(&mock_lock);
+    if (!e) {
+        return CUDA_ERROR_OUT_OF_MEMORY;
+    }
+    *phEvent = e;
+    return CUDA_SUCCESS;
+}
+
+CUresult cuEventDestroy(CUevent hEvent) {
+    mock_call(API_cuEventDestroy);
+    pthread_mutex_lock(&mock_lock);
+    struct mock_event* e = find_event(hEvent);
+    if (e) {
+        e->used = 0;
+    }
+    pthread_mutex_unlock(&mock_lock);
+    return e ? CUDA_SUCCESS : CUDA_ERROR_INVALID_HANDLE;
+}
+
+static CUresult event_record(CUevent hEvent, CUstream hStream) {
+    pthread_mutex_lock(&mock_lock);
+    struct mock_event* e = find_event(hEvent);
+    struct mock_stream* s = find_stream(hStream);
+    if (e && s) {
+        e->recorded = 1;
+        e->time = enqueue(s, 0);
+    }
+    pthread_mutex_unlock(&mock_lock);
+    return e && s ? CUDA_SUCCESS : CUDA_ERROR_INVALID_HANDLE;
+}
+
+CUresult cuEventRecord(CUevent hEvent, CUstream hStream) {
+    mock_call(API_cuEventRecord);
+    return event_record(hEvent, hStream);
+}
+
+CUresult cuEventRecordWithFlags(CUevent hEvent, CUstream hStream, unsigned int flags) {
+    mock_call(API_cuEventRecordWithFlags);
+    return event_record(hEvent, hStream);
+}
+
+CUresult cuEventQuery(CUevent hEvent) {
+    mock_call(API_cuEventQuery);
+    pthread_mutex_lock(&mock_lock);
+    struct mock_event* e = find_event(hEvent);
+    CUresult result = !e ? CUDA_ERROR_INVALID_HANDLE
+                      : e->recorded && e->time > now_ns() ? CUDA_ERROR_NOT_READY
+                                                          : CUDA_SUCCESS;
+    pthread_mutex_unlock(&mock_lock);
+    return result;
+}
+
+CUresult cuEventSynchronize(CUevent hEvent) {
+    mock_call(API_cuEventSynchronize);
+    pthread_mutex_lock(&mock_lock);
+    struct mock_event* e = find_event(hEvent);
+    int64_t done = e && e->recorded ? e->time : 0;
+    pthread_mutex_unlock(&mock_lock);
+    if (!e) {
+        return CUDA_ERROR_INVALID_HANDLE;
+    }
+    wait_until(done);
+    return CUDA_SUCCESS;
+}
+
+CUresult cuEventElapsedTime(float* pMilliseconds, CUevent hStart, CUevent hEnd) {
+    mock_call(API_cuEventElapsedTime);
+    if (!pMilliseconds) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    pthread_mutex_lock(&mock_lock);
+    struct mock_event* start = find_event(hStart);
+    struct mock_event* end = find_event(hEnd);
+    CUresult result = CUDA_SUCCESS;
+    if (!start || !end || !start->recorded || !end->recorded ||
+        ((start->flags | end->flags) & EVENT_DISABLE_TIMING)) {
+        result = CUDA_ERROR_INVALID_HANDLE;
+    } else if (start->time > now_ns() || end->time > now_ns()) {
+        result = CUDA_ERROR_NOT_READY;
+    } else {
+        *pMilliseconds = (float)((double)(end->time - start->time) / 1e6);
+    }
+    pthread_mutex_unlock(&mock_lock);
+    return result;
+}
+
+CUresult cuStreamWaitEvent(CUstream hStream, CUevent hEvent, unsigned int Flags) {
+    mock_call(API_cuStreamWaitEvent);
+    pthread_mutex_lock(&mock_lock);
+    struct mock_stream* s = find_stream(hStream);
+    struct mock_event* e = find_event(hEvent);
+    if (s && e && e->recorded && e->time > s->tail) {
+        s->tail = e->time;
+    }
+    pthread_mutex_unlock(&mock_lock);
+    return s && e ? CUDA_SUCCESS : CUDA_ERROR_INVALID_HANDLE;
+}
+
+//
+// Modules and kernels
+//
+
+static uint64_t hash_name(const char* s) {
+    // FNV-1a
+    uint64_t h = 14695981039346656037ULL;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// The same name in the same module is the same handle
+static CUresult get_function(void** out, uint64_t module, const char* name) {
+    if (!out || !name) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    uint64_t hash = hash_name(name);
+    pthread_mutex_lock(&mock_lock);
+    struct mock_function* f = NULL;
+    for (uint32_t i = 0; i < function_count && !f; i++) {
+        if (functions[i].hash == hash && functions[i].module == module &&
+            strcmp(functions[i].name, name) == 0) {
+            f = &functions[i];
+        }
+    }
+    if (!f && function_count < MOCK_FUNCTIONS) {
+        char* copy = strdup(name);
+        if (copy) {
+            f = &functions[function_count++];
+            f->module = module;
+            f->hash = hash;
+            f->name = copy;
+            f->time = kernel_time(name);
+        }
+    }
+    pthread_mutex_unlock(&mock_lock);
+    if (!f) {
+        return CUDA_ERROR_OUT_OF_MEMORY;
+    }
+    *out = f;
+    return CUDA_SUCCESS;
+}
+
+static const struct mock_dist* launch_time(CUfunction f) {
+    uintptr_t p = (uintptr_t)f;
+    if (p < (uintptr_t)functions || p >= (uintptr_t)(functions + MOCK_FUNCTIONS) ||
+        (p - (uintptr_t)functions) % sizeof(functions[0]) != 0) {
+        return kernel_time(NULL);
+    }
+    return ((struct mock_function*)f)->time;
+}
+
+CUresult cuModuleLoad(CUmodule* module, const char* fname) {
+    mock_call(API_cuModuleLoad);
+    if (!module || !fname) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    *module = (CUmodule)(uintptr_t)mock_handle();
+    return CUDA_SUCCESS;
+}
+
+CUresult cuModuleUnload(CUmodule hmod) {
+    mock_call(API_cuModuleUnload);
+    return CUDA_SUCCESS;
+}
+
+CUresult cuModuleGetFunction(CUfunction* hfunc, CUmodule hmod, const char* name) {
+    mock_call(API_cuModuleGetFunction);
+    return get_function(hfunc, (uintptr_t)hmod, name);
+}
+
+CUresult cuLibraryGetKernel(CUkernel* pKernel, CUlibrary library, const char* name) {
+    mock_call(API_cuLibraryGetKernel);
+    return get_function(pKernel, (uintptr_t)library, name);
+}
+
+// A kernel and its function are one handle here
+CUresult cuKernelGetFunction(CUfunction* pFunc, CUkernel kernel) {
+    mock_call(API_cuKernelGetFunction);
+    if (!pFunc) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    *pFunc = kernel;
+    return CUDA_SUCCESS;
+}
+
+CUresult cuLaunchKernel(CUfunction f, unsigned int gridDimX, unsigned int gridDimY,
+                        unsigned int gridDimZ, unsigned int blockDimX, unsigned int blockDimY,
+                        unsigned int blockDimZ, unsigned int sharedMemBytes, CUstream hStream,
+                        void** kernelParams, void** extra) {
+    mock_call(API_cuLaunchKernel);
+    if (!f) {
+        return CUDA_ERROR_INVALID_HANDLE;
+    }
+    return issue(hStream, draw_ns(launch_time(f)));
+}
+
+CUresult cuLaunchCooperativeKernel(CUfunction f, unsigned int gridDimX, unsigned int gridDimY,
+                                   unsigned int gridDimZ, unsigned int blockDimX,
+                                   unsigned int blockDimY, unsigned int blockDimZ,
+                                   unsigned int sharedMemBytes, CUstream hStream,
+                                   void** kernelParams) {
+    mock_call(API_cuLaunchCooperativeKernel);
+    if (!f) {
+        return CUDA_ERROR_INVALID_HANDLE;
+    }
+    return issue(hStream, draw_ns(launch_time(f)));
+}
+
+// The leading fields of CUlaunchConfig
+struct mock_launch_config {
+    unsigned int grid[3];
+    unsigned int block[3];
+    unsigned int shared_mem;
+    CUstream stream;
+};
+
+CUresult cuLaunchKernelEx(const void* config, CUfunction f, void** kernelParams, void** extra) {
+    mock_call(API_cuLaunchKernelEx);
+    if (!config || !f) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    return issue(((const struct mock_launch_config*)config)->stream, draw_ns(launch_time(f)));
+}
+
+CUresult cuGraphLaunch(CUgraphExec hGraphExec, CUstream hStream) {
+    mock_call(API_cuGraphLaunch);
+    if (!hGraphExec) {
+        return CUDA_ERROR_INVALID_HANDLE;
+    }
+    return issue(hStream, draw_ns(kernel_time(NULL)));
+}
+
+//
+// Device memory
+//
+
+static size_t alloc_slot(uint64_t ptr) {
+    return (size_t)(((ptr / MOCK_ALIGN) * 0x9e3779b97f4a7c15ULL) >> 17) & (alloc_cap - 1);
+}
+
+// Caller holds mock_lock
+static struct mock_alloc* alloc_find(uint64_t ptr) {
+    if (!alloc_cap) {
+        return NULL;
+    }
+    for (size_t i = alloc_slot(ptr);; i = (i + 1) & (alloc_cap - 1)) {
+        if (allocs[i].ptr == ptr) {
+            return &allocs[i];
+        }
+        if (allocs[i].ptr == 0) {
+            return NULL;
+        }
+    }
+}
+
+static int alloc_insert(uint64_t ptr, uint64_t size, int device) {
+    if ((alloc_filled + 1) * 2 > alloc_cap) {
+        // Sized for what is live; deleted slots are dropped on the way
+        size_t cap = 1024;
+        while (cap < (live_allocs + 1) * 4) {
+            cap *= 2;
+        }
+        struct mock_alloc* grown = calloc(cap, sizeof(*grown));
+        if (!grown) {
+            return -1;
+        }
+        struct mock_alloc* old = allocs;
+        size_t old_cap = alloc_cap;
+        allocs = grown;
+        alloc_cap = cap;
+        alloc_filled = 0;
+        for (size_t i = 0; i < old_cap; i++) {
+            if (old[i].ptr > 1) {
+                size_t j = alloc_slot(old[i].ptr);
+                while (allocs[j].ptr) {
+                    j = (j + 1) & (cap - 1);
+                }
+                allocs[j] = old[i];
+                alloc_filled++;
+            }
+        }
+        free(old);
+    }
+    size_t i = alloc_slot(ptr);
+    while (allocs[i].ptr > 1) {
+        i = (i + 1) & (alloc_cap - 1);
+    }
+    if (allocs[i].ptr == 0) {
+        alloc_filled++;
+    }
+    allocs[i] = (struct mock_alloc){ ptr, size, device };
+    return 0;
+}
+
+static CUresult device_alloc(CUdeviceptr* dptr, size_t bytesize) {
+    if (!dptr || bytesize == 0) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    int device = current_device();
+    CUresult result = CUDA_ERROR_OUT_OF_MEMORY;
+    pthread_mutex_lock(&mock_lock);
+    if (used_bytes[device] + bytesize <= memory_bytes &&
+        alloc_insert(next_address, bytesize, device) == 0) {
+        *dptr = next_address;
+        next_address += (bytesize + MOCK_ALIGN - 1) & ~(uint64_t)(MOCK_ALIGN - 1);
+        used_bytes[device] += bytesize;
+        if (used_bytes[device] > peak_bytes[device]) {
+            peak_bytes[device] = used_bytes[device];
+        }
+        live_allocs++;
+        result = CUDA_SUCCESS;
+    }
+    pthread_mutex_unlock(&mock_lock);
+    return result;
+}
+
+static CUresult device_free(CUdeviceptr dptr) {
+    if (dptr == 0) {
+        return CUDA_SUCCESS;
+    }
+    pthread_mutex_lock(&mock_lock);
+    struct mock_alloc* a = alloc_find(dptr);
+    if (a) {
+        used_bytes[a->device] -= a->size;
+        live_allocs--;
+        a->ptr = 1;
+    }
+    pthread_mutex_unlock(&mock_lock);
+    return a ? CUDA_SUCCESS : CUDA_ERROR_INVALID_VALUE;
+}
+
+CUresult cuMemAlloc(CUdeviceptr* dptr, size_t bytesize) {
+    mock_call(API_cuMemAlloc);
+    return device_alloc(dptr, bytesize);
+}
+
+CUresult cuMemFree(CUdeviceptr dptr) {
+    mock_call(API_cuMemFree);
+    return device_free(dptr);
+}
+
+// Stream-ordered allocation takes effect at once; nothing waits on it
+CUresult cuMemAllocAsync(CUdeviceptr* dptr, size_t bytesize, CUstream hStream) {
+    mock_call(API_cuMemAllocAsync);
+    return device_alloc(dptr, bytesize);
+}
+
+CUresult cuMemFreeAsync(CUdeviceptr dptr, CUstream hStream) {
+    mock_call(API_cuMemFreeAsync);
+    return device_free(dptr);
+}
+
+CUresult cuMemAllocFromPoolAsync(CUdeviceptr* dptr, size_t bytesize, CUmemoryPool pool,
+                                 CUstream hStream) {
+    mock_call(API_cuMemAllocFromPoolAsync);
+    return device_alloc(dptr, bytesize);
+}
+
+CUresult cuMemAllocManaged(CUdeviceptr* dptr, size_t bytesize, unsigned int flags) {
+    mock_call(API_cuMemAllocManaged);
+    return device_alloc(dptr, bytesize);
+}
+
+CUresult cuMemAllocPitch(CUdeviceptr* dptr, size_t* pPitch, size_t WidthInBytes, size_t Height,
+                         unsigned int ElementSizeBytes) {
+    mock_call(API_cuMemAllocPitch);
+    if (!pPitch) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    size_t pitch = (WidthInBytes + MOCK_ALIGN - 1) & ~(size_t)(MOCK_ALIGN - 1);
+    CUresult result = device_alloc(dptr, pitch * Height);
+    if (result == CUDA_SUCCESS) {
+        *pPitch = pitch;
+    }
+    return result;
+}
+
+CUresult cuMemGetInfo(size_t* free_bytes, size_t* total_bytes) {
+    mock_call(API_cuMemGetInfo);
+    int device = current_device();
+    pthread_mutex_lock(&mock_lock);
+    if (free_bytes) {
+        *free_bytes = memory_bytes - used_bytes[device];
+    }
+    pthread_mutex_unlock(&mock_lock);
+    if (total_bytes) {
+        *total_bytes = memory_bytes;
+    }
+    return CUDA_SUCCESS;
+}
+
+//
+// Host memory
+//
+
+static CUresult host_alloc(void** pp, size_t bytesize) {
+    if (!pp) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    *pp = malloc(bytesize ? bytesize : 1);
+    return *pp ? CUDA_SUCCESS : CUDA_ERROR_OUT_OF_MEMORY;
+}
+
+CUresult cuMemAllocHost(void** pp, size_t bytesize) {
+    mock_call(API_cuMemAllocHost);
+    return host_alloc(pp, bytesize);
+}
+
+CUresult cuMemHostAlloc(void** pp, size_t bytesize, unsigned int Flags) {
+    mock_call(API_cuMemHostAlloc);
+    return host_alloc(pp, bytesize);
+}
+
+CUresult cuMemFreeHost(void* p) {
+    mock_call(API_cuMemFreeHost);
+    free(p);
+    return CUDA_SUCCESS;
+}
+
+CUresult cuMemHostRegister(void* p, size_t bytesize, unsigned int Flags) {
+    mock_call(API_cuMemHostRegister);
+    return p && bytesize ? CUDA_SUCCESS : CUDA_ERROR_INVALID_VALUE;
+}
+
+CUresult cuMemHostUnregister(void* p) {
+    mock_call(API_cuMemHostUnregister);
+    return p ? CUDA_SUCCESS : CUDA_ERROR_INVALID_VALUE;
+}
+
+//
+// Copies and memsets: device time at CUDA_MOCK_BANDWIDTH_GBPS
+//
+
+CUresult cuMemcpyHtoD(CUdeviceptr dstDevice, const void* srcHost, size_t ByteCount) {
+    mock_call(API_cuMemcpyHtoD);
+    return issue_sync(copy_ns(ByteCount));
+}
+
+CUresult cuMemcpyDtoH(void* dstHost, CUdeviceptr srcDevice, size_t ByteCount) {
+    mock_call(API_cuMemcpyDtoH);
+    return issue_sync(copy_ns(ByteCount));
+}
+
+CUresult cuMemcpyDtoD(CUdeviceptr dstDevice, CUdeviceptr srcDevice, size_t ByteCount) {
+    mock_call(API_cuMemcpyDtoD);
+    return issue_sync(copy_ns(ByteCount));
+}
+
+CUresult cuMemcpy(CUdeviceptr dst, CUdeviceptr src, size_t ByteCount) {
+    mock_call(API_cuMemcpy);
+    return issue_sync(copy_ns(ByteCount));
+}
+
+CUresult cuMemcpyPeer(CUdeviceptr dstDevice, CUcontext dstContext, CUdeviceptr srcDevice,
+                      CUcontext srcContext, size_t ByteCount) {
+    mock_call(API_cuMemcpyPeer);
+    return issue_sync(copy_ns(ByteCount));
+}
+
+CUresult cuMemcpyAsync(CUdeviceptr dst, CUdeviceptr src, size_t ByteCount, CUstream hStream) {
+    mock_call(API_cuMemcpyAsync);
+    return issue(hStream, copy_ns(ByteCount));
+}
+
+CUresult cuMemcpyHtoDAsync(CUdeviceptr dstDevice, const void* srcHost, size_t ByteCount,
+                           CUstream hStream) {
+    mock_call(API_cuMemcpyHtoDAsync);
+    return issue(hStream, copy_ns(ByteCount));
+}
+
+CUresult cuMemcpyDtoHAsync(void* dstHost, CUdeviceptr srcDevice, size_t ByteCount,
+                           CUstream hStream) {
+    mock_call(API_cuMemcpyDtoHAsync);
+    return issue(hStream, copy_ns(ByteCount));
+}
+
+CUresult cuMemcpyDtoDAsync(CUdeviceptr dstDevice, CUdeviceptr srcDevice, size_t ByteCount,
+                           CUstream hStream) {
+    mock_call(API_cuMemcpyDtoDAsync);
+    return issue(hStream, copy_ns(ByteCount));
+}
+
+CUresult cuMemcpyPeerAsync(CUdeviceptr dstDevice, CUcontext dstContext, CUdeviceptr srcDevice,
+                           CUcontext srcContext, size_t ByteCount, CUstream hStream) {
+    mock_call(API_cuMemcpyPeerAsync);
+    return issue(hStream, copy_ns(ByteCount));
+}
+
+CUresult cuMemsetD8(CUdeviceptr dstDevice, unsigned char uc, size_t N) {
+    mock_call(API_cuMemsetD8);
+    return issue_sync(copy_ns(N));
+}
+
+CUresult cuMemsetD16(CUdeviceptr dstDevice, unsigned short us, size_t N) {
+    mock_call(API_cuMemsetD16);
+    return issue_sync(copy_ns(N * 2));
+}
+
+CUresult cuMemsetD32(CUdeviceptr dstDevice, unsigned int ui, size_t N) {
+    mock_call(API_cuMemsetD32);
+    return issue_sync(copy_ns(N * 4));
+}
+
+CUresult cuMemsetD8Async(CUdeviceptr dstDevice, unsigned char uc, size_t N, CUstream hStream) {
+    mock_call(API_cuMemsetD8Async);
+    return issue(hStream, copy_ns(N));
+}
+
+CUresult cuMemsetD16Async(CUdeviceptr dstDevice, unsigned short us, size_t N, CUstream hStream) {
+    mock_call(API_cuMemsetD16Async);
+    return issue(hStream, copy_ns(N * 2));
+}
+
+CUresult cuMemsetD32Async(CUdeviceptr dstDevice, unsigned int ui, size_t N, CUstream hStream) {
+    mock_call(API_cuMemsetD32Async);
+    return issue(hStream, copy_ns(N * 4));
+}
+
+//
+// Entry points by name
+//
+
+CUresult cuGetProcAddress(const char* symbol, void** pfn, int cudaVersion, uint64_t flags);
+CUresult cuGetProcAddress_v2(const char* symbol, void** pfn, int cudaVersion, uint64_t flags,
+                             int* symbolStatus);
+
+// The current ABI, as the driver answers for any recent cudaVersion: the
+// v2 symbol when there is one
+static CUresult get_proc(const char* symbol, void** pfn) {
+    static void* self = NULL;
+    if (!symbol || !pfn) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    if (!__atomic_load_n(&self, __ATOMIC_ACQUIRE)) {
+        Dl_info info;
+        void* handle = dladdr((void*)get_proc, &info) ? dlopen(info.dli_fname, RTLD_LAZY | RTLD_NOLOAD)
+                                                      : NULL;
+        __atomic_store_n(&self, handle, __ATOMIC_RELEASE);
+    }
+    char versioned[128];
+    *pfn = NULL;
+    if (self && snprintf(versioned, sizeof(versioned), "%s_v2", symbol) < (int)sizeof(versioned)) {
+        *pfn = dlsym(self, versioned);
+    }
+    if (self && !*pfn) {
+        *pfn = dlsym(self, symbol);
+    }
+    return *pfn ? CUDA_SUCCESS : CUDA_ERROR_NOT_FOUND;
+}
+
+CUresult cuGetProcAddress(const char* symbol, void** pfn, int cudaVersion, uint64_t flags) {
+    return get_proc(symbol, pfn);
+}
+
+CUresult cuGetProcAddress_v2(const char* symbol, void** pfn, int cudaVersion, uint64_t flags,
+                             int* symbolStatus) {
+    CUresult result = get_proc(symbol, pfn);
+    if (symbolStatus) {
+        // CU_GET_PROC_ADDRESS_SUCCESS, CU_GET_PROC_ADDRESS_SYMBOL_NOT_FOUND
+        *symbolStatus = result == CUDA_SUCCESS ? 0 : 1;
+    }
+    return result;
+}
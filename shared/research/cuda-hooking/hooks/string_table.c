@@ -0,0 +1,124 @@
+/*
+ * string_table.c - Interned strings referenced by trace events
+ *
+ * Strings are stored in fixed-size chunks that never move, so a reader that
+ * has seen an id (through a published event) can look it up without locking.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+
+#include "cuda_hook.h"
+
+static uint32_t hash_string(const char* s) {
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+void string_table_init(struct string_table* tab) {
+    memset(tab, 0, sizeof(*tab));
+    pthread_mutex_init(&tab->lock, NULL);
+    tab->count = 1;             // Id 0 is NULL
+}
+
+void string_table_free(struct string_table* tab) {
+    uint32_t count = tab->count;
+    for (uint32_t id = 1; id < count; id++) {
+        free(tab->chunks[id >> STRTAB_CHUNK_SHIFT][id & (STRTAB_CHUNK_SIZE - 1)]);
+    }
+    for (uint32_t c = 0; c < STRTAB_MAX_CHUNKS && tab->chunks[c]; c++) {
+        free(tab->chunks[c]);
+    }
+    free(tab->index);
+    pthread_mutex_destroy(&tab->lock);
+    memset(tab, 0, sizeof(*tab));
+}
+
+// Caller holds the lock
+static int index_grow(struct string_table* tab) {
+    uint32_t cap = tab->index_cap ? tab->index_cap * 2 : 1024;
+    uint32_t* index = calloc(cap, sizeof(uint32_t));
+    if (!index) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < tab->index_cap; i++) {
+        uint32_t id = tab->index[i];
+        if (!id) {
+            continue;
+        }
+        uint32_t slot = hash_string(string_table_get(tab, id)) & (cap - 1);
+        while (index[slot]) {
+            slot = (slot + 1) & (cap - 1);
+        }
+        index[slot] = id;
+    }
+    free(tab->index);
+    tab->index = index;
+    tab->index_cap = cap;
+    return 0;
+}
+
+uint32_t string_table_intern(struct string_table* tab, const char* s) {
+    if (!s) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&tab->lock);
+
+    uint32_t id = 0;
+    uint32_t count = tab->count;
+    if ((count - 1) * 2 >= tab->index_cap && index_grow(tab) != 0) {
+        goto out;
+    }
+
+    uint32_t h = hash_string(s);
+    uint32_t slot = h & (tab->index_cap - 1);
+    while (tab->index[slot]) {
+        if (strcmp(string_table_get(tab, tab->index[slot]), s) == 0) {
+            id = tab->index[slot];
+            goto out;
+        }
+        slot = (slot + 1) & (tab->index_cap - 1);
+    }
+
+    uint32_t chunk = count >> STRTAB_CHUNK_SHIFT;
+    if (chunk >= STRTAB_MAX_CHUNKS) {
+        goto out;
+    }
+    if (!tab->chunks[chunk]) {
+        tab->chunks[chunk] = calloc(STRTAB_CHUNK_SIZE, sizeof(char*));
+        if (!tab->chunks[chunk]) {
+            goto out;
+        }
+    }
+    char* copy = strdup(s);
+    if (!copy) {
+        goto out;
+    }
+
+    tab->chunks[chunk][count & (STRTAB_CHUNK_SIZE - 1)] = copy;
+    tab->index[slot] = count;
+    id = count;
+    __atomic_store_n(&tab->count, count + 1, __ATOMIC_RELEASE);
+
+out:
+    pthread_mutex_unlock(&tab->lock);
+    return id;
+}
+
+const char* string_table_get(const struct string_table* tab, uint32_t id) {
+    if (id == 0 || id >= string_table_count(tab)) {
+        return NULL;
+    }
+    return tab->chunks[id >> STRTAB_CHUNK_SHIFT][id & (STRTAB_CHUNK_SIZE - 1)];
+}
+
+uint32_t string_table_count(const struct string_table* tab) {
+    return __atomic_load_n(&tab->count, __ATOMIC_ACQUIRE);
+}
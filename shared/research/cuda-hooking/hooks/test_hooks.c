@@ -0,0 +1,1201 @@
+/*
+ * test_hooks.c - End-to-end checks of the hook against the mock driver
+ *
+ * Built and run by `make test`. The program is linked against
+ * libcuda_mock.so (mock_cuda.c), so it needs no GPU, and each check runs it
+ * again (with --run=WORKLOAD) with libcuda_hook.so preloaded:
+ *
+ *   json      a JSON Lines trace has the workload's calls, the device time
+ *             of each of its kernels (CUDA_HOOK_GPU_TIMING, harvested when
+ *             the context is destroyed), and the allocation it leaks is
+ *             reported at exit (CUDA_HOOK_ALLOCS)
+ *   binary    the same workload traced in binary and converted back with
+ *             cuda_trace_convert gives the same calls in the same order
+ *   procaddr  cuGetProcAddress_v2 hands out the hook rather than the
+ *             driver's entry point, and calls through it are traced;
+ *             dlsym(RTLD_NEXT) still searches from the caller
+ *   fork      a forked child and an exec'd one that make CUDA calls each
+ *             write their own trace, and nothing hangs (pinned memory calls
+ *             in the forked child included)
+ *   legacy    a call through the plain symbol of a v2 API (the ABI from
+ *             before CUDA 3.2) reaches the driver's plain symbol untouched
+ *   control   a process started in off mode that writes "filter memory" and
+ *             a timed "trace" to its control file records memory calls
+ *             only, and only until the mode reverts to off; both switches
+ *             are in the trace
+ *   rotate    a binary trace rotated every MB and gzipped: every segment
+ *             converts, the index lists them in order with time ranges that
+ *             do not overlap, and together they hold the calls an unrotated
+ *             trace of the same workload holds
+ *   aggregate aggregate mode writes no call records and a total summary
+ *             that counts every call
+ *   sample    with cuMemAlloc sampled 1 in SAMPLE_EVERY, that many fewer of
+ *             its calls are recorded, other APIs are all recorded, and the
+ *             total summary still counts every call exactly
+ *   collector two processes streaming to one cuda_trace_collectd each have
+ *             their calls in its node trace, under their own pid
+ *   critpath  cuda_trace_critpath puts a long kernel, the event recorded
+ *             after it and the kernel waiting for that event on another
+ *             stream on the critical path, and not the short kernel that
+ *             ran beside them; in the collector's node trace it keeps the
+ *             two processes' calls and default streams apart
+ *   chrome    the Chrome trace of the streams workload is one JSON array
+ *             with a track per stream and the device time of each kernel
+ *   replay    cuda_trace_replay re-issues the streams workload's binary trace
+ *             against the mock under the hook, which traces the same
+ *             launches (by kernel name), stream and event calls again
+ *   diff      cuda_trace_diff exits 1 on a trace whose allocations the mock
+ *             made ten times slower, 0 on a trace against itself, and 2 on
+ *             binary or compressed input
+ *
+ * The trace tools other than the converter, and the mock for the replay,
+ * are taken from the converter's directory. Traces go to a temporary
+ * directory, removed when every check passes. The exit status is the
+ * number of checks that failed.
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cuda_hook.h"
+
+#define HOOK_API(name, category, versioned, ret, params, args) ret name params;
+#include "hook_apis.h"
+#undef HOOK_API
+
+// What a program built against cuda.h links to
+__typeof__(cuCtxCreate) cuCtxCreate_v2;
+__typeof__(cuCtxDestroy) cuCtxDestroy_v2;
+__typeof__(cuMemAlloc) cuMemAlloc_v2;
+__typeof__(cuMemFree) cuMemFree_v2;
+__typeof__(cuMemcpyHtoD) cuMemcpyHtoD_v2;
+__typeof__(cuMemAllocHost) cuMemAllocHost_v2;
+__typeof__(cuMemGetInfo) cuMemGetInfo_v2;
+
+// What a program built before CUDA 3.2 links to, with 32-bit sizes
+CUresult cuMemGetInfo_v1(unsigned int* free_bytes, unsigned int* total_bytes)
+    __asm__("cuMemGetInfo");
+
+typedef CUresult (*get_proc_address_v2_fn)(const char*, void**, int, uint64_t, int*);
+
+#define DEFAULT_HOOK     "./libcuda_hook.so"
+#define DEFAULT_CONVERT  "./cuda_trace_convert"
+#define TIMEOUT_S        30
+#define LAUNCHES         4
+#define KERNEL_US        10     // CUDA_MOCK_KERNEL for the workloads
+#define GUARD            0x5a5a5a5au
+#define NOT_SUPPORTED    801    // the mock's answer to the pre-3.2 ABI
+#define STREAM_NON_BLOCKING 0x1
+#define LONG_KERNEL      "CUDA_MOCK_KERNEL=long_kernel=fixed:2000,*=fixed:10"
+#define CONTROL_COMMAND  "filter memory\ntrace 0.3\n"
+#define CONTROL_ROUNDS   1000   // of about 1 ms, well past the timed mode
+#define LOOP_ROUNDS      20000  // allocations and frees, a few MB of binary trace
+#define MAX_SEGMENTS     64
+#define SAMPLE_EVERY     100
+#define FAST_ALLOC       "CUDA_MOCK_LATENCY=cuMemAlloc=fixed:5"
+#define SLOW_ALLOC       "CUDA_MOCK_LATENCY=cuMemAlloc=fixed:50"
+
+#define CHECK_CU(call)                                                      \
+    do {                                                                    \
+        CUresult rc_ = (call);                                              \
+        if (rc_ != CUDA_SUCCESS) {                                          \
+            fprintf(stderr, "%s:%d: %s returned %d\n", __FILE__, __LINE__, \
+                    #call, rc_);                                            \
+            return 1;                                                       \
+        }                                                                   \
+    } while (0)
+
+static char dir[PATH_MAX];
+static const char* hook = DEFAULT_HOOK;
+static const char* convert = DEFAULT_CONVERT;
+static char* self;
+static int failures = 0;
+static CUcontext context;
+
+// Workloads, run under the hook
+
+static int open_context(void) {
+    CUdevice dev;
+    CHECK_CU(cuInit(0));
+    CHECK_CU(cuDeviceGet(&dev, 0));
+    CHECK_CU(cuCtxCreate_v2(&context, 0, dev));
+    return 0;
+}
+
+static int alloc_and_free(void) {
+    CUdeviceptr ptr;
+    CHECK_CU(cuMemAlloc_v2(&ptr, 4096));
+    CHECK_CU(cuMemFree_v2(ptr));
+    return 0;
+}
+
+static int pinned_alloc_and_free(void) {
+    void* host;
+    CHECK_CU(cuMemAllocHost_v2(&host, 4096));
+    CHECK_CU(cuMemFreeHost(host));
+    return 0;
+}
+
+// Three allocations, the third through cuGetProcAddress_v2; the 1 MiB one
+// is never freed. Four launches of "scale", then the context is destroyed.
+static int workload_basic(void) {
+    static char host[4096];
+    CUdeviceptr big, small, looked_up;
+    CUmodule module;
+    CUfunction fn;
+
+    if (open_context() != 0) {
+        return 1;
+    }
+    CHECK_CU(cuMemAlloc_v2(&big, 1 << 20));
+    CHECK_CU(cuMemAlloc_v2(&small, sizeof(host)));
+    CHECK_CU(cuMemcpyHtoD_v2(small, host, sizeof(host)));
+    CHECK_CU(cuModuleLoad(&module, "test.cubin"));
+    CHECK_CU(cuModuleGetFunction(&fn, module, "scale"));
+    for (int i = 0; i < LAUNCHES; i++) {
+        CHECK_CU(cuLaunchKernel(fn, 1, 1, 1, 32, 1, 1, 0, NULL, NULL, NULL));
+    }
+    CHECK_CU(cuCtxSynchronize());
+
+    // The preloaded hook comes first in the global scope
+    get_proc_address_v2_fn get_proc =
+        (get_proc_address_v2_fn)dlsym(RTLD_DEFAULT, "cuGetProcAddress_v2");
+    void* hooked = dlsym(RTLD_DEFAULT, "cuMemAlloc_v2");
+    void* pfn = NULL;
+    int status;
+    if (!get_proc) {
+        fprintf(stderr, "cuGetProcAddress_v2 not found\n");
+        return 1;
+    }
+    CHECK_CU(get_proc("cuMemAlloc", &pfn, 12000, 0, &status));
+    if (pfn != hooked) {
+        fprintf(stderr, "cuGetProcAddress_v2(\"cuMemAlloc\") gave %p, the hook is %p\n", pfn,
+                hooked);
+        return 1;
+    }
+    // Other lookups keep the caller's place in the search order: the next
+    // cuInit after this program is the hook's, not the driver's
+    if (dlsym(RTLD_NEXT, "cuInit") != dlsym(RTLD_DEFAULT, "cuInit")) {
+        fprintf(stderr, "dlsym(RTLD_NEXT) answered relative to the hook\n");
+        return 1;
+    }
+    CHECK_CU(((__typeof__(cuMemAlloc)*)pfn)(&looked_up, 4096));
+    CHECK_CU(cuMemFree_v2(looked_up));
+    CHECK_CU(cuMemFree_v2(small));
+    CHECK_CU(cuCtxDestroy_v2(context));
+    return 0;
+}
+
+// Prints the pids of the children that should have traced. The forked
+// child also takes the hook's pinned memory lock the parent has used.
+static int workload_fork(void) {
+    if (open_context() != 0 || alloc_and_free() != 0 || pinned_alloc_and_free() != 0) {
+        return 1;
+    }
+    // exit, not _exit, so the hook's records are written out
+    pid_t forked = fork();
+    if (forked == 0) {
+        exit(alloc_and_free() || pinned_alloc_and_free());
+    }
+    pid_t execed = fork();
+    if (execed == 0) {
+        execl(self, self, "--run=exec", (char*)NULL);
+        _exit(127);
+    }
+    int ok = 1;
+    pid_t pids[2] = { forked, execed };
+    for (int i = 0; i < 2; i++) {
+        int status;
+        if (pids[i] < 0 || waitpid(pids[i], &status, 0) != pids[i] || !WIFEXITED(status) ||
+            WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "%s child failed\n", i ? "exec'd" : "forked");
+            ok = 0;
+        }
+    }
+    printf("%d %d\n", (int)forked, (int)execed);
+    return ok ? 0 : 1;
+}
+
+// The plain symbol must reach the driver's plain symbol untouched, and the
+// versioned one its own
+static int workload_legacy(void) {
+    struct {
+        unsigned int free_bytes, guard0, total_bytes, guard1;
+    } v1 = { 0, GUARD, 0, GUARD };
+    size_t free_bytes, total_bytes;
+
+    if (open_context() != 0) {
+        return 1;
+    }
+    CUresult result = cuMemGetInfo_v1(&v1.free_bytes, &v1.total_bytes);
+    if (result != NOT_SUPPORTED || v1.guard0 != GUARD || v1.guard1 != GUARD) {
+        fprintf(stderr, "cuMemGetInfo returned %d and wrote past 32-bit outputs: %s\n", result,
+                v1.guard0 != GUARD || v1.guard1 != GUARD ? "yes" : "no");
+        return 1;
+    }
+    CHECK_CU(cuMemGetInfo_v2(&free_bytes, &total_bytes));
+    return 0;
+}
+
+static int workload_exec(void) {
+    return open_context() != 0 || alloc_and_free() != 0;
+}
+
+// Stream B runs a short kernel, then waits for an event recorded on stream
+// A after a long kernel, then runs a third: the critical path is the long
+// kernel, the event and the tail kernel
+static int workload_streams(void) {
+    CUstream a, b;
+    CUevent done;
+    CUmodule module;
+    CUfunction long_fn, short_fn, tail_fn;
+
+    if (open_context() != 0) {
+        return 1;
+    }
+    CHECK_CU(cuModuleLoad(&module, "test.cubin"));
+    CHECK_CU(cuModuleGetFunction(&long_fn, module, "long_kernel"));
+    CHECK_CU(cuModuleGetFunction(&short_fn, module, "short_kernel"));
+    CHECK_CU(cuModuleGetFunction(&tail_fn, module, "tail_kernel"));
+    CHECK_CU(cuStreamCreate(&a, STREAM_NON_BLOCKING));
+    CHECK_CU(cuStreamCreate(&b, STREAM_NON_BLOCKING));
+    CHECK_CU(cuEventCreate(&done, 0));
+
+    CHECK_CU(cuLaunchKernel(long_fn, 1, 1, 1, 32, 1, 1, 0, a, NULL, NULL));
+    CHECK_CU(cuEventRecord(done, a));
+    CHECK_CU(cuLaunchKernel(short_fn, 1, 1, 1, 32, 1, 1, 0, b, NULL, NULL));
+    CHECK_CU(cuStreamWaitEvent(b, done, 0));
+    CHECK_CU(cuLaunchKernel(tail_fn, 1, 1, 1, 32, 1, 1, 0, b, NULL, NULL));
+    CHECK_CU(cuCtxSynchronize());
+    CHECK_CU(cuCtxDestroy_v2(context));
+    return 0;
+}
+
+static int workload_loop(void) {
+    if (open_context() != 0) {
+        return 1;
+    }
+    for (int i = 0; i < LOOP_ROUNDS; i++) {
+        if (alloc_and_free() != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Switches its own hook through the control file, then keeps making memory
+// and sync calls until well after the timed mode has ended
+static int workload_control(void) {
+    const char* path = getenv("CUDA_HOOK_CONTROL");
+    if (open_context() != 0) {
+        return 1;
+    }
+    int fd = path ? open(path, O_WRONLY | O_TRUNC | O_CLOEXEC) : -1;
+    ssize_t len = (ssize_t)strlen(CONTROL_COMMAND);
+    if (fd < 0 || write(fd, CONTROL_COMMAND, (size_t)len) != len) {
+        fprintf(stderr, "Could not write the control file %s\n", path ? path : "(unset)");
+        return 1;
+    }
+    close(fd);
+
+    struct timespec tick = { 0, 1000000 };
+    for (int i = 0; i < CONTROL_ROUNDS; i++) {
+        if (alloc_and_free() != 0) {
+            return 1;
+        }
+        CHECK_CU(cuCtxSynchronize());
+        nanosleep(&tick, NULL);
+    }
+    return 0;
+}
+
+// The checks
+
+static void fail(const char* check, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+static void fail(const char* check, const char* fmt, ...) {
+    va_list ap;
+    printf("%-9s FAIL: ", check);
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    putchar('\n');
+    failures++;
+}
+
+static void pass(const char* check) {
+    printf("%-9s ok\n", check);
+}
+
+static void path_of(char* out, size_t size, const char* name) {
+    snprintf(out, size, "%s/%s", dir, name);
+}
+
+// A trace tool next to the converter
+static void tool_path(char* out, size_t size, const char* tool) {
+    const char* slash = strrchr(convert, '/');
+    snprintf(out, size, "%.*s/%s", (int)(slash - convert), convert, tool);
+}
+
+// Starts the program in `argv` with the environment additions in `env`
+// ("NAME=value" strings, NULL-terminated), stdout and stderr going to
+// <dir>/<name>.out and .err. Returns its pid, or -1.
+static pid_t spawn(const char* name, char* const argv[], char* const env[]) {
+    char out_path[PATH_MAX + 32], err_path[PATH_MAX + 32];
+    snprintf(out_path, sizeof(out_path), "%s/%s.out", dir, name);
+    snprintf(err_path, sizeof(err_path), "%s/%s.err", dir, name);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        return -1;
+    }
+    if (pid == 0) {
+        int out = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        int err = open(err_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out < 0 || err < 0) {
+            _exit(127);
+        }
+        dup2(out, STDOUT_FILENO);
+        dup2(err, STDERR_FILENO);
+        unsetenv("CUDA_HOOK_TRACE_OWNER");
+        for (char* const* e = env; e && *e; e++) {
+            putenv(*e);
+        }
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    return pid;
+}
+
+// Exit status of a spawned program, or -1 if it was killed or did not
+// finish in TIMEOUT_S
+static int finish(const char* name, pid_t pid) {
+    if (pid < 0) {
+        return -1;
+    }
+    struct timespec poll = { 0, 10000000 };
+    for (long waited = 0; waited < TIMEOUT_S * 100L; waited++) {
+        int status;
+        pid_t done = waitpid(pid, &status, WNOHANG);
+        if (done == pid) {
+            return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+        }
+        if (done < 0 && errno != EINTR) {
+            return -1;
+        }
+        nanosleep(&poll, NULL);
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    fprintf(stderr, "%s: killed after %d s\n", name, TIMEOUT_S);
+    return -1;
+}
+
+static int run(const char* name, char* const argv[], char* const env[]) {
+    return finish(name, spawn(name, argv, env));
+}
+
+// Starts a workload under the hook, tracing to <dir>/<trace>, with the
+// environment additions in `extra` (NULL-terminated, or NULL)
+#define EXTRA_ENV 8
+static pid_t start_workload(const char* name, const char* workload, const char* trace,
+                            const char* format, char* const extra[]) {
+    static char env[6][PATH_MAX + 32];
+    char run_arg[64];
+    snprintf(run_arg, sizeof(run_arg), "--run=%s", workload);
+    char* argv[] = { self, run_arg, NULL };
+    snprintf(env[0], sizeof(env[0]), "LD_PRELOAD=%s", hook);
+    snprintf(env[1], sizeof(env[1]), "CUDA_HOOK_TRACE=%s/%s", dir, trace);
+    snprintf(env[2], sizeof(env[2]), "CUDA_HOOK_FORMAT=%s", format);
+    snprintf(env[3], sizeof(env[3]), "CUDA_HOOK_GPU_TIMING=1");
+    snprintf(env[4], sizeof(env[4]), "CUDA_HOOK_ALLOCS=1");
+    snprintf(env[5], sizeof(env[5]), "CUDA_MOCK_KERNEL=*=fixed:%d", KERNEL_US);
+    char* envp[6 + EXTRA_ENV + 1] = { env[0], env[1], env[2], env[3], env[4], env[5] };
+    for (int i = 0; extra && extra[i] && i < EXTRA_ENV; i++) {
+        envp[6 + i] = extra[i];
+    }
+    return spawn(name, argv, envp);
+}
+
+static int run_workload(const char* name, const char* workload, const char* trace,
+                        const char* format, char* const extra[]) {
+    int rc = finish(name, start_workload(name, workload, trace, format, extra));
+    if (rc != 0) {
+        fail(name, "workload exited with %d, see %s/%s.err", rc, dir, name);
+    }
+    return rc;
+}
+
+static char* read_file(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        return NULL;
+    }
+    size_t size = 0, cap = 4096;
+    char* data = malloc(cap);
+    size_t n;
+    while (data && (n = fread(data + size, 1, cap - size - 1, f)) > 0) {
+        size += n;
+        if (cap - size == 1) {
+            char* grown = realloc(data, cap * 2);
+            if (!grown) {
+                free(data);
+                data = NULL;
+                break;
+            }
+            data = grown;
+            cap *= 2;
+        }
+    }
+    fclose(f);
+    if (data) {
+        data[size] = '\0';
+    }
+    return data;
+}
+
+// Lines of a JSON Lines trace matching an API or record name and phase,
+// and (if not NULL) containing `also`
+static int count_lines(const char* trace, const char* name, const char* phase, const char* also) {
+    char name_key[128], phase_key[32];
+    snprintf(name_key, sizeof(name_key), "\"name\":\"%s\"", name);
+    snprintf(phase_key, sizeof(phase_key), "\"phase\":\"%s\"", phase);
+    int count = 0;
+    for (const char* line = trace; *line;) {
+        const char* end = strchr(line, '\n');
+        size_t len = end ? (size_t)(end - line) : strlen(line);
+        char* copy = strndup(line, len);
+        if (copy && strstr(copy, name_key) && strstr(copy, phase_key) &&
+            (!also || strstr(copy, also))) {
+            count++;
+        }
+        free(copy);
+        line += len + (end != NULL);
+    }
+    return count;
+}
+
+// An API's call count in the trace's total summary, or -1
+static long total_count(const char* trace, const char* api) {
+    char key[128];
+    snprintf(key, sizeof(key), "\"%s\":{\"count\":", api);
+    const char* total =
+        strstr(trace, "\"phase\":\"S\",\"category\":\"summary\",\"name\":\"total\"");
+    const char* eol = total ? strchr(total, '\n') : NULL;
+    const char* p = total ? strstr(total, key) : NULL;
+    if (!p || (eol && p > eol)) {
+        return -1;
+    }
+    return strtol(p + strlen(key), NULL, 10);
+}
+
+// Occurrences of `text` in `data`
+static int count_text(const char* data, const char* text) {
+    int count = 0;
+    for (const char* p = strstr(data, text); p; p = strstr(p + 1, text)) {
+        count++;
+    }
+    return count;
+}
+
+// Whether *p starts with one JSON value; *p is left after it
+static int json_value(const char** p) {
+    const char* s = *p + strspn(*p, " \t\r\n");
+    if (*s == '{' || *s == '[') {
+        char close = *s == '{' ? '}' : ']';
+        s += 1 + strspn(s + 1, " \t\r\n");
+        if (*s == close) {
+            *p = s + 1;
+            return 1;
+        }
+        for (;;) {
+            if (close == '}') {
+                s += strspn(s, " \t\r\n");
+                if (*s != '"' || !json_value(&s)) {
+                    return 0;
+                }
+                s += strspn(s, " \t\r\n");
+                if (*s++ != ':') {
+                    return 0;
+                }
+            }
+            if (!json_value(&s)) {
+                return 0;
+            }
+            s += strspn(s, " \t\r\n");
+            if (*s == close) {
+                *p = s + 1;
+                return 1;
+            }
+            if (*s++ != ',') {
+                return 0;
+            }
+        }
+    }
+    if (*s == '"') {
+        for (s++; *s != '"'; s++) {
+            if (*s == '\0' || (unsigned char)*s < 0x20 || (*s == '\\' && *++s == '\0')) {
+                return 0;
+            }
+        }
+        *p = s + 1;
+        return 1;
+    }
+    if (strncmp(s, "true", 4) == 0 || strncmp(s, "null", 4) == 0) {
+        *p = s + 4;
+        return 1;
+    }
+    if (strncmp(s, "false", 5) == 0) {
+        *p = s + 5;
+        return 1;
+    }
+    char* end;
+    strtod(s, &end);
+    if (end == s || *s == '+' || *s == '.' || !strchr("-0123456789", *s)) {
+        return 0;
+    }
+    *p = end;
+    return 1;
+}
+
+// "B name" / "E name" per call record, in file order
+static char* call_sequence(const char* trace) {
+    size_t cap = strlen(trace) + 1, used = 0;
+    char* seq = malloc(cap);
+    if (!seq) {
+        return NULL;
+    }
+    seq[0] = '\0';
+    for (const char* line = strstr(trace, "\"phase\":\""); line;
+         line = strstr(line, "\"phase\":\"")) {
+        line += 9;
+        const char* eol = strchr(line, '\n');
+        const char* name = strstr(line, "\"name\":\"");
+        if ((line[0] == 'B' || line[0] == 'E') && name && (!eol || name < eol)) {
+            name += 8;
+            used += (size_t)snprintf(seq + used, cap - used, "%c %.*s\n", line[0],
+                                     (int)strcspn(name, "\""), name);
+        }
+    }
+    return seq;
+}
+
+static void check_json(void) {
+    char path[PATH_MAX + 32];
+    if (run_workload("json", "basic", "basic.jsonl", "json", NULL) != 0) {
+        return;
+    }
+    path_of(path, sizeof(path), "basic.jsonl");
+    char* trace = read_file(path);
+    path_of(path, sizeof(path), "json.err");
+    char* err = read_file(path);
+    if (!trace || !err) {
+        fail("json", "no trace written");
+    } else if (count_lines(trace, "cuMemAlloc", "E", "\"status\":0") != 3 ||
+               count_lines(trace, "cuLaunchKernel", "E", "\"status\":0") != LAUNCHES) {
+        fail("json", "calls missing from %s", "basic.jsonl");
+    } else if (count_lines(trace, "gpuKernel", "C", "\"kernel\":\"scale\"") != LAUNCHES) {
+        fail("json", "expected %d gpuKernel records", LAUNCHES);
+    } else if (!strstr(err, "1 allocations never freed (1.0 MiB)")) {
+        fail("json", "leaked allocation not reported");
+    } else {
+        // Device times are the mock's, give or take its clock
+        int in_range = 1;
+        for (const char* p = strstr(trace, "\"device_us\":"); p; p = strstr(p + 1, "\"device_us\":")) {
+            double us = strtod(p + 12, NULL);
+            in_range &= us > KERNEL_US * 0.5 && us < KERNEL_US * 5.0;
+        }
+        if (in_range) {
+            pass("json");
+        } else {
+            fail("json", "device times far from %d us", KERNEL_US);
+        }
+    }
+
+    // The workload has checked the pointer itself
+    if (trace && count_lines(trace, "cuMemAlloc", "E", "\"size\":4096") == 2) {
+        pass("procaddr");
+    } else {
+        fail("procaddr", "cuMemAlloc through cuGetProcAddress_v2 not traced");
+    }
+    free(trace);
+    free(err);
+}
+
+static void check_binary(void) {
+    char bin[PATH_MAX + 32], converted[PATH_MAX + 32], json[PATH_MAX + 32];
+    if (run_workload("binary", "basic", "basic.bin", "binary", NULL) != 0) {
+        return;
+    }
+    path_of(bin, sizeof(bin), "basic.bin");
+    path_of(converted, sizeof(converted), "converted.jsonl");
+    path_of(json, sizeof(json), "basic.jsonl");
+    char* argv[] = { (char*)convert, bin, converted, NULL };
+    int rc = run("convert", argv, NULL);
+    if (rc != 0) {
+        fail("binary", "%s exited with %d", convert, rc);
+        return;
+    }
+    char* a = read_file(json);
+    char* b = read_file(converted);
+    char* seq_a = a ? call_sequence(a) : NULL;
+    char* seq_b = b ? call_sequence(b) : NULL;
+    if (!seq_a || !seq_b || !*seq_b) {
+        fail("binary", "nothing converted");
+    } else if (strcmp(seq_a, seq_b) != 0) {
+        fail("binary", "converted calls differ from the JSON trace");
+    } else if (count_lines(b, "gpuKernel", "C", NULL) != LAUNCHES) {
+        fail("binary", "expected %d gpuKernel records", LAUNCHES);
+    } else {
+        pass("binary");
+    }
+    free(seq_a);
+    free(seq_b);
+    free(a);
+    free(b);
+}
+
+static void check_fork(void) {
+    char path[PATH_MAX + 32];
+    if (run_workload("fork", "fork", "fork.jsonl", "json", NULL) != 0) {
+        return;
+    }
+    path_of(path, sizeof(path), "fork.out");
+    char* out = read_file(path);
+    int pids[2];
+    if (!out || sscanf(out, "%d %d", &pids[0], &pids[1]) != 2) {
+        fail("fork", "children not reported");
+        free(out);
+        return;
+    }
+    free(out);
+    for (int i = 0; i < 2; i++) {
+        snprintf(path, sizeof(path), "%s/fork.%d.jsonl", dir, pids[i]);
+        char* trace = read_file(path);
+        if (!trace || count_lines(trace, "cuMemAlloc", "E", "\"status\":0") != 1) {
+            fail("fork", "%s child %d has no trace of its own", i ? "exec'd" : "forked", pids[i]);
+            free(trace);
+            return;
+        }
+        free(trace);
+    }
+    pass("fork");
+}
+
+static void check_legacy(void) {
+    char path[PATH_MAX + 32];
+    if (run_workload("legacy", "legacy", "legacy.jsonl", "json", NULL) != 0) {
+        return;
+    }
+    path_of(path, sizeof(path), "legacy.jsonl");
+    char* trace = read_file(path);
+    if (!trace || count_lines(trace, "cuMemGetInfo", "E", NULL) != 1) {
+        fail("legacy", "expected only the cuMemGetInfo_v2 call traced");
+    } else {
+        pass("legacy");
+    }
+    free(trace);
+}
+
+static void check_control(void) {
+    char path[PATH_MAX + 32], control_env[PATH_MAX + 32];
+    snprintf(control_env, sizeof(control_env), "CUDA_HOOK_CONTROL=%s/control", dir);
+    char* extra[] = { "CUDA_HOOK_MODE=off", control_env, NULL };
+    if (run_workload("control", "control", "control.jsonl", "json", extra) != 0) {
+        return;
+    }
+    path_of(path, sizeof(path), "control.jsonl");
+    char* trace = read_file(path);
+    int allocs = trace ? count_lines(trace, "cuMemAlloc", "E", "\"status\":0") : 0;
+    if (!trace) {
+        fail("control", "no trace written");
+    } else if (count_lines(trace, "mode", "M", "\"mode\":\"trace\",\"previous\":\"off\"") != 1 ||
+               count_lines(trace, "mode", "M", "\"mode\":\"off\",\"previous\":\"trace\"") != 1) {
+        fail("control", "expected one switch to trace and one back to off");
+    } else if (count_lines(trace, "filter", "M", "\"filter\":\"memory\"") != 1) {
+        fail("control", "filter switch missing");
+    } else if (count_lines(trace, "cuInit", "B", NULL) != 0 ||
+               count_lines(trace, "cuCtxSynchronize", "B", NULL) != 0) {
+        fail("control", "calls recorded outside the filter or before the switch");
+    } else if (allocs == 0 || allocs >= CONTROL_ROUNDS) {
+        fail("control", "%d of %d cuMemAlloc calls recorded, want only the timed mode's", allocs,
+             CONTROL_ROUNDS);
+    } else {
+        pass("control");
+    }
+    free(trace);
+}
+
+// Converts <dir>/<bin> to <dir>/<jsonl> and returns the JSON, or NULL
+static char* convert_trace(const char* check, const char* bin, const char* jsonl) {
+    char in[PATH_MAX + 32], out[PATH_MAX + 32];
+    path_of(in, sizeof(in), bin);
+    path_of(out, sizeof(out), jsonl);
+    char* argv[] = { (char*)convert, in, out, NULL };
+    int rc = run("convert", argv, NULL);
+    if (rc != 0) {
+        fail(check, "%s %s exited with %d", convert, bin, rc);
+        return NULL;
+    }
+    return read_file(out);
+}
+
+static void check_rotate(void) {
+    char path[PATH_MAX + 32], name[64];
+    char* extra[] = { "CUDA_HOOK_ROTATE_MB=1", "CUDA_HOOK_COMPRESS=1", NULL };
+    if (run_workload("rotate", "loop", "rotate.bin", "binary", extra) != 0 ||
+        run_workload("unrotated", "loop", "unrotated.bin", "binary", NULL) != 0) {
+        return;
+    }
+    char* whole = convert_trace("rotate", "unrotated.bin", "unrotated.jsonl");
+    if (!whole) {
+        return;
+    }
+    int expected = count_lines(whole, "cuMemAlloc", "E", "\"status\":0");
+    free(whole);
+
+    path_of(path, sizeof(path), "rotate.index.jsonl");
+    FILE* index = fopen(path, "r");
+    if (!index) {
+        fail("rotate", "no index written");
+        return;
+    }
+    struct {
+        int seen;
+        int64_t start_s, start_frac, end_s, end_frac;
+        char path[64];
+    } segments[MAX_SEGMENTS] = { 0 };
+    unsigned count = 0, seg;
+    char line[512], seg_path[64];
+    int64_t s0, s1, e0, e1;
+    int ok = 1;
+    while (fgets(line, sizeof(line), index)) {
+        if (sscanf(line, "{\"segment\":%u,\"path\":\"%63[^\"]\",\"start\":%" SCNd64 ".%" SCNd64
+                         ",\"end\":%" SCNd64 ".%" SCNd64, &seg, seg_path, &s0, &s1, &e0, &e1) != 6 ||
+            seg >= MAX_SEGMENTS || segments[seg].seen) {
+            ok = 0;
+            break;
+        }
+        segments[seg].seen = 1;
+        segments[seg].start_s = s0;
+        segments[seg].start_frac = s1;
+        segments[seg].end_s = e0;
+        segments[seg].end_frac = e1;
+        snprintf(segments[seg].path, sizeof(segments[seg].path), "%s", seg_path);
+        count++;
+    }
+    fclose(index);
+    if (!ok || count < 2) {
+        fail("rotate", "index unreadable or the trace was not rotated (%u segments)", count);
+        return;
+    }
+
+    int total = 0;
+    for (unsigned i = 0; i < count; i++) {
+        int64_t start = segments[i].start_s * 1000000000 + segments[i].start_frac;
+        int64_t end = segments[i].end_s * 1000000000 + segments[i].end_frac;
+        int64_t prev_end = i ? segments[i - 1].end_s * 1000000000 + segments[i - 1].end_frac : 0;
+        if (!segments[i].seen || start > end || start < prev_end) {
+            fail("rotate", "segment %u missing or its time range overlaps", i);
+            return;
+        }
+        if (!strstr(segments[i].path, ".gz")) {
+            fail("rotate", "segment %s not compressed", segments[i].path);
+            return;
+        }
+        snprintf(name, sizeof(name), "rotate.%u.jsonl", i);
+        char* part = convert_trace("rotate", segments[i].path, name);
+        if (!part) {
+            return;
+        }
+        total += count_lines(part, "cuMemAlloc", "E", "\"status\":0");
+        free(part);
+    }
+    if (expected != LOOP_ROUNDS || total != expected) {
+        fail("rotate", "%d calls in %u segments, %d unrotated, %d made", total, count, expected,
+             LOOP_ROUNDS);
+    } else {
+        pass("rotate");
+    }
+}
+
+static void check_aggregate(void) {
+    char path[PATH_MAX + 32];
+    char* extra[] = { "CUDA_HOOK_MODE=aggregate", NULL };
+    if (run_workload("aggregate", "loop", "aggregate.jsonl", "json", extra) != 0) {
+        return;
+    }
+    path_of(path, sizeof(path), "aggregate.jsonl");
+    char* trace = read_file(path);
+    long allocs = trace ? total_count(trace, "cuMemAlloc") : -1;
+    long frees = trace ? total_count(trace, "cuMemFree") : -1;
+    if (!trace) {
+        fail("aggregate", "no trace written");
+    } else if (count_lines(trace, "cuMemAlloc", "E", NULL) != 0) {
+        fail("aggregate", "call records written in aggregate mode");
+    } else if (allocs != LOOP_ROUNDS || frees != LOOP_ROUNDS) {
+        fail("aggregate", "total summary counts %ld allocations and %ld frees of %d", allocs,
+             frees, LOOP_ROUNDS);
+    } else {
+        pass("aggregate");
+    }
+    free(trace);
+}
+
+static void check_sample(void) {
+    char path[PATH_MAX + 32], sample_env[64];
+    snprintf(sample_env, sizeof(sample_env), "CUDA_HOOK_SAMPLE=cuMemAlloc=%d", SAMPLE_EVERY);
+    char* extra[] = { sample_env, NULL };
+    if (run_workload("sample", "loop", "sample.jsonl", "json", extra) != 0) {
+        return;
+    }
+    path_of(path, sizeof(path), "sample.jsonl");
+    char* trace = read_file(path);
+    int recorded = trace ? count_lines(trace, "cuMemAlloc", "E", NULL) : 0;
+    long counted = trace ? total_count(trace, "cuMemAlloc") : -1;
+    if (!trace) {
+        fail("sample", "no trace written");
+    } else if (recorded != LOOP_ROUNDS / SAMPLE_EVERY ||
+               count_lines(trace, "cuMemFree", "E", NULL) != LOOP_ROUNDS) {
+        fail("sample", "%d of %d cuMemAlloc calls recorded, want 1 in %d and every cuMemFree",
+             recorded, LOOP_ROUNDS, SAMPLE_EVERY);
+    } else if (counted != LOOP_ROUNDS) {
+        fail("sample", "total summary counts %ld of %d cuMemAlloc calls", counted, LOOP_ROUNDS);
+    } else {
+        pass("sample");
+    }
+    free(trace);
+}
+
+// Waits for a spawned program to print `text` to stderr
+static int wait_for_output(const char* name, const char* text) {
+    char path[PATH_MAX + 32];
+    snprintf(path, sizeof(path), "%s/%s.err", dir, name);
+    struct timespec poll = { 0, 10000000 };
+    for (long waited = 0; waited < TIMEOUT_S * 100L; waited++) {
+        char* err = read_file(path);
+        int found = err && strstr(err, text);
+        free(err);
+        if (found) {
+            return 0;
+        }
+        nanosleep(&poll, NULL);
+    }
+    return -1;
+}
+
+static void check_collector(void) {
+    char tool[PATH_MAX + 32], output[PATH_MAX + 32], socket_arg[PATH_MAX + 32];
+    char socket_env[PATH_MAX + 64];
+    tool_path(tool, sizeof(tool), "cuda_trace_collectd");
+    path_of(output, sizeof(output), "node.jsonl");
+    snprintf(socket_arg, sizeof(socket_arg), "--socket=%s/collector.sock", dir);
+    snprintf(socket_env, sizeof(socket_env), "CUDA_HOOK_COLLECTOR=%s/collector.sock", dir);
+    char* argv[] = { tool, socket_arg, output, NULL };
+    pid_t collectd = spawn("collectd", argv, NULL);
+    if (collectd < 0 || wait_for_output("collectd", "Listening") != 0) {
+        fail("collector", "cuda_trace_collectd did not start, see %s/collectd.err", dir);
+        if (collectd > 0) {
+            kill(collectd, SIGKILL);
+            waitpid(collectd, NULL, 0);
+        }
+        return;
+    }
+
+    char* extra[] = { socket_env, NULL };
+    pid_t pids[2];
+    pids[0] = start_workload("collector_a", "basic", "collector_a.jsonl", "json", extra);
+    pids[1] = start_workload("collector_b", "basic", "collector_b.jsonl", "json", extra);
+    int rc_a = finish("collector_a", pids[0]);
+    int rc_b = finish("collector_b", pids[1]);
+    kill(collectd, SIGTERM);
+    int rc = finish("collectd", collectd);
+    if (rc_a != 0 || rc_b != 0 || rc != 0) {
+        fail("collector", "exit status %d and %d, collector %d", rc_a, rc_b, rc);
+        return;
+    }
+
+    char* node = read_file(output);
+    for (int i = 0; i < 2; i++) {
+        char own[32];
+        snprintf(own, sizeof(own), "{\"pid\":%d,", (int)pids[i]);
+        if (!node || count_lines(node, "cuMemAlloc", "E", own) != 3 ||
+            count_lines(node, "cuLaunchKernel", "E", own) != LAUNCHES) {
+            fail("collector", "calls of pid %d missing from the node trace", (int)pids[i]);
+            free(node);
+            return;
+        }
+    }
+    free(node);
+    pass("collector");
+}
+
+// The node trace of check_collector: two processes, one default stream each
+static int critpath_node_ok(const char* tool) {
+    char trace_path[PATH_MAX + 32], path[PATH_MAX + 32], expect[96];
+    path_of(trace_path, sizeof(trace_path), "node.jsonl");
+    char* node = read_file(trace_path);
+    if (!node) {
+        fail("critpath", "no node trace from the collector check");
+        return 0;
+    }
+    int calls = count_text(node, "\"phase\":\"E\"");
+    free(node);
+
+    char* argv[] = { (char*)tool, trace_path, NULL };
+    int rc = run("critpath_node", argv, NULL);
+    path_of(path, sizeof(path), "critpath_node.out");
+    char* out = read_file(path);
+    snprintf(expect, sizeof(expect), "Stream dependency graph: %d calls", calls);
+    int ok = rc == 0 && out && strstr(out, expect) && strstr(out, "on 2 streams") &&
+             strstr(out, ", 2 processes");
+    if (!ok) {
+        fail("critpath", "node trace: want %d calls on 2 streams of 2 processes", calls);
+    }
+    free(out);
+    return ok;
+}
+
+static void check_critpath(void) {
+    char tool[PATH_MAX + 32], trace_path[PATH_MAX + 32], path[PATH_MAX + 32];
+    char* extra[] = { LONG_KERNEL, NULL };
+    if (run_workload("critpath_run", "streams", "streams.jsonl", "json", extra) != 0) {
+        return;
+    }
+    tool_path(tool, sizeof(tool), "cuda_trace_critpath");
+    path_of(trace_path, sizeof(trace_path), "streams.jsonl");
+    char* argv[] = { tool, "--iteration=0", "--limit=100", trace_path, NULL };
+    int rc = run("critpath", argv, NULL);
+    path_of(path, sizeof(path), "critpath.out");
+    char* out = read_file(path);
+    const char* crit = out ? strstr(out, "Critical path of iteration 0") : NULL;
+    const char* first = crit ? strstr(crit, "long_kernel") : NULL;
+    const char* record = first ? strstr(first, "cuEventRecord") : NULL;
+    if (rc != 0 || !crit) {
+        fail("critpath", "cuda_trace_critpath exited with %d, see %s/critpath.err", rc, dir);
+    } else if (!strstr(out, "on 2 streams, 1 event edges") || !strstr(out, "3 of 3 ops measured")) {
+        fail("critpath", "expected 3 timed kernels on 2 streams and 1 event edge");
+    } else if (!record || !strstr(record, "tail_kernel") || strstr(crit, "short_kernel")) {
+        fail("critpath", "critical path is not long_kernel, the event, tail_kernel");
+    } else if (critpath_node_ok(tool)) {
+        pass("critpath");
+    }
+    free(out);
+}
+
+static void check_chrome(void) {
+    char path[PATH_MAX + 32];
+    char* extra[] = { LONG_KERNEL, NULL };
+    if (run_workload("chrome", "streams", "streams.json", "chrome", extra) != 0) {
+        return;
+    }
+    path_of(path, sizeof(path), "streams.json");
+    char* trace = read_file(path);
+    const char* end = trace;
+    if (!trace || !json_value(&end) || trace[strspn(trace, " \t\r\n")] != '[' ||
+        end[strspn(end, " \t\r\n")] != '\0') {
+        fail("chrome", "%s is not one JSON array", "streams.json");
+    } else if (count_text(trace, "\"name\":\"thread_name\"") != 2 ||
+               count_text(trace, "\"args\":{\"name\":\"stream 0x") != 2) {
+        fail("chrome", "expected a track for each of the 2 streams");
+    } else if (count_text(trace, "\"queue_us\":") != 3) {
+        fail("chrome", "expected the device time of 3 kernels");
+    } else {
+        pass("chrome");
+    }
+    free(trace);
+}
+
+static void check_replay(void) {
+    static const char* const replayed[][2] = {
+        { "cuLaunchKernel", "\"kernel\":\"long_kernel\"" },
+        { "cuLaunchKernel", "\"kernel\":\"short_kernel\"" },
+        { "cuLaunchKernel", "\"kernel\":\"tail_kernel\"" },
+        { "cuStreamCreate", NULL },
+        { "cuEventRecord", NULL },
+        { "cuStreamWaitEvent", NULL },
+    };
+    char tool[PATH_MAX + 32], bin[PATH_MAX + 32], mock[PATH_MAX + 32];
+    char libcuda_arg[PATH_MAX + 48], preload_env[PATH_MAX + 32], trace_env[PATH_MAX + 32];
+    char path[PATH_MAX + 32];
+    char* extra[] = { LONG_KERNEL, NULL };
+    if (run_workload("replay_run", "streams", "streams.bin", "binary", extra) != 0) {
+        return;
+    }
+    char* original = convert_trace("replay", "streams.bin", "streams_bin.jsonl");
+    if (!original) {
+        return;
+    }
+
+    tool_path(tool, sizeof(tool), "cuda_trace_replay");
+    tool_path(mock, sizeof(mock), "libcuda_mock.so");
+    snprintf(libcuda_arg, sizeof(libcuda_arg), "--libcuda=%s", mock);
+    path_of(bin, sizeof(bin), "streams.bin");
+    snprintf(preload_env, sizeof(preload_env), "LD_PRELOAD=%s", hook);
+    snprintf(trace_env, sizeof(trace_env), "CUDA_HOOK_TRACE=%s/replayed.jsonl", dir);
+    char* argv[] = { tool, "--timing=fast", libcuda_arg, bin, NULL };
+    char* env[] = { preload_env, trace_env, NULL };
+    int rc = run("replay", argv, env);
+    path_of(path, sizeof(path), "replayed.jsonl");
+    char* again = rc == 0 ? read_file(path) : NULL;
+    if (!again) {
+        fail("replay", "cuda_trace_replay exited with %d, see %s/replay.err", rc, dir);
+    } else {
+        int ok = 1;
+        for (size_t i = 0; ok && i < sizeof(replayed) / sizeof(replayed[0]); i++) {
+            int want = count_lines(original, replayed[i][0], "E", replayed[i][1]);
+            int got = count_lines(again, replayed[i][0], "E", replayed[i][1]);
+            if (want == 0 || got != want) {
+                fail("replay", "%d %s %s replayed, traced %d", got, replayed[i][0],
+                     replayed[i][1] ? replayed[i][1] : "calls", want);
+                ok = 0;
+            }
+        }
+        if (ok) {
+            pass("replay");
+        }
+    }
+    free(original);
+    free(again);
+}
+
+static int run_diff(const char* name, const char* a, const char* b) {
+    char tool[PATH_MAX + 32], path_a[PATH_MAX + 32], path_b[PATH_MAX + 32];
+    tool_path(tool, sizeof(tool), "cuda_trace_diff");
+    path_of(path_a, sizeof(path_a), a);
+    path_of(path_b, sizeof(path_b), b);
+    char* argv[] = { tool, path_a, path_b, NULL };
+    return run(name, argv, NULL);
+}
+
+static void check_diff(void) {
+    char* fast[] = { FAST_ALLOC, NULL };
+    char* slow[] = { SLOW_ALLOC, NULL };
+    if (run_workload("diff_fast", "loop", "fast.jsonl", "json", fast) != 0 ||
+        run_workload("diff_slow", "loop", "slow.jsonl", "json", slow) != 0 ||
+        run_workload("diff_bin", "basic", "diff.bin", "binary", NULL) != 0) {
+        return;
+    }
+    // Only the gzip magic is looked at
+    char gz[PATH_MAX + 32];
+    path_of(gz, sizeof(gz), "diff.jsonl.gz");
+    FILE* f = fopen(gz, "w");
+    if (!f || fwrite("\x1f\x8b\x08\x00", 1, 4, f) != 4 || fclose(f) != 0) {
+        fail("diff", "could not write %s", gz);
+        return;
+    }
+
+    int slower = run_diff("diff", "fast.jsonl", "slow.jsonl");
+    int same = run_diff("diff_same", "fast.jsonl", "fast.jsonl");
+    int binary = run_diff("diff_binary", "fast.jsonl", "diff.bin");
+    int compressed = run_diff("diff_gz", "diff.jsonl.gz", "fast.jsonl");
+    if (slower != 1 || same != 0 || binary != 2 || compressed != 2) {
+        fail("diff", "exit status %d slower, %d same, %d binary, %d gzip; want 1, 0, 2, 2",
+             slower, same, binary, compressed);
+    } else {
+        pass("diff");
+    }
+}
+
+static void remove_dir(void) {
+    char cmd[PATH_MAX + 16];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", dir);
+    if (system(cmd) != 0) {
+        fprintf(stderr, "Could not remove %s\n", dir);
+    }
+}
+
+int main(int argc, char** argv) {
+    static char self_path[PATH_MAX], hook_path[PATH_MAX], convert_path[PATH_MAX];
+    const char* workload = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--run=", 6) == 0) {
+            workload = argv[i] + 6;
+        } else if (strncmp(argv[i], "--hook=", 7) == 0) {
+            hook = argv[i] + 7;
+        } else if (strncmp(argv[i], "--convert=", 10) == 0) {
+            convert = argv[i] + 10;
+        } else {
+            fprintf(stderr, "Usage: %s [--hook=PATH] [--convert=PATH]\n"
+                            "Default: hook %s, converter %s\n",
+                    argv[0], DEFAULT_HOOK, DEFAULT_CONVERT);
+            return 1;
+        }
+    }
+    if (!realpath("/proc/self/exe", self_path)) {
+        perror("/proc/self/exe");
+        return 1;
+    }
+    self = self_path;
+
+    if (workload) {
+        if (strcmp(workload, "basic") == 0) {
+            return workload_basic();
+        }
+        if (strcmp(workload, "fork") == 0) {
+            return workload_fork();
+        }
+        if (strcmp(workload, "legacy") == 0) {
+            return workload_legacy();
+        }
+        if (strcmp(workload, "exec") == 0) {
+            return workload_exec();
+        }
+        if (strcmp(workload, "streams") == 0) {
+            return workload_streams();
+        }
+        if (strcmp(workload, "loop") == 0) {
+            return workload_loop();
+        }
+        if (strcmp(workload, "control") == 0) {
+            return workload_control();
+        }
+        fprintf(stderr, "Error: unknown workload %s\n", workload);
+        return 1;
+    }
+
+    if (!realpath(hook, hook_path) || !realpath(convert, convert_path)) {
+        perror(realpath(hook, hook_path) ? convert : hook);
+        return 1;
+    }
+    hook = hook_path;
+    convert = convert_path;
+    snprintf(dir, sizeof(dir), "%s/cuda_hook_test.XXXXXX", getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+    if (!mkdtemp(dir)) {
+        perror(dir);
+        return 1;
+    }
+
+    check_json();
+    check_binary();
+    check_fork();
+    check_legacy();
+    check_control();
+    check_rotate();
+    check_aggregate();
+    check_sample();
+    check_collector();
+    check_critpath();
+    check_chrome();
+    check_replay();
+    check_diff();
+
+    if (failures == 0) {
+        remove_dir();
+    } else {
+        printf("%d check(s) failed; output kept in %s\n", failures, dir);
+    }
+    return failures;
+}
@@ -0,0 +1,345 @@
+/*
+ * trace_chrome.c - Chrome Trace Event output with stream tracks and flows
+ *
+ * Writes the JSON Array form of the Chrome Trace Event format: "[", then
+ * one event per element. The closing "]" is optional in that form, so a
+ * trace whose process died before exit still opens.
+ *
+ * Every call is a complete ("X") slice on the thread that made it. Work
+ * issued to a stream (launches, async copies and memsets, graph launches,
+ * stream-ordered allocations) is also marked on a track of its own per
+ * stream, named after the stream handle, and a kernel's device time from
+ * CUDA_HOOK_GPU_TIMING is a slice on that track with an arrow from its
+ * launch. The last work issued to a stream before a cuStreamSynchronize,
+ * cuCtxSynchronize or cuEventSynchronize (through the event's record) gets
+ * an arrow to that sync, so a long wait points at what it waited for.
+ *
+ * Calls are matched in the order the drainer writes them, which is exact
+ * within a thread; across threads a sync may be written before work issued
+ * just ahead of it on another thread and then points at earlier work.
+ */
+
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cuda_hook.h"
+
+// Stream tracks get tids no thread has (pid_max is at most 2^22)
+#define STREAM_TRACK_BASE 0x40000000u
+
+// CU_STREAM_LEGACY and CU_STREAM_PER_THREAD
+#define STREAM_LEGACY     0x1
+#define STREAM_PER_THREAD 0x2
+
+struct chrome_writer hook_chrome;
+
+// Position of a generated hook's hStream capture, -1 if it has none
+static int8_t stream_arg[API_COUNT];
+static int stream_args_ready = 0;
+
+static void find_stream_args(void) {
+    for (unsigned api = 0; api < API_COUNT; api++) {
+        stream_arg[api] = -1;
+        for (unsigned i = 0; i < HOOK_GEN_ARGS; i++) {
+            const struct hook_arg_desc* arg = &hook_api_args[api][i];
+            if (arg->kind == HOOK_ARG_HANDLE && !arg->out && strcmp(arg->name, "hStream") == 0) {
+                stream_arg[api] = (int8_t)i;
+            }
+        }
+    }
+    stream_args_ready = 1;
+}
+
+// Stream a call puts work on; returns 0 for calls that issue no work
+static int work_stream(const struct hook_event* ev, uint64_t* stream) {
+    switch (ev->api) {
+    case API_cuLaunchKernel:
+        *stream = ev->args.launch.stream;
+        return 1;
+    case API_cuMemcpyAsync:
+    case API_cuMemcpyHtoDAsync:
+    case API_cuMemcpyDtoHAsync:
+    case API_cuMemcpyDtoDAsync:
+        *stream = ev->args.copy.stream;
+        return 1;
+    case API_cuMemAllocAsync:
+    case API_cuMemFreeAsync:
+        *stream = ev->args.mem.stream;
+        return 1;
+    default:
+        break;
+    }
+    // Stream and event management take a stream without issuing work
+    const char* category = hook_api_categories[ev->api];
+    if (stream_arg[ev->api] < 0 || strcmp(category, "stream") == 0 ||
+        strcmp(category, "event") == 0) {
+        return 0;
+    }
+    *stream = ev->args.generic[stream_arg[ev->api]];
+    return 1;
+}
+
+// The legacy default stream is one track however it is named; each
+// thread's per-thread default stream is a track of its own
+static uint64_t chrome_stream_key(uint64_t stream, uint32_t tid) {
+    if (stream == STREAM_LEGACY) {
+        return 0;
+    }
+    if (stream == STREAM_PER_THREAD) {
+        return STREAM_PER_THREAD | (uint64_t)tid << 32;
+    }
+    return stream;
+}
+
+static uint64_t mix(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key;
+}
+
+static void separator(struct chrome_writer* w) {
+    fputs(w->first ? "\n" : ",\n", w->out);
+    w->first = 0;
+}
+
+static double us(int64_t ns) {
+    return ns / 1e3;
+}
+
+static void write_track_name(struct chrome_writer* w, const struct chrome_stream* s) {
+    separator(w);
+    fprintf(w->out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":",
+            w->pid, s->track);
+    if (s->key == 0) {
+        fputs("\"stream (legacy default)\"", w->out);
+    } else if ((s->key & 0xffffffffu) == STREAM_PER_THREAD) {
+        fprintf(w->out, "\"stream (per-thread default, tid %u)\"", (uint32_t)(s->key >> 32));
+    } else {
+        fprintf(w->out, "\"stream 0x%" PRIx64 "\"", s->key);
+    }
+    // Below the host threads
+    fprintf(w->out, "}},\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,"
+            "\"args\":{\"sort_index\":%u}}",
+            w->pid, s->track, s->track);
+}
+
+// NULL once the table is full: that stream's work then has no track
+static struct chrome_stream* find_stream(struct chrome_writer* w, uint64_t key) {
+    uint32_t mask = CHROME_STREAMS - 1;
+    for (uint32_t i = 0, at = (uint32_t)mix(key) & mask; i < CHROME_STREAMS; i++, at = (at + 1) & mask) {
+        struct chrome_stream* s = &w->streams[at];
+        if (s->track == 0) {
+            s->key = key;
+            s->track = STREAM_TRACK_BASE + ++w->tracks;
+            memset(&s->pending, 0, sizeof(s->pending));
+            write_track_name(w, s);
+            return s;
+        }
+        if (s->key == key) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+// Events are recorded over and over from small pools; when the table is
+// full a new handle takes its home slot
+static struct chrome_event* find_event(struct chrome_writer* w, uint64_t handle) {
+    uint32_t mask = CHROME_EVENTS - 1;
+    uint32_t home = (uint32_t)mix(handle) & mask;
+    for (uint32_t i = 0, at = home; i < CHROME_EVENTS; i++, at = (at + 1) & mask) {
+        struct chrome_event* e = &w->events[at];
+        if (e->handle == 0 || e->handle == handle) {
+            e->handle = handle;
+            return e;
+        }
+    }
+    w->events[home].handle = handle;
+    return &w->events[home];
+}
+
+// Flow ends bind to the slice around their timestamp, hence the middles
+static void write_flow(struct chrome_writer* w, const char* name, const struct chrome_op* from,
+                       uint32_t to_tid, int64_t to_ts) {
+    uint64_t id = ++w->flows;
+    separator(w);
+    fprintf(w->out,
+            "{\"name\":\"%s\",\"cat\":\"flow\",\"ph\":\"s\",\"id\":%" PRIu64 ",\"ts\":%.3f,"
+            "\"pid\":%u,\"tid\":%u},\n"
+            "{\"name\":\"%s\",\"cat\":\"flow\",\"ph\":\"f\",\"bp\":\"e\",\"id\":%" PRIu64 ","
+            "\"ts\":%.3f,\"pid\":%u,\"tid\":%u}",
+            name, id, us(from->ts), w->pid, from->tid, name, id, us(to_ts), w->pid, to_tid);
+}
+
+static const char* kernel_name(const struct chrome_writer* w, uint32_t func) {
+    const struct func_entry* fn = func_table_get(w->functions, func);
+    return fn ? string_table_get(w->strings, fn->name) : NULL;
+}
+
+// Device time of a timed launch, on its stream's track
+static void write_device(struct chrome_writer* w, const struct hook_event* ev) {
+    struct chrome_stream* s = find_stream(w, chrome_stream_key(ev->args.gpu.stream, ev->tid));
+    if (!s) {
+        return;
+    }
+    const char* name = kernel_name(w, ev->args.gpu.func);
+    separator(w);
+    fputs("{\"name\":", w->out);
+    trace_write_string(w->out, name ? name : "kernel");
+    fprintf(w->out,
+            ",\"cat\":\"device\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%u,\"tid\":%u,"
+            "\"args\":{\"op_id\":%" PRIu64 ",\"queue_us\":%.3f}}",
+            us(ev->ts), us(ev->end - ev->ts), w->pid, s->track, ev->op_id,
+            us(ev->args.gpu.queue_ns));
+
+    // The launch call began queue_ns before the kernel started
+    struct chrome_op launch = { ev->ts - ev->args.gpu.queue_ns, ev->tid, 1 };
+    write_flow(w, "launch", &launch, s->track, ev->ts + (ev->end - ev->ts) / 2);
+}
+
+// Work marker on the stream's track; it becomes what the next sync waits for
+static void write_work(struct chrome_writer* w, const struct hook_event* ev, uint64_t stream) {
+    struct chrome_stream* s = find_stream(w, chrome_stream_key(stream, ev->tid));
+    if (!s) {
+        return;
+    }
+    const char* name = ev->api == API_cuLaunchKernel ? kernel_name(w, ev->args.launch.func) : NULL;
+    separator(w);
+    fputs("{\"name\":", w->out);
+    trace_write_string(w->out, name ? name : hook_api_names[ev->api]);
+    fprintf(w->out,
+            ",\"cat\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%u,\"tid\":%u,"
+            "\"args\":{\"op_id\":%" PRIu64 "}}",
+            hook_api_categories[ev->api], us(ev->ts), w->pid, s->track, ev->op_id);
+
+    s->pending.ts = ev->ts + (ev->end - ev->ts) / 2;
+    s->pending.tid = ev->tid;
+    s->pending.valid = 1;
+}
+
+static void wait_stream(struct chrome_writer* w, struct chrome_stream* s,
+                        const struct hook_event* ev) {
+    if (s->pending.valid && s->pending.ts <= ev->end) {
+        write_flow(w, "sync", &s->pending, ev->tid, ev->ts + (ev->end - ev->ts) / 2);
+    }
+    s->pending.valid = 0;
+}
+
+// Arrows into synchronizations, and what event records capture
+static void follow_sync(struct chrome_writer* w, const struct hook_event* ev) {
+    struct chrome_stream* s;
+    switch (ev->api) {
+    case API_cuStreamSynchronize:
+        if ((s = find_stream(w, chrome_stream_key(ev->args.stream.stream, ev->tid)))) {
+            wait_stream(w, s, ev);
+        }
+        break;
+    case API_cuCtxSynchronize:
+        for (uint32_t i = 0; i < CHROME_STREAMS; i++) {
+            if (w->streams[i].track) {
+                wait_stream(w, &w->streams[i], ev);
+            }
+        }
+        break;
+    case API_cuEventRecord:
+    case API_cuEventRecordWithFlags:
+        if ((s = find_stream(w, chrome_stream_key(ev->args.event.stream, ev->tid)))) {
+            find_event(w, ev->args.event.event)->op = s->pending;
+        }
+        break;
+    case API_cuEventSynchronize: {
+        struct chrome_event* e = find_event(w, ev->args.generic[0]);
+        if (e->op.valid && e->op.ts <= ev->end) {
+            write_flow(w, "sync", &e->op, ev->tid, ev->ts + (ev->end - ev->ts) / 2);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void chrome_writer_init(struct chrome_writer* w, FILE* out, const struct string_table* strings,
+                        const struct func_table* functions, uint32_t pid) {
+    if (!stream_args_ready) {
+        find_stream_args();
+    }
+    memset(w, 0, sizeof(*w));
+    w->out = out;
+    w->strings = strings;
+    w->functions = functions;
+    w->pid = pid;
+    w->first = 1;
+}
+
+// Start of a file: a new segment or a forked child's trace repeats the
+// track names, so it opens on its own
+void chrome_begin(struct chrome_writer* w, const char* process_name) {
+    memset(w->streams, 0, sizeof(w->streams));
+    memset(w->events, 0, sizeof(w->events));
+    w->tracks = 0;
+    w->first = 1;
+    fputc('[', w->out);
+    separator(w);
+    fprintf(w->out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":0,\"args\":{\"name\":",
+            w->pid);
+    trace_write_string(w->out, process_name);
+    fputs("}}", w->out);
+}
+
+// Timestamps in ns
+void chrome_event(struct chrome_writer* w, const struct hook_event* ev) {
+    if (ev->api == REC_GPU_KERNEL) {
+        write_device(w, ev);
+        return;
+    }
+    if (ev->api >= REC_COUNT) {
+        return;
+    }
+
+    trace_write_chrome(w->out, ev, w->strings, w->functions, w->pid, w->first);
+    w->first = 0;
+    if (ev->api >= API_COUNT || ev->status != CUDA_SUCCESS) {
+        return;
+    }
+    uint64_t stream;
+    if (work_stream(ev, &stream)) {
+        write_work(w, ev, stream);
+    } else {
+        follow_sync(w, ev);
+    }
+}
+
+void chrome_process(struct chrome_writer* w, const struct trace_process* process) {
+    char label[64];
+    switch (process->origin) {
+    case PROCESS_FORK:
+        snprintf(label, sizeof(label), "forked from %u", process->parent);
+        break;
+    case PROCESS_EXEC:
+        snprintf(label, sizeof(label), "exec'd from %u", process->parent);
+        break;
+    default:
+        snprintf(label, sizeof(label), "started");
+        break;
+    }
+    w->pid = process->pid;
+    separator(w);
+    fprintf(w->out, "{\"name\":\"process_labels\",\"ph\":\"M\",\"pid\":%u,\"tid\":0,"
+            "\"args\":{\"labels\":\"%s\"}}",
+            w->pid, label);
+}
+
+#define CHROME_CLOSE "\n]\n"
+
+void chrome_end(struct chrome_writer* w) {
+    fputs(CHROME_CLOSE, w->out);
+}
+
+// The file is still open after a failed rotation: take the bracket back
+void chrome_resume(struct chrome_writer* w) {
+    fseek(w->out, -(long)strlen(CHROME_CLOSE), SEEK_CUR);
+}
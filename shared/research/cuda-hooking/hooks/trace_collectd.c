@@ -0,0 +1,779 @@
+/*
+ * trace_collectd.c - Node-local collector for traced processes
+ *
+ * Processes started with CUDA_HOOK_COLLECTOR register with this daemon over
+ * a Unix socket and hand it a shared-memory ring carrying their binary trace
+ * stream (see hook_collector.c). One reader thread per process decodes its
+ * stream; the main thread merges the events of all processes by start time
+ * and writes one node-level JSONL trace, rotated and compressed like the
+ * hook's own output. Every line it copies from a process gains a "pid"
+ * member; the lines without one are node-wide per-API summaries over all
+ * processes, one per window and a total at exit.
+ *
+ * Events are held back for --merge-ms before they are written, which gives
+ * every process's drainer time to hand over anything that started earlier.
+ * An event that still turns up after later ones were written goes out at
+ * once and is counted as late.
+ *
+ * Compile: make cuda_trace_collectd
+ * Usage: cuda_trace_collectd [--socket=PATH] [--rotate-mb=N] [--rotate-s=N]
+ *                            [--compress=N] [--window-ms=N] [--merge-ms=N]
+ *                            [output]
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cuda_hook.h"
+
+#define DEFAULT_OUTPUT    "node_trace.jsonl"
+#define DEFAULT_MERGE_MS  500
+#define DEFAULT_WINDOW_MS 10000
+#define EVENT_BATCH       1024
+#define WRITE_BATCH       4096
+#define LOOP_MS           5
+#define READER_IDLE_US    1000
+#define OUTPUT_BUFFER     (1 << 20)
+
+struct source;
+
+// A record waiting in the merge heap: an event, or any other record
+// already formatted
+struct pending {
+    int64_t ts;
+    uint64_t seq;               // Arrival order among equal timestamps
+    struct source* src;
+    char* text;                 // NULL for an event
+    size_t len;
+    struct hook_event ev;
+};
+
+struct source {
+    uint32_t pid;
+    int sock;
+    struct collector_ring* ring;
+    size_t map_bytes;
+    FILE* in;
+    struct trace_reader reader;
+    pthread_t thread;
+    int hung_up;                // Process closed its socket (reader thread)
+    struct pending batch[EVENT_BATCH];
+    size_t batch_count;
+    int done;                   // Reader finished; guarded by merge_lock
+    uint64_t pending;           // Entries in the heap; guarded by merge_lock
+    uint64_t events;            // Written (main thread)
+    struct source* next;
+};
+
+static volatile sig_atomic_t stop_requested = 0;
+static int stopping = 0;
+static struct source* sources = NULL;
+
+// Min-heap on (ts, seq), filled by the readers and emptied by the main thread
+static pthread_mutex_t merge_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct pending* heap = NULL;
+static size_t heap_count = 0;
+static size_t heap_cap = 0;
+static uint64_t heap_seq = 0;
+
+// Output, main thread only
+static FILE* out = NULL;
+static FILE* scratch = NULL;
+static char* scratch_buf = NULL;
+static size_t scratch_size = 0;
+static int64_t segment_first = 0;
+static int64_t segment_last = 0;
+static int64_t last_written = 0;
+static uint64_t written = 0;
+static uint64_t late = 0;
+static uint32_t processes = 0;
+
+// Node-wide stats: the current window and the whole run, durations in ns
+static int64_t window_ns = 0;
+static int64_t window_start = 0;
+static struct agg_api_stats* window_stats = NULL;
+static struct agg_api_stats* total_stats = NULL;
+static int64_t total_start = 0;
+static struct trace_summary_api* summary_apis = NULL;
+
+static int64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static int before(const struct pending* a, const struct pending* b) {
+    return a->ts < b->ts || (a->ts == b->ts && a->seq < b->seq);
+}
+
+// Caller holds merge_lock
+static int heap_push(const struct pending* p) {
+    if (heap_count == heap_cap) {
+        size_t cap = heap_cap ? heap_cap * 2 : 65536;
+        struct pending* grown = realloc(heap, cap * sizeof(*heap));
+        if (!grown) {
+            return -1;
+        }
+        heap = grown;
+        heap_cap = cap;
+    }
+    size_t i = heap_count++;
+    heap[i] = *p;
+    heap[i].seq = heap_seq++;
+    while (i > 0 && before(&heap[i], &heap[(i - 1) / 2])) {
+        struct pending tmp = heap[i];
+        heap[i] = heap[(i - 1) / 2];
+        heap[(i - 1) / 2] = tmp;
+        i = (i - 1) / 2;
+    }
+    p->src->pending++;
+    return 0;
+}
+
+// Caller holds merge_lock
+static void heap_pop(struct pending* top) {
+    *top = heap[0];
+    top->src->pending--;
+    heap[0] = heap[--heap_count];
+    size_t i = 0;
+    for (;;) {
+        size_t l = 2 * i + 1, r = l + 1, m = i;
+        if (l < heap_count && before(&heap[l], &heap[m])) {
+            m = l;
+        }
+        if (r < heap_count && before(&heap[r], &heap[m])) {
+            m = r;
+        }
+        if (m == i) {
+            break;
+        }
+        struct pending tmp = heap[i];
+        heap[i] = heap[m];
+        heap[m] = tmp;
+        i = m;
+    }
+}
+
+//
+// Reader threads
+//
+
+static void flush_batch(struct source* src) {
+    if (src->batch_count == 0) {
+        return;
+    }
+    pthread_mutex_lock(&merge_lock);
+    for (size_t i = 0; i < src->batch_count; i++) {
+        if (heap_push(&src->batch[i]) != 0) {
+            fprintf(stderr, "[COLLECTD] Out of memory, dropping events of pid %u\n", src->pid);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&merge_lock);
+    src->batch_count = 0;
+}
+
+// The process never writes to the socket after its hello, so a readable
+// socket means it has gone
+static int peer_gone(int sock) {
+    struct pollfd pfd = { sock, POLLIN | POLLRDHUP, 0 };
+    return poll(&pfd, 1, 0) != 0;
+}
+
+// fopencookie read: blocks until the process writes or goes away
+static ssize_t ring_read(void* cookie, char* buf, size_t size) {
+    struct source* src = cookie;
+    struct collector_ring* ring = src->ring;
+    for (;;) {
+        uint64_t tail = ring->tail;
+        uint64_t avail = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - tail;
+        if (avail > ring->size) {
+            fprintf(stderr, "[COLLECTD] Ring of pid %u is corrupt\n", src->pid);
+            return -1;
+        }
+        if (avail) {
+            size_t n = avail < size ? avail : size;
+            uint64_t at = tail & (ring->size - 1);
+            size_t first = ring->size - at < n ? ring->size - at : n;
+            memcpy(buf, ring->data + at, first);
+            memcpy(buf + first, ring->data, n - first);
+            __atomic_store_n(&ring->tail, tail + n, __ATOMIC_RELEASE);
+            return (ssize_t)n;
+        }
+        if (src->hung_up) {
+            return 0;
+        }
+        // Whatever is decoded so far goes to the merge before waiting
+        flush_batch(src);
+        if (__atomic_load_n(&stopping, __ATOMIC_RELAXED) || peer_gone(src->sock)) {
+            // Look at the ring once more: the last bytes precede the close
+            src->hung_up = 1;
+            continue;
+        }
+        struct timespec pause = { 0, READER_IDLE_US * 1000 };
+        nanosleep(&pause, NULL);
+    }
+}
+
+static void on_event(void* ctx, const struct hook_event* ev) {
+    struct source* src = ctx;
+    struct pending* p = &src->batch[src->batch_count++];
+    p->ts = ev->ts;
+    p->src = src;
+    p->text = NULL;
+    p->ev = *ev;
+    if (src->batch_count == EVENT_BATCH) {
+        flush_batch(src);
+    }
+}
+
+// Other records are formatted here, on the reader's thread, and merged at
+// their own timestamp
+struct text {
+    FILE* m;
+    char* buf;
+    size_t len;
+};
+
+static FILE* text_begin(struct text* t) {
+    t->buf = NULL;
+    t->len = 0;
+    t->m = open_memstream(&t->buf, &t->len);
+    return t->m;
+}
+
+static void text_push(void* ctx, int64_t ts, struct text* t) {
+    struct source* src = ctx;
+    fclose(t->m);
+    flush_batch(src);
+    struct pending p = { ts, 0, src, t->buf, t->len, { 0 } };
+    pthread_mutex_lock(&merge_lock);
+    if (!t->buf || heap_push(&p) != 0) {
+        free(t->buf);
+    }
+    pthread_mutex_unlock(&merge_lock);
+}
+
+static void on_summary(void* ctx, const struct trace_summary* summary,
+                       const struct trace_summary_api* apis) {
+    struct text t;
+    if (text_begin(&t)) {
+        trace_write_summary_json(t.m, summary, apis);
+        text_push(ctx, summary->end_ns, &t);
+    }
+}
+
+static void on_allocs(void* ctx, const struct trace_alloc_report* report,
+                      const struct trace_alloc_context* contexts) {
+    struct text t;
+    if (text_begin(&t)) {
+        trace_write_allocs_json(t.m, report, contexts);
+        text_push(ctx, report->ts_ns, &t);
+    }
+}
+
+// Stack entries carry no time of their own; they sort first, so each one
+// is written before any event that refers to it
+static void on_stack(void* ctx, const struct trace_stack* stack) {
+    struct text t;
+    if (text_begin(&t)) {
+        trace_write_stack_json(t.m, stack);
+        text_push(ctx, 0, &t);
+    }
+}
+
+static void on_maps(void* ctx, const struct trace_maps* maps, const char* text, size_t len) {
+    struct text t;
+    if (text_begin(&t)) {
+        trace_write_maps_json(t.m, maps, text, len);
+        text_push(ctx, maps->ts_ns, &t);
+    }
+}
+
+static void on_mode(void* ctx, const struct trace_mode_change* change) {
+    struct text t;
+    if (text_begin(&t)) {
+        trace_write_mode_json(t.m, change);
+        text_push(ctx, change->ts_ns, &t);
+    }
+}
+
+static void on_filter(void* ctx, const struct trace_filter_change* change, const char* spec) {
+    struct text t;
+    if (text_begin(&t)) {
+        trace_write_filter_json(t.m, change, spec);
+        text_push(ctx, change->ts_ns, &t);
+    }
+}
+
+static void on_process(void* ctx, const struct trace_process* process) {
+    struct text t;
+    if (text_begin(&t)) {
+        trace_write_process_json(t.m, process);
+        text_push(ctx, process->ts_ns, &t);
+    }
+}
+
+static const struct trace_reader_ops collect_ops = {
+    on_event, on_summary, on_allocs, on_stack, on_maps, on_mode, on_filter, on_process,
+};
+
+static void* reader_main(void* arg) {
+    struct source* src = arg;
+    char name[32];
+    snprintf(name, sizeof(name), "pid %u", src->pid);
+    // A process that gave up before the reply writes nothing at all
+    int c = getc(src->in);
+    if (c != EOF && ungetc(c, src->in) != EOF &&
+        trace_reader_open(&src->reader, src->in, name) == 0) {
+        while (trace_reader_next(&src->reader, &collect_ops, src) > 0) {
+        }
+    }
+    flush_batch(src);
+
+    pthread_mutex_lock(&merge_lock);
+    src->done = 1;
+    pthread_mutex_unlock(&merge_lock);
+    return NULL;
+}
+
+//
+// Registration
+//
+
+static int receive_hello(int sock, struct collector_hello* hello, int* memfd) {
+    struct iovec iov = { hello, sizeof(*hello) };
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = { 0 };
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    *memfd = -1;
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != (ssize_t)sizeof(*hello)) {
+        return -1;
+    }
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+        return -1;
+    }
+    memcpy(memfd, CMSG_DATA(cmsg), sizeof(int));
+    return hello->magic == COLLECTOR_MAGIC && hello->version == COLLECTOR_VERSION ? 0 : -1;
+}
+
+static struct collector_ring* map_ring(int memfd, uint64_t map_bytes) {
+    struct stat st;
+    if (fstat(memfd, &st) != 0 || (uint64_t)st.st_size != map_bytes ||
+        map_bytes <= sizeof(struct collector_ring)) {
+        return NULL;
+    }
+    struct collector_ring* ring =
+        mmap(NULL, map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (ring == MAP_FAILED) {
+        return NULL;
+    }
+    uint64_t size = ring->size;
+    if (ring->magic != COLLECTOR_MAGIC || size == 0 || (size & (size - 1)) ||
+        sizeof(*ring) + size != map_bytes) {
+        munmap(ring, map_bytes);
+        return NULL;
+    }
+    return ring;
+}
+
+static void accept_source(int listener) {
+    int sock = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+    if (sock < 0) {
+        return;
+    }
+    // A client that connects and says nothing must not stall the merge
+    struct timeval timeout = { 1, 0 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    struct collector_hello hello;
+    int memfd;
+    struct collector_ring* ring = NULL;
+    if (receive_hello(sock, &hello, &memfd) == 0) {
+        ring = map_ring(memfd, hello.map_bytes);
+    }
+    if (memfd >= 0) {
+        close(memfd);
+    }
+
+    struct source* src = ring ? calloc(1, sizeof(*src)) : NULL;
+    cookie_io_functions_t io = { ring_read, NULL, NULL, NULL };
+    if (src) {
+        src->pid = hello.pid;
+        src->sock = sock;
+        src->ring = ring;
+        src->map_bytes = hello.map_bytes;
+        src->in = fopencookie(src, "r", io);
+    }
+    uint32_t reply = src && src->in ? 0 : 1;
+    if (reply == 0) {
+        setvbuf(src->in, NULL, _IOFBF, OUTPUT_BUFFER);
+        if (pthread_create(&src->thread, NULL, reader_main, src) != 0) {
+            fclose(src->in);
+            reply = 1;
+        }
+    }
+    if (send(sock, &reply, sizeof(reply), MSG_NOSIGNAL) != sizeof(reply) && reply == 0) {
+        // The process gave up waiting; the reader sees it gone and finishes
+        fprintf(stderr, "[COLLECTD] pid %u did not take the reply\n", hello.pid);
+    }
+    if (reply != 0) {
+        fprintf(stderr, "[COLLECTD] Rejected a registration\n");
+        if (ring) {
+            munmap(ring, hello.map_bytes);
+        }
+        free(src);
+        close(sock);
+        return;
+    }
+
+    src->next = sources;
+    sources = src;
+    processes++;
+    fprintf(stderr, "[COLLECTD] pid %u attached (%" PRIu64 " KiB ring)\n", src->pid,
+            ring->size >> 10);
+}
+
+// Release sources whose reader is done and whose records are all written
+static void reap_sources(void) {
+    struct source** link = &sources;
+    while (*link) {
+        struct source* src = *link;
+        pthread_mutex_lock(&merge_lock);
+        int finished = src->done && src->pending == 0;
+        pthread_mutex_unlock(&merge_lock);
+        if (!finished) {
+            link = &src->next;
+            continue;
+        }
+        *link = src->next;
+        pthread_join(src->thread, NULL);
+        fprintf(stderr, "[COLLECTD] pid %u detached: %" PRIu64 " events\n", src->pid,
+                src->events);
+        trace_reader_close(&src->reader);
+        fclose(src->in);
+        munmap(src->ring, src->map_bytes);
+        close(src->sock);
+        free(src);
+    }
+}
+
+//
+// Merged output, main thread
+//
+
+// Every line a process produced starts with '{'; the pid goes right after
+static void write_lines(const char* text, size_t len, uint32_t pid) {
+    while (len > 0) {
+        const char* nl = memchr(text, '\n', len);
+        size_t n = nl ? (size_t)(nl - text) + 1 : len;
+        fprintf(out, "{\"pid\":%u,", pid);
+        fwrite(text + 1, 1, n - 1, out);
+        text += n;
+        len -= n;
+    }
+}
+
+static void write_node_summary(const struct agg_api_stats* stats, int64_t start_ns,
+                               int64_t end_ns, uint32_t flags) {
+    static uint64_t hist[STATS_BUCKETS];
+    uint32_t n = 0;
+    for (uint16_t api = 0; api < API_COUNT; api++) {
+        const struct agg_api_stats* s = &stats[api];
+        if (s->count == 0) {
+            continue;
+        }
+        unsigned highest = 0;
+        for (unsigned b = 0; b < STATS_BUCKETS; b++) {
+            hist[b] = s->hist[b];
+            if (hist[b]) {
+                highest = b;
+            }
+        }
+        struct trace_summary_api* a = &summary_apis[n++];
+        memset(a, 0, sizeof(*a));
+        a->api = api;
+        a->count = s->count;
+        a->errors = s->errors;
+        a->bytes = s->bytes;
+        a->total_ns = (int64_t)s->total;
+        a->p50_ns = (int64_t)stats_percentile(hist, s->count, 0.50);
+        a->p99_ns = (int64_t)stats_percentile(hist, s->count, 0.99);
+        a->p999_ns = (int64_t)stats_percentile(hist, s->count, 0.999);
+        a->max_ns = (int64_t)stats_bucket_value(highest, 1);
+        for (unsigned c = 0; c < STATS_SIZE_CLASSES; c++) {
+            a->sizes[c].count = s->sizes[c].count;
+            a->sizes[c].bytes = s->sizes[c].bytes;
+            a->sizes[c].total_ns = (int64_t)s->sizes[c].total;
+        }
+    }
+    if (n > 0) {
+        struct trace_summary summary = { start_ns, end_ns, n, flags };
+        trace_write_summary_json(out, &summary, summary_apis);
+    }
+}
+
+static void stats_add_event(struct agg_api_stats* s, const struct hook_event* ev) {
+    uint64_t duration = ev->end > ev->ts ? (uint64_t)(ev->end - ev->ts) : 0;
+    uint64_t bytes = hook_event_bytes(ev);
+    s->count++;
+    s->errors += ev->status != CUDA_SUCCESS;
+    s->bytes += bytes;
+    s->total += duration;
+    s->hist[stats_bucket(duration)]++;
+    if (bytes) {
+        unsigned cls = stats_size_class(bytes);
+        s->sizes[cls].count++;
+        s->sizes[cls].bytes += bytes;
+        s->sizes[cls].total += duration;
+    }
+}
+
+// Windows follow event time, so they line up with the processes' own
+static void account(const struct hook_event* ev) {
+    if (ev->api >= API_COUNT) {
+        return;
+    }
+    if (!window_start) {
+        window_start = ev->ts;
+        total_start = ev->ts;
+    }
+    if (ev->ts >= window_start + window_ns) {
+        write_node_summary(window_stats, window_start, window_start + window_ns, 0);
+        memset(window_stats, 0, API_COUNT * sizeof(*window_stats));
+        window_start += (ev->ts - window_start) / window_ns * window_ns;
+    }
+    stats_add_event(&window_stats[ev->api], ev);
+    stats_add_event(&total_stats[ev->api], ev);
+}
+
+static void write_pending(const struct pending* p) {
+    if (p->text) {
+        write_lines(p->text, p->len, p->src->pid);
+        free(p->text);
+        return;
+    }
+
+    const struct hook_event* ev = &p->ev;
+    rewind(scratch);
+    trace_write_json(scratch, ev, &p->src->reader.strings, &p->src->reader.functions);
+    long len = ftell(scratch);
+    fflush(scratch);
+    write_lines(scratch_buf, (size_t)len, p->src->pid);
+
+    if (ev->ts < last_written) {
+        late++;
+    } else {
+        last_written = ev->ts;
+    }
+    if (!segment_first || ev->ts < segment_first) {
+        segment_first = ev->ts;
+    }
+    if (ev->end > segment_last) {
+        segment_last = ev->end;
+    }
+    account(ev);
+    p->src->events++;
+    written++;
+}
+
+// Write up to WRITE_BATCH of the records that started before `horizon`;
+// returns how many, so the caller can go back to accepting in between
+static size_t write_due(int64_t horizon) {
+    static struct pending due[WRITE_BATCH];
+    size_t n = 0;
+    pthread_mutex_lock(&merge_lock);
+    while (n < WRITE_BATCH && heap_count > 0 && heap[0].ts < horizon) {
+        heap_pop(&due[n]);
+        // Keep the source alive until its record is written
+        due[n++].src->pending++;
+    }
+    pthread_mutex_unlock(&merge_lock);
+    for (size_t i = 0; i < n; i++) {
+        write_pending(&due[i]);
+    }
+    pthread_mutex_lock(&merge_lock);
+    for (size_t i = 0; i < n; i++) {
+        due[i].src->pending--;
+    }
+    pthread_mutex_unlock(&merge_lock);
+    return n;
+}
+
+static void on_signal(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [--socket=PATH] [--rotate-mb=N] [--rotate-s=N] [--compress=N]\n"
+            "       [--window-ms=N] [--merge-ms=N] [output]\n"
+            "Default socket %s, default output %s\n",
+            prog, COLLECTOR_SOCKET, DEFAULT_OUTPUT);
+}
+
+static int option_long(const char* arg, const char* name, long* value) {
+    size_t len = strlen(name);
+    if (strncmp(arg, name, len) != 0 || arg[len] != '=') {
+        return 0;
+    }
+    char* endp;
+    *value = strtol(arg + len + 1, &endp, 10);
+    return *endp == '\0' && *value >= 0 ? 1 : -1;
+}
+
+int main(int argc, char** argv) {
+    const char* socket_path = COLLECTOR_SOCKET;
+    const char* output = DEFAULT_OUTPUT;
+    long rotate_mb = 0, rotate_s = 0, compress = 0;
+    long window_ms = DEFAULT_WINDOW_MS, merge_ms = DEFAULT_MERGE_MS;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        int ok = 0;
+        if (strncmp(arg, "--socket=", 9) == 0) {
+            socket_path = arg + 9;
+            ok = 1;
+        } else if (strncmp(arg, "--", 2) != 0) {
+            output = arg;
+            ok = 1;
+        } else {
+            ok = option_long(arg, "--rotate-mb", &rotate_mb) + option_long(arg, "--rotate-s", &rotate_s) +
+                 option_long(arg, "--compress", &compress) + option_long(arg, "--window-ms", &window_ms) +
+                 option_long(arg, "--merge-ms", &merge_ms);
+        }
+        if (ok != 1) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (window_ms <= 0) {
+        window_ms = DEFAULT_WINDOW_MS;
+    }
+    window_ns = (int64_t)window_ms * 1000000;
+    int64_t merge_ns = (int64_t)merge_ms * 1000000;
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: socket path too long: %s\n", socket_path);
+        return 1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    window_stats = calloc(API_COUNT, sizeof(*window_stats));
+    total_stats = calloc(API_COUNT, sizeof(*total_stats));
+    summary_apis = calloc(API_COUNT, sizeof(*summary_apis));
+    scratch = open_memstream(&scratch_buf, &scratch_size);
+    if (!window_stats || !total_stats || !summary_apis || !scratch) {
+        fprintf(stderr, "Error: out of memory\n");
+        return 1;
+    }
+
+    out = rotate_mb > 0 || rotate_s > 0
+              ? segment_open(output, rotate_mb, rotate_s, (int)compress)
+              : fopen(output, "w");
+    if (!out) {
+        perror(output);
+        return 1;
+    }
+    setvbuf(out, NULL, _IOFBF, OUTPUT_BUFFER);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    unlink(socket_path);
+    if (listener < 0 || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(listener, 64) != 0) {
+        perror(socket_path);
+        return 1;
+    }
+
+    struct sigaction sa = { 0 };
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    fprintf(stderr, "[COLLECTD] Listening on %s, writing %s\n", socket_path, output);
+
+    int busy = 0;
+    for (;;) {
+        if (stop_requested && !stopping) {
+            // Take no one new; readers finish once their rings are empty
+            close(listener);
+            listener = -1;
+            unlink(socket_path);
+            __atomic_store_n(&stopping, 1, __ATOMIC_RELAXED);
+        }
+
+        // A registering process waits on its reply, so while there is a
+        // backlog to write the listener is still checked between batches
+        struct pollfd pfd = { listener, POLLIN, 0 };
+        if (listener >= 0 && poll(&pfd, 1, busy ? 0 : LOOP_MS) > 0) {
+            accept_source(listener);
+        } else if (listener < 0 && !busy) {
+            struct timespec pause = { 0, LOOP_MS * 1000000L };
+            nanosleep(&pause, NULL);
+        }
+
+        int64_t now = monotonic_ns();
+        size_t n = write_due(stopping ? INT64_MAX : now - merge_ns);
+        busy = n == WRITE_BATCH;
+        if (n > 0 && !busy) {
+            fflush(out);
+        }
+        reap_sources();
+        if (segment_active && segment_due(out, now) && segment_rotate(out, segment_first,
+                                                                      segment_last, now) == 0) {
+            segment_first = 0;
+            segment_last = 0;
+        }
+        if (stopping && !sources) {
+            break;
+        }
+    }
+
+    while (write_due(INT64_MAX) > 0) {
+    }
+    if (window_start) {
+        write_node_summary(window_stats, window_start, last_written, 0);
+        write_node_summary(total_stats, total_start, last_written, TRACE_SUMMARY_TOTAL);
+    }
+    fflush(out);
+    segment_finish(out, segment_first, segment_last);
+    fclose(out);
+
+    fprintf(stderr, "[COLLECTD] Wrote %" PRIu64 " events from %u processes", written, processes);
+    if (late) {
+        fprintf(stderr, ", %" PRIu64 " late (raise --merge-ms)", late);
+    }
+    fprintf(stderr, "\n");
+
+    fclose(scratch);
+    free(scratch_buf);
+    free(heap);
+    free(window_stats);
+    free(total_stats);
+    free(summary_apis);
+    return 0;
+}
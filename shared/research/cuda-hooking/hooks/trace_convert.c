@@ -0,0 +1,150 @@
+/*
+ * trace_convert.c - Convert binary hook traces to JSONL or Chrome traces
+ *
+ * Reads a trace written with CUDA_HOOK_FORMAT=binary and produces the same
+ * JSON Lines the hook writes in json mode (for visualize_pipeline.py), or
+ * the Chrome trace CUDA_HOOK_FORMAT=chrome writes (trace_chrome.c) for
+ * chrome://tracing / Perfetto. Segments the
+ * hook compressed (CUDA_HOOK_COMPRESS) are read as they are.
+ *
+ * Compile: make cuda_trace_convert
+ * Usage: cuda_trace_convert [--format=jsonl|chrome] trace.bin [output]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cuda_hook.h"
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [--format=jsonl|chrome] trace.bin [output]\n", prog);
+}
+
+struct convert {
+    FILE* out;
+    struct chrome_writer* chrome;   // NULL for JSONL
+    struct trace_reader* reader;
+};
+
+static void on_event(void* ctx, const struct hook_event* ev) {
+    struct convert* c = ctx;
+    if (c->chrome) {
+        chrome_event(c->chrome, ev);
+    } else {
+        trace_write_json(c->out, ev, &c->reader->strings, &c->reader->functions);
+    }
+}
+
+// Chrome output has no place for the records below, the process record
+// aside, so they are only written as JSONL
+static void on_summary(void* ctx, const struct trace_summary* summary,
+                       const struct trace_summary_api* apis) {
+    trace_write_summary_json(((struct convert*)ctx)->out, summary, apis);
+}
+
+static void on_allocs(void* ctx, const struct trace_alloc_report* report,
+                      const struct trace_alloc_context* contexts) {
+    trace_write_allocs_json(((struct convert*)ctx)->out, report, contexts);
+}
+
+static void on_stack(void* ctx, const struct trace_stack* stack) {
+    trace_write_stack_json(((struct convert*)ctx)->out, stack);
+}
+
+static void on_maps(void* ctx, const struct trace_maps* maps, const char* text, size_t len) {
+    trace_write_maps_json(((struct convert*)ctx)->out, maps, text, len);
+}
+
+static void on_mode(void* ctx, const struct trace_mode_change* change) {
+    trace_write_mode_json(((struct convert*)ctx)->out, change);
+}
+
+static void on_filter(void* ctx, const struct trace_filter_change* change, const char* spec) {
+    trace_write_filter_json(((struct convert*)ctx)->out, change, spec);
+}
+
+static void on_process(void* ctx, const struct trace_process* process) {
+    struct convert* c = ctx;
+    if (c->chrome) {
+        chrome_process(c->chrome, process);
+    } else {
+        trace_write_process_json(c->out, process);
+    }
+}
+
+static const struct trace_reader_ops jsonl_ops = {
+    on_event, on_summary, on_allocs, on_stack, on_maps, on_mode, on_filter, on_process,
+};
+static const struct trace_reader_ops chrome_ops = { .event = on_event, .process = on_process };
+
+int main(int argc, char** argv) {
+    int chrome = 0;
+    int argi = 1;
+
+    for (; argi < argc && strncmp(argv[argi], "--", 2) == 0; argi++) {
+        if (strcmp(argv[argi], "--format=chrome") == 0) {
+            chrome = 1;
+        } else if (strcmp(argv[argi], "--format=jsonl") == 0) {
+            chrome = 0;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argi >= argc || argc - argi > 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FILE* in = trace_reader_fopen(argv[argi]);
+    if (!in) {
+        perror(argv[argi]);
+        return 1;
+    }
+    FILE* out = stdout;
+    if (argi + 1 < argc) {
+        out = fopen(argv[argi + 1], "w");
+        if (!out) {
+            perror(argv[argi + 1]);
+            return 1;
+        }
+    }
+
+    struct trace_reader reader;
+    if (trace_reader_open(&reader, in, argv[argi]) != 0) {
+        return 1;
+    }
+
+    // Large, and the same size whatever the trace
+    static struct chrome_writer writer;
+    struct convert convert = { out, chrome ? &writer : NULL, &reader };
+    if (chrome) {
+        char name[32];
+        snprintf(name, sizeof(name), "pid %u", reader.hdr.pid);
+        chrome_writer_init(&writer, out, &reader.strings, &reader.functions, reader.hdr.pid);
+        chrome_begin(&writer, name);
+    }
+
+    int rc;
+    while ((rc = trace_reader_next(&reader, chrome ? &chrome_ops : &jsonl_ops, &convert)) > 0) {
+    }
+
+    if (chrome) {
+        chrome_end(&writer);
+    }
+
+    fprintf(stderr, "Converted %llu events", (unsigned long long)reader.events);
+    if (reader.summaries) {
+        fprintf(stderr, ", %llu summaries", (unsigned long long)reader.summaries);
+    }
+    fprintf(stderr, "\n");
+
+    trace_reader_close(&reader);
+    fclose(in);
+    if (out != stdout) {
+        fclose(out);
+    }
+    return rc < 0 ? 1 : 0;
+}
@@ -0,0 +1,840 @@
+/*
+ * trace_critpath.cpp - Stream dependency graph and critical path of a trace
+ *
+ * Reads the JSON Lines the hook writes (or cuda_trace_convert produces) and
+ * rebuilds the ordering the device had to respect: issue order within a
+ * stream, cuEventRecord -> cuStreamWaitEvent edges between streams, the
+ * legacy default stream's implicit barrier with blocking streams, and the
+ * host threads that issue the work and block in synchronizing calls.
+ *
+ * Every call is a host node spanning its call; stream work and event
+ * records also get a device node. A device node's interval is measured when
+ * CUDA_HOOK_GPU_TIME recorded the kernel, otherwise it is modeled: it starts
+ * once its predecessors have finished (and not before it was issued) and
+ * lasts as long as the call did. Walking back from whatever finished last in
+ * an iteration, always through the predecessor that released the node last,
+ * gives the chain of operations that bounds that iteration's latency.
+ *
+ * A node trace from cuda_trace_collectd holds several processes. Their op
+ * ids, handles and threads are kept apart; they share only the timeline the
+ * iterations are cut from.
+ *
+ * Compile: make cuda_trace_critpath
+ * Usage: cuda_trace_critpath [options] trace.jsonl
+ */
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "trace_jsonl.h"
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [options] trace.jsonl\n"
+            "  --begin=NAME      start an iteration at each call to API NAME or launch\n"
+            "                    of a kernel whose name contains NAME\n"
+            "  --end=NAME        end an iteration after each call to API NAME (may be\n"
+            "                    repeated; default cuCtxSynchronize and cuStreamSynchronize)\n"
+            "  --iteration=N     print the path of iteration N (default: the slowest)\n"
+            "  --limit=N         rows per table (default 20)\n",
+            prog);
+}
+
+//
+// JSON Lines input
+//
+
+// One traced call, put together from its "B" and "E" lines and, for a
+// timed launch, its gpuKernel line
+struct Call {
+    uint32_t pid = 0;           // 0 unless the trace came from the collector
+    uint64_t op_id = 0;
+    uint32_t tid = 0;
+    std::string name;
+    std::string kernel;         // Launches: kernel name when it is known
+    int64_t begin = -1;
+    int64_t end = -1;
+    int status = 0;
+    bool has_stream = false;
+    uint64_t stream = 0;
+    uint64_t event = 0;
+    uint64_t flags = 0;
+    uint64_t created = 0;       // cuStreamCreate*: the new stream
+    int64_t device_start = -1;  // From CUDA_HOOK_GPU_TIME
+    int64_t device_ns = -1;
+};
+
+// Details keep the names the hooks print; generated hooks print the driver's
+// parameter names, which is also what traces from before the event hooks
+// were handwritten have for cuEventRecord and cuStreamWaitEvent.
+static void merge_details(Call* call, const std::unordered_map<std::string, std::string>& d,
+                          bool entry) {
+    if (const std::string* s = find(d, "stream", "hStream")) {
+        call->has_stream = true;
+        call->stream = parse_handle(*s);
+    }
+    if (const std::string* s = find(d, "event", "hEvent")) {
+        call->event = parse_handle(*s);
+    }
+    if (const std::string* s = find(d, "kernel")) {
+        call->kernel = *s;
+    }
+    if (entry) {
+        if (const std::string* s = find(d, "flags", "Flags")) {
+            call->flags = strtoull(s->c_str(), nullptr, 0);
+        }
+    } else {
+        if (const std::string* s = find(d, "status")) {
+            call->status = atoi(s->c_str());
+        }
+        if (call->name == "cuStreamCreate" || call->name == "cuStreamCreateWithPriority") {
+            const std::string* s = find(d, "stream", "phStream");
+            call->created = s ? parse_handle(*s) : 0;
+            call->has_stream = false;
+        }
+    }
+}
+
+static int load_trace(const char* path, std::vector<Call>* out) {
+    FILE* in = fopen(path, "r");
+    if (!in) {
+        perror(path);
+        return -1;
+    }
+
+    std::unordered_map<ProcessKey, size_t, ProcessKeyHash> index;
+    std::vector<Call> calls;
+    LineParser parser;
+    char* line = nullptr;
+    size_t cap = 0;
+    uint64_t lineno = 0;
+    uint64_t bad = 0;
+    ssize_t len;
+
+    while ((len = getline(&line, &cap, in)) > 0) {
+        lineno++;
+        if (lineno == 1) {
+            if (const char* why = unreadable_input(line, (size_t)len)) {
+                fprintf(stderr, "Error: %s: %s\n", path, why);
+                free(line);
+                fclose(in);
+                return -1;
+            }
+        }
+        if (!parser.parse(line)) {
+            if (bad++ == 0) {
+                fprintf(stderr, "Warning: %s:%" PRIu64 ": unparsable line skipped\n", path, lineno);
+            }
+            continue;
+        }
+        const std::string* phase = find(parser.fields, "phase");
+        const std::string* op = find(parser.fields, "op_id");
+        const std::string* ts = find(parser.fields, "ts");
+        if (!phase || !op || !ts) {
+            continue;
+        }
+        // "B"/"E" calls and "C" device timings; summaries, metadata and
+        // stack instants do not take part in the graph
+        if (*phase != "B" && *phase != "E" && *phase != "C") {
+            continue;
+        }
+
+        const ProcessKey key = { line_pid(parser.fields), strtoull(op->c_str(), nullptr, 10) };
+        auto it = index.find(key);
+        if (it == index.end()) {
+            it = index.emplace(key, calls.size()).first;
+            calls.emplace_back();
+            calls.back().pid = key.pid;
+            calls.back().op_id = key.value;
+        }
+        Call& call = calls[it->second];
+
+        if (*phase == "C") {
+            const std::string* us = find(parser.details, "device_us");
+            call.device_start = parse_ns(*ts);
+            call.device_ns = us ? (int64_t)(strtod(us->c_str(), nullptr) * 1e3) : 0;
+            continue;
+        }
+
+        if (const std::string* name = find(parser.fields, "name")) {
+            call.name = *name;
+        }
+        if (const std::string* tid = find(parser.fields, "tid")) {
+            call.tid = (uint32_t)strtoul(tid->c_str(), nullptr, 10);
+        }
+        if (*phase == "B") {
+            call.begin = parse_ns(*ts);
+            merge_details(&call, parser.details, true);
+        } else {
+            call.end = parse_ns(*ts);
+            merge_details(&call, parser.details, false);
+        }
+    }
+    free(line);
+    fclose(in);
+
+    if (bad > 1) {
+        fprintf(stderr, "Warning: %" PRIu64 " unparsable lines skipped in total\n", bad);
+    }
+
+    // Calls cut off by the end of the trace have no exit
+    out->clear();
+    for (Call& call : calls) {
+        if (call.begin >= 0 && call.end >= call.begin) {
+            out->push_back(std::move(call));
+        }
+    }
+    std::stable_sort(out->begin(), out->end(), [](const Call& a, const Call& b) {
+        if (a.begin != b.begin) {
+            return a.begin < b.begin;
+        }
+        return a.pid != b.pid ? a.pid < b.pid : a.op_id < b.op_id;
+    });
+    return 0;
+}
+
+//
+// Dependency graph
+//
+
+enum node_kind {
+    NODE_HOST,          // Call without device work
+    NODE_DEVICE,        // Work enqueued on a stream
+    NODE_RECORD,        // Event record: a point in its stream's order
+};
+
+struct Node {
+    const Call* call;
+    node_kind kind = NODE_HOST;
+    ProcessKey stream = {};     // Stream key, see stream_key()
+    std::vector<int> preds;     // Device nodes this node's device part waits for
+    int host_prev = -1;         // Previous call on the same thread
+    int awaited = -1;           // Blocking call: node whose device part it waited for
+    int64_t start = 0;          // Device part
+    int64_t finish = 0;
+    bool measured = false;
+    int device_crit = -1;       // Predecessor that released the device part, -1: host
+};
+
+// Legacy default stream (0 or CU_STREAM_LEGACY) is key 0; the per-thread
+// default stream (CU_STREAM_PER_THREAD) gets a key per thread. Every
+// process has its own.
+#define STREAM_PER_THREAD_KEY (1ULL << 63)
+
+static ProcessKey stream_key(const Call& call) {
+    if (call.stream == 0x1) {
+        return { call.pid, 0 };
+    }
+    if (call.stream == 0x2) {
+        return { call.pid, STREAM_PER_THREAD_KEY | call.tid };
+    }
+    return { call.pid, call.stream };
+}
+
+static bool starts_with(const std::string& s, const char* prefix) {
+    return s.compare(0, strlen(prefix), prefix) == 0;
+}
+
+static bool ends_with(const std::string& s, const char* suffix) {
+    size_t n = strlen(suffix);
+    return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+// Copies without a stream run on the legacy default stream and return once
+// the data has moved; memsets without one only enqueue
+static bool is_sync_copy(const Call& call) {
+    return !call.has_stream && starts_with(call.name, "cuMemcpy") && !ends_with(call.name, "Async");
+}
+
+static bool is_sync_memset(const Call& call) {
+    return !call.has_stream && starts_with(call.name, "cuMemset") && !ends_with(call.name, "Async");
+}
+
+// Stream and event management take a stream without putting work on it
+static bool is_stream_work(const Call& call) {
+    if (!call.has_stream) {
+        return false;
+    }
+    if (call.name == "cuStreamAddCallback") {
+        return true;
+    }
+    return !starts_with(call.name, "cuStream") && !starts_with(call.name, "cuEvent");
+}
+
+struct Graph {
+    std::vector<Node> nodes;
+    std::unordered_set<ProcessKey, ProcessKeyHash> streams;
+    std::unordered_set<uint32_t> processes;
+    uint64_t event_edges = 0;
+    uint64_t device_ops = 0;
+    uint64_t measured_ops = 0;
+    uint64_t launches = 0;
+};
+
+static void build_graph(const std::vector<Call>& calls, Graph* g) {
+    // All keyed per process
+    std::unordered_map<ProcessKey, int, ProcessKeyHash> stream_last;
+    // Waits for a stream's next op
+    std::unordered_map<ProcessKey, std::vector<int>, ProcessKeyHash> pending_waits;
+    std::unordered_map<ProcessKey, int, ProcessKeyHash> event_last;
+    std::unordered_map<ProcessKey, int, ProcessKeyHash> thread_last;
+    std::unordered_set<ProcessKey, ProcessKeyHash> nonblocking;
+    std::unordered_set<ProcessKey, ProcessKeyHash> capturing;
+
+    g->nodes.resize(calls.size());
+    for (size_t i = 0; i < calls.size(); i++) {
+        const Call& call = calls[i];
+        Node& n = g->nodes[i];
+        n.call = &call;
+        g->processes.insert(call.pid);
+
+        const ProcessKey thread = { call.pid, call.tid };
+        auto last = thread_last.find(thread);
+        n.host_prev = last == thread_last.end() ? -1 : last->second;
+        thread_last[thread] = (int)i;
+
+        if (call.status != 0) {
+            continue;
+        }
+
+        const ProcessKey key = stream_key(call);
+        const ProcessKey event = { call.pid, call.event };
+        if (call.name == "cuStreamCreate" || call.name == "cuStreamCreateWithPriority") {
+            // CU_STREAM_NON_BLOCKING: no implicit barrier with the legacy stream
+            if (call.flags & 0x1) {
+                nonblocking.insert({ call.pid, call.created });
+            }
+            continue;
+        }
+        if (call.name == "cuStreamBeginCapture") {
+            capturing.insert(key);
+            continue;
+        }
+        if (call.name == "cuStreamEndCapture") {
+            capturing.erase(key);
+            continue;
+        }
+        if (call.has_stream && capturing.count(key)) {
+            // Captured into a graph rather than run
+            continue;
+        }
+
+        if (call.name == "cuStreamWaitEvent") {
+            auto rec = event_last.find(event);
+            if (rec != event_last.end()) {
+                pending_waits[key].push_back(rec->second);
+                g->event_edges++;
+            }
+            continue;
+        }
+        if (call.name == "cuStreamSynchronize") {
+            auto it = stream_last.find(key);
+            n.awaited = it == stream_last.end() ? -1 : it->second;
+            continue;
+        }
+        if (call.name == "cuEventSynchronize") {
+            auto it = event_last.find(event);
+            n.awaited = it == event_last.end() ? -1 : it->second;
+            continue;
+        }
+        if (call.name == "cuCtxSynchronize") {
+            for (const auto& s : stream_last) {
+                if (s.first.pid != call.pid) {
+                    continue;
+                }
+                if (n.awaited < 0 || g->nodes[s.second].finish > g->nodes[n.awaited].finish) {
+                    n.awaited = s.second;
+                }
+            }
+            continue;
+        }
+
+        const bool record = call.name == "cuEventRecord" || call.name == "cuEventRecordWithFlags";
+        const bool sync_copy = is_sync_copy(call);
+        if (!record && !sync_copy && !is_sync_memset(call) && !is_stream_work(call)) {
+            continue;
+        }
+
+        n.kind = record ? NODE_RECORD : NODE_DEVICE;
+        n.stream = call.has_stream ? key : ProcessKey{ call.pid, 0 };
+        const ProcessKey legacy_key = { call.pid, 0 };
+        g->streams.insert(n.stream);
+
+        // Stream order, plus the legacy stream's barrier: work on it waits
+        // for every blocking stream, and blocking streams wait for it
+        auto prev = stream_last.find(n.stream);
+        if (prev != stream_last.end()) {
+            n.preds.push_back(prev->second);
+        }
+        if (n.stream == legacy_key) {
+            for (const auto& s : stream_last) {
+                if (s.first.pid == call.pid && s.first.value != 0 && !nonblocking.count(s.first)) {
+                    n.preds.push_back(s.second);
+                }
+            }
+        } else if (!nonblocking.count(n.stream)) {
+            auto legacy = stream_last.find(legacy_key);
+            if (legacy != stream_last.end()) {
+                n.preds.push_back(legacy->second);
+            }
+        }
+        auto waits = pending_waits.find(n.stream);
+        if (waits != pending_waits.end()) {
+            n.preds.insert(n.preds.end(), waits->second.begin(), waits->second.end());
+            pending_waits.erase(waits);
+        }
+
+        int64_t ready = call.begin;
+        n.device_crit = -1;
+        for (int p : n.preds) {
+            if (g->nodes[p].finish > ready) {
+                ready = g->nodes[p].finish;
+                n.device_crit = p;
+            }
+        }
+
+        if (call.device_start >= 0) {
+            n.start = call.device_start;
+            n.finish = call.device_start + call.device_ns;
+            n.measured = true;
+            g->measured_ops++;
+        } else {
+            n.start = ready;
+            n.finish = ready + (record ? 0 : call.end - call.begin);
+        }
+        if (sync_copy) {
+            // Returns once the copy is done
+            n.finish = std::max(n.finish, call.end);
+            n.awaited = (int)i;
+        }
+        if (!record) {
+            g->device_ops++;
+            if (!call.kernel.empty() || starts_with(call.name, "cuLaunch")) {
+                g->launches++;
+            }
+        }
+
+        stream_last[n.stream] = (int)i;
+        if (record) {
+            event_last[event] = (int)i;
+        }
+    }
+}
+
+//
+// Critical path
+//
+
+enum segment_kind {
+    SEG_DEVICE,         // Device work of an op
+    SEG_HOST,           // Inside a call
+    SEG_HOST_GAP,       // Host thread between calls
+    SEG_LAUNCH,         // Issued and released, not yet running
+};
+
+struct Segment {
+    segment_kind kind;
+    int node;
+    int64_t ns;
+};
+
+struct Iteration {
+    int first = 0;
+    int last = 0;           // Inclusive
+    int64_t start = 0;
+    int64_t finish = 0;
+    std::vector<Segment> path;
+};
+
+// Streams of a node trace are prefixed with their process
+static std::string stream_name(const Graph& g, ProcessKey key) {
+    char buf[48];
+    int len = 0;
+    if (g.processes.size() > 1) {
+        len = snprintf(buf, sizeof(buf), "%u:", key.pid);
+    }
+    if (key.value == 0) {
+        snprintf(buf + len, sizeof(buf) - len, "default");
+    } else if (key.value & STREAM_PER_THREAD_KEY) {
+        snprintf(buf + len, sizeof(buf) - len, "per-thread/%u",
+                 (uint32_t)(key.value & 0xffffffffu));
+    } else {
+        snprintf(buf + len, sizeof(buf) - len, "0x%" PRIx64, key.value);
+    }
+    return buf;
+}
+
+static std::string op_name(const Node& n) {
+    if (n.kind == NODE_RECORD) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%s 0x%" PRIx64, n.call->name.c_str(), n.call->event);
+        return buf;
+    }
+    return n.call->kernel.empty() ? n.call->name : n.call->kernel;
+}
+
+// What a segment is charged to in the summary
+static std::string segment_label(const Graph& g, const Segment& s) {
+    const Node& n = g.nodes[s.node];
+    switch (s.kind) {
+    case SEG_DEVICE:
+        return op_name(n);
+    case SEG_HOST:
+        return "[host] " + n.call->name;
+    case SEG_HOST_GAP:
+        return "[host] between calls";
+    default:
+        return "[launch] waiting to run";
+    }
+}
+
+// A point the walk stands on: a node's device part or its host call
+struct Part {
+    int node;
+    bool device;
+};
+
+static int64_t part_start(const Graph& g, Part p) {
+    const Node& n = g.nodes[p.node];
+    return p.device ? n.start : n.call->begin;
+}
+
+static int64_t part_finish(const Graph& g, Part p) {
+    const Node& n = g.nodes[p.node];
+    return p.device ? n.finish : n.call->end;
+}
+
+// The predecessor that released a part; false at the start of the trace
+static bool part_crit(const Graph& g, Part p, Part* out) {
+    const Node& n = g.nodes[p.node];
+    if (p.device) {
+        if (n.device_crit >= 0) {
+            *out = { n.device_crit, true };
+            return true;
+        }
+        // Held back only by its issue. A synchronous copy's own call is
+        // blocked on it, so go to what ran before that call instead.
+        if (n.awaited != p.node) {
+            *out = { p.node, false };
+            return true;
+        }
+        if (n.host_prev < 0) {
+            return false;
+        }
+        *out = { n.host_prev, false };
+        return true;
+    }
+    if (n.awaited >= 0 && g.nodes[n.awaited].finish > n.call->begin) {
+        *out = { n.awaited, true };
+        return true;
+    }
+    if (n.host_prev < 0) {
+        return false;
+    }
+    *out = { n.host_prev, false };
+    return true;
+}
+
+static void walk_path(const Graph& g, Iteration* it) {
+    // Sink: whatever finished last among the iteration's calls and work
+    Part part = { it->first, false };
+    it->finish = g.nodes[it->first].call->end;
+    for (int i = it->first; i <= it->last; i++) {
+        const Node& n = g.nodes[i];
+        if (n.call->end > it->finish) {
+            it->finish = n.call->end;
+            part = { i, false };
+        }
+        if (n.kind != NODE_HOST && n.finish > it->finish) {
+            it->finish = n.finish;
+            part = { i, true };
+        }
+    }
+
+    int64_t cursor = it->finish;
+    size_t steps = 2 * g.nodes.size() + 1;
+    while (steps-- > 0) {
+        Part pred = { -1, false };
+        bool has_pred = part_crit(g, part, &pred);
+
+        // A call blocked on device work is charged only for returning after
+        // it; the wait itself belongs to the work's own chain
+        int64_t from = std::max(part_start(g, part), it->start);
+        if (has_pred && !part.device && pred.device) {
+            from = std::max(from, std::min(part_finish(g, pred), cursor));
+        }
+        // Event records take no time but show where the path changed streams
+        bool record = part.device && g.nodes[part.node].kind == NODE_RECORD;
+        if (cursor > from || record) {
+            it->path.push_back({ part.device ? SEG_DEVICE : SEG_HOST, part.node,
+                                 std::max<int64_t>(cursor - from, 0) });
+            cursor = std::min(cursor, from);
+        }
+        if (cursor <= it->start || !has_pred) {
+            break;
+        }
+        int64_t released = std::min(std::max(part_finish(g, pred), it->start), cursor);
+        if (cursor > released) {
+            // Host to host: the thread was busy outside traced calls. Into a
+            // device part: issued (or released) but not yet running.
+            segment_kind gap = (!part.device && !pred.device) ? SEG_HOST_GAP : SEG_LAUNCH;
+            it->path.push_back({ gap, part.node, cursor - released });
+            cursor = released;
+        }
+        part = pred;
+    }
+    std::reverse(it->path.begin(), it->path.end());
+}
+
+//
+// Iterations
+//
+
+struct Options {
+    std::vector<std::string> end_names;
+    std::string begin_name;
+    long iteration = -1;
+    size_t limit = 20;
+};
+
+static bool begins_iteration(const Options& opt, const Call& call) {
+    if (opt.begin_name.empty()) {
+        return false;
+    }
+    return call.name == opt.begin_name ||
+           (!call.kernel.empty() && call.kernel.find(opt.begin_name) != std::string::npos);
+}
+
+static bool ends_iteration(const Options& opt, const Call& call) {
+    return std::find(opt.end_names.begin(), opt.end_names.end(), call.name) != opt.end_names.end();
+}
+
+static std::vector<Iteration> split_iterations(const Graph& g, const Options& opt) {
+    std::vector<Iteration> iterations;
+    int first = 0;
+    const int count = (int)g.nodes.size();
+    for (int i = 0; i < count; i++) {
+        const Call& call = *g.nodes[i].call;
+        if (i > first && begins_iteration(opt, call)) {
+            iterations.push_back({ first, i - 1 });
+            first = i;
+        }
+        if (ends_iteration(opt, call)) {
+            iterations.push_back({ first, i });
+            first = i + 1;
+        }
+    }
+    if (first < count) {
+        iterations.push_back({ first, count - 1 });
+    }
+    for (Iteration& it : iterations) {
+        it.start = g.nodes[it.first].call->begin;
+    }
+    return iterations;
+}
+
+//
+// Report
+//
+
+struct PathTotals {
+    int64_t device = 0;
+    int64_t host = 0;
+    int64_t launch = 0;
+};
+
+static PathTotals path_totals(const Iteration& it) {
+    PathTotals t;
+    for (const Segment& s : it.path) {
+        if (s.kind == SEG_DEVICE) {
+            t.device += s.ns;
+        } else if (s.kind == SEG_LAUNCH) {
+            t.launch += s.ns;
+        } else {
+            t.host += s.ns;
+        }
+    }
+    return t;
+}
+
+static void print_path(const Graph& g, const Iteration& it, size_t index, size_t limit) {
+    printf("\nCritical path of iteration %zu (%.3f ms, %zu segments):\n", index,
+           (it.finish - it.start) / 1e6, it.path.size());
+    printf("  %10s  %-8s  %-14s  %s\n", "Time(ms)", "Kind", "Where", "Operation");
+
+    size_t shown = 0;
+    for (const Segment& s : it.path) {
+        if (shown++ == limit) {
+            printf("  ... %zu more segments (--limit)\n", it.path.size() - limit);
+            break;
+        }
+        const Node& n = g.nodes[s.node];
+        char where[48];
+        const char* kind;
+        std::string what;
+        switch (s.kind) {
+        case SEG_DEVICE:
+            kind = n.kind == NODE_RECORD ? "event" : n.measured ? "device" : "device*";
+            snprintf(where, sizeof(where), "%s", stream_name(g, n.stream).c_str());
+            what = op_name(n);
+            break;
+        case SEG_HOST:
+            kind = "host";
+            snprintf(where, sizeof(where), "tid %u", n.call->tid);
+            what = n.call->name;
+            break;
+        case SEG_HOST_GAP:
+            kind = "host";
+            snprintf(where, sizeof(where), "tid %u", n.call->tid);
+            what = "(between calls, before " + n.call->name + ")";
+            break;
+        default:
+            kind = "launch";
+            snprintf(where, sizeof(where), "%s", "");
+            what = "(" + op_name(n) + " waiting to run)";
+            break;
+        }
+        printf("  %10.3f  %-8s  %-14s  %s\n", s.ns / 1e6, kind, where, what.c_str());
+    }
+}
+
+static void print_report(const Graph& g, std::vector<Iteration>& iterations, const Options& opt) {
+    printf("Stream dependency graph: %zu calls, %" PRIu64 " device ops on %zu streams, "
+           "%" PRIu64 " event edges",
+           g.nodes.size(), g.device_ops, g.streams.size(), g.event_edges);
+    if (g.processes.size() > 1) {
+        printf(", %zu processes", g.processes.size());
+    }
+    printf("\n");
+    printf("Device durations: %" PRIu64 " of %" PRIu64 " ops measured", g.measured_ops, g.device_ops);
+    if (g.measured_ops < g.device_ops) {
+        printf("; the rest (device*) last as long as their call");
+        if (g.launches > g.measured_ops) {
+            printf(" - set CUDA_HOOK_GPU_TIME for kernel times");
+        }
+    }
+    printf("\n");
+
+    std::vector<size_t> order(iterations.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return iterations[a].finish - iterations[a].start > iterations[b].finish - iterations[b].start;
+    });
+
+    std::vector<int64_t> latencies;
+    for (const Iteration& it : iterations) {
+        latencies.push_back(it.finish - it.start);
+    }
+    std::sort(latencies.begin(), latencies.end());
+    printf("\n%zu iterations: median %.3f ms, p90 %.3f ms, max %.3f ms\n", iterations.size(),
+           latencies[latencies.size() / 2] / 1e6, latencies[latencies.size() * 9 / 10] / 1e6,
+           latencies.back() / 1e6);
+
+    printf("\nSlowest iterations (critical path split into device / host / launch time):\n");
+    printf("  %9s  %16s  %12s  %10s  %10s  %10s  %6s\n", "Iteration", "Start(s)", "Latency(ms)",
+           "Device(ms)", "Host(ms)", "Launch(ms)", "Calls");
+    for (size_t r = 0; r < order.size() && r < opt.limit; r++) {
+        const Iteration& it = iterations[order[r]];
+        PathTotals t = path_totals(it);
+        printf("  %9zu  %16.6f  %12.3f  %10.3f  %10.3f  %10.3f  %6d\n", order[r], it.start / 1e9,
+               (it.finish - it.start) / 1e6, t.device / 1e6, t.host / 1e6, t.launch / 1e6,
+               it.last - it.first + 1);
+    }
+    if (order.size() > opt.limit) {
+        printf("  ... %zu more (--limit)\n", order.size() - opt.limit);
+    }
+
+    // What the paths are made of, over all iterations
+    struct Share {
+        uint64_t count = 0;
+        int64_t ns = 0;
+    };
+    std::unordered_map<std::string, Share> shares;
+    int64_t total = 0;
+    for (const Iteration& it : iterations) {
+        for (const Segment& s : it.path) {
+            Share& sh = shares[segment_label(g, s)];
+            sh.count++;
+            sh.ns += s.ns;
+            total += s.ns;
+        }
+    }
+    std::vector<std::pair<std::string, Share>> ranked(shares.begin(), shares.end());
+    std::sort(ranked.begin(), ranked.end(), [](const auto& a, const auto& b) {
+        return a.second.ns > b.second.ns;
+    });
+    printf("\nOn the critical path, all iterations:\n");
+    printf("  %8s  %12s  %6s  %s\n", "Count", "Total(ms)", "Share", "Operation");
+    for (size_t r = 0; r < ranked.size() && r < opt.limit; r++) {
+        printf("  %8" PRIu64 "  %12.3f  %5.1f%%  %s\n", ranked[r].second.count,
+               ranked[r].second.ns / 1e6, total > 0 ? 100.0 * ranked[r].second.ns / total : 0.0,
+               ranked[r].first.c_str());
+    }
+
+    size_t detail = order[0];
+    if (opt.iteration >= 0) {
+        if ((size_t)opt.iteration >= iterations.size()) {
+            fprintf(stderr, "Warning: no iteration %ld, showing the slowest\n", opt.iteration);
+        } else {
+            detail = (size_t)opt.iteration;
+        }
+    }
+    print_path(g, iterations[detail], detail, opt.limit);
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    int argi = 1;
+
+    for (; argi < argc && strncmp(argv[argi], "--", 2) == 0; argi++) {
+        const char* arg = argv[argi];
+        if (strncmp(arg, "--begin=", 8) == 0) {
+            opt.begin_name = arg + 8;
+        } else if (strncmp(arg, "--end=", 6) == 0) {
+            opt.end_names.push_back(arg + 6);
+        } else if (strncmp(arg, "--iteration=", 12) == 0) {
+            opt.iteration = strtol(arg + 12, nullptr, 10);
+        } else if (strncmp(arg, "--limit=", 8) == 0) {
+            opt.limit = strtoul(arg + 8, nullptr, 10);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argi != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (opt.begin_name.empty() && opt.end_names.empty()) {
+        opt.end_names = { "cuCtxSynchronize", "cuStreamSynchronize" };
+    }
+
+    std::vector<Call> calls;
+    if (load_trace(argv[argi], &calls) != 0) {
+        return 1;
+    }
+    if (calls.empty()) {
+        fprintf(stderr, "Error: no calls in %s (binary traces: run cuda_trace_convert first)\n",
+                argv[argi]);
+        return 1;
+    }
+
+    Graph g;
+    build_graph(calls, &g);
+    std::vector<Iteration> iterations = split_iterations(g, opt);
+    for (Iteration& it : iterations) {
+        walk_path(g, &it);
+    }
+    print_report(g, iterations, opt);
+    return 0;
+}
@@ -0,0 +1,541 @@
+/*
+ * trace_diff.cpp - Per-API and per-kernel latency comparison of two traces
+ *
+ * Reads two JSON Lines traces (a baseline A and a candidate B, as the hook
+ * writes them or cuda_trace_convert produces them) and compares, for every
+ * driver API and every kernel, the number of calls, the total time and the
+ * p50/p90/p99 latency. An API's latency is its host call time; a kernel's is
+ * its device time when both traces were recorded with CUDA_HOOK_GPU_TIMING,
+ * otherwise the host time of the launches that named it.
+ *
+ * The inputs are streamed once, so memory does not grow with their size:
+ * every API and kernel keeps an exact count and total, and a fixed-size
+ * uniform sample of its latencies (reservoir sampling, seeded so runs are
+ * repeatable) from which the quantiles are taken. Each quantile delta gets
+ * a percentile bootstrap confidence interval, resampling both samples. A
+ * quantile that got slower by more than --threshold and --min-delta, with an
+ * interval that excludes zero, is a regression, and the exit status is then
+ * 1, so the tool can gate a driver or model upgrade in CI. The absolute
+ * floor keeps calls that take well under a microsecond, where a busy host
+ * alone moves the quantiles by tens of percent, from failing the gate.
+ *
+ * Compile: make cuda_trace_diff
+ * Usage: cuda_trace_diff [options] baseline.jsonl candidate.jsonl
+ */
+
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "trace_jsonl.h"
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [options] baseline.jsonl candidate.jsonl\n"
+            "  --threshold=PCT   slowdown of a quantile that counts as a regression\n"
+            "                    (default 5)\n"
+            "  --min-delta=US    and by at least US microseconds (default 1)\n"
+            "  --min-calls=N     compare quantiles only with N samples on both sides\n"
+            "                    (default 30)\n"
+            "  --confidence=PCT  bootstrap confidence level (default 95)\n"
+            "  --bootstrap=N     bootstrap resamples (default 1000)\n"
+            "  --samples=N       latencies kept per API or kernel (default 4096)\n"
+            "  --seed=N          seed for sampling and resampling (default 1)\n"
+            "  --limit=N         rows per table (default 20)\n"
+            "Binary traces: cuda_trace_diff <(cuda_trace_convert a.bin) <(cuda_trace_convert b.bin)\n"
+            "Exit status: 0 no regression, 1 regressions found, 2 error\n",
+            prog);
+}
+
+struct Options {
+    double threshold = 0.05;
+    double min_delta_ns = 1000;
+    uint64_t min_calls = 30;
+    double confidence = 0.95;
+    int bootstrap = 1000;
+    size_t samples = 4096;
+    uint64_t seed = 1;
+    size_t limit = 20;
+};
+
+// splitmix64: small, and the same sequence everywhere for a given seed
+struct Rng {
+    uint64_t state;
+
+    explicit Rng(uint64_t seed) : state(seed) {}
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    // Uniform in [0, n)
+    uint64_t below(uint64_t n) {
+        return (uint64_t)(((unsigned __int128)next() * n) >> 64);
+    }
+};
+
+static uint64_t hash_name(const std::string& s) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (unsigned char c : s) {
+        h = (h ^ c) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+//
+// Streaming statistics
+//
+
+// Exact count and total; quantiles come from a uniform sample of at most
+// `cap` latencies (Vitter's algorithm R)
+struct Series {
+    uint64_t count = 0;
+    int64_t total_ns = 0;
+    std::vector<int64_t> sample;
+
+    void add(int64_t ns, size_t cap, Rng* rng) {
+        count++;
+        total_ns += ns;
+        if (sample.size() < cap) {
+            sample.push_back(ns);
+        } else {
+            uint64_t slot = rng->below(count);
+            if (slot < cap) {
+                sample[slot] = ns;
+            }
+        }
+    }
+};
+
+// One API or kernel as seen in one trace
+struct Entry {
+    Series host;    // Call time: the API's, or the launches of the kernel
+    Series device;  // Kernels only: device time from gpuKernel lines
+};
+
+struct Trace {
+    const char* path = nullptr;
+    std::map<std::string, Entry> apis;
+    std::map<std::string, Entry> kernels;
+    uint64_t calls = 0;
+    uint64_t timed_kernels = 0;
+    int64_t first_ns = -1;
+    int64_t last_ns = -1;
+};
+
+//
+// JSON Lines input
+//
+
+// A call whose "B" line has been read and whose "E" line has not; the hook
+// writes them one after the other, so only calls cut off by a crash or
+// interleaved by the collector stay here for long
+struct Open {
+    int64_t begin;
+    std::string name;
+    std::string kernel;
+};
+
+static int load_trace(const char* path, const Options& opt, Trace* trace) {
+    FILE* in = fopen(path, "r");
+    if (!in) {
+        perror(path);
+        return -1;
+    }
+
+    trace->path = path;
+    Rng rng(opt.seed ^ hash_name(path));
+    std::unordered_map<ProcessKey, Open, ProcessKeyHash> open;
+    LineParser parser;
+    char* line = nullptr;
+    size_t cap = 0;
+    uint64_t lineno = 0;
+    uint64_t bad = 0;
+    ssize_t len;
+
+    while ((len = getline(&line, &cap, in)) > 0) {
+        lineno++;
+        if (lineno == 1) {
+            if (const char* why = unreadable_input(line, (size_t)len)) {
+                fprintf(stderr, "Error: %s: %s\n", path, why);
+                free(line);
+                fclose(in);
+                return -1;
+            }
+        }
+        if (!parser.parse(line)) {
+            if (bad++ == 0) {
+                fprintf(stderr, "Warning: %s:%" PRIu64 ": unparsable line skipped\n", path, lineno);
+            }
+            continue;
+        }
+        const std::string* phase = find(parser.fields, "phase");
+        const std::string* op = find(parser.fields, "op_id");
+        const std::string* ts = find(parser.fields, "ts");
+        if (!phase || !op || !ts) {
+            continue;
+        }
+        int64_t now = parse_ns(*ts);
+        const ProcessKey key = { line_pid(parser.fields), strtoull(op->c_str(), nullptr, 10) };
+
+        if (*phase == "C") {
+            const std::string* kernel = find(parser.details, "kernel");
+            const std::string* us = find(parser.details, "device_us");
+            if (us) {
+                int64_t ns = (int64_t)(strtod(us->c_str(), nullptr) * 1e3);
+                trace->kernels[kernel ? *kernel : "(unnamed)"].device.add(ns, opt.samples, &rng);
+                trace->timed_kernels++;
+            }
+            continue;
+        }
+        if (*phase == "B") {
+            Open& o = open[key];
+            o.begin = now;
+            const std::string* name = find(parser.fields, "name");
+            o.name = name ? *name : "";
+            const std::string* kernel = find(parser.details, "kernel");
+            o.kernel = kernel ? *kernel : "";
+            continue;
+        }
+        if (*phase != "E") {
+            continue;
+        }
+        auto it = open.find(key);
+        if (it == open.end()) {
+            continue;
+        }
+        Open& o = it->second;
+        if (now >= o.begin && !o.name.empty()) {
+            const std::string* kernel = find(parser.details, "kernel");
+            if (kernel) {
+                o.kernel = *kernel;
+            }
+            trace->apis[o.name].host.add(now - o.begin, opt.samples, &rng);
+            if (!o.kernel.empty()) {
+                trace->kernels[o.kernel].host.add(now - o.begin, opt.samples, &rng);
+            }
+            trace->calls++;
+            if (trace->first_ns < 0 || o.begin < trace->first_ns) {
+                trace->first_ns = o.begin;
+            }
+            trace->last_ns = std::max(trace->last_ns, now);
+        }
+        open.erase(it);
+    }
+    free(line);
+    fclose(in);
+
+    if (bad > 1) {
+        fprintf(stderr, "Warning: %" PRIu64 " unparsable lines skipped in total\n", bad);
+    }
+    return 0;
+}
+
+//
+// Quantiles and bootstrap
+//
+
+static const double kQuantiles[] = {0.50, 0.90, 0.99};
+static const char* const kQuantileNames[] = {"p50", "p90", "p99"};
+static const int kNumQuantiles = 3;
+
+// Nearest-rank index of quantile q among n sorted values
+static size_t rank_of(double q, size_t n) {
+    size_t k = (size_t)std::ceil(q * n);
+    return k > 0 ? k - 1 : 0;
+}
+
+// The quantiles of one resample of `sorted`. Drawing indices instead of
+// values and selecting among them gives the same order statistics, since
+// the values are sorted, without sorting the resample.
+static void resample_quantiles(const std::vector<int64_t>& sorted, Rng* rng,
+                               std::vector<uint32_t>* idx, int64_t out[]) {
+    size_t n = sorted.size();
+    idx->resize(n);
+    for (size_t i = 0; i < n; i++) {
+        (*idx)[i] = (uint32_t)rng->below(n);
+    }
+    // Ascending ranks, each selection narrowing the range of the next
+    auto from = idx->begin();
+    for (int q = 0; q < kNumQuantiles; q++) {
+        auto at = idx->begin() + rank_of(kQuantiles[q], n);
+        std::nth_element(from, at, idx->end());
+        out[q] = sorted[*at];
+        from = at;
+    }
+}
+
+struct QuantileDiff {
+    int64_t a = 0;
+    int64_t b = 0;
+    double lo = 0;  // Confidence interval of b - a
+    double hi = 0;
+    bool regression = false;
+    bool improvement = false;
+};
+
+// Point estimates and percentile bootstrap intervals of the deltas
+static void compare_quantiles(const Series& a, const Series& b, const Options& opt,
+                              uint64_t seed, QuantileDiff out[]) {
+    std::vector<int64_t> sa = a.sample;
+    std::vector<int64_t> sb = b.sample;
+    std::sort(sa.begin(), sa.end());
+    std::sort(sb.begin(), sb.end());
+    for (int q = 0; q < kNumQuantiles; q++) {
+        out[q].a = sa[rank_of(kQuantiles[q], sa.size())];
+        out[q].b = sb[rank_of(kQuantiles[q], sb.size())];
+    }
+
+    Rng rng(seed);
+    std::vector<uint32_t> idx;
+    std::vector<double> deltas[kNumQuantiles];
+    for (int r = 0; r < opt.bootstrap; r++) {
+        int64_t qa[kNumQuantiles];
+        int64_t qb[kNumQuantiles];
+        resample_quantiles(sa, &rng, &idx, qa);
+        resample_quantiles(sb, &rng, &idx, qb);
+        for (int q = 0; q < kNumQuantiles; q++) {
+            deltas[q].push_back((double)(qb[q] - qa[q]));
+        }
+    }
+
+    double tail = (1.0 - opt.confidence) / 2;
+    for (int q = 0; q < kNumQuantiles; q++) {
+        QuantileDiff& d = out[q];
+        std::vector<double>& v = deltas[q];
+        if (v.empty()) {
+            d.lo = d.hi = (double)(d.b - d.a);
+        } else {
+            std::sort(v.begin(), v.end());
+            d.lo = v[std::min(v.size() - 1, (size_t)std::floor(tail * v.size()))];
+            d.hi = v[std::min(v.size() - 1, (size_t)std::floor((1.0 - tail) * v.size()))];
+        }
+        double delta = (double)(d.b - d.a);
+        double change = d.a > 0 ? delta / d.a : (d.b > 0 ? INFINITY : 0);
+        d.regression = change > opt.threshold && delta >= opt.min_delta_ns && d.lo > 0;
+        d.improvement = change < -opt.threshold && -delta >= opt.min_delta_ns && d.hi < 0;
+    }
+}
+
+//
+// Report
+//
+
+struct Row {
+    std::string name;
+    const char* measure = "";  // Which latency was compared
+    const Series* a = nullptr;
+    const Series* b = nullptr;
+    bool compared = false;
+    QuantileDiff q[kNumQuantiles];
+    int regressions = 0;
+    double worst = 0;          // Largest relative slowdown among regressions
+};
+
+static const Series kEmpty;
+
+static Row make_row(const std::string& name, const char* measure, const Series* a,
+                    const Series* b, const Options& opt) {
+    Row row;
+    row.name = name;
+    row.measure = measure;
+    row.a = a ? a : &kEmpty;
+    row.b = b ? b : &kEmpty;
+    if (row.a->count >= opt.min_calls && row.b->count >= opt.min_calls) {
+        row.compared = true;
+        compare_quantiles(*row.a, *row.b, opt, opt.seed ^ hash_name(name), row.q);
+        for (const QuantileDiff& d : row.q) {
+            if (d.regression) {
+                row.regressions++;
+                row.worst = std::max(row.worst, d.a > 0 ? (double)(d.b - d.a) / d.a : INFINITY);
+            }
+        }
+    }
+    return row;
+}
+
+// Regressions first, worst first; then by how much the total time moved
+static void rank_rows(std::vector<Row>* rows) {
+    std::sort(rows->begin(), rows->end(), [](const Row& x, const Row& y) {
+        if ((x.regressions > 0) != (y.regressions > 0)) {
+            return x.regressions > 0;
+        }
+        if (x.worst != y.worst) {
+            return x.worst > y.worst;
+        }
+        int64_t dx = std::llabs(x.b->total_ns - x.a->total_ns);
+        int64_t dy = std::llabs(y.b->total_ns - y.a->total_ns);
+        if (dx != dy) {
+            return dx > dy;
+        }
+        return x.name < y.name;
+    });
+}
+
+static std::string percent(double num, double den) {
+    char buf[32];
+    if (den > 0) {
+        snprintf(buf, sizeof(buf), "%+.1f%%", 100.0 * num / den);
+    } else {
+        snprintf(buf, sizeof(buf), "%s", num > 0 ? "new" : "-");
+    }
+    return buf;
+}
+
+static void print_rows(const char* title, std::vector<Row>& rows, const Options& opt) {
+    rank_rows(&rows);
+    printf("\n%s:\n", title);
+    printf("  %-40s  %9s  %9s  %12s  %12s  %8s\n", "Name", "Calls A", "Calls B", "Total A(ms)",
+           "Total B(ms)", "Total");
+    size_t shown = 0;
+    for (const Row& row : rows) {
+        if (shown == opt.limit) {
+            printf("  ... %zu more (--limit)\n", rows.size() - shown);
+            break;
+        }
+        shown++;
+        std::string name = row.name;
+        if (name.size() > 40) {
+            name = name.substr(0, 37) + "...";
+        }
+        printf("  %-40s  %9" PRIu64 "  %9" PRIu64 "  %12.3f  %12.3f  %8s%s%s\n", name.c_str(),
+               row.a->count, row.b->count, row.a->total_ns / 1e6, row.b->total_ns / 1e6,
+               percent((double)(row.b->total_ns - row.a->total_ns), (double)row.a->total_ns).c_str(),
+               *row.measure ? "  " : "", row.measure);
+        if (!row.compared) {
+            continue;
+        }
+        for (int q = 0; q < kNumQuantiles; q++) {
+            const QuantileDiff& d = row.q[q];
+            printf("      %s  %10.3f -> %10.3f us  %+10.3f us %8s  CI [%+.3f, %+.3f]%s\n",
+                   kQuantileNames[q], d.a / 1e3, d.b / 1e3, (d.b - d.a) / 1e3,
+                   percent((double)(d.b - d.a), (double)d.a).c_str(), d.lo / 1e3, d.hi / 1e3,
+                   d.regression ? "  REGRESSION" : d.improvement ? "  faster" : "");
+        }
+    }
+}
+
+static void print_trace(const char* label, const Trace& t) {
+    printf("%s: %s: %" PRIu64 " calls, %zu APIs, %zu kernels (%" PRIu64 " device-timed), "
+           "%.3f s\n",
+           label, t.path, t.calls, t.apis.size(), t.kernels.size(), t.timed_kernels,
+           t.calls ? (t.last_ns - t.first_ns) / 1e9 : 0.0);
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    int argi = 1;
+    for (; argi < argc && strncmp(argv[argi], "--", 2) == 0; argi++) {
+        const char* arg = argv[argi];
+        if (strncmp(arg, "--threshold=", 12) == 0) {
+            opt.threshold = strtod(arg + 12, nullptr) / 100;
+        } else if (strncmp(arg, "--min-delta=", 12) == 0) {
+            opt.min_delta_ns = strtod(arg + 12, nullptr) * 1e3;
+        } else if (strncmp(arg, "--min-calls=", 12) == 0) {
+            opt.min_calls = strtoull(arg + 12, nullptr, 10);
+        } else if (strncmp(arg, "--confidence=", 13) == 0) {
+            opt.confidence = strtod(arg + 13, nullptr) / 100;
+        } else if (strncmp(arg, "--bootstrap=", 12) == 0) {
+            opt.bootstrap = atoi(arg + 12);
+        } else if (strncmp(arg, "--samples=", 10) == 0) {
+            opt.samples = strtoull(arg + 10, nullptr, 10);
+        } else if (strncmp(arg, "--seed=", 7) == 0) {
+            opt.seed = strtoull(arg + 7, nullptr, 0);
+        } else if (strncmp(arg, "--limit=", 8) == 0) {
+            opt.limit = strtoull(arg + 8, nullptr, 10);
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (argc - argi != 2 || opt.confidence <= 0 || opt.confidence >= 1 || opt.bootstrap < 0 ||
+        opt.samples == 0 || opt.samples > UINT32_MAX) {
+        usage(argv[0]);
+        return 2;
+    }
+    opt.min_calls = std::max<uint64_t>(opt.min_calls, 1);
+
+    Trace a;
+    Trace b;
+    if (load_trace(argv[argi], opt, &a) != 0 || load_trace(argv[argi + 1], opt, &b) != 0) {
+        return 2;
+    }
+    for (const Trace* t : {&a, &b}) {
+        if (t->calls == 0) {
+            fprintf(stderr, "Error: no calls in %s (binary traces: run cuda_trace_convert first)\n",
+                    t->path);
+            return 2;
+        }
+    }
+
+    print_trace("A", a);
+    print_trace("B", b);
+    printf("Quantiles from up to %zu samples per API or kernel; %d bootstrap resamples, "
+           "%.0f%% intervals of B - A\n",
+           opt.samples, opt.bootstrap, opt.confidence * 100);
+
+    std::vector<Row> apis;
+    std::map<std::string, std::pair<const Entry*, const Entry*>> names;
+    for (const auto& [name, e] : a.apis) {
+        names[name].first = &e;
+    }
+    for (const auto& [name, e] : b.apis) {
+        names[name].second = &e;
+    }
+    for (const auto& [name, pair] : names) {
+        apis.push_back(make_row(name, "", pair.first ? &pair.first->host : nullptr,
+                                pair.second ? &pair.second->host : nullptr, opt));
+    }
+
+    // Device time when both sides measured it, so a slower launch path is
+    // not mistaken for a slower kernel and the other way round
+    std::vector<Row> kernels;
+    names.clear();
+    for (const auto& [name, e] : a.kernels) {
+        names[name].first = &e;
+    }
+    for (const auto& [name, e] : b.kernels) {
+        names[name].second = &e;
+    }
+    for (const auto& [name, pair] : names) {
+        const Entry* ea = pair.first;
+        const Entry* eb = pair.second;
+        bool device = ea && eb && ea->device.count > 0 && eb->device.count > 0;
+        const Series* sa = ea ? (device ? &ea->device : &ea->host) : nullptr;
+        const Series* sb = eb ? (device ? &eb->device : &eb->host) : nullptr;
+        kernels.push_back(make_row(name, device ? "device" : "launch", sa, sb, opt));
+    }
+
+    print_rows("Per API (host time per call)", apis, opt);
+    if (!kernels.empty()) {
+        print_rows("Per kernel (device time, or launch time without CUDA_HOOK_GPU_TIMING)",
+                   kernels, opt);
+    }
+
+    int regressions = 0;
+    for (const std::vector<Row>* rows : {&apis, &kernels}) {
+        for (const Row& row : *rows) {
+            regressions += row.regressions > 0;
+        }
+    }
+    if (regressions > 0) {
+        printf("\n%d significant regression%s (> %.1f%% and >= %.3f us slower, %.0f%% interval "
+               "above zero)\n",
+               regressions, regressions == 1 ? "" : "s", opt.threshold * 100,
+               opt.min_delta_ns / 1e3, opt.confidence * 100);
+        return 1;
+    }
+    printf("\nNo significant regressions\n");
+    return 0;
+}
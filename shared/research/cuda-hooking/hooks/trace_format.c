@@ -0,0 +1,826 @@
+/*
+ * trace_format.c - Render hook events as JSON Lines
+ *
+ * Each record expands to a "B" and an "E" line carrying the same details
+ * the hooks used to format inline, so visualize_pipeline.py keeps working.
+ * Formatting only ever runs on the drainer thread or in cuda_trace_convert;
+ * the binary writers at the end dump records without formatting them.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "cuda_hook.h"
+
+const char* const hook_api_names[REC_COUNT] = {
+#define HOOK_API(name, category, versioned, ret, params, args) #name,
+#include "hook_apis.h"
+#undef HOOK_API
+    [REC_GPU_KERNEL] = "gpuKernel",
+    [REC_HOST_STACK] = "hostStack",
+};
+
+const char* const hook_api_categories[REC_COUNT] = {
+#define HOOK_API(name, category, versioned, ret, params, args) category,
+#include "hook_apis.h"
+#undef HOOK_API
+    [REC_GPU_KERNEL] = "kernel",
+    [REC_HOST_STACK] = "stack",
+};
+
+// Argument descriptions of the generated hooks, by API id
+#define CAP_NONE          { HOOK_ARG_NONE, 0, NULL }
+#define CAP_SIZE(x)       { HOOK_ARG_SIZE, 0, #x }
+#define CAP_INT(x)        { HOOK_ARG_INT, 0, #x }
+#define CAP_FLAGS(x)      { HOOK_ARG_FLAGS, 0, #x }
+#define CAP_HANDLE(x)     { HOOK_ARG_HANDLE, 0, #x }
+#define CAP_PTR(x)        { HOOK_ARG_PTR, 0, #x }
+#define CAP_STRING(x)     { HOOK_ARG_STRING, 0, #x }
+#define CAP_OUT_HANDLE(p) { HOOK_ARG_HANDLE, 1, #p }
+#define CAP_OUT_INT(p)    { HOOK_ARG_INT, 1, #p }
+#define CAP_OUT_SIZE(p)   { HOOK_ARG_SIZE, 1, #p }
+
+const char* const hook_mode_names[HOOK_MODE_COUNT] = {
+    [HOOK_MODE_TRACE] = "trace",
+    [HOOK_MODE_AGGREGATE] = "aggregate",
+    [HOOK_MODE_OFF] = "off",
+};
+
+const struct hook_arg_desc hook_api_args[API_COUNT][HOOK_GEN_ARGS] = {
+#define HOOK_API(name, category, versioned, ret, params, args)
+#define HOOK_GEN(name, category, version, params, args, c0, c1, c2, c3) \
+    [API_##name] = { c0, c1, c2, c3 },
+#include "hook_apis.h"
+#undef HOOK_GEN
+#undef HOOK_API
+};
+
+const uint8_t hook_api_arg_count[API_COUNT] = {
+#define HOOK_API(name, category, versioned, ret, params, args)
+#define HOOK_GEN(name, category, version, params, args, c0, c1, c2, c3) \
+    [API_##name] = HOOK_NARGS args,
+#include "hook_apis.h"
+#undef HOOK_GEN
+#undef HOOK_API
+};
+
+void trace_write_string(FILE* out, const char* s) {
+    if (!s) {
+        fputs("\"null\"", out);
+        return;
+    }
+    fputc('"', out);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            fputc('\\', out);
+            fputc(c, out);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void write_prefix(FILE* out, const struct hook_event* ev, const char* phase, int64_t ts) {
+    fprintf(out,
+            "{\"ts\":%" PRId64 ".%09" PRId64 ",\"op_id\":%" PRIu64 ",\"tid\":%u,"
+            "\"phase\":\"%s\",\"category\":\"%s\",\"name\":\"%s\"",
+            ts / 1000000000, ts % 1000000000, ev->op_id, ev->tid,
+            phase, hook_api_categories[ev->api], hook_api_names[ev->api]);
+}
+
+// "host_memory" member of a copy's exit details, with its trailing comma
+static const char* host_memory(const struct hook_event* ev) {
+    switch (ev->args.copy.host) {
+    case HOOK_HOST_PINNED:
+        return "\"host_memory\":\"pinned\",";
+    case HOOK_HOST_PAGEABLE:
+        return "\"host_memory\":\"pageable\",";
+    default:
+        return "";
+    }
+}
+
+static double bandwidth_gbps(uint64_t bytes, int64_t duration_ns) {
+    // Bytes per nanosecond is GB/s
+    return duration_ns > 0 ? (double)bytes / duration_ns : 0.0;
+}
+
+static const char* copy_direction(uint16_t api) {
+    switch (api) {
+    case API_cuMemcpyHtoD:
+    case API_cuMemcpyHtoDAsync: return "host_to_device";
+    case API_cuMemcpyDtoH:
+    case API_cuMemcpyDtoHAsync: return "device_to_host";
+    case API_cuMemcpy:
+    case API_cuMemcpyAsync:     return "unified";
+    default:                    return "device_to_device";
+    }
+}
+
+const char* const stats_size_class_names[STATS_SIZE_CLASSES] = {
+    "0", "1K", "4K", "16K", "64K", "256K", "1M", "4M", "16M", "64M",
+};
+
+// Launched kernel as "function":"0x...","kernel":"name", (kernel only
+// when the handle's name is known)
+static void write_kernel(FILE* out, const struct hook_event* ev, const struct string_table* strings,
+                         const struct func_table* functions, int with_handle) {
+    const struct func_entry* fn = func_table_get(functions, ev->args.launch.func);
+    if (with_handle) {
+        fprintf(out, "\"function\":\"0x%" PRIx64 "\",", fn ? fn->handle : 0);
+    }
+    const char* name = fn ? string_table_get(strings, fn->name) : NULL;
+    if (name) {
+        fputs("\"kernel\":", out);
+        trace_write_string(out, name);
+        fputc(',', out);
+    }
+}
+
+// Captures of a generated hook: inputs at entry (out = 0), outputs at exit
+// (out = 1). Returns the number written.
+static int write_generic_args(FILE* out, const struct hook_event* ev,
+                              const struct string_table* strings, int outputs) {
+    int n = 0;
+    for (unsigned i = 0; i < HOOK_GEN_ARGS; i++) {
+        const struct hook_arg_desc* arg = &hook_api_args[ev->api][i];
+        uint64_t value = ev->args.generic[i];
+        if (arg->kind == HOOK_ARG_NONE || arg->out != outputs) {
+            continue;
+        }
+
+        fprintf(out, "%s\"%s\":", n++ ? "," : "", arg->name);
+        switch (arg->kind) {
+        case HOOK_ARG_INT:
+            fprintf(out, "%" PRId64, (int64_t)value);
+            break;
+        case HOOK_ARG_HANDLE:
+        case HOOK_ARG_PTR:
+            fprintf(out, "\"0x%" PRIx64 "\"", value);
+            break;
+        case HOOK_ARG_STRING:
+            trace_write_string(out, string_table_get(strings, (uint32_t)value));
+            break;
+        default:
+            fprintf(out, "%" PRIu64, value);
+            break;
+        }
+    }
+    return n;
+}
+
+// Details recorded at call entry
+static void write_begin_details(FILE* out, const struct hook_event* ev,
+                                const struct string_table* strings,
+                                const struct func_table* functions) {
+    const uint32_t block = ev->args.launch.block;
+
+    switch (ev->api) {
+    case API_cuMemAlloc:
+    case API_cuMemAllocHost:
+        fprintf(out, "{\"size\":%" PRIu64 "}", ev->args.mem.size);
+        break;
+    case API_cuMemHostAlloc:
+        fprintf(out, "{\"size\":%" PRIu64 ",\"flags\":%u}", ev->args.mem.size, ev->args.mem.flags);
+        break;
+    case API_cuMemHostRegister:
+        fprintf(out, "{\"ptr\":\"0x%" PRIx64 "\",\"size\":%" PRIu64 ",\"flags\":%u}",
+                ev->args.mem.ptr, ev->args.mem.size, ev->args.mem.flags);
+        break;
+    case API_cuMemAllocAsync:
+        fprintf(out, "{\"size\":%" PRIu64 ",\"stream\":\"0x%" PRIx64 "\"}",
+                ev->args.mem.size, ev->args.mem.stream);
+        break;
+    case API_cuMemFree:
+    case API_cuMemFreeHost:
+    case API_cuMemHostUnregister:
+        fprintf(out, "{\"ptr\":\"0x%" PRIx64 "\"}", ev->args.mem.ptr);
+        break;
+    case API_cuMemFreeAsync:
+        fprintf(out, "{\"ptr\":\"0x%" PRIx64 "\",\"stream\":\"0x%" PRIx64 "\"}",
+                ev->args.mem.ptr, ev->args.mem.stream);
+        break;
+    case API_cuMemcpyHtoD:
+    case API_cuMemcpyDtoH:
+    case API_cuMemcpyDtoD:
+    case API_cuMemcpy:
+        fprintf(out, "{\"direction\":\"%s\",\"dst\":\"0x%" PRIx64 "\",\"src\":\"0x%" PRIx64 "\","
+                "\"size\":%" PRIu64 "}",
+                copy_direction(ev->api), ev->args.copy.dst, ev->args.copy.src,
+                (uint64_t)ev->args.copy.size);
+        break;
+    case API_cuMemcpyAsync:
+    case API_cuMemcpyHtoDAsync:
+    case API_cuMemcpyDtoHAsync:
+    case API_cuMemcpyDtoDAsync:
+        fprintf(out, "{\"direction\":\"%s\",\"dst\":\"0x%" PRIx64 "\",\"src\":\"0x%" PRIx64 "\","
+                "\"size\":%" PRIu64 ",\"stream\":\"0x%" PRIx64 "\"}",
+                copy_direction(ev->api), ev->args.copy.dst, ev->args.copy.src,
+                (uint64_t)ev->args.copy.size, ev->args.copy.stream);
+        break;
+    case API_cuCtxCreate:
+        fprintf(out, "{\"flags\":%u,\"device\":\"0x%" PRIx64 "\"}",
+                ev->args.ctx.flags, ev->args.ctx.device);
+        break;
+    case API_cuCtxDestroy:
+    case API_cuCtxSetCurrent:
+        fprintf(out, "{\"ctx\":\"0x%" PRIx64 "\"}", ev->args.ctx.ctx);
+        break;
+    case API_cuStreamCreate:
+        fprintf(out, "{\"flags\":%u}", ev->args.stream.flags);
+        break;
+    case API_cuStreamDestroy:
+    case API_cuStreamSynchronize:
+        fprintf(out, "{\"stream\":\"0x%" PRIx64 "\"}", ev->args.stream.stream);
+        break;
+    case API_cuEventRecord:
+    case API_cuEventRecordWithFlags:
+    case API_cuStreamWaitEvent:
+        fprintf(out, "{\"event\":\"0x%" PRIx64 "\",\"stream\":\"0x%" PRIx64 "\",\"flags\":%u}",
+                ev->args.event.event, ev->args.event.stream, ev->args.event.flags);
+        break;
+    case API_cuLaunchKernel:
+        fputc('{', out);
+        write_kernel(out, ev, strings, functions, 1);
+        fprintf(out, "\"grid\":[%u,%u,%u],\"block\":[%u,%u,%u],"
+                "\"shared_mem\":%u,\"stream\":\"0x%" PRIx64 "\"}",
+                ev->args.launch.grid_x, ev->args.launch.grid_y, ev->args.launch.grid_z,
+                HOOK_BLOCK_X(block), HOOK_BLOCK_Y(block), HOOK_BLOCK_Z(block),
+                ev->args.launch.shared_mem, ev->args.launch.stream);
+        break;
+    case API_cuModuleLoad:
+        fputs("{\"file\":", out);
+        trace_write_string(out, string_table_get(strings, ev->args.module.name));
+        fputc('}', out);
+        break;
+    case API_cuModuleUnload:
+        fprintf(out, "{\"module\":\"0x%" PRIx64 "\"}", ev->args.module.module);
+        break;
+    case API_cuModuleGetFunction:
+        fprintf(out, "{\"module\":\"0x%" PRIx64 "\",\"name\":", ev->args.module.module);
+        trace_write_string(out, string_table_get(strings, ev->args.module.name));
+        fputc('}', out);
+        break;
+    case API_cuLibraryGetKernel:
+        fprintf(out, "{\"library\":\"0x%" PRIx64 "\",\"name\":", ev->args.module.module);
+        trace_write_string(out, string_table_get(strings, ev->args.module.name));
+        fputc('}', out);
+        break;
+    case API_cuInit:
+        fprintf(out, "{\"flags\":%u}", ev->args.device.flags);
+        break;
+    case API_cuDeviceGet:
+        fprintf(out, "{\"ordinal\":%d}", ev->args.device.ordinal);
+        break;
+    default:
+        fputc('{', out);
+        int n = write_generic_args(out, ev, strings, 0);
+        // Parameters left out of the record, so a reader does not take
+        // the captures for the whole call
+        int captured = 0;
+        for (unsigned i = 0; i < HOOK_GEN_ARGS; i++) {
+            captured += hook_api_args[ev->api][i].kind != HOOK_ARG_NONE;
+        }
+        if (hook_api_arg_count[ev->api] > captured) {
+            fprintf(out, "%s\"args_not_recorded\":%d", n ? "," : "",
+                    hook_api_arg_count[ev->api] - captured);
+        }
+        fputc('}', out);
+        break;
+    }
+}
+
+// Details recorded at call exit
+static void write_end_details(FILE* out, const struct hook_event* ev,
+                              const struct string_table* strings,
+                              const struct func_table* functions) {
+    const int64_t duration = ev->end - ev->ts;
+    const uint32_t block = ev->args.launch.block;
+
+    switch (ev->api) {
+    case API_cuMemAlloc:
+    case API_cuMemAllocHost:
+    case API_cuMemHostAlloc:
+        fprintf(out, "{\"size\":%" PRIu64 ",\"ptr\":\"0x%" PRIx64 "\",\"status\":%d}",
+                ev->args.mem.size, ev->args.mem.ptr, ev->status);
+        break;
+    case API_cuMemAllocAsync:
+        fprintf(out, "{\"size\":%" PRIu64 ",\"ptr\":\"0x%" PRIx64 "\",\"stream\":\"0x%" PRIx64 "\","
+                "\"status\":%d}",
+                ev->args.mem.size, ev->args.mem.ptr, ev->args.mem.stream, ev->status);
+        break;
+    case API_cuMemFree:
+    case API_cuMemFreeHost:
+    case API_cuMemFreeAsync:
+    case API_cuMemHostRegister:
+    case API_cuMemHostUnregister:
+        fprintf(out, "{\"ptr\":\"0x%" PRIx64 "\",\"status\":%d}", ev->args.mem.ptr, ev->status);
+        break;
+    case API_cuMemcpyHtoD:
+    case API_cuMemcpyDtoH:
+    case API_cuMemcpyDtoD:
+    case API_cuMemcpy:
+        fprintf(out, "{\"direction\":\"%s\",\"size\":%" PRIu64 ",\"bandwidth_gbps\":%.2f,%s"
+                "\"status\":%d}",
+                copy_direction(ev->api), (uint64_t)ev->args.copy.size,
+                bandwidth_gbps(ev->args.copy.size, duration), host_memory(ev), ev->status);
+        break;
+    case API_cuMemcpyAsync:
+    case API_cuMemcpyHtoDAsync:
+    case API_cuMemcpyDtoHAsync:
+    case API_cuMemcpyDtoDAsync:
+        // Only the enqueue is timed here, so no bandwidth
+        fprintf(out, "{\"direction\":\"%s\",\"size\":%" PRIu64 ",\"stream\":\"0x%" PRIx64 "\","
+                "%s\"status\":%d}",
+                copy_direction(ev->api), (uint64_t)ev->args.copy.size, ev->args.copy.stream,
+                host_memory(ev), ev->status);
+        break;
+    case API_cuCtxCreate:
+    case API_cuCtxDestroy:
+    case API_cuCtxSetCurrent:
+        fprintf(out, "{\"ctx\":\"0x%" PRIx64 "\",\"status\":%d}", ev->args.ctx.ctx, ev->status);
+        break;
+    case API_cuCtxSynchronize:
+        fprintf(out, "{\"duration_ms\":%.3f,\"status\":%d}", duration / 1e6, ev->status);
+        break;
+    case API_cuStreamCreate:
+    case API_cuStreamDestroy:
+        fprintf(out, "{\"stream\":\"0x%" PRIx64 "\",\"status\":%d}",
+                ev->args.stream.stream, ev->status);
+        break;
+    case API_cuStreamSynchronize:
+        fprintf(out, "{\"stream\":\"0x%" PRIx64 "\",\"duration_ms\":%.3f,\"status\":%d}",
+                ev->args.stream.stream, duration / 1e6, ev->status);
+        break;
+    case API_cuEventRecord:
+    case API_cuEventRecordWithFlags:
+    case API_cuStreamWaitEvent:
+        fprintf(out, "{\"event\":\"0x%" PRIx64 "\",\"stream\":\"0x%" PRIx64 "\",\"status\":%d}",
+                ev->args.event.event, ev->args.event.stream, ev->status);
+        break;
+    case API_cuLaunchKernel: {
+        uint64_t total_threads = (uint64_t)ev->args.launch.grid_x * ev->args.launch.grid_y *
+                                 ev->args.launch.grid_z * HOOK_BLOCK_X(block) *
+                                 HOOK_BLOCK_Y(block) * HOOK_BLOCK_Z(block);
+        fputc('{', out);
+        write_kernel(out, ev, strings, functions, 0);
+        fprintf(out, "\"grid\":[%u,%u,%u],\"block\":[%u,%u,%u],\"total_threads\":%" PRIu64 ","
+                "\"stream\":\"0x%" PRIx64 "\",\"duration_us\":%.3f,\"status\":%d}",
+                ev->args.launch.grid_x, ev->args.launch.grid_y, ev->args.launch.grid_z,
+                HOOK_BLOCK_X(block), HOOK_BLOCK_Y(block), HOOK_BLOCK_Z(block),
+                total_threads, ev->args.launch.stream, duration / 1e3, ev->status);
+        break;
+    }
+    case API_cuModuleLoad:
+        fprintf(out, "{\"module\":\"0x%" PRIx64 "\",\"file\":", ev->args.module.module);
+        trace_write_string(out, string_table_get(strings, ev->args.module.name));
+        fprintf(out, ",\"status\":%d}", ev->status);
+        break;
+    case API_cuModuleUnload:
+        fprintf(out, "{\"module\":\"0x%" PRIx64 "\",\"status\":%d}", ev->args.module.module, ev->status);
+        break;
+    case API_cuModuleGetFunction:
+        fprintf(out, "{\"function\":\"0x%" PRIx64 "\",\"name\":", ev->args.module.func);
+        trace_write_string(out, string_table_get(strings, ev->args.module.name));
+        fprintf(out, ",\"status\":%d}", ev->status);
+        break;
+    case API_cuLibraryGetKernel:
+        fprintf(out, "{\"kernel_handle\":\"0x%" PRIx64 "\",\"name\":", ev->args.module.func);
+        trace_write_string(out, string_table_get(strings, ev->args.module.name));
+        fprintf(out, ",\"status\":%d}", ev->status);
+        break;
+    case API_cuDeviceGet:
+        fprintf(out, "{\"device\":\"0x%" PRIx64 "\",\"ordinal\":%d,\"status\":%d}",
+                ev->args.device.device, ev->args.device.ordinal, ev->status);
+        break;
+    default:
+        fputc('{', out);
+        if (write_generic_args(out, ev, strings, 1)) {
+            fputc(',', out);
+        }
+        fprintf(out, "\"status\":%d}", ev->status);
+        break;
+    }
+}
+
+// Device-side timing of a launch: a single "C" (completion) line, so
+// visualize_pipeline.py does not pair it with the launch's op_id
+static void write_gpu_details(FILE* out, const struct hook_event* ev,
+                              const struct string_table* strings,
+                              const struct func_table* functions) {
+    const struct func_entry* fn = func_table_get(functions, ev->args.gpu.func);
+    const char* name = fn ? string_table_get(strings, fn->name) : NULL;
+
+    fprintf(out, "{\"function\":\"0x%" PRIx64 "\",", fn ? fn->handle : 0);
+    if (name) {
+        fputs("\"kernel\":", out);
+        trace_write_string(out, name);
+        fputc(',', out);
+    }
+    fprintf(out, "\"stream\":\"0x%" PRIx64 "\",\"device_us\":%.3f,\"queue_us\":%.3f}",
+            ev->args.gpu.stream, ev->args.gpu.device_ns / 1e3, ev->args.gpu.queue_ns / 1e3);
+}
+
+static void write_stack_details(FILE* out, const struct hook_event* ev) {
+    fprintf(out, "{\"stack\":%u,\"depth\":%u}", ev->args.stack.id, ev->args.stack.depth);
+}
+
+void trace_write_json(FILE* out, const struct hook_event* ev, const struct string_table* strings,
+                      const struct func_table* functions) {
+    if (ev->api == REC_GPU_KERNEL) {
+        write_prefix(out, ev, "C", ev->ts);
+        fputs(",\"details\":", out);
+        write_gpu_details(out, ev, strings, functions);
+        fputs("}\n", out);
+        return;
+    }
+    if (ev->api == REC_HOST_STACK) {
+        // Instant on the call's op_id; the frames are in the "stack" line
+        // with that id
+        write_prefix(out, ev, "I", ev->ts);
+        fputs(",\"details\":", out);
+        write_stack_details(out, ev);
+        fputs("}\n", out);
+        return;
+    }
+    if (ev->api >= API_COUNT) {
+        return;
+    }
+
+    write_prefix(out, ev, "B", ev->ts);
+    if (ev->api != API_cuCtxSynchronize) {
+        fputs(",\"details\":", out);
+        write_begin_details(out, ev, strings, functions);
+    }
+    fputs("}\n", out);
+
+    write_prefix(out, ev, "E", ev->end);
+    fputs(",\"details\":", out);
+    write_end_details(out, ev, strings, functions);
+    fputs("}\n", out);
+}
+
+// Chrome Trace Event Format: one complete ("X") event per call with the
+// exit details as args. The caller writes the surrounding traceEvents array.
+void trace_write_chrome(FILE* out, const struct hook_event* ev, const struct string_table* strings,
+                        const struct func_table* functions, uint32_t pid, int first) {
+    if (ev->api >= REC_COUNT) {
+        return;
+    }
+
+    fprintf(out,
+            "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+            "\"pid\":%u,\"tid\":%u,\"args\":",
+            first ? "" : ",\n", hook_api_names[ev->api], hook_api_categories[ev->api],
+            ev->ts / 1e3, (ev->end - ev->ts) / 1e3, pid, ev->tid);
+    if (ev->api == REC_GPU_KERNEL) {
+        write_gpu_details(out, ev, strings, functions);
+    } else if (ev->api == REC_HOST_STACK) {
+        write_stack_details(out, ev);
+    } else {
+        write_end_details(out, ev, strings, functions);
+    }
+    fputc('}', out);
+}
+
+// Copy volume by size class; bandwidth only where the call covers the copy
+static void write_summary_sizes(FILE* out, const struct trace_summary_api* a) {
+    int first = 1;
+    fputs(",\"sizes\":{", out);
+    for (unsigned c = 0; c < STATS_SIZE_CLASSES; c++) {
+        if (a->sizes[c].count == 0) {
+            continue;
+        }
+        fprintf(out, "%s\"%s\":{\"count\":%" PRIu64 ",\"bytes\":%" PRIu64 ",\"total_us\":%.3f",
+                first ? "" : ",", stats_size_class_names[c], a->sizes[c].count, a->sizes[c].bytes,
+                a->sizes[c].total_ns / 1e3);
+        if (!hook_api_is_async_copy(a->api)) {
+            fprintf(out, ",\"bandwidth_gbps\":%.2f",
+                    bandwidth_gbps(a->sizes[c].bytes, a->sizes[c].total_ns));
+        }
+        fputc('}', out);
+        first = 0;
+    }
+    fputc('}', out);
+}
+
+// One line per summary window; phase "S" keeps visualize_pipeline.py from
+// pairing it with call events
+void trace_write_summary_json(FILE* out, const struct trace_summary* summary,
+                              const struct trace_summary_api* apis) {
+    int64_t ts = summary->end_ns;
+    fprintf(out,
+            "{\"ts\":%" PRId64 ".%09" PRId64 ",\"phase\":\"S\",\"category\":\"summary\","
+            "\"name\":\"%s\",\"details\":{\"duration_ms\":%.3f,\"apis\":{",
+            ts / 1000000000, ts % 1000000000,
+            (summary->flags & TRACE_SUMMARY_TOTAL) ? "total" : "window",
+            (summary->end_ns - summary->start_ns) / 1e6);
+
+    for (uint32_t i = 0; i < summary->api_count; i++) {
+        const struct trace_summary_api* a = &apis[i];
+        if (a->api >= API_COUNT) {
+            continue;
+        }
+        fprintf(out,
+                "%s\"%s\":{\"count\":%" PRIu64 ",\"errors\":%" PRIu64 ",\"bytes\":%" PRIu64 ","
+                "\"total_us\":%.3f,\"p50_us\":%.3f,\"p99_us\":%.3f,\"p999_us\":%.3f,"
+                "\"max_us\":%.3f",
+                i ? "," : "", hook_api_names[a->api], a->count, a->errors, a->bytes,
+                a->total_ns / 1e3, a->p50_ns / 1e3, a->p99_ns / 1e3, a->p999_ns / 1e3,
+                a->max_ns / 1e3);
+        if (a->bytes) {
+            write_summary_sizes(out, a);
+        }
+        fputc('}', out);
+    }
+    fputs("}}}\n", out);
+}
+
+// Allocation report; phase "S" like the summaries
+void trace_write_allocs_json(FILE* out, const struct trace_alloc_report* report,
+                             const struct trace_alloc_context* contexts) {
+    int64_t ts = report->ts_ns;
+    fprintf(out,
+            "{\"ts\":%" PRId64 ".%09" PRId64 ",\"phase\":\"S\",\"category\":\"memory\","
+            "\"name\":\"allocations\",\"details\":{\"final\":%s,\"contexts\":{",
+            ts / 1000000000, ts % 1000000000,
+            (report->flags & TRACE_ALLOC_FINAL) ? "true" : "false");
+
+    for (uint32_t i = 0; i < report->context_count; i++) {
+        const struct trace_alloc_context* c = &contexts[i];
+        fprintf(out,
+                "%s\"0x%" PRIx64 "\":{\"live_count\":%" PRIu64 ",\"live_bytes\":%" PRIu64 ","
+                "\"peak_bytes\":%" PRIu64 ",\"allocs\":%" PRIu64 ",\"frees\":%" PRIu64 ","
+                "\"sizes\":{",
+                i ? "," : "", c->ctx, c->live_count, c->live_bytes, c->peak_bytes,
+                c->allocs, c->frees);
+        int first = 1;
+        for (unsigned k = 0; k < STATS_SIZE_CLASSES; k++) {
+            if (c->sizes[k].count == 0) {
+                continue;
+            }
+            fprintf(out, "%s\"%s\":{\"count\":%" PRIu64 ",\"bytes\":%" PRIu64 "}",
+                    first ? "" : ",", stats_size_class_names[k], c->sizes[k].count,
+                    c->sizes[k].bytes);
+            first = 0;
+        }
+        fputs("}}", out);
+    }
+    fputs("}}}\n", out);
+}
+
+// Stack table entry, written once before the records that use its id
+void trace_write_stack_json(FILE* out, const struct trace_stack* stack) {
+    fprintf(out, "{\"phase\":\"M\",\"category\":\"stack\",\"name\":\"stack\","
+            "\"details\":{\"id\":%u,\"frames\":[", stack->id);
+    for (unsigned i = 0; i < stack->depth; i++) {
+        fprintf(out, "%s\"0x%" PRIx64 "\"", i ? "," : "", stack->frames[i]);
+    }
+    fputs("]}}\n", out);
+}
+
+// Executable file mappings from a /proc/self/maps snapshot, enough to turn
+// stack frames into file offsets for addr2line and friends
+void trace_write_maps_json(FILE* out, const struct trace_maps* maps, const char* text,
+                           size_t len) {
+    int64_t ts = maps->ts_ns;
+    fprintf(out,
+            "{\"ts\":%" PRId64 ".%09" PRId64 ",\"phase\":\"M\",\"category\":\"process\","
+            "\"name\":\"maps\",\"details\":{\"final\":%s,\"mappings\":[",
+            ts / 1000000000, ts % 1000000000,
+            (maps->flags & TRACE_MAPS_FINAL) ? "true" : "false");
+
+    int first = 1;
+    const char* end = text + len;
+    for (const char* line = text; line < end;) {
+        const char* eol = memchr(line, '\n', end - line);
+        eol = eol ? eol : end;
+
+        char buf[4096];
+        size_t n = (size_t)(eol - line) < sizeof(buf) - 1 ? (size_t)(eol - line) : sizeof(buf) - 1;
+        memcpy(buf, line, n);
+        buf[n] = '\0';
+        line = eol + 1;
+
+        // start-end perms offset dev inode [path]
+        uint64_t start, stop, offset;
+        char perms[8];
+        int path_at = 0;
+        if (sscanf(buf, "%" SCNx64 "-%" SCNx64 " %7s %" SCNx64 " %*s %*s %n",
+                   &start, &stop, perms, &offset, &path_at) < 4 ||
+            strchr(perms, 'x') == NULL || path_at == 0 || buf[path_at] == '\0') {
+            continue;
+        }
+        fprintf(out, "%s{\"start\":\"0x%" PRIx64 "\",\"end\":\"0x%" PRIx64 "\","
+                "\"offset\":\"0x%" PRIx64 "\",\"path\":",
+                first ? "" : ",", start, stop, offset);
+        trace_write_string(out, buf + path_at);
+        fputc('}', out);
+        first = 0;
+    }
+    fputs("]}}\n", out);
+}
+
+static const char* mode_name(uint32_t mode) {
+    return mode < HOOK_MODE_COUNT ? hook_mode_names[mode] : "unknown";
+}
+
+// Runtime mode switch; calls between two of these were recorded as the
+// first one says, and not at all while "off"
+void trace_write_mode_json(FILE* out, const struct trace_mode_change* change) {
+    int64_t ts = change->ts_ns;
+    fprintf(out,
+            "{\"ts\":%" PRId64 ".%09" PRId64 ",\"phase\":\"M\",\"category\":\"process\","
+            "\"name\":\"mode\",\"details\":{\"mode\":\"%s\",\"previous\":\"%s\"",
+            ts / 1000000000, ts % 1000000000, mode_name(change->mode), mode_name(change->previous));
+    if (change->until_ns) {
+        fprintf(out, ",\"until\":%" PRId64 ".%09" PRId64,
+                change->until_ns / 1000000000, change->until_ns % 1000000000);
+    }
+    fputs("}}\n", out);
+}
+
+// API filter now in effect; calls it leaves out are missing from the trace
+void trace_write_filter_json(FILE* out, const struct trace_filter_change* change,
+                             const char* spec) {
+    int64_t ts = change->ts_ns;
+    fprintf(out,
+            "{\"ts\":%" PRId64 ".%09" PRId64 ",\"phase\":\"M\",\"category\":\"process\","
+            "\"name\":\"filter\",\"details\":{\"filter\":",
+            ts / 1000000000, ts % 1000000000);
+    trace_write_string(out, spec);
+    fputs("}}\n", out);
+}
+
+static const char* origin_name(uint32_t origin) {
+    static const char* const names[] = { "start", "fork", "exec" };
+    return origin < sizeof(names) / sizeof(names[0]) ? names[origin] : "unknown";
+}
+
+// Process that wrote this trace; a forked or exec'd child names its parent,
+// whose own trace sits next to this one
+void trace_write_process_json(FILE* out, const struct trace_process* process) {
+    int64_t ts = process->ts_ns;
+    fprintf(out,
+            "{\"ts\":%" PRId64 ".%09" PRId64 ",\"phase\":\"M\",\"category\":\"process\","
+            "\"name\":\"process\",\"details\":{\"pid\":%u,\"parent\":%u,\"origin\":\"%s\"}}\n",
+            ts / 1000000000, ts % 1000000000, process->pid, process->parent,
+            origin_name(process->origin));
+}
+
+//
+// Binary format writers
+//
+
+int trace_write_binary_header(FILE* out, uint32_t pid, uint32_t clock, int64_t start_ns) {
+    struct trace_file_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.version = TRACE_VERSION;
+    hdr.record_size = sizeof(struct hook_event);
+    hdr.api_count = REC_COUNT;
+    hdr.pid = pid;
+    hdr.clock = clock;
+    hdr.start_ns = start_ns;
+
+    hdr.header_size = sizeof(hdr);
+    for (uint16_t id = 0; id < REC_COUNT; id++) {
+        hdr.header_size += sizeof(uint16_t) + 2 + strlen(hook_api_names[id]) +
+                           strlen(hook_api_categories[id]);
+    }
+
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1) {
+        return -1;
+    }
+    for (uint16_t id = 0; id < REC_COUNT; id++) {
+        uint8_t name_len = (uint8_t)strlen(hook_api_names[id]);
+        uint8_t category_len = (uint8_t)strlen(hook_api_categories[id]);
+        fwrite(&id, sizeof(id), 1, out);
+        fwrite(&name_len, 1, 1, out);
+        fwrite(hook_api_names[id], 1, name_len, out);
+        fwrite(&category_len, 1, 1, out);
+        fwrite(hook_api_categories[id], 1, category_len, out);
+    }
+    return ferror(out) ? -1 : 0;
+}
+
+void trace_write_binary_strings(FILE* out, const struct string_table* strings,
+                                uint32_t first, uint32_t end) {
+    if (first >= end) {
+        return;
+    }
+
+    struct trace_block block = { TRACE_BLOCK_STRINGS, 0 };
+    for (uint32_t id = first; id < end; id++) {
+        block.size += 2 * sizeof(uint32_t) + strlen(string_table_get(strings, id));
+    }
+    fwrite(&block, sizeof(block), 1, out);
+
+    for (uint32_t id = first; id < end; id++) {
+        const char* s = string_table_get(strings, id);
+        uint32_t len = (uint32_t)strlen(s);
+        fwrite(&id, sizeof(id), 1, out);
+        fwrite(&len, sizeof(len), 1, out);
+        fwrite(s, 1, len, out);
+    }
+}
+
+void trace_write_binary_functions(FILE* out, const struct func_table* functions,
+                                  uint32_t first, uint32_t end) {
+    if (first >= end) {
+        return;
+    }
+
+    struct trace_block block = { TRACE_BLOCK_FUNCTIONS,
+                                 (end - first) * (uint32_t)sizeof(struct trace_function) };
+    fwrite(&block, sizeof(block), 1, out);
+    for (uint32_t id = first; id < end; id++) {
+        const struct func_entry* fn = func_table_get(functions, id);
+        struct trace_function rec = { id, fn->name, fn->handle };
+        fwrite(&rec, sizeof(rec), 1, out);
+    }
+}
+
+void trace_write_binary_clock(FILE* out, const struct trace_clock_point* pt) {
+    struct trace_block block = { TRACE_BLOCK_CLOCK, sizeof(*pt) };
+    fwrite(&block, sizeof(block), 1, out);
+    fwrite(pt, sizeof(*pt), 1, out);
+}
+
+void trace_write_binary_events(FILE* out, const struct hook_event* ev, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    struct trace_block block = { TRACE_BLOCK_EVENTS, (uint32_t)(count * sizeof(*ev)) };
+    fwrite(&block, sizeof(block), 1, out);
+    fwrite(ev, sizeof(*ev), count, out);
+}
+
+void trace_write_binary_summary(FILE* out, const struct trace_summary* summary,
+                                const struct trace_summary_api* apis) {
+    struct trace_block block = {
+        TRACE_BLOCK_SUMMARY,
+        (uint32_t)(sizeof(*summary) + summary->api_count * sizeof(*apis)),
+    };
+    fwrite(&block, sizeof(block), 1, out);
+    fwrite(summary, sizeof(*summary), 1, out);
+    fwrite(apis, sizeof(*apis), summary->api_count, out);
+}
+
+void trace_write_binary_allocs(FILE* out, const struct trace_alloc_report* report,
+                               const struct trace_alloc_context* contexts) {
+    struct trace_block block = {
+        TRACE_BLOCK_ALLOCS,
+        (uint32_t)(sizeof(*report) + report->context_count * sizeof(*contexts)),
+    };
+    fwrite(&block, sizeof(block), 1, out);
+    fwrite(report, sizeof(*report), 1, out);
+    fwrite(contexts, sizeof(*contexts), report->context_count, out);
+}
+
+void trace_write_binary_stacks(FILE* out, const struct trace_stack* stacks, uint32_t count) {
+    size_t head = offsetof(struct trace_stack, frames);
+    struct trace_block block = { TRACE_BLOCK_STACKS, 0 };
+    for (uint32_t i = 0; i < count; i++) {
+        block.size += head + stacks[i].depth * sizeof(uint64_t);
+    }
+    fwrite(&block, sizeof(block), 1, out);
+    for (uint32_t i = 0; i < count; i++) {
+        fwrite(&stacks[i], head + stacks[i].depth * sizeof(uint64_t), 1, out);
+    }
+}
+
+void trace_write_binary_maps(FILE* out, const struct trace_maps* maps, const char* text,
+                             size_t len) {
+    struct trace_block block = { TRACE_BLOCK_MAPS, (uint32_t)(sizeof(*maps) + len) };
+    fwrite(&block, sizeof(block), 1, out);
+    fwrite(maps, sizeof(*maps), 1, out);
+    fwrite(text, 1, len, out);
+}
+
+void trace_write_binary_mode(FILE* out, const struct trace_mode_change* change) {
+    struct trace_block block = { TRACE_BLOCK_MODE, sizeof(*change) };
+    fwrite(&block, sizeof(block), 1, out);
+    fwrite(change, sizeof(*change), 1, out);
+}
+
+void trace_write_binary_filter(FILE* out, const struct trace_filter_change* change,
+                               const char* spec) {
+    struct trace_block block = { TRACE_BLOCK_FILTER, (uint32_t)(sizeof(*change) + change->length) };
+    fwrite(&block, sizeof(block), 1, out);
+    fwrite(change, sizeof(*change), 1, out);
+    fwrite(spec, 1, change->length, out);
+}
+
+void trace_write_binary_process(FILE* out, const struct trace_process* process) {
+    struct trace_block block = { TRACE_BLOCK_PROCESS, sizeof(*process) };
+    fwrite(&block, sizeof(block), 1, out);
+    fwrite(process, sizeof(*process), 1, out);
+}
@@ -0,0 +1,228 @@
+/*
+ * trace_jsonl.h - Reading the hook's JSON Lines traces from C++
+ *
+ * Shared by the C++ analysis tools (trace_critpath.cpp, trace_diff.cpp),
+ * which read the JSON Lines the hook writes or cuda_trace_convert produces
+ * rather than linking the C trace reader.
+ */
+
+#ifndef TRACE_JSONL_H
+#define TRACE_JSONL_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+// Handle values as the hook prints them ("0x..."); 0 if absent
+inline uint64_t parse_handle(const std::string& s) {
+    return strtoull(s.c_str(), nullptr, 0);
+}
+
+// Timestamps are printed as seconds with nine decimals; keep them exact
+inline int64_t parse_ns(const std::string& s) {
+    const char* p = s.c_str();
+    char* dot;
+    int64_t ns = strtoll(p, &dot, 10) * 1000000000LL;
+    if (*dot == '.') {
+        int64_t scale = 100000000;
+        for (const char* d = dot + 1; *d >= '0' && *d <= '9' && scale > 0; d++, scale /= 10) {
+            ns += (*d - '0') * scale;
+        }
+    }
+    return ns;
+}
+
+// Why a file starting with `head` (the first `len` bytes read) is not JSON
+// Lines the tools can read, or nullptr. The binary magic is TRACE_MAGIC in
+// cuda_hook.h.
+inline const char* unreadable_input(const char* head, size_t len) {
+    if (len >= 8 && memcmp(head, "CUHKTRCE", 8) == 0) {
+        return "binary trace, run cuda_trace_convert first";
+    }
+    if (len >= 2 && (unsigned char)head[0] == 0x1f && (unsigned char)head[1] == 0x8b) {
+        return "compressed trace, decompress it first (cuda_trace_convert reads .bin.gz)";
+    }
+    return nullptr;
+}
+
+// Flattens one line: top-level scalars go to `fields`, the scalars of the
+// "details" object to `details`. Arrays and deeper objects are skipped.
+class LineParser {
+public:
+    std::unordered_map<std::string, std::string> fields;
+    std::unordered_map<std::string, std::string> details;
+
+    bool parse(const char* line) {
+        p_ = line;
+        fields.clear();
+        details.clear();
+        return object(&fields, true);
+    }
+
+private:
+    const char* p_ = nullptr;
+
+    void ws() {
+        while (*p_ == ' ' || *p_ == '\t' || *p_ == '\r' || *p_ == '\n') {
+            p_++;
+        }
+    }
+
+    bool string(std::string* out) {
+        if (*p_ != '"') {
+            return false;
+        }
+        p_++;
+        out->clear();
+        while (*p_ && *p_ != '"') {
+            if (*p_ == '\\' && p_[1]) {
+                p_++;
+                if (*p_ == 'u') {
+                    // Only control characters are escaped this way
+                    out->push_back((char)strtol(std::string(p_ + 1, 4).c_str(), nullptr, 16));
+                    p_ += 4;
+                } else {
+                    out->push_back(*p_ == 'n' ? '\n' : *p_ == 't' ? '\t' : *p_);
+                }
+            } else {
+                out->push_back(*p_);
+            }
+            p_++;
+        }
+        if (*p_ != '"') {
+            return false;
+        }
+        p_++;
+        return true;
+    }
+
+    // Any value; scalars are stored in *out when it is not null
+    bool value(std::string* out, bool top) {
+        ws();
+        if (*p_ == '"') {
+            std::string s;
+            if (!string(&s)) {
+                return false;
+            }
+            if (out) {
+                *out = s;
+            }
+            return true;
+        }
+        if (*p_ == '{') {
+            return object(top ? &details : nullptr, false);
+        }
+        if (*p_ == '[') {
+            p_++;
+            ws();
+            if (*p_ == ']') {
+                p_++;
+                return true;
+            }
+            for (;;) {
+                if (!value(nullptr, false)) {
+                    return false;
+                }
+                ws();
+                if (*p_ == ']') {
+                    p_++;
+                    return true;
+                }
+                if (*p_++ != ',') {
+                    return false;
+                }
+            }
+        }
+        const char* start = p_;
+        while (*p_ && *p_ != ',' && *p_ != '}' && *p_ != ']' && *p_ != ' ') {
+            p_++;
+        }
+        if (p_ == start) {
+            return false;
+        }
+        if (out) {
+            out->assign(start, p_);
+        }
+        return true;
+    }
+
+    // `top` is true for the line itself, whose "details" member is kept
+    bool object(std::unordered_map<std::string, std::string>* out, bool top) {
+        ws();
+        if (*p_ != '{') {
+            return false;
+        }
+        p_++;
+        ws();
+        if (*p_ == '}') {
+            p_++;
+            return true;
+        }
+        std::string key;
+        for (;;) {
+            ws();
+            if (!string(&key)) {
+                return false;
+            }
+            ws();
+            if (*p_++ != ':') {
+                return false;
+            }
+            std::string scalar;
+            bool nested = top && key == "details";
+            if (!value(out && !nested ? &scalar : nullptr, nested)) {
+                return false;
+            }
+            if (out && !nested) {
+                (*out)[key] = scalar;
+            }
+            ws();
+            if (*p_ == '}') {
+                p_++;
+                return true;
+            }
+            if (*p_++ != ',') {
+                return false;
+            }
+        }
+    }
+};
+
+inline const std::string* find(const std::unordered_map<std::string, std::string>& m,
+                               const char* key, const char* alt = nullptr) {
+    auto it = m.find(key);
+    if (it == m.end() && alt) {
+        it = m.find(alt);
+    }
+    return it == m.end() ? nullptr : &it->second;
+}
+
+// The process a line came from: cuda_trace_collectd puts a "pid" on every
+// line it copies into a node trace, a single process's trace has none (0).
+// Op ids, handles and thread ids are only unique within one process.
+inline uint32_t line_pid(const std::unordered_map<std::string, std::string>& fields) {
+    const std::string* pid = find(fields, "pid");
+    return pid ? (uint32_t)strtoul(pid->c_str(), nullptr, 10) : 0;
+}
+
+// A value that is only unique within one process, such as an op id or a
+// handle, qualified by that process
+struct ProcessKey {
+    uint32_t pid;
+    uint64_t value;
+
+    bool operator==(const ProcessKey& o) const {
+        return pid == o.pid && value == o.value;
+    }
+};
+
+struct ProcessKeyHash {
+    size_t operator()(const ProcessKey& k) const {
+        return std::hash<uint64_t>()(k.value ^ ((uint64_t)k.pid * 0x9e3779b97f4a7c15ULL));
+    }
+};
+
+#endif // TRACE_JSONL_H
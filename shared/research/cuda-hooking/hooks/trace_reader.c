@@ -0,0 +1,488 @@
+/*
+ * trace_reader.c - Decode binary hook traces block by block
+ *
+ * Shared by cuda_trace_convert, cuda_trace_collectd and cuda_trace_replay. The reader checks
+ * the header, maps the file's API ids onto this build's, replays the string
+ * and function tables and the TSC calibration points as they come, and
+ * hands every event (timestamps in CLOCK_MONOTONIC ns) and every other
+ * record to the caller's callbacks. It only ever reads forward, so the
+ * input may be a pipe, a gzip stream or a collector ring.
+ */
+
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "cuda_hook.h"
+
+#define READ_BATCH 4096
+
+static int read_exact(FILE* in, void* buf, size_t size) {
+    return fread(buf, 1, size, in) == size ? 0 : -1;
+}
+
+static int skip(FILE* in, size_t size) {
+    char buf[4096];
+    while (size > 0) {
+        size_t n = size < sizeof(buf) ? size : sizeof(buf);
+        if (read_exact(in, buf, n)) {
+            return -1;
+        }
+        size -= n;
+    }
+    return 0;
+}
+
+static ssize_t gz_read(void* cookie, char* buf, size_t size) {
+    int n = gzread((gzFile)cookie, buf, (unsigned)size);
+    return n < 0 ? -1 : n;
+}
+
+static int gz_seek(void* cookie, off64_t* offset, int whence) {
+    z_off_t pos = gzseek((gzFile)cookie, (z_off_t)*offset, whence);
+    if (pos < 0) {
+        return -1;
+    }
+    *offset = pos;
+    return 0;
+}
+
+static int gz_close(void* cookie) {
+    return gzclose((gzFile)cookie) == Z_OK ? 0 : -1;
+}
+
+// A gzipped trace is read through zlib behind a FILE, so everything below
+// reads either kind the same way
+FILE* trace_reader_fopen(const char* path) {
+    FILE* in = fopen(path, "rb");
+    unsigned char magic[2];
+    if (!in || fread(magic, 1, sizeof(magic), in) != sizeof(magic) ||
+        magic[0] != 0x1f || magic[1] != 0x8b) {
+        if (in) {
+            rewind(in);
+        }
+        return in;
+    }
+    fclose(in);
+
+    gzFile z = gzopen(path, "rb");
+    if (!z) {
+        return NULL;
+    }
+    gzbuffer(z, 1 << 20);
+    cookie_io_functions_t io = { gz_read, NULL, gz_seek, gz_close };
+    in = fopencookie(z, "rb", io);
+    if (!in) {
+        gzclose(z);
+    }
+    return in;
+}
+
+// Map the file's API ids onto this build's enum by name, so traces stay
+// readable when the API list grows. Returns the bytes read.
+static long read_api_table(FILE* in, const struct trace_file_header* hdr, uint16_t* api_map) {
+    long consumed = 0;
+    for (uint32_t i = 0; i < hdr->api_count; i++) {
+        uint16_t id;
+        uint8_t len;
+        char name[256];
+        char category[256];
+
+        if (read_exact(in, &id, sizeof(id)) || read_exact(in, &len, 1) ||
+            read_exact(in, name, len)) {
+            return -1;
+        }
+        name[len] = '\0';
+        consumed += sizeof(id) + 1 + len;
+        if (read_exact(in, &len, 1) || read_exact(in, category, len)) {
+            return -1;
+        }
+        consumed += 1 + len;
+
+        api_map[id] = REC_COUNT;
+        for (uint16_t local = 0; local < REC_COUNT; local++) {
+            if (strcmp(hook_api_names[local], name) == 0) {
+                api_map[id] = local;
+                break;
+            }
+        }
+        if (api_map[id] == REC_COUNT) {
+            fprintf(stderr, "Warning: unknown API '%s' in trace, its events are skipped\n", name);
+        }
+    }
+    return consumed;
+}
+
+int trace_reader_open(struct trace_reader* r, FILE* in, const char* name) {
+    memset(r, 0, sizeof(*r));
+    r->in = in;
+
+    struct trace_file_header* hdr = &r->hdr;
+    if (read_exact(in, hdr, sizeof(*hdr)) || memcmp(hdr->magic, TRACE_MAGIC, sizeof(hdr->magic))) {
+        fprintf(stderr, "Error: %s is not a binary CUDA hook trace\n", name);
+        return -1;
+    }
+    if (hdr->version < 1 || hdr->version > TRACE_VERSION ||
+        hdr->record_size != sizeof(struct hook_event)) {
+        fprintf(stderr, "Error: unsupported trace version %u (record size %u)\n",
+                hdr->version, hdr->record_size);
+        return -1;
+    }
+
+    r->api_map = malloc(65536 * sizeof(*r->api_map));
+    if (!r->api_map) {
+        return -1;
+    }
+    for (size_t i = 0; i < 65536; i++) {
+        r->api_map[i] = REC_COUNT;
+    }
+    long table = read_api_table(in, hdr, r->api_map);
+    if (table < 0 || hdr->header_size < sizeof(*hdr) + table ||
+        skip(in, hdr->header_size - sizeof(*hdr) - table) != 0) {
+        fprintf(stderr, "Error: truncated trace header\n");
+        free(r->api_map);
+        r->api_map = NULL;
+        return -1;
+    }
+
+    string_table_init(&r->strings);
+    func_table_init(&r->functions);
+
+    // Before version 3 a launch record held the raw CUfunction handle; such
+    // handles get nameless local entries.
+    r->launch_handles = hdr->version < 3;
+    // Before version 8 the event hooks were generated and cuStreamWaitEvent
+    // captured its stream ahead of the event.
+    r->wait_stream_first = hdr->version < 8;
+    r->summary_entry_size = hdr->version < 4 ? offsetof(struct trace_summary_api, sizes)
+                                             : sizeof(struct trace_summary_api);
+    // TSC traces carry calibration blocks; every point precedes the events
+    // drained after it, so the map is complete when an event needs it.
+    r->tsc = hdr->version >= 2 && hdr->clock == TRACE_CLOCK_TSC;
+    return 0;
+}
+
+void trace_reader_close(struct trace_reader* r) {
+    if (!r->api_map) {
+        return;
+    }
+    clock_map_free(&r->clock);
+    func_table_free(&r->functions);
+    string_table_free(&r->strings);
+    free(r->api_map);
+    r->api_map = NULL;
+}
+
+// Entries before version 4 stop short of the size classes, which then read
+// as empty
+static int read_summary(struct trace_reader* r, uint32_t size, const struct trace_reader_ops* ops,
+                        void* ctx) {
+    struct trace_summary summary;
+    if (size < sizeof(summary) || read_exact(r->in, &summary, sizeof(summary)) ||
+        size != sizeof(summary) + summary.api_count * r->summary_entry_size) {
+        return -1;
+    }
+
+    struct trace_summary_api* apis = calloc(summary.api_count + 1, sizeof(*apis));
+    if (!apis) {
+        return -1;
+    }
+
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < summary.api_count; i++) {
+        if (read_exact(r->in, &apis[n], r->summary_entry_size)) {
+            free(apis);
+            return -1;
+        }
+        uint16_t local = r->api_map[apis[n].api];
+        if (local < API_COUNT) {
+            apis[n++].api = local;
+        } else {
+            memset(&apis[n], 0, sizeof(apis[n]));
+        }
+    }
+    summary.api_count = n;
+
+    if (ops->summary && n > 0) {
+        ops->summary(ctx, &summary, apis);
+    }
+    free(apis);
+    r->summaries++;
+    return 0;
+}
+
+static int read_allocs(struct trace_reader* r, uint32_t size, const struct trace_reader_ops* ops,
+                       void* ctx) {
+    struct trace_alloc_report report;
+    if (size < sizeof(report) || read_exact(r->in, &report, sizeof(report)) ||
+        size != sizeof(report) + report.context_count * sizeof(struct trace_alloc_context)) {
+        return -1;
+    }
+
+    struct trace_alloc_context* contexts =
+        calloc(report.context_count + 1, sizeof(*contexts));
+    if (!contexts ||
+        read_exact(r->in, contexts, report.context_count * sizeof(*contexts))) {
+        free(contexts);
+        return -1;
+    }
+
+    if (ops->allocs) {
+        ops->allocs(ctx, &report, contexts);
+    }
+    free(contexts);
+    r->summaries++;
+    return 0;
+}
+
+static int read_stacks(struct trace_reader* r, uint32_t size, const struct trace_reader_ops* ops,
+                       void* ctx) {
+    const size_t head = offsetof(struct trace_stack, frames);
+    struct trace_stack stack;
+    while (size >= head) {
+        if (read_exact(r->in, &stack, head) || stack.depth > STACK_MAX_DEPTH ||
+            size - head < stack.depth * sizeof(uint64_t) ||
+            read_exact(r->in, stack.frames, stack.depth * sizeof(uint64_t))) {
+            return -1;
+        }
+        size -= head + stack.depth * sizeof(uint64_t);
+        if (ops->stack) {
+            ops->stack(ctx, &stack);
+        }
+    }
+    return size == 0 ? 0 : -1;
+}
+
+static int read_maps(struct trace_reader* r, uint32_t size, const struct trace_reader_ops* ops,
+                     void* ctx) {
+    struct trace_maps maps;
+    if (size < sizeof(maps) || read_exact(r->in, &maps, sizeof(maps))) {
+        return -1;
+    }
+    size_t len = size - sizeof(maps);
+    char* text = malloc(len + 1);
+    if (!text || read_exact(r->in, text, len)) {
+        free(text);
+        return -1;
+    }
+    if (ops->maps) {
+        ops->maps(ctx, &maps, text, len);
+    }
+    free(text);
+    return 0;
+}
+
+static int read_mode(struct trace_reader* r, uint32_t size, const struct trace_reader_ops* ops,
+                     void* ctx) {
+    struct trace_mode_change change;
+    if (size != sizeof(change) || read_exact(r->in, &change, sizeof(change))) {
+        return -1;
+    }
+    if (ops->mode) {
+        ops->mode(ctx, &change);
+    }
+    return 0;
+}
+
+static int read_filter(struct trace_reader* r, uint32_t size, const struct trace_reader_ops* ops,
+                       void* ctx) {
+    struct trace_filter_change change;
+    char spec[FILTER_SPEC_MAX];
+    if (size < sizeof(change) || read_exact(r->in, &change, sizeof(change)) ||
+        change.length != size - sizeof(change) || change.length >= sizeof(spec) ||
+        read_exact(r->in, spec, change.length)) {
+        return -1;
+    }
+    spec[change.length] = '\0';
+    if (ops->filter) {
+        ops->filter(ctx, &change, spec);
+    }
+    return 0;
+}
+
+static int read_process(struct trace_reader* r, uint32_t size, const struct trace_reader_ops* ops,
+                        void* ctx) {
+    struct trace_process process;
+    if (size != sizeof(process) || read_exact(r->in, &process, sizeof(process))) {
+        return -1;
+    }
+    if (ops->process) {
+        ops->process(ctx, &process);
+    }
+    return 0;
+}
+
+static int read_strings(struct trace_reader* r, uint32_t size) {
+    char* buf = malloc(size + 1);
+    if (!buf || read_exact(r->in, buf, size)) {
+        free(buf);
+        return -1;
+    }
+
+    uint32_t pos = 0;
+    while (pos + 2 * sizeof(uint32_t) <= size) {
+        uint32_t id, len;
+        memcpy(&id, buf + pos, sizeof(id));
+        memcpy(&len, buf + pos + sizeof(id), sizeof(len));
+        pos += 2 * sizeof(uint32_t);
+        if (len > size - pos) {
+            break;
+        }
+
+        // Ids are written in order, so interning reproduces them
+        char saved = buf[pos + len];
+        buf[pos + len] = '\0';
+        uint32_t local = string_table_intern(&r->strings, buf + pos);
+        buf[pos + len] = saved;
+        if (local != id) {
+            fprintf(stderr, "Error: string table out of order (id %u)\n", id);
+            free(buf);
+            return -1;
+        }
+        pos += len;
+    }
+
+    free(buf);
+    return 0;
+}
+
+static int read_functions(struct trace_reader* r, uint32_t size) {
+    struct trace_function rec;
+    for (uint32_t n = size / sizeof(rec); n > 0; n--) {
+        if (read_exact(r->in, &rec, sizeof(rec))) {
+            return -1;
+        }
+        // Same replay as for strings: registering in order reproduces the ids
+        uint32_t local = func_table_register(&r->functions, rec.handle, rec.name);
+        if (local != rec.id) {
+            fprintf(stderr, "Error: function table out of order (id %u)\n", rec.id);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void read_events(struct trace_reader* r, uint32_t size, const struct trace_reader_ops* ops,
+                        void* ctx) {
+    static __thread struct hook_event batch[READ_BATCH];
+    size_t remaining = size / sizeof(struct hook_event);
+    while (remaining > 0) {
+        size_t n = remaining < READ_BATCH ? remaining : READ_BATCH;
+        if (fread(batch, sizeof(struct hook_event), n, r->in) != n) {
+            fprintf(stderr, "Warning: trace truncated after %llu events\n",
+                    (unsigned long long)r->events);
+            r->truncated = 1;
+            return;
+        }
+        for (size_t i = 0; i < n; i++) {
+            struct hook_event* ev = &batch[i];
+            ev->api = r->api_map[ev->api];
+            if (ev->api >= REC_COUNT) {
+                continue;
+            }
+            if (r->launch_handles && ev->api == API_cuLaunchKernel) {
+                uint64_t handle;
+                memcpy(&handle, ev->args.raw, sizeof(handle));
+                ev->args.launch.func = func_table_lookup(&r->functions, handle);
+                if (!ev->args.launch.func) {
+                    ev->args.launch.func = func_table_register(&r->functions, handle, 0);
+                }
+            }
+            if (r->wait_stream_first && ev->api == API_cuStreamWaitEvent) {
+                uint64_t stream = ev->args.event.event;
+                ev->args.event.event = ev->args.event.stream;
+                ev->args.event.stream = stream;
+            }
+            if (r->tsc) {
+                ev->ts = clock_map_to_ns(&r->clock, ev->ts);
+                ev->end = clock_map_to_ns(&r->clock, ev->end);
+            }
+            if (ops->event) {
+                ops->event(ctx, ev);
+            }
+            r->events++;
+        }
+        remaining -= n;
+    }
+}
+
+// Returns 1 after a block, 0 at the end of the trace and -1, with a
+// message, on a malformed block
+int trace_reader_next(struct trace_reader* r, const struct trace_reader_ops* ops, void* ctx) {
+    struct trace_block block;
+    if (r->truncated || read_exact(r->in, &block, sizeof(block)) != 0) {
+        return 0;
+    }
+
+    const char* what = NULL;
+    switch (block.type) {
+    case TRACE_BLOCK_EVENTS:
+        read_events(r, block.size, ops, ctx);
+        return r->truncated ? 0 : 1;
+    case TRACE_BLOCK_STRINGS:
+        return read_strings(r, block.size) == 0 ? 1 : -1;
+    case TRACE_BLOCK_FUNCTIONS:
+        return read_functions(r, block.size) == 0 ? 1 : -1;
+    case TRACE_BLOCK_CLOCK:
+        if (block.size == sizeof(struct trace_clock_point)) {
+            struct trace_clock_point pt;
+            return read_exact(r->in, &pt, sizeof(pt)) == 0 &&
+                   clock_map_add(&r->clock, &pt) == 0 ? 1 : -1;
+        }
+        break;
+    case TRACE_BLOCK_SUMMARY:
+        if (read_summary(r, block.size, ops, ctx) == 0) {
+            return 1;
+        }
+        what = "summary";
+        break;
+    case TRACE_BLOCK_ALLOCS:
+        if (read_allocs(r, block.size, ops, ctx) == 0) {
+            return 1;
+        }
+        what = "allocation";
+        break;
+    case TRACE_BLOCK_STACKS:
+        if (read_stacks(r, block.size, ops, ctx) == 0) {
+            return 1;
+        }
+        what = "stack";
+        break;
+    case TRACE_BLOCK_MAPS:
+        if (read_maps(r, block.size, ops, ctx) == 0) {
+            return 1;
+        }
+        what = "maps";
+        break;
+    case TRACE_BLOCK_MODE:
+        if (read_mode(r, block.size, ops, ctx) == 0) {
+            return 1;
+        }
+        what = "mode";
+        break;
+    case TRACE_BLOCK_FILTER:
+        if (read_filter(r, block.size, ops, ctx) == 0) {
+            return 1;
+        }
+        what = "filter";
+        break;
+    case TRACE_BLOCK_PROCESS:
+        if (read_process(r, block.size, ops, ctx) == 0) {
+            return 1;
+        }
+        what = "process";
+        break;
+    default:
+        break;
+    }
+    if (what) {
+        fprintf(stderr, "Error: malformed %s block\n", what);
+        return -1;
+    }
+
+    // Unknown block types are skipped
+    return skip(r->in, block.size) == 0 ? 1 : 0;
+}
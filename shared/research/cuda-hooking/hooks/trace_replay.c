@@ -0,0 +1,1340 @@
+/*
+ * trace_replay.c - Re-issue the driver calls of a captured trace
+ *
+ * Reads a trace written with CUDA_HOOK_FORMAT=binary and makes its driver
+ * calls again, each on its own thread again (one replay thread per traced
+ * thread), against the real driver or a stand-in (libcuda_mock.so,
+ * libcuda_stub.so). Run under LD_PRELOAD=libcuda_hook.so, the hook sees the
+ * call pattern of the traced workload (transformer_inference.py, say)
+ * without the workload, which is how hook overhead and driver changes are
+ * measured off the cluster.
+ *
+ * Handles and pointers are remapped: every context, stream, event and
+ * allocation the trace creates is created again, and later calls get the
+ * new one, pointers keeping their offset into an allocation. Host buffers
+ * the trace never page-locked are a scratch buffer per thread. A call
+ * needing a handle the trace does not create (made before tracing
+ * started, or by a call that is not replayed) is skipped.
+ *
+ * Kernel code and arguments are not in a trace, so a launch runs a
+ * stand-in of the same name (when it is a valid PTX name) with the same
+ * grid, which spins for the device time CUDA_HOOK_GPU_TIMING measured for
+ * it: that launch's, the kernel's mean when the launch was not sampled, or
+ * --kernel-us. The stand-ins are JIT-compiled from PTX once per context,
+ * and module and library loads are not re-issued. Calls whose arguments
+ * the trace does not hold, such as graph launches and cuLaunchKernelEx,
+ * are not replayed.
+ *
+ * Calls on different threads keep the order that matters: a call waits
+ * for the one that created its handles, for work another thread queued
+ * before it on the same stream, and for the record of an event it waits
+ * on.
+ *
+ * --timing=original (default) issues every call at its offset from the
+ * start of the trace, or as soon as the calls it waits for allow;
+ * --timing=fast issues every call as soon as it can. Either way the
+ * report compares the host time of each API with the trace's.
+ *
+ * The whole trace is held in memory, a little over 100 bytes per call.
+ *
+ * Compile: make cuda_trace_replay
+ * Usage: cuda_trace_replay [--timing=original|fast] [--libcuda=PATH]
+ *                          [--kernel-us=N] trace.bin
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cuda_hook.h"
+
+#define REPLAY_OPERANDS     3
+#define REPLAY_MAX_CONTEXTS 16
+#define REPLAY_SPIN_NS      50000       // Shorter waits spin instead of sleeping
+#define REPLAY_LATE_NS      100000      // Calls further behind their time count as late
+#define REPLAY_START_NS     10000000    // Setup time between creating the threads and the first call
+#define REPLAY_GENERIC      "replay_kernel"
+
+enum operand_kind {
+    OPND_NONE = 0,
+    OPND_DEVICE,                // Device pointer, possibly into an allocation
+    OPND_PINNED,                // Start of page-locked host memory
+    OPND_HOST,                  // Host side of a copy; scratch unless page-locked
+    OPND_ANY,                   // Either side of cuMemcpy(Async)
+    OPND_STREAM,
+    OPND_EVENT,
+    OPND_CONTEXT,
+};
+
+struct operand {
+    uint8_t kind;               // enum operand_kind
+    uint64_t value;             // As traced
+};
+
+struct replay_op {
+    struct hook_event ev;
+    uint32_t thread;            // Index into threads
+    uint32_t kernel;            // Launches and function lookups: index into kernels
+    uint32_t ref[REPLAY_OPERANDS];  // Op that created each operand, 0 if none
+    uint32_t after[2];          // Ops on other threads to issue first, 0 if none
+    uint64_t kernel_ns;         // Launches: how long the stand-in spins
+    uint64_t value;             // What this op created, once issued; 0 if nothing
+    int done;                   // Issued (or skipped), published with release
+};
+
+struct replay_thread {
+    pthread_t thread;
+    uint32_t tid;               // As traced
+    uint32_t* ops;              // In issue order
+    size_t count, cap;
+    void* scratch;
+    size_t scratch_size;
+    uint64_t calls[API_COUNT];
+    int64_t call_ns[API_COUNT];
+    uint64_t unresolved;        // Skipped for a handle the trace does not create
+    uint64_t failed;            // Failed here, succeeded in the trace
+    uint64_t late;
+    int64_t late_max_ns;
+    int64_t end_ns;
+};
+
+struct replay_module {
+    CUcontext ctx;
+    CUmodule module;
+    int loaded;                 // The stand-ins loaded, even if as NULL (the stub)
+    CUfunction* functions;      // By kernel index, resolved on first use
+};
+
+// Open addressing, keys never 0 (callers offset them)
+struct u64_map {
+    uint64_t* keys;             // 0 = empty, UINT64_MAX = deleted
+    uint64_t* values;
+    size_t cap, filled;
+};
+
+// Live allocations, sorted by start
+struct range {
+    uint64_t start, end;
+    uint32_t op;
+};
+
+struct range_list {
+    struct range* ranges;
+    size_t count, cap;
+};
+
+// Loaded trace
+static struct replay_op* ops = NULL;      // ops[0] unused, so 0 means none
+static size_t op_count = 1, op_cap = 0;
+static struct replay_thread* threads = NULL;
+static uint32_t thread_count = 0;
+static const char** kernels = NULL;       // Kernel names, NULL if unknown
+static uint32_t kernel_count = 0;
+static int64_t first_ts = INT64_MAX, last_ts = 0;
+static uint64_t not_replayed[API_COUNT];
+static uint64_t traced_calls[API_COUNT];
+static int64_t traced_ns[API_COUNT];
+static struct u64_map gpu_ns;             // op_id + 1 -> measured device time
+
+// Replay
+static struct hook_dispatch drv;
+static int original_timing = 1;
+static int64_t start_ns = 0;
+static CUcontext default_ctx = NULL;
+static char* ptx = NULL;
+static pthread_mutex_t module_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct replay_module modules[REPLAY_MAX_CONTEXTS];
+static int module_count = 0;
+static __thread CUcontext tls_context = NULL;
+
+// What the replay re-issues; the rest is counted and dropped at load
+static const uint16_t replayed_apis[] = {
+    API_cuInit, API_cuDeviceGet,
+    API_cuCtxCreate, API_cuCtxDestroy, API_cuCtxSetCurrent, API_cuCtxSynchronize,
+    API_cuDevicePrimaryCtxRetain, API_cuDevicePrimaryCtxRelease,
+    API_cuStreamCreate, API_cuStreamCreateWithPriority, API_cuStreamDestroy,
+    API_cuStreamSynchronize, API_cuStreamQuery, API_cuStreamWaitEvent,
+    API_cuEventCreate, API_cuEventDestroy, API_cuEventRecord, API_cuEventRecordWithFlags,
+    API_cuEventSynchronize, API_cuEventQuery, API_cuEventElapsedTime,
+    API_cuMemAlloc, API_cuMemFree, API_cuMemAllocAsync, API_cuMemFreeAsync,
+    API_cuMemAllocManaged, API_cuMemAllocFromPoolAsync,
+    API_cuMemAllocHost, API_cuMemHostAlloc, API_cuMemFreeHost,
+    API_cuMemHostRegister, API_cuMemHostUnregister,
+    API_cuMemcpyHtoD, API_cuMemcpyDtoH, API_cuMemcpyDtoD, API_cuMemcpy,
+    API_cuMemcpyAsync, API_cuMemcpyHtoDAsync, API_cuMemcpyDtoHAsync, API_cuMemcpyDtoDAsync,
+    API_cuMemsetD8, API_cuMemsetD16, API_cuMemsetD32,
+    API_cuMemsetD8Async, API_cuMemsetD16Async, API_cuMemsetD32Async,
+    API_cuModuleGetFunction, API_cuLibraryGetKernel,
+    API_cuLaunchKernel, API_cuLaunchCooperativeKernel,
+};
+static uint8_t replayed[API_COUNT];
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [--timing=original|fast] [--libcuda=PATH] [--kernel-us=N] trace.bin\n",
+            prog);
+}
+
+static int64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void wait_until(int64_t deadline) {
+    if (deadline - now_ns() > REPLAY_SPIN_NS) {
+        int64_t wake = deadline - REPLAY_SPIN_NS / 2;
+        struct timespec ts = { wake / 1000000000, wake % 1000000000 };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+        }
+    }
+    while (now_ns() < deadline) {
+    }
+}
+
+//
+// Maps
+//
+
+static size_t map_slot(const struct u64_map* m, uint64_t key) {
+    return (size_t)((key * 0x9e3779b97f4a7c15ULL) >> 20) & (m->cap - 1);
+}
+
+static uint64_t* map_find(const struct u64_map* m, uint64_t key) {
+    if (!m->cap) {
+        return NULL;
+    }
+    for (size_t i = map_slot(m, key);; i = (i + 1) & (m->cap - 1)) {
+        if (m->keys[i] == key) {
+            return &m->values[i];
+        }
+        if (m->keys[i] == 0) {
+            return NULL;
+        }
+    }
+}
+
+static void map_put(struct u64_map* m, uint64_t key, uint64_t value) {
+    uint64_t* found = map_find(m, key);
+    if (found) {
+        *found = value;
+        return;
+    }
+    if ((m->filled + 1) * 2 > m->cap) {
+        struct u64_map grown = { 0 };
+        grown.cap = m->cap ? m->cap * 2 : 1024;
+        grown.keys = calloc(grown.cap, sizeof(uint64_t));
+        grown.values = malloc(grown.cap * sizeof(uint64_t));
+        if (!grown.keys || !grown.values) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        for (size_t i = 0; i < m->cap; i++) {
+            if (m->keys[i] && m->keys[i] != UINT64_MAX) {
+                map_put(&grown, m->keys[i], m->values[i]);
+            }
+        }
+        free(m->keys);
+        free(m->values);
+        *m = grown;
+    }
+    size_t i = map_slot(m, key);
+    while (m->keys[i] && m->keys[i] != UINT64_MAX) {
+        i = (i + 1) & (m->cap - 1);
+    }
+    if (m->keys[i] == 0) {
+        m->filled++;
+    }
+    m->keys[i] = key;
+    m->values[i] = value;
+}
+
+static void map_remove(struct u64_map* m, uint64_t key) {
+    uint64_t* found = map_find(m, key);
+    if (found) {
+        m->keys[found - m->values] = UINT64_MAX;
+    }
+}
+
+static void map_free(struct u64_map* m) {
+    free(m->keys);
+    free(m->values);
+    memset(m, 0, sizeof(*m));
+}
+
+// First range starting after ptr
+static size_t range_upper(const struct range_list* l, uint64_t ptr) {
+    size_t lo = 0, hi = l->count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (l->ranges[mid].start <= ptr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static const struct range* range_find(const struct range_list* l, uint64_t ptr) {
+    size_t i = range_upper(l, ptr);
+    if (i == 0) {
+        return NULL;
+    }
+    const struct range* r = &l->ranges[i - 1];
+    return ptr < r->end || ptr == r->start ? r : NULL;
+}
+
+static void range_insert(struct range_list* l, uint64_t start, uint64_t size, uint32_t op) {
+    size_t i = range_upper(l, start);
+    if (i > 0 && l->ranges[i - 1].start == start) {
+        // Never freed in the trace (dropped or sampled out), so reused
+        l->ranges[i - 1] = (struct range){ start, start + size, op };
+        return;
+    }
+    if (l->count == l->cap) {
+        l->cap = l->cap ? l->cap * 2 : 256;
+        l->ranges = realloc(l->ranges, l->cap * sizeof(*l->ranges));
+        if (!l->ranges) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+    memmove(&l->ranges[i + 1], &l->ranges[i], (l->count - i) * sizeof(*l->ranges));
+    l->ranges[i] = (struct range){ start, start + size, op };
+    l->count++;
+}
+
+static void range_remove(struct range_list* l, uint64_t start) {
+    size_t i = range_upper(l, start);
+    if (i > 0 && l->ranges[i - 1].start == start) {
+        memmove(&l->ranges[i - 1], &l->ranges[i], (l->count - i) * sizeof(*l->ranges));
+        l->count--;
+    }
+}
+
+//
+// What each replayed API uses and creates
+//
+
+static int operands(const struct hook_event* ev, struct operand* o) {
+    int n = 0;
+#define OPERAND(k, v) (o[n].kind = (k), o[n].value = (v), n++)
+    switch (ev->api) {
+    case API_cuMemFree:
+        OPERAND(OPND_DEVICE, ev->args.mem.ptr);
+        break;
+    case API_cuMemFreeAsync:
+        OPERAND(OPND_DEVICE, ev->args.mem.ptr);
+        OPERAND(OPND_STREAM, ev->args.mem.stream);
+        break;
+    case API_cuMemAllocAsync:
+        OPERAND(OPND_STREAM, ev->args.mem.stream);
+        break;
+    case API_cuMemAllocFromPoolAsync:
+        OPERAND(OPND_STREAM, ev->args.generic[2]);
+        break;
+    case API_cuMemFreeHost:
+    case API_cuMemHostUnregister:
+        OPERAND(OPND_PINNED, ev->args.mem.ptr);
+        break;
+    case API_cuMemcpyHtoD:
+    case API_cuMemcpyHtoDAsync:
+        OPERAND(OPND_DEVICE, ev->args.copy.dst);
+        OPERAND(OPND_HOST, ev->args.copy.src);
+        break;
+    case API_cuMemcpyDtoH:
+    case API_cuMemcpyDtoHAsync:
+        OPERAND(OPND_HOST, ev->args.copy.dst);
+        OPERAND(OPND_DEVICE, ev->args.copy.src);
+        break;
+    case API_cuMemcpyDtoD:
+    case API_cuMemcpyDtoDAsync:
+        OPERAND(OPND_DEVICE, ev->args.copy.dst);
+        OPERAND(OPND_DEVICE, ev->args.copy.src);
+        break;
+    case API_cuMemcpy:
+    case API_cuMemcpyAsync:
+        OPERAND(OPND_ANY, ev->args.copy.dst);
+        OPERAND(OPND_ANY, ev->args.copy.src);
+        break;
+    case API_cuMemsetD8:
+    case API_cuMemsetD16:
+    case API_cuMemsetD32:
+        OPERAND(OPND_DEVICE, ev->args.generic[0]);
+        break;
+    case API_cuMemsetD8Async:
+    case API_cuMemsetD16Async:
+    case API_cuMemsetD32Async:
+        OPERAND(OPND_DEVICE, ev->args.generic[0]);
+        OPERAND(OPND_STREAM, ev->args.generic[3]);
+        break;
+    case API_cuCtxDestroy:
+    case API_cuCtxSetCurrent:
+        OPERAND(OPND_CONTEXT, ev->args.ctx.ctx);
+        break;
+    case API_cuStreamDestroy:
+    case API_cuStreamSynchronize:
+        OPERAND(OPND_STREAM, ev->args.stream.stream);
+        break;
+    case API_cuStreamQuery:
+        OPERAND(OPND_STREAM, ev->args.generic[0]);
+        break;
+    case API_cuLaunchKernel:
+        OPERAND(OPND_STREAM, ev->args.launch.stream);
+        break;
+    case API_cuLaunchCooperativeKernel:
+        OPERAND(OPND_STREAM, ev->args.generic[1]);
+        break;
+    case API_cuEventRecord:
+    case API_cuEventRecordWithFlags:
+        OPERAND(OPND_EVENT, ev->args.event.event);
+        OPERAND(OPND_STREAM, ev->args.event.stream);
+        break;
+    case API_cuStreamWaitEvent:
+        OPERAND(OPND_STREAM, ev->args.event.stream);
+        OPERAND(OPND_EVENT, ev->args.event.event);
+        break;
+    case API_cuEventDestroy:
+    case API_cuEventSynchronize:
+    case API_cuEventQuery:
+        OPERAND(OPND_EVENT, ev->args.generic[0]);
+        break;
+    case API_cuEventElapsedTime:
+        OPERAND(OPND_EVENT, ev->args.generic[0]);
+        OPERAND(OPND_EVENT, ev->args.generic[1]);
+        break;
+    }
+#undef OPERAND
+    return n;
+}
+
+// The handle or memory a call returns, with its size for memory
+static int creates(const struct hook_event* ev, struct operand* o, uint64_t* size) {
+    *size = 0;
+    switch (ev->api) {
+    case API_cuMemAlloc:
+    case API_cuMemAllocAsync:
+        *o = (struct operand){ OPND_DEVICE, ev->args.mem.ptr };
+        *size = ev->args.mem.size;
+        break;
+    case API_cuMemAllocManaged:
+        *o = (struct operand){ OPND_DEVICE, ev->args.generic[2] };
+        *size = ev->args.generic[0];
+        break;
+    case API_cuMemAllocFromPoolAsync:
+        *o = (struct operand){ OPND_DEVICE, ev->args.generic[3] };
+        *size = ev->args.generic[0];
+        break;
+    case API_cuMemAllocHost:
+    case API_cuMemHostAlloc:
+    case API_cuMemHostRegister:
+        *o = (struct operand){ OPND_PINNED, ev->args.mem.ptr };
+        *size = ev->args.mem.size;
+        break;
+    case API_cuCtxCreate:
+        *o = (struct operand){ OPND_CONTEXT, ev->args.ctx.ctx };
+        break;
+    case API_cuDevicePrimaryCtxRetain:
+        *o = (struct operand){ OPND_CONTEXT, ev->args.generic[1] };
+        break;
+    case API_cuStreamCreate:
+        *o = (struct operand){ OPND_STREAM, ev->args.stream.stream };
+        break;
+    case API_cuStreamCreateWithPriority:
+        *o = (struct operand){ OPND_STREAM, ev->args.generic[2] };
+        break;
+    case API_cuEventCreate:
+        *o = (struct operand){ OPND_EVENT, ev->args.generic[1] };
+        break;
+    default:
+        return 0;
+    }
+    return o->value != 0;
+}
+
+// The first operand is gone after these
+static int destroys(uint16_t api) {
+    return api == API_cuMemFree || api == API_cuMemFreeAsync || api == API_cuMemFreeHost ||
+           api == API_cuMemHostUnregister || api == API_cuCtxDestroy ||
+           api == API_cuStreamDestroy || api == API_cuEventDestroy;
+}
+
+// The default streams and no context are the same in every process
+static int passes_through(const struct operand* o) {
+    return (o->kind == OPND_STREAM && o->value <= 2) || (o->kind == OPND_CONTEXT && o->value == 0);
+}
+
+static uint64_t handle_key(uint8_t kind, uint64_t value) {
+    return (value << 3) | kind;
+}
+
+//
+// Loading
+//
+
+static void on_event(void* ctx, const struct hook_event* ev) {
+    if (ev->api == REC_GPU_KERNEL) {
+        map_put(&gpu_ns, ev->op_id + 1, (uint64_t)ev->args.gpu.device_ns);
+        return;
+    }
+    if (ev->api >= API_COUNT) {
+        return;
+    }
+    if (ev->ts < first_ts) {
+        first_ts = ev->ts;
+    }
+    if (ev->end > last_ts) {
+        last_ts = ev->end;
+    }
+    if (!replayed[ev->api]) {
+        not_replayed[ev->api]++;
+        return;
+    }
+    if (op_count >= op_cap) {
+        op_cap = op_cap ? op_cap * 2 : 65536;
+        ops = realloc(ops, op_cap * sizeof(*ops));
+        if (!ops) {
+            fprintf(stderr, "Out of memory after %zu calls\n", op_count);
+            exit(1);
+        }
+    }
+    struct replay_op* op = &ops[op_count++];
+    memset(op, 0, sizeof(*op));
+    op->ev = *ev;
+    traced_calls[ev->api]++;
+    traced_ns[ev->api] += ev->end - ev->ts;
+}
+
+static int by_issue_order(const void* a, const void* b) {
+    const struct hook_event* x = &((const struct replay_op*)a)->ev;
+    const struct hook_event* y = &((const struct replay_op*)b)->ev;
+    if (x->ts != y->ts) {
+        return x->ts < y->ts ? -1 : 1;
+    }
+    return x->op_id < y->op_id ? -1 : x->op_id > y->op_id;
+}
+
+static void assign_threads(void) {
+    struct u64_map tids = { 0 };        // tid + 1 -> thread index
+    for (size_t i = 1; i < op_count; i++) {
+        uint64_t* index = map_find(&tids, (uint64_t)ops[i].ev.tid + 1);
+        if (!index) {
+            threads = realloc(threads, (thread_count + 1) * sizeof(*threads));
+            if (!threads) {
+                fprintf(stderr, "Out of memory\n");
+                exit(1);
+            }
+            memset(&threads[thread_count], 0, sizeof(*threads));
+            threads[thread_count].tid = ops[i].ev.tid;
+            map_put(&tids, (uint64_t)ops[i].ev.tid + 1, thread_count);
+            index = map_find(&tids, (uint64_t)ops[i].ev.tid + 1);
+            thread_count++;
+        }
+        struct replay_thread* t = &threads[*index];
+        if (t->count == t->cap) {
+            t->cap = t->cap ? t->cap * 2 : 1024;
+            t->ops = realloc(t->ops, t->cap * sizeof(uint32_t));
+            if (!t->ops) {
+                fprintf(stderr, "Out of memory\n");
+                exit(1);
+            }
+        }
+        t->ops[t->count++] = (uint32_t)i;
+        ops[i].thread = (uint32_t)*index;
+    }
+    map_free(&tids);
+}
+
+// Walk the calls in time order, pointing every operand at the call that
+// created it and every stream or event use at the last one before it
+static void link_ops(void) {
+    struct u64_map created = { 0 };     // handle_key -> op
+    struct u64_map last_use = { 0 };    // handle_key of a stream or event -> op
+    struct range_list device = { 0 }, pinned = { 0 };
+
+    for (uint32_t seq = 1; seq < op_count; seq++) {
+        struct replay_op* op = &ops[seq];
+        struct operand o[REPLAY_OPERANDS];
+        int n = operands(&op->ev, o);
+        int after = 0;
+
+        for (int i = 0; i < n; i++) {
+            const struct range* r = NULL;
+            uint64_t* found = NULL;
+            switch (o[i].kind) {
+            case OPND_DEVICE:
+                r = range_find(&device, o[i].value);
+                break;
+            case OPND_PINNED:
+            case OPND_HOST:
+                r = range_find(&pinned, o[i].value);
+                break;
+            case OPND_ANY:
+                r = range_find(&device, o[i].value);
+                if (!r) {
+                    r = range_find(&pinned, o[i].value);
+                }
+                break;
+            default:
+                if (!passes_through(&o[i])) {
+                    found = map_find(&created, handle_key(o[i].kind, o[i].value));
+                }
+                break;
+            }
+            op->ref[i] = r ? r->op : found ? (uint32_t)*found : 0;
+
+            // Recording an event orders later waits on it; everything else
+            // on a stream or event follows what came before it there
+            if (o[i].kind == OPND_STREAM || o[i].kind == OPND_EVENT) {
+                uint64_t key = handle_key(o[i].kind, o[i].value);
+                uint64_t* last = map_find(&last_use, key);
+                if (last && ops[*last].thread != op->thread && after < 2) {
+                    op->after[after++] = (uint32_t)*last;
+                }
+                int records = o[i].kind == OPND_EVENT && (op->ev.api == API_cuEventRecord ||
+                                                          op->ev.api == API_cuEventRecordWithFlags);
+                if (o[i].kind == OPND_STREAM || records) {
+                    map_put(&last_use, key, seq);
+                }
+            }
+        }
+
+        if (n > 0 && destroys(op->ev.api) && op->ref[0]) {
+            if (o[0].kind == OPND_DEVICE) {
+                range_remove(&device, o[0].value);
+            } else if (o[0].kind == OPND_PINNED) {
+                range_remove(&pinned, o[0].value);
+            } else {
+                map_remove(&created, handle_key(o[0].kind, o[0].value));
+                map_remove(&last_use, handle_key(o[0].kind, o[0].value));
+            }
+        }
+
+        struct operand made;
+        uint64_t size;
+        if (op->ev.status == CUDA_SUCCESS && creates(&op->ev, &made, &size)) {
+            if (made.kind == OPND_DEVICE) {
+                range_insert(&device, made.value, size, seq);
+            } else if (made.kind == OPND_PINNED) {
+                range_insert(&pinned, made.value, size, seq);
+            } else {
+                map_put(&created, handle_key(made.kind, made.value), seq);
+                map_remove(&last_use, handle_key(made.kind, made.value));
+            }
+        }
+    }
+
+    map_free(&created);
+    map_free(&last_use);
+    free(device.ranges);
+    free(pinned.ranges);
+}
+
+// Give every launch and function lookup its kernel, and every launch the
+// device time to spin for
+static void assign_kernels(struct trace_reader* reader, uint64_t default_ns) {
+    struct u64_map by_name = { 0 };     // String id + 1 -> kernel index
+    struct u64_map by_handle = { 0 };   // Function handle -> string id + 1
+    for (uint32_t id = 1; id <= func_table_count(&reader->functions); id++) {
+        const struct func_entry* f = func_table_get(&reader->functions, id);
+        if (f && f->handle) {
+            map_put(&by_handle, f->handle, (uint64_t)f->name + 1);
+        }
+    }
+
+    for (uint32_t seq = 1; seq < op_count; seq++) {
+        const struct hook_event* ev = &ops[seq].ev;
+        uint32_t name = 0;
+        if (ev->api == API_cuLaunchKernel) {
+            const struct func_entry* f = func_table_get(&reader->functions, ev->args.launch.func);
+            name = f ? f->name : 0;
+        } else if (ev->api == API_cuLaunchCooperativeKernel) {
+            uint64_t* found = map_find(&by_handle, ev->args.generic[0]);
+            name = found ? (uint32_t)(*found - 1) : 0;
+        } else if (ev->api == API_cuModuleGetFunction || ev->api == API_cuLibraryGetKernel) {
+            name = ev->args.module.name;
+        } else {
+            continue;
+        }
+        uint64_t* index = map_find(&by_name, (uint64_t)name + 1);
+        if (!index) {
+            kernels = realloc(kernels, (kernel_count + 1) * sizeof(*kernels));
+            if (!kernels) {
+                fprintf(stderr, "Out of memory\n");
+                exit(1);
+            }
+            kernels[kernel_count] = name ? string_table_get(&reader->strings, name) : NULL;
+            map_put(&by_name, (uint64_t)name + 1, kernel_count);
+            index = map_find(&by_name, (uint64_t)name + 1);
+            kernel_count++;
+        }
+        ops[seq].kernel = (uint32_t)*index;
+    }
+
+    // Unsampled launches take their kernel's mean
+    uint64_t* sum = calloc(kernel_count + 1, sizeof(uint64_t));
+    uint64_t* timed = calloc(kernel_count + 1, sizeof(uint64_t));
+    if (!sum || !timed) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    for (uint32_t seq = 1; seq < op_count; seq++) {
+        struct replay_op* op = &ops[seq];
+        uint64_t* ns = map_find(&gpu_ns, op->ev.op_id + 1);
+        if (ns && (op->ev.api == API_cuLaunchKernel || op->ev.api == API_cuLaunchCooperativeKernel)) {
+            op->kernel_ns = *ns;
+            sum[op->kernel] += *ns;
+            timed[op->kernel]++;
+        }
+    }
+    for (uint32_t seq = 1; seq < op_count; seq++) {
+        struct replay_op* op = &ops[seq];
+        uint64_t* ns = map_find(&gpu_ns, op->ev.op_id + 1);
+        if (!ns && (op->ev.api == API_cuLaunchKernel || op->ev.api == API_cuLaunchCooperativeKernel)) {
+            op->kernel_ns = timed[op->kernel] ? sum[op->kernel] / timed[op->kernel] : default_ns;
+        }
+    }
+    free(sum);
+    free(timed);
+    map_free(&by_name);
+    map_free(&by_handle);
+}
+
+//
+// Stand-in kernels
+//
+
+static int ptx_name_ok(const char* s) {
+    if (!s || !((*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z') || *s == '_' || *s == '$')) {
+        return 0;
+    }
+    for (; *s; s++) {
+        if (!((*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z') || (*s >= '0' && *s <= '9') ||
+              *s == '_' || *s == '$')) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static const char* entry_name(uint32_t kernel) {
+    return ptx_name_ok(kernels[kernel]) ? kernels[kernel] : REPLAY_GENERIC;
+}
+
+// One entry per kernel name, each spinning on the global timer for the
+// nanoseconds it is passed
+static char* build_ptx(void) {
+    static const char entry[] =
+        ".visible .entry %s(.param .u64 ns)\n"
+        "{\n"
+        "    .reg .pred %%p<2>;\n"
+        "    .reg .b64 %%rd<4>;\n"
+        "    ld.param.u64 %%rd1, [ns];\n"
+        "    mov.u64 %%rd2, %%globaltimer;\n"
+        "$L_spin%u:\n"
+        "    mov.u64 %%rd3, %%globaltimer;\n"
+        "    sub.u64 %%rd3, %%rd3, %%rd2;\n"
+        "    setp.lt.u64 %%p1, %%rd3, %%rd1;\n"
+        "    @%%p1 bra $L_spin%u;\n"
+        "    ret;\n"
+        "}\n";
+    char* text = NULL;
+    size_t len = 0;
+    FILE* out = open_memstream(&text, &len);
+    if (!out) {
+        return NULL;
+    }
+    fprintf(out, ".version 6.0\n.target sm_50\n.address_size 64\n\n");
+    fprintf(out, entry, REPLAY_GENERIC, kernel_count, kernel_count);
+    for (uint32_t k = 0; k < kernel_count; k++) {
+        if (ptx_name_ok(kernels[k]) && strcmp(kernels[k], REPLAY_GENERIC) != 0) {
+            fprintf(out, entry, kernels[k], k, k);
+        }
+    }
+    fclose(out);
+    return text;
+}
+
+// The stand-ins in the calling thread's context
+static struct replay_module* replay_module(void) {
+    CUcontext ctx = tls_context;
+    struct replay_module* m = NULL;
+    pthread_mutex_lock(&module_lock);
+    for (int i = 0; i < module_count && !m; i++) {
+        if (modules[i].ctx == ctx) {
+            m = &modules[i];
+        }
+    }
+    if (!m && module_count < REPLAY_MAX_CONTEXTS) {
+        m = &modules[module_count++];
+        m->ctx = ctx;
+        m->functions = calloc(kernel_count + 1, sizeof(CUfunction));
+        m->loaded = drv.cuModuleLoadData(&m->module, ptx) == CUDA_SUCCESS;
+        if (!m->loaded) {
+            fprintf(stderr, "Cannot load the stand-in kernels in context %p, "
+                    "its launches will fail\n", ctx);
+        }
+    }
+    pthread_mutex_unlock(&module_lock);
+    return m;
+}
+
+static CUfunction replay_function(struct replay_module* m, uint32_t kernel) {
+    if (!m || !m->loaded || !m->functions) {
+        return NULL;
+    }
+    CUfunction f = __atomic_load_n(&m->functions[kernel], __ATOMIC_ACQUIRE);
+    if (!f) {
+        pthread_mutex_lock(&module_lock);
+        if (!m->functions[kernel] &&
+            drv.cuModuleGetFunction(&f, m->module, entry_name(kernel)) == CUDA_SUCCESS) {
+            __atomic_store_n(&m->functions[kernel], f, __ATOMIC_RELEASE);
+        }
+        f = m->functions[kernel];
+        pthread_mutex_unlock(&module_lock);
+    }
+    return f;
+}
+
+//
+// Replay
+//
+
+static void* scratch(struct replay_thread* t, size_t size) {
+    if (size > t->scratch_size) {
+        void* grown = realloc(t->scratch, size);
+        if (!grown) {
+            return NULL;
+        }
+        t->scratch = grown;
+        t->scratch_size = size;
+    }
+    return t->scratch ? t->scratch : (t->scratch = malloc(1));
+}
+
+static void wait_issued(const struct replay_op* op) {
+    while (!__atomic_load_n(&op->done, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+}
+
+// This replay's value for an operand; -1 if it has none
+static int resolve(struct replay_thread* t, const struct replay_op* op, int i,
+                   const struct operand* o, uint64_t* out) {
+    if (op->ref[i]) {
+        const struct replay_op* src = &ops[op->ref[i]];
+        struct operand made;
+        uint64_t size;
+        wait_issued(src);
+        if (!src->value || !creates(&src->ev, &made, &size)) {
+            return -1;
+        }
+        *out = src->value + (o->value - made.value);
+        return 0;
+    }
+    if (passes_through(o)) {
+        *out = o->value;
+        return 0;
+    }
+    if (o->kind == OPND_HOST || o->kind == OPND_ANY) {
+        *out = (uintptr_t)scratch(t, op->ev.args.copy.size);
+        return *out ? 0 : -1;
+    }
+    return -1;
+}
+
+#define V_STREAM(i) ((CUstream)(uintptr_t)v[i])
+#define V_EVENT(i)  ((CUevent)(uintptr_t)v[i])
+#define V_PTR(i)    ((void*)(uintptr_t)v[i])
+
+// Make the call; what it creates goes to *out
+static CUresult issue(const struct replay_op* op, const uint64_t* v, struct replay_module* m,
+                      CUfunction f, uint64_t* out) {
+    const struct hook_event* ev = &op->ev;
+    const uint64_t* g = ev->args.generic;
+    void* params[] = { (void*)&op->kernel_ns };
+    CUresult result;
+
+    switch (ev->api) {
+    case API_cuInit:
+        return drv.cuInit(ev->args.device.flags);
+    case API_cuDeviceGet: {
+        CUdevice device;
+        return drv.cuDeviceGet(&device, ev->args.device.ordinal);
+    }
+    case API_cuCtxCreate: {
+        CUcontext ctx = NULL;
+        result = drv.cuCtxCreate(&ctx, ev->args.ctx.flags, (CUdevice)ev->args.ctx.device);
+        if (result == CUDA_SUCCESS) {
+            tls_context = ctx;
+        }
+        *out = (uintptr_t)ctx;
+        return result;
+    }
+    case API_cuCtxDestroy:
+        result = drv.cuCtxDestroy((CUcontext)V_PTR(0));
+        if (result == CUDA_SUCCESS && tls_context == V_PTR(0)) {
+            tls_context = NULL;
+        }
+        return result;
+    case API_cuCtxSetCurrent:
+        result = drv.cuCtxSetCurrent((CUcontext)V_PTR(0));
+        if (result == CUDA_SUCCESS) {
+            tls_context = V_PTR(0);
+        }
+        return result;
+    case API_cuCtxSynchronize:
+        return drv.cuCtxSynchronize();
+    case API_cuDevicePrimaryCtxRetain: {
+        CUcontext ctx = NULL;
+        result = drv.cuDevicePrimaryCtxRetain(&ctx, (CUdevice)g[0]);
+        *out = (uintptr_t)ctx;
+        return result;
+    }
+    case API_cuDevicePrimaryCtxRelease:
+        return drv.cuDevicePrimaryCtxRelease((CUdevice)g[0]);
+
+    case API_cuStreamCreate: {
+        CUstream stream = NULL;
+        result = drv.cuStreamCreate(&stream, ev->args.stream.flags);
+        *out = (uintptr_t)stream;
+        return result;
+    }
+    case API_cuStreamCreateWithPriority: {
+        CUstream stream = NULL;
+        result = drv.cuStreamCreateWithPriority(&stream, (unsigned int)g[0], (int)g[1]);
+        *out = (uintptr_t)stream;
+        return result;
+    }
+    case API_cuStreamDestroy:
+        return drv.cuStreamDestroy(V_STREAM(0));
+    case API_cuStreamSynchronize:
+        return drv.cuStreamSynchronize(V_STREAM(0));
+    case API_cuStreamQuery:
+        return drv.cuStreamQuery(V_STREAM(0));
+    case API_cuStreamWaitEvent:
+        return drv.cuStreamWaitEvent(V_STREAM(0), V_EVENT(1), ev->args.event.flags);
+
+    case API_cuEventCreate: {
+        CUevent event = NULL;
+        result = drv.cuEventCreate(&event, (unsigned int)g[0]);
+        *out = (uintptr_t)event;
+        return result;
+    }
+    case API_cuEventDestroy:
+        return drv.cuEventDestroy(V_EVENT(0));
+    case API_cuEventRecord:
+        return drv.cuEventRecord(V_EVENT(0), V_STREAM(1));
+    case API_cuEventRecordWithFlags:
+        return drv.cuEventRecordWithFlags(V_EVENT(0), V_STREAM(1), ev->args.event.flags);
+    case API_cuEventSynchronize:
+        return drv.cuEventSynchronize(V_EVENT(0));
+    case API_cuEventQuery:
+        return drv.cuEventQuery(V_EVENT(0));
+    case API_cuEventElapsedTime: {
+        float ms;
+        return drv.cuEventElapsedTime(&ms, V_EVENT(0), V_EVENT(1));
+    }
+
+    case API_cuMemAlloc: {
+        CUdeviceptr ptr = 0;
+        result = drv.cuMemAlloc(&ptr, ev->args.mem.size);
+        *out = ptr;
+        return result;
+    }
+    case API_cuMemFree:
+        return drv.cuMemFree(v[0]);
+    case API_cuMemAllocAsync: {
+        CUdeviceptr ptr = 0;
+        result = drv.cuMemAllocAsync(&ptr, ev->args.mem.size, V_STREAM(0));
+        *out = ptr;
+        return result;
+    }
+    case API_cuMemFreeAsync:
+        return drv.cuMemFreeAsync(v[0], V_STREAM(1));
+    case API_cuMemAllocManaged: {
+        CUdeviceptr ptr = 0;
+        result = drv.cuMemAllocManaged(&ptr, g[0], (unsigned int)g[1]);
+        *out = ptr;
+        return result;
+    }
+    case API_cuMemAllocFromPoolAsync: {
+        // The pool is not recorded; the device's default pool stands in
+        CUdeviceptr ptr = 0;
+        result = drv.cuMemAllocAsync(&ptr, g[0], V_STREAM(0));
+        *out = ptr;
+        return result;
+    }
+    case API_cuMemAllocHost: {
+        void* p = NULL;
+        result = drv.cuMemAllocHost(&p, ev->args.mem.size);
+        *out = (uintptr_t)p;
+        return result;
+    }
+    case API_cuMemHostAlloc: {
+        void* p = NULL;
+        result = drv.cuMemHostAlloc(&p, ev->args.mem.size, ev->args.mem.flags);
+        *out = (uintptr_t)p;
+        return result;
+    }
+    case API_cuMemFreeHost:
+        return drv.cuMemFreeHost(V_PTR(0));
+    case API_cuMemHostRegister: {
+        // The traced buffer is not ours to pin; a fresh one of the same size is
+        size_t size = (ev->args.mem.size + 4095) & ~(size_t)4095;
+        void* p = aligned_alloc(4096, size ? size : 4096);
+        if (!p) {
+            return CUDA_ERROR_NOT_FOUND;
+        }
+        result = drv.cuMemHostRegister(p, ev->args.mem.size, ev->args.mem.flags);
+        if (result != CUDA_SUCCESS) {
+            free(p);
+            p = NULL;
+        }
+        *out = (uintptr_t)p;
+        return result;
+    }
+    case API_cuMemHostUnregister:
+        result = drv.cuMemHostUnregister(V_PTR(0));
+        if (result == CUDA_SUCCESS) {
+            free(V_PTR(0));
+        }
+        return result;
+
+    case API_cuMemcpyHtoD:
+        return drv.cuMemcpyHtoD(v[0], V_PTR(1), ev->args.copy.size);
+    case API_cuMemcpyDtoH:
+        return drv.cuMemcpyDtoH(V_PTR(0), v[1], ev->args.copy.size);
+    case API_cuMemcpyDtoD:
+        return drv.cuMemcpyDtoD(v[0], v[1], ev->args.copy.size);
+    case API_cuMemcpy:
+        return drv.cuMemcpy(v[0], v[1], ev->args.copy.size);
+    case API_cuMemcpyAsync:
+        return drv.cuMemcpyAsync(v[0], v[1], ev->args.copy.size, V_STREAM(2));
+    case API_cuMemcpyHtoDAsync:
+        return drv.cuMemcpyHtoDAsync(v[0], V_PTR(1), ev->args.copy.size, V_STREAM(2));
+    case API_cuMemcpyDtoHAsync:
+        return drv.cuMemcpyDtoHAsync(V_PTR(0), v[1], ev->args.copy.size, V_STREAM(2));
+    case API_cuMemcpyDtoDAsync:
+        return drv.cuMemcpyDtoDAsync(v[0], v[1], ev->args.copy.size, V_STREAM(2));
+    case API_cuMemsetD8:
+        return drv.cuMemsetD8(v[0], (unsigned char)g[2], g[1]);
+    case API_cuMemsetD16:
+        return drv.cuMemsetD16(v[0], (unsigned short)g[2], g[1]);
+    case API_cuMemsetD32:
+        return drv.cuMemsetD32(v[0], (unsigned int)g[2], g[1]);
+    case API_cuMemsetD8Async:
+        return drv.cuMemsetD8Async(v[0], (unsigned char)g[2], g[1], V_STREAM(1));
+    case API_cuMemsetD16Async:
+        return drv.cuMemsetD16Async(v[0], (unsigned short)g[2], g[1], V_STREAM(1));
+    case API_cuMemsetD32Async:
+        return drv.cuMemsetD32Async(v[0], (unsigned int)g[2], g[1], V_STREAM(1));
+
+    case API_cuModuleGetFunction:
+    case API_cuLibraryGetKernel: {
+        // Looked up again among the stand-ins
+        CUfunction found = NULL;
+        return m && m->loaded ? drv.cuModuleGetFunction(&found, m->module, entry_name(op->kernel))
+                              : CUDA_ERROR_NOT_FOUND;
+    }
+    case API_cuLaunchKernel: {
+        // Dynamic shared memory is left out: the stand-in needs none, and
+        // sizes past the default limit need an attribute set first
+        uint32_t block = ev->args.launch.block;
+        return drv.cuLaunchKernel(f, ev->args.launch.grid_x, ev->args.launch.grid_y,
+                                  ev->args.launch.grid_z, HOOK_BLOCK_X(block),
+                                  HOOK_BLOCK_Y(block), HOOK_BLOCK_Z(block), 0, V_STREAM(0),
+                                  params, NULL);
+    }
+    case API_cuLaunchCooperativeKernel:
+        // Only the x dimensions are recorded
+        return drv.cuLaunchCooperativeKernel(f, (unsigned int)g[2], 1, 1, (unsigned int)g[3], 1, 1,
+                                             0, V_STREAM(0), params);
+    }
+    return CUDA_ERROR_NOT_FOUND;
+}
+
+static void publish(struct replay_op* op, uint64_t value) {
+    op->value = value;
+    __atomic_store_n(&op->done, 1, __ATOMIC_RELEASE);
+}
+
+static void replay_call(struct replay_thread* t, struct replay_op* op) {
+    const struct hook_event* ev = &op->ev;
+    if (original_timing) {
+        int64_t due = start_ns + (ev->ts - first_ts);
+        wait_until(due);
+        int64_t behind = now_ns() - due;
+        if (behind > REPLAY_LATE_NS) {
+            t->late++;
+        }
+        if (behind > t->late_max_ns) {
+            t->late_max_ns = behind;
+        }
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (op->after[i]) {
+            wait_issued(&ops[op->after[i]]);
+        }
+    }
+    struct operand o[REPLAY_OPERANDS];
+    uint64_t v[REPLAY_OPERANDS] = { 0 };
+    int n = operands(ev, o);
+    for (int i = 0; i < n; i++) {
+        if (resolve(t, op, i, &o[i], &v[i]) != 0) {
+            t->unresolved++;
+            publish(op, 0);
+            return;
+        }
+    }
+
+    struct replay_module* m = NULL;
+    CUfunction f = NULL;
+    if (ev->api == API_cuLaunchKernel || ev->api == API_cuLaunchCooperativeKernel ||
+        ev->api == API_cuModuleGetFunction || ev->api == API_cuLibraryGetKernel) {
+        m = replay_module();
+        f = replay_function(m, op->kernel);
+    }
+
+    uint64_t out = 0;
+    int64_t start = now_ns();
+    CUresult result = issue(op, v, m, f, &out);
+    t->call_ns[ev->api] += now_ns() - start;
+    t->calls[ev->api]++;
+    if (result != CUDA_SUCCESS && ev->status == CUDA_SUCCESS) {
+        t->failed++;
+    }
+    // A driver that succeeds without returning anything (the stub) keeps
+    // the traced value, so the calls using it still go out
+    struct operand made;
+    uint64_t size;
+    if (result == CUDA_SUCCESS && !out && creates(ev, &made, &size)) {
+        out = made.value;
+    }
+    publish(op, result == CUDA_SUCCESS ? out : 0);
+}
+
+static void* replay_main(void* arg) {
+    struct replay_thread* t = arg;
+    if (default_ctx) {
+        drv.cuCtxSetCurrent(default_ctx);
+        tls_context = default_ctx;
+    }
+    for (size_t i = 0; i < t->count; i++) {
+        replay_call(t, &ops[t->ops[i]]);
+    }
+    t->end_ns = now_ns();
+    return NULL;
+}
+
+//
+// Driver
+//
+
+#define HOOK_API(name, category, versioned, ret, params, args) \
+    static ret missing_##name params { return (ret)CUDA_ERROR_NOT_FOUND; }
+#include "hook_apis.h"
+#undef HOOK_API
+
+static int open_driver(const char* path) {
+    if (!dlopen(path, RTLD_NOW | RTLD_GLOBAL)) {
+        fprintf(stderr, "Cannot load %s: %s\n", path, dlerror());
+        return -1;
+    }
+// Through the global scope, so a preloaded hook sees the calls, and by
+// the symbol an application built against cuda.h calls
+#define HOOK_API(name, category, versioned, ret, params, args) \
+    drv.name = (__typeof__(drv.name))dlsym(RTLD_DEFAULT, HOOK_SYMBOL_##versioned(name)); \
+    if (!drv.name) { \
+        drv.name = missing_##name; \
+    }
+#include "hook_apis.h"
+#undef HOOK_API
+
+    CUdevice device = 0;
+    CUresult result = drv.cuInit(0);
+    if (result != CUDA_SUCCESS) {
+        fprintf(stderr, "cuInit failed (%d)\n", result);
+        return -1;
+    }
+    if (drv.cuDeviceGet(&device, 0) != CUDA_SUCCESS ||
+        drv.cuDevicePrimaryCtxRetain(&default_ctx, device) != CUDA_SUCCESS) {
+        fprintf(stderr, "No device 0, threads start without a context\n");
+        default_ctx = NULL;
+    }
+    return 0;
+}
+
+//
+// Report
+//
+
+static int by_calls(const void* a, const void* b) {
+    uint16_t x = *(const uint16_t*)a, y = *(const uint16_t*)b;
+    return traced_calls[x] < traced_calls[y] ? 1 : traced_calls[x] > traced_calls[y] ? -1 : 0;
+}
+
+static void report(int64_t wall_ns) {
+    uint64_t calls[API_COUNT] = { 0 };
+    int64_t call_ns[API_COUNT] = { 0 };
+    uint64_t total = 0, unresolved = 0, failed = 0, late = 0, skipped = 0;
+    int64_t late_max = 0;
+    for (uint32_t i = 0; i < thread_count; i++) {
+        const struct replay_thread* t = &threads[i];
+        for (int api = 0; api < API_COUNT; api++) {
+            calls[api] += t->calls[api];
+            call_ns[api] += t->call_ns[api];
+            total += t->calls[api];
+        }
+        unresolved += t->unresolved;
+        failed += t->failed;
+        late += t->late;
+        if (t->late_max_ns > late_max) {
+            late_max = t->late_max_ns;
+        }
+    }
+    for (int api = 0; api < API_COUNT; api++) {
+        skipped += not_replayed[api];
+    }
+
+    printf("Replayed %llu of %llu calls on %u threads in %.3f ms (traced: %.3f ms), "
+           "timing=%s\n",
+           (unsigned long long)total, (unsigned long long)(op_count - 1 + skipped), thread_count,
+           wall_ns / 1e6, (last_ts - first_ts) / 1e6, original_timing ? "original" : "fast");
+    if (skipped) {
+        printf("  not replayable:");
+        const char* sep = " ";
+        for (int api = 0; api < API_COUNT; api++) {
+            if (not_replayed[api]) {
+                printf("%s%s %llu", sep, hook_api_names[api], (unsigned long long)not_replayed[api]);
+                sep = ", ";
+            }
+        }
+        printf("\n");
+    }
+    if (unresolved || failed) {
+        printf("  skipped for a handle the trace does not create: %llu; "
+               "failed where the trace succeeded: %llu\n",
+               (unsigned long long)unresolved, (unsigned long long)failed);
+    }
+    if (original_timing) {
+        printf("  %llu calls more than %d us behind their time, at worst %.3f ms\n",
+               (unsigned long long)late, REPLAY_LATE_NS / 1000, late_max / 1e6);
+    }
+
+    uint16_t order[API_COUNT];
+    int n = 0;
+    for (int api = 0; api < API_COUNT; api++) {
+        if (traced_calls[api]) {
+            order[n++] = (uint16_t)api;
+        }
+    }
+    qsort(order, (size_t)n, sizeof(order[0]), by_calls);
+    printf("%-32s %10s %12s %12s\n", "api", "calls", "traced_us", "replay_us");
+    for (int i = 0; i < n; i++) {
+        int api = order[i];
+        printf("%-32s %10llu %12.3f %12.3f\n", hook_api_names[api],
+               (unsigned long long)calls[api], traced_ns[api] / 1e3 / traced_calls[api],
+               calls[api] ? call_ns[api] / 1e3 / calls[api] : 0.0);
+    }
+}
+
+int main(int argc, char** argv) {
+    const char* libcuda = getenv("CUDA_HOOK_LIBCUDA");
+    double kernel_us = 0;
+    int argi = 1;
+
+    for (; argi < argc && strncmp(argv[argi], "--", 2) == 0; argi++) {
+        if (strcmp(argv[argi], "--timing=original") == 0) {
+            original_timing = 1;
+        } else if (strcmp(argv[argi], "--timing=fast") == 0) {
+            original_timing = 0;
+        } else if (strncmp(argv[argi], "--libcuda=", 10) == 0) {
+            libcuda = argv[argi] + 10;
+        } else if (strncmp(argv[argi], "--kernel-us=", 12) == 0) {
+            kernel_us = strtod(argv[argi] + 12, NULL);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argi + 1 != argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    for (size_t i = 0; i < sizeof(replayed_apis) / sizeof(replayed_apis[0]); i++) {
+        replayed[replayed_apis[i]] = 1;
+    }
+
+    FILE* in = trace_reader_fopen(argv[argi]);
+    if (!in) {
+        perror(argv[argi]);
+        return 1;
+    }
+    struct trace_reader reader;
+    if (trace_reader_open(&reader, in, argv[argi]) != 0) {
+        return 1;
+    }
+    static const struct trace_reader_ops load_ops = { .event = on_event };
+    int rc;
+    while ((rc = trace_reader_next(&reader, &load_ops, NULL)) > 0) {
+    }
+    if (rc < 0) {
+        return 1;
+    }
+    if (op_count == 1) {
+        fprintf(stderr, "%s: no calls to replay\n", argv[argi]);
+        return 1;
+    }
+
+    qsort(&ops[1], op_count - 1, sizeof(*ops), by_issue_order);
+    assign_threads();
+    link_ops();
+    assign_kernels(&reader, (uint64_t)(kernel_us * 1000));
+    map_free(&gpu_ns);
+
+    if (open_driver(libcuda ? libcuda : "libcuda.so.1") != 0) {
+        return 1;
+    }
+    ptx = build_ptx();
+    if (!ptx) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    tls_context = default_ctx;
+    replay_module();
+
+    // Threads wait for start_ns to issue their first call at its time, or
+    // go at once in fast mode
+    int64_t created = now_ns();
+    start_ns = created + REPLAY_START_NS;
+    for (uint32_t i = 0; i < thread_count; i++) {
+        if (pthread_create(&threads[i].thread, NULL, replay_main, &threads[i]) != 0) {
+            fprintf(stderr, "Cannot create replay thread %u\n", i);
+            return 1;
+        }
+    }
+    int64_t end = 0;
+    for (uint32_t i = 0; i < thread_count; i++) {
+        pthread_join(threads[i].thread, NULL);
+        if (threads[i].end_ns > end) {
+            end = threads[i].end_ns;
+        }
+    }
+    // Work still queued finishes before the driver goes away
+    drv.cuCtxSynchronize();
+
+    report(end - (original_timing ? start_ns : created));
+
+    trace_reader_close(&reader);
+    fclose(in);
+    return 0;
+}
@@ -0,0 +1,423 @@
+/*
+ * trace_ring.c - Per-thread event rings and the background drainer
+ *
+ * Hooked calls append fixed-size records to a ring owned by the calling
+ * thread (see trace_reserve() in cuda_hook.h). A single drainer thread polls
+ * every registered ring and is the only code that touches the trace file,
+ * either formatting records as JSON or copying them out verbatim in the
+ * binary format, or as a Chrome trace (trace_chrome.c). In aggregate mode
+ * it also closes the summary windows
+ * (hook_aggregate.c), and with rotation on it starts each new trace
+ * segment (trace_segment.c).
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "cuda_hook.h"
+
+// Publish the consumer index at least this often so producers see free space
+// while a large backlog is being written.
+#define DRAIN_BATCH 256
+
+__thread struct trace_ring* tls_ring __attribute__((tls_model("initial-exec"))) = NULL;
+int tracing_active = 0;
+
+// Registry of all rings. Only attach (insert at head) and the drainer
+// (unlink) modify it, both under registry_lock; the drainer walks it without
+// the lock since inserts publish a fully built node.
+static struct trace_ring* rings = NULL;
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;
+
+static FILE* drain_out = NULL;
+static enum trace_format drain_format = TRACE_FORMAT_JSON;
+static uint32_t strings_written = 1;  // Binary format: ids below this are in the file
+static uint32_t functions_written = 1;
+static size_t ring_capacity = 0;
+static long drain_interval_us = 0;
+static int64_t calibrate_interval_ns = 0;
+static int64_t last_calibration_ns = 0;
+static pthread_t drainer_thread;
+static int drainer_stop = 0;
+static int drainer_running = 0;
+static int ring_key_ready = 0;
+static uint64_t reaped_dropped = 0;  // Drops from rings already freed
+
+// Calls written to the current segment span [segment_first, segment_last],
+// in clock units; segment_first is 0 until the first one
+static int64_t segment_first = 0;
+static int64_t segment_last = 0;
+
+static void ring_thread_exit(void* arg) {
+    struct trace_ring* ring = arg;
+    tls_ring = NULL;
+    __atomic_store_n(&ring->dead, 1, __ATOMIC_RELEASE);
+}
+
+struct trace_ring* trace_ring_attach(void) {
+    if (__builtin_expect(fork_restart_pending, 0)) {
+        fork_restart();
+    }
+
+    struct trace_ring* ring = aligned_alloc(64, sizeof(*ring));
+    if (!ring) {
+        return NULL;
+    }
+    memset(ring, 0, sizeof(*ring));
+
+    ring->events = aligned_alloc(64, ring_capacity * sizeof(struct hook_event));
+    if (!ring->events) {
+        free(ring);
+        return NULL;
+    }
+    ring->mask = ring_capacity - 1;
+    ring->tid = (uint32_t)syscall(SYS_gettid);
+
+    pthread_mutex_lock(&registry_lock);
+    ring->next = rings;
+    __atomic_store_n(&rings, ring, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&registry_lock);
+
+    pthread_setspecific(ring_key, ring);
+    tls_ring = ring;
+    return ring;
+}
+
+static int64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// Binary format: emit strings and functions registered since the last pass.
+// Called after a ring's head has been read, so every id its events refer to
+// is covered. Functions are counted first: their names were interned before
+// they were registered.
+static void drain_strings(void) {
+    uint32_t functions = func_table_count(&hook_functions);
+    uint32_t count = string_table_count(&hook_strings);
+    trace_write_binary_strings(drain_out, &hook_strings, strings_written, count);
+    strings_written = count;
+    trace_write_binary_functions(drain_out, &hook_functions, functions_written, functions);
+    functions_written = functions;
+}
+
+static void note_segment_range(const struct hook_event* ev, uint64_t count) {
+    for (uint64_t i = 0; i < count; i++) {
+        if (!segment_first || ev[i].ts < segment_first) {
+            segment_first = ev[i].ts;
+        }
+        if (ev[i].end > segment_last) {
+            segment_last = ev[i].end;
+        }
+    }
+}
+
+static int64_t segment_ns(int64_t units) {
+    return hook_clock_tsc && units ? clock_map_to_ns(&hook_clock_map, units) : units;
+}
+
+// Between two batches, so the segment ends on a whole record. A binary
+// segment starts with its own header and the string, function and stack
+// tables again, so it converts without the ones before it.
+static void rotate_segment(int64_t now_ns) {
+    if (drain_format == TRACE_FORMAT_CHROME) {
+        chrome_end(&hook_chrome);
+    }
+    fflush(drain_out);
+    if (segment_rotate(drain_out, segment_ns(segment_first), segment_ns(segment_last),
+                       now_ns) != 0) {
+        if (drain_format == TRACE_FORMAT_CHROME) {
+            chrome_resume(&hook_chrome);
+        }
+        return;
+    }
+    segment_first = 0;
+    segment_last = 0;
+
+    if (drain_format == TRACE_FORMAT_BINARY) {
+        uint32_t clock = hook_clock_tsc ? TRACE_CLOCK_TSC : TRACE_CLOCK_MONOTONIC;
+        trace_write_binary_header(drain_out, (uint32_t)getpid(), clock, now_ns);
+        if (hook_clock_tsc) {
+            trace_write_binary_clock(drain_out, &hook_clock_map.points[hook_clock_map.count - 1]);
+        }
+        strings_written = 1;
+        functions_written = 1;
+        drain_strings();
+    } else if (drain_format == TRACE_FORMAT_CHROME) {
+        chrome_begin(&hook_chrome, program_invocation_short_name);
+    }
+    process_segment_start(now_ns);
+    stack_segment_start(now_ns);
+    stack_drain();
+    fflush(drain_out);
+}
+
+static void drain_text(const struct hook_event* ev) {
+    if (drain_format == TRACE_FORMAT_CHROME) {
+        chrome_event(&hook_chrome, ev);
+    } else {
+        trace_write_json(drain_out, ev, &hook_strings, &hook_functions);
+    }
+}
+
+// Write out everything currently published in one ring
+static size_t drain_ring(struct trace_ring* ring) {
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = ring->tail;
+    size_t drained = 0;
+
+    if (tail != head) {
+        if (drain_format == TRACE_FORMAT_BINARY) {
+            drain_strings();
+        }
+        stack_drain();
+    }
+
+    while (tail != head) {
+        // Contiguous run, stopping at the ring's wrap point
+        uint64_t first = tail & ring->mask;
+        uint64_t run = head - tail;
+        if (run > DRAIN_BATCH) {
+            run = DRAIN_BATCH;
+        }
+        if (run > ring->mask + 1 - first) {
+            run = ring->mask + 1 - first;
+        }
+
+        if (segment_active) {
+            note_segment_range(&ring->events[first], run);
+        }
+        if (drain_format == TRACE_FORMAT_BINARY) {
+            trace_write_binary_events(drain_out, &ring->events[first], run);
+        } else if (hook_clock_tsc) {
+            for (uint64_t i = 0; i < run; i++) {
+                struct hook_event ev = ring->events[first + i];
+                ev.ts = clock_map_to_ns(&hook_clock_map, ev.ts);
+                ev.end = clock_map_to_ns(&hook_clock_map, ev.end);
+                drain_text(&ev);
+            }
+        } else {
+            for (uint64_t i = 0; i < run; i++) {
+                drain_text(&ring->events[first + i]);
+            }
+        }
+
+        tail += run;
+        drained += run;
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+        // A long backlog must not run one segment past its limit
+        if (segment_active) {
+            int64_t now_ns = monotonic_ns();
+            if (segment_due(drain_out, now_ns)) {
+                rotate_segment(now_ns);
+            }
+        }
+    }
+    return drained;
+}
+
+static size_t drain_all(void) {
+    size_t drained = 0;
+    struct trace_ring* prev = NULL;
+    struct trace_ring* ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+
+    while (ring) {
+        // Read dead before draining: once set, the owner has committed its
+        // last event, so an empty ring afterwards can be freed.
+        int dead = __atomic_load_n(&ring->dead, __ATOMIC_ACQUIRE);
+        drained += drain_ring(ring);
+
+        struct trace_ring* next = ring->next;
+        if (dead) {
+            pthread_mutex_lock(&registry_lock);
+            if (prev) {
+                prev->next = next;
+            } else if (rings == ring) {
+                rings = next;
+            } else {
+                // A new ring was inserted at the head since we started
+                struct trace_ring* p = rings;
+                while (p->next != ring) {
+                    p = p->next;
+                }
+                p->next = next;
+            }
+            reaped_dropped += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&registry_lock);
+            free(ring->events);
+            free(ring);
+        } else {
+            prev = ring;
+        }
+        ring = next;
+    }
+
+    if (drained) {
+        fflush(drain_out);
+    }
+    return drained;
+}
+
+// TSC clock: start a new calibration segment once the interval has passed.
+// Runs between passes, so every event already written predates the point.
+static void maybe_recalibrate(int64_t now_ns) {
+    if (now_ns - last_calibration_ns < calibrate_interval_ns) {
+        return;
+    }
+    last_calibration_ns = now_ns;
+
+    struct trace_clock_point pt;
+    if (hook_clock_recalibrate(&pt) == 0 && drain_format == TRACE_FORMAT_BINARY) {
+        trace_write_binary_clock(drain_out, &pt);
+    }
+}
+
+static void* drainer_main(void* arg) {
+    (void)arg;
+    struct timespec interval = {
+        .tv_sec = drain_interval_us / 1000000,
+        .tv_nsec = (drain_interval_us % 1000000) * 1000,
+    };
+
+    while (!__atomic_load_n(&drainer_stop, __ATOMIC_ACQUIRE)) {
+        int64_t now_ns = monotonic_ns();
+        if (hook_clock_tsc) {
+            maybe_recalibrate(now_ns);
+        }
+        aggregate_poll(now_ns);
+        alloc_poll(now_ns);
+        sample_adapt(now_ns);
+        control_poll(now_ns);
+        if (drain_all() == 0) {
+            nanosleep(&interval, NULL);
+            // The time limit still applies to a quiet process
+            if (segment_active && segment_due(drain_out, now_ns)) {
+                rotate_segment(now_ns);
+            }
+        }
+    }
+    return NULL;
+}
+
+int trace_rings_start(FILE* out, enum trace_format format, size_t ring_events,
+                      long interval_us, long calibrate_interval_ms) {
+    // Round up to a power of two so the ring index is a mask
+    size_t capacity = 1;
+    while (capacity < ring_events) {
+        capacity <<= 1;
+    }
+
+    drain_out = out;
+    drain_format = format;
+    ring_capacity = capacity;
+    drain_interval_us = interval_us > 0 ? interval_us : 1000;
+    calibrate_interval_ns = (int64_t)calibrate_interval_ms * 1000000;
+    if (hook_clock_tsc && hook_clock_map.count > 0) {
+        last_calibration_ns = hook_clock_map.points[0].ns;
+    }
+
+    if (pthread_key_create(&ring_key, ring_thread_exit) != 0) {
+        return -1;
+    }
+    ring_key_ready = 1;
+    if (trace_rings_restart() != 0) {
+        return -1;
+    }
+
+    __atomic_store_n(&tracing_active, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Also run by a forked child once its own trace is open
+int trace_rings_restart(void) {
+    // Keep application signals off the drainer thread
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int rc = pthread_create(&drainer_thread, NULL, drainer_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rc != 0) {
+        return -1;
+    }
+    drainer_running = 1;
+    return 0;
+}
+
+// The child has no drainer and none of the parent's other threads; what
+// their rings still hold is the parent's to write, so they are dropped.
+// tracing_active stays set, so the child's first recorded call reaches
+// trace_ring_attach() and with it fork_restart().
+void trace_rings_atfork(enum fork_phase phase) {
+    if (phase == FORK_PREPARE) {
+        pthread_mutex_lock(&registry_lock);
+        return;
+    }
+    pthread_mutex_unlock(&registry_lock);
+    if (phase == FORK_PARENT) {
+        return;
+    }
+
+    struct trace_ring* ring = rings;
+    while (ring) {
+        struct trace_ring* next = ring->next;
+        free(ring->events);
+        free(ring);
+        ring = next;
+    }
+    rings = NULL;
+    tls_ring = NULL;
+    if (ring_key_ready) {
+        pthread_setspecific(ring_key, NULL);
+    }
+    drainer_running = 0;
+    drainer_stop = 0;
+    reaped_dropped = 0;
+    strings_written = 1;
+    functions_written = 1;
+    segment_first = 0;
+    segment_last = 0;
+}
+
+void trace_rings_stop(void) {
+    if (!__atomic_load_n(&tracing_active, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    __atomic_store_n(&tracing_active, 0, __ATOMIC_RELEASE);
+
+    if (drainer_running) {
+        __atomic_store_n(&drainer_stop, 1, __ATOMIC_RELEASE);
+        pthread_join(drainer_thread, NULL);
+        drainer_running = 0;
+    }
+
+    // Pick up whatever was committed after the drainer's last pass
+    drain_all();
+    aggregate_finish(monotonic_ns());
+    alloc_finish(monotonic_ns());
+    stack_finish(monotonic_ns());
+    if (drain_format == TRACE_FORMAT_CHROME) {
+        chrome_end(&hook_chrome);
+    }
+    fflush(drain_out);
+    segment_finish(drain_out, segment_ns(segment_first), segment_ns(segment_last));
+}
+
+uint64_t trace_dropped_events(void) {
+    pthread_mutex_lock(&registry_lock);
+    uint64_t total = reaped_dropped;
+    for (struct trace_ring* ring = rings; ring; ring = ring->next) {
+        total += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&registry_lock);
+    return total;
+}
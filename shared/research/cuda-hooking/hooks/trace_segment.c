@@ -0,0 +1,358 @@
+/*
+ * trace_segment.c - Size and time based rotation of the trace output
+ *
+ * With CUDA_HOOK_ROTATE_MB or CUDA_HOOK_ROTATE_S set, the trace is written
+ * as a series of segments next to CUDA_HOOK_TRACE: cuda_trace.jsonl becomes
+ * cuda_trace.00000.jsonl, cuda_trace.00001.jsonl and so on. The drainer
+ * switches segments between two passes, so a segment always ends on a whole
+ * record, and it does so by pointing the trace FILE at a new file
+ * descriptor: every module keeps writing to the FILE it was given.
+ *
+ * Finished segments go to a compressor thread that gzips them
+ * (CUDA_HOOK_COMPRESS=<level>) and removes the original, so neither the
+ * application nor the drainer waits for compression. Each finished segment
+ * gets a line in cuda_trace.index.jsonl with the time range of the calls it
+ * holds, in the order the segments were written.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdio_ext.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "cuda_hook.h"
+
+// Finished segments waiting for the compressor; past this many the drainer
+// leaves a segment uncompressed rather than wait
+#define SEGMENT_QUEUE 16
+#define COMPRESS_CHUNK (256 * 1024)
+
+struct segment {
+    uint32_t index;
+    int64_t first_ns;           // Earliest call start, 0 = no calls
+    int64_t last_ns;            // Latest call end
+    uint64_t bytes;
+    char path[PATH_MAX];
+};
+
+int segment_active = 0;
+
+static char stem[PATH_MAX];         // Trace path up to its extension
+static char extension[64];
+static uint64_t max_bytes = 0;      // 0 = no size limit
+static int64_t max_ns = 0;          // 0 = no time limit
+static int compress_level = 0;      // 0 = keep segments as written
+
+static struct segment current;
+static int64_t current_opened_ns = 0;
+static FILE* index_file = NULL;
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static struct segment queue[SEGMENT_QUEUE];
+static unsigned queue_head = 0;
+static unsigned queue_tail = 0;
+static int compressor_stop = 0;
+static int compressor_running = 0;
+static pthread_t compressor_thread;
+
+static int segment_path(char* out, size_t size, uint32_t index) {
+    return snprintf(out, size, "%s.%05u%s", stem, index, extension) < (int)size ? 0 : -1;
+}
+
+static int64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// Callers hold queue_lock
+static void write_index(const struct segment* seg, const char* path, uint64_t stored) {
+    const char* name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    fprintf(index_file, "{\"segment\":%u,\"path\":\"%s\",\"start\":%" PRId64 ".%09" PRId64
+            ",\"end\":%" PRId64 ".%09" PRId64 ",\"bytes\":%" PRIu64 ",\"stored_bytes\":%" PRIu64
+            "}\n", seg->index, name, seg->first_ns / 1000000000, seg->first_ns % 1000000000,
+            seg->last_ns / 1000000000, seg->last_ns % 1000000000, seg->bytes, stored);
+    fflush(index_file);
+}
+
+// Stream the segment through deflate into <path>.gz, then drop the original.
+// On failure the original stays and is indexed as is.
+static void compress_segment(const struct segment* seg) {
+    char gz_path[PATH_MAX + 4];
+    snprintf(gz_path, sizeof(gz_path), "%s.gz", seg->path);
+
+    char mode[8];
+    snprintf(mode, sizeof(mode), "wb%d", compress_level);
+    int in = open(seg->path, O_RDONLY | O_CLOEXEC);
+    gzFile out = in >= 0 ? gzopen(gz_path, mode) : NULL;
+    int ok = out != NULL;
+    if (ok) {
+        gzbuffer(out, COMPRESS_CHUNK);
+        static char chunk[COMPRESS_CHUNK];
+        ssize_t n;
+        while ((n = read(in, chunk, sizeof(chunk))) > 0) {
+            if (gzwrite(out, chunk, (unsigned)n) != n) {
+                ok = 0;
+                break;
+            }
+        }
+        ok = gzclose(out) == Z_OK && ok && n == 0;
+    }
+    if (in >= 0) {
+        close(in);
+    }
+
+    struct stat st;
+    pthread_mutex_lock(&queue_lock);
+    if (ok && stat(gz_path, &st) == 0) {
+        unlink(seg->path);
+        write_index(seg, gz_path, (uint64_t)st.st_size);
+    } else {
+        fprintf(stderr, "[CUDA_HOOK] Failed to compress %s, keeping it\n", seg->path);
+        unlink(gz_path);
+        write_index(seg, seg->path, seg->bytes);
+    }
+    pthread_mutex_unlock(&queue_lock);
+}
+
+static void* compressor_main(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&queue_lock);
+    for (;;) {
+        while (queue_head == queue_tail && !compressor_stop) {
+            pthread_cond_wait(&queue_cond, &queue_lock);
+        }
+        if (queue_head == queue_tail) {
+            break;
+        }
+        struct segment seg = queue[queue_head % SEGMENT_QUEUE];
+        pthread_mutex_unlock(&queue_lock);
+        compress_segment(&seg);
+        pthread_mutex_lock(&queue_lock);
+        queue_head++;
+    }
+    pthread_mutex_unlock(&queue_lock);
+    return NULL;
+}
+
+// Hand a finished segment to the compressor, or index it as it is
+static void finish_segment(const struct segment* seg) {
+    pthread_mutex_lock(&queue_lock);
+    if (compressor_running && queue_tail - queue_head < SEGMENT_QUEUE) {
+        queue[queue_tail++ % SEGMENT_QUEUE] = *seg;
+        pthread_cond_signal(&queue_cond);
+    } else {
+        write_index(seg, seg->path, seg->bytes);
+    }
+    pthread_mutex_unlock(&queue_lock);
+}
+
+// Length of `path` without its extension; a leading dot is not one
+static size_t stem_length(const char* path) {
+    const char* base = strrchr(path, '/');
+    const char* dot = strrchr(base ? base : path, '.');
+    return dot && dot != (base ? base + 1 : path) ? (size_t)(dot - path) : strlen(path);
+}
+
+// cuda_trace.jsonl with tag 4242 becomes cuda_trace.4242.jsonl
+int trace_path_insert(char* out, size_t size, const char* path, const char* tag) {
+    size_t stem_len = stem_length(path);
+    int len = snprintf(out, size, "%.*s.%s%s", (int)stem_len, path, tag, path + stem_len);
+    return len >= 0 && (size_t)len < size ? 0 : -1;
+}
+
+static int set_stem(const char* path) {
+    size_t stem_len = stem_length(path);
+    if (stem_len >= sizeof(stem) || strlen(path + stem_len) >= sizeof(extension)) {
+        return -1;
+    }
+    memcpy(stem, path, stem_len);
+    stem[stem_len] = '\0';
+    strcpy(extension, path + stem_len);
+    return 0;
+}
+
+static int open_index(void) {
+    char index_path[PATH_MAX + 16];
+    snprintf(index_path, sizeof(index_path), "%s.index.jsonl", stem);
+    index_file = fopen(index_path, "we");
+    if (!index_file) {
+        perror(index_path);
+        return -1;
+    }
+    return 0;
+}
+
+static void start_compressor(void) {
+    compressor_stop = 0;
+    if (compress_level > 0) {
+        // Keep application signals off the compressor, as for the drainer
+        sigset_t all, old;
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, &old);
+        compressor_running = pthread_create(&compressor_thread, NULL, compressor_main, NULL) == 0;
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+        if (!compressor_running) {
+            fprintf(stderr, "[CUDA_HOOK] Failed to start compressor, keeping segments as is\n");
+        }
+    }
+}
+
+FILE* segment_open(const char* path, long rotate_mb, long rotate_s, int level) {
+    if (set_stem(path) != 0 || open_index() != 0) {
+        return NULL;
+    }
+
+    memset(&current, 0, sizeof(current));
+    FILE* out = segment_path(current.path, sizeof(current.path), 0) == 0
+                    ? fopen(current.path, "we") : NULL;
+    if (!out) {
+        perror(current.path);
+        fclose(index_file);
+        index_file = NULL;
+        return NULL;
+    }
+
+    max_bytes = rotate_mb > 0 ? (uint64_t)rotate_mb << 20 : 0;
+    max_ns = rotate_s > 0 ? (int64_t)rotate_s * 1000000000 : 0;
+    compress_level = level < 0 ? 0 : level > 9 ? 9 : level;
+    current_opened_ns = monotonic_ns();
+    start_compressor();
+
+    segment_active = 1;
+    return out;
+}
+
+// The compressor did not survive the fork and the index is the parent's;
+// the child keeps the limits, and segment_reopen() starts its own series
+void segment_atfork(enum fork_phase phase) {
+    if (phase == FORK_PREPARE) {
+        pthread_mutex_lock(&queue_lock);
+        return;
+    }
+    if (phase == FORK_CHILD) {
+        queue_head = queue_tail = 0;
+        compressor_stop = 0;
+        compressor_running = 0;
+        pthread_cond_init(&queue_cond, NULL);
+        if (index_file) {
+            // Drop what the parent had buffered rather than write it twice
+            __fpurge(index_file);
+            fclose(index_file);
+            index_file = NULL;
+        }
+        segment_active = 0;
+    }
+    pthread_mutex_unlock(&queue_lock);
+}
+
+// A forked child: start a new series of segments at `path`, under the
+// descriptor `out` already has. Returns 1 when the trace is not rotated.
+int segment_reopen(FILE* out, const char* path) {
+    if (!max_bytes && !max_ns) {
+        return 1;
+    }
+    if (set_stem(path) != 0 || open_index() != 0) {
+        return -1;
+    }
+
+    memset(&current, 0, sizeof(current));
+    int fd = segment_path(current.path, sizeof(current.path), 0) == 0
+                 ? open(current.path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) : -1;
+    if (fd < 0 || dup3(fd, fileno(out), O_CLOEXEC) < 0) {
+        perror(current.path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        fclose(index_file);
+        index_file = NULL;
+        return -1;
+    }
+    close(fd);
+
+    current_opened_ns = monotonic_ns();
+    start_compressor();
+    segment_active = 1;
+    return 0;
+}
+
+// Drainer thread, between passes
+int segment_due(FILE* out, int64_t now_ns) {
+    if (max_ns && now_ns - current_opened_ns >= max_ns) {
+        return 1;
+    }
+    struct stat st;
+    return max_bytes && fstat(fileno(out), &st) == 0 && (uint64_t)st.st_size >= max_bytes;
+}
+
+static void close_current(FILE* out, int64_t first_ns, int64_t last_ns) {
+    fflush(out);
+    struct stat st;
+    current.bytes = fstat(fileno(out), &st) == 0 ? (uint64_t)st.st_size : 0;
+    current.first_ns = first_ns;
+    current.last_ns = last_ns;
+}
+
+// Drainer thread, with `out` flushed to a record boundary. The next segment
+// takes over the FILE's descriptor, so its buffer and every holder of the
+// FILE carry on unchanged.
+int segment_rotate(FILE* out, int64_t first_ns, int64_t last_ns, int64_t now_ns) {
+    char next_path[PATH_MAX];
+    int fd = segment_path(next_path, sizeof(next_path), current.index + 1) == 0
+                 ? open(next_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) : -1;
+    if (fd < 0) {
+        // Carry on in this segment and try again at the next limit
+        fprintf(stderr, "[CUDA_HOOK] Cannot open %s: %s\n", next_path, strerror(errno));
+        current_opened_ns = now_ns;
+        return -1;
+    }
+
+    close_current(out, first_ns, last_ns);
+    if (dup3(fd, fileno(out), O_CLOEXEC) < 0) {
+        close(fd);
+        unlink(next_path);
+        current_opened_ns = now_ns;
+        return -1;
+    }
+    close(fd);
+
+    finish_segment(&current);
+    current.index++;
+    strcpy(current.path, next_path);
+    current_opened_ns = now_ns;
+    return 0;
+}
+
+// After the drainer has written its last record: the final segment is
+// compressed before the process goes, so the index is complete at exit
+void segment_finish(FILE* out, int64_t first_ns, int64_t last_ns) {
+    if (!segment_active) {
+        return;
+    }
+    segment_active = 0;
+    close_current(out, first_ns, last_ns);
+    finish_segment(&current);
+
+    if (compressor_running) {
+        pthread_mutex_lock(&queue_lock);
+        compressor_stop = 1;
+        pthread_cond_signal(&queue_cond);
+        pthread_mutex_unlock(&queue_lock);
+        pthread_join(compressor_thread, NULL);
+        compressor_running = 0;
+    }
+    fclose(index_file);
+    index_file = NULL;
+}
@@ -12,6 +12,7 @@ Usage:
 """
 
 import json
+import os
 import sys
 import argparse
 from collections import defaultdict
@@ -37,6 +38,36 @@ class PipelineAnalyzer:
         self.events = []
         self.categories = defaultdict(list)
         self.timeline = []
+        self.totals = None  # Exact per-API counts from a sampled trace
+        self.stacks = {}  # Stack id -> return addresses (CUDA_HOOK_STACKS)
+        self.call_stacks = {}  # op_id -> stack id
+        self.mappings = []  # Executable mappings for symbolizing frames
+
+    def load_summary(self, data):
+        """Keep the whole-run summary the hook writes when sampling"""
+        if data.get('name') == 'total':
+            self.totals = data.get('details', {}).get('apis', {})
+
+    def load_metadata(self, data):
+        """Stack table entries and /proc/self/maps snapshots"""
+        details = data.get('details', {})
+        if data.get('name') == 'stack':
+            self.stacks[details['id']] = [int(f, 16) for f in details.get('frames', [])]
+        elif data.get('name') == 'maps':
+            # The exit snapshot adds libraries loaded after startup
+            known = {(m['start'], m['path']) for m in self.mappings}
+            for m in details.get('mappings', []):
+                if (m['start'], m['path']) not in known:
+                    self.mappings.append(m)
+
+    def symbolize(self, addr):
+        """module+offset, as addr2line -e module wants it"""
+        for m in self.mappings:
+            start, end = int(m['start'], 16), int(m['end'], 16)
+            if start <= addr < end:
+                offset = addr - start + int(m['offset'], 16)
+                return f"{os.path.basename(m['path'])}+0x{offset:x}"
+        return f"0x{addr:x}"
 
     def load_jsonl(self, filename):
         """Load trace from JSON Lines format"""
@@ -46,6 +77,15 @@ class PipelineAnalyzer:
                     continue
                 try:
                     data = json.loads(line)
+                    if data.get('phase') == 'S':
+                        self.load_summary(data)
+                        continue
+                    if data.get('phase') == 'M':
+                        self.load_metadata(data)
+                        continue
+                    if data.get('name') == 'hostStack':
+                        self.call_stacks[data.get('op_id')] = data['details']['stack']
+                        continue
                     event = CUDATraceEvent(
                         ts=data.get('ts', 0),
                         name=data.get('name', 'unknown'),
@@ -72,6 +112,7 @@ class PipelineAnalyzer:
 
                 op = {
                     'name': event.name,
+                    'op_id': event.op_id,
                     'start': begin.ts,
                     'end': event.ts,
                     'duration': duration,
@@ -216,6 +257,20 @@ class PipelineAnalyzer:
                 'avg_time': avg_time
             }
 
+        # Sampled traces: the summary has exact counts and times for every
+        # call, recorded or not
+        if self.totals:
+            print(f"Sampled trace: {len(self.timeline)} recorded operations, "
+                  f"totals below include unrecorded calls\n")
+            category_stats = {}
+            for name, api in self.totals.items():
+                stats = category_stats.setdefault(self.categorize(name),
+                                                  {'count': 0, 'total_time': 0})
+                stats['count'] += api['count']
+                stats['total_time'] += api['total_us'] / 1e6
+            for stats in category_stats.values():
+                stats['avg_time'] = stats['total_time'] / stats['count'] if stats['count'] else 0
+
         # Print category summary
         total_time = sum(stats['total_time'] for stats in category_stats.values())
 
@@ -251,6 +306,46 @@ class PipelineAnalyzer:
             category = self.categorize(op['name'])
             print(f"{i:<4} {op['name']:<40} {op['duration']*1000:>12.3f} ms {category:<15}")
 
+    def print_pageable_transfers(self, limit=20, frames=3):
+        """Host copies through pageable memory, by call site"""
+        copies = [op for op in self.timeline if op['details'].get('host_memory')]
+        if not copies:
+            return
+
+        print("\n" + "="*100)
+        print("PAGEABLE HOST TRANSFERS")
+        print("="*100 + "\n")
+
+        for kind in ('pinned', 'pageable'):
+            ops = [op for op in copies if op['details']['host_memory'] == kind]
+            size = sum(op['details'].get('size', 0) for op in ops)
+            time = sum(op['duration'] for op in ops)
+            print(f"{kind:<10} {len(ops):>8} copies {size/1e6:>12.1f} MB "
+                  f"{time*1000:>12.3f} ms")
+
+        sites = defaultdict(lambda: {'count': 0, 'bytes': 0, 'time': 0.0})
+        for op in copies:
+            if op['details']['host_memory'] != 'pageable':
+                continue
+            stack = self.stacks.get(self.call_stacks.get(op['op_id']))
+            if stack:
+                site = ' < '.join(self.symbolize(pc) for pc in stack[:frames])
+            else:
+                site = f"{op['name']} (no stack, set CUDA_HOOK_STACKS=transfer=1)"
+            entry = sites[site]
+            entry['count'] += 1
+            entry['bytes'] += op['details'].get('size', 0)
+            entry['time'] += op['duration']
+        if not sites:
+            return
+
+        print(f"\n{'Count':>8} {'MB':>10} {'Time':>12} {'GB/s':>8}  Call site")
+        print("-" * 100)
+        for site, e in sorted(sites.items(), key=lambda kv: kv[1]['time'], reverse=True)[:limit]:
+            gbps = e['bytes'] / e['time'] / 1e9 if e['time'] > 0 else 0
+            print(f"{e['count']:>8} {e['bytes']/1e6:>10.1f} {e['time']*1000:>9.3f} ms "
+                  f"{gbps:>8.2f}  {site}")
+
     def generate_flamegraph_data(self, output_file='flamegraph.txt'):
         """Generate data for flamegraph visualization"""
         with open(output_file, 'w') as f:
@@ -319,6 +414,7 @@ def main():
         analyzer.print_ascii_timeline()
         analyzer.print_pipeline_summary()
         analyzer.print_detailed_operations(args.top)
+        analyzer.print_pageable_transfers(args.top)
 
     if args.format in ['chrome', 'all']:
         analyzer.generate_chrome_trace()